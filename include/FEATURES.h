@@ -0,0 +1,32 @@
+#ifndef FEATURES
+#define FEATURES
+// Optional subsystems, switched per environment in platformio.ini with
+// build_flags = -DKIRBY_FEATURE_MQTT=0 and the like. A disabled one costs no
+// flash and no RAM: its task is an empty OptionalTask, its endpoints and
+// metrics sit behind `if constexpr`, so nothing references its code and the
+// linker drops it, library included. tools/size_budget.py shows the effect.
+#ifndef KIRBY_FEATURE_MQTT
+#define KIRBY_FEATURE_MQTT 1       // MqttTask, PubSubClient
+#endif
+#ifndef KIRBY_FEATURE_TELEMETRY
+#define KIRBY_FEATURE_TELEMETRY 1  // TelemetryTask, multicast datagrams
+#endif
+#ifndef KIRBY_FEATURE_UPDATE
+#define KIRBY_FEATURE_UPDATE 1     // POST /update, Updater and the gzip decoder
+#endif
+#ifndef KIRBY_FEATURE_MDNS
+#define KIRBY_FEATURE_MDNS 1       // kirby.local
+#endif
+#ifndef KIRBY_FEATURE_SNTP
+#define KIRBY_FEATURE_SNTP 1       // ClockTask, timestamps on samples
+#endif
+#ifndef KIRBY_FEATURE_RULES
+#define KIRBY_FEATURE_RULES 1      // /rules, the autopilot's rule compiler and machine
+#endif
+constexpr bool featureMqtt = KIRBY_FEATURE_MQTT;
+constexpr bool featureTelemetry = KIRBY_FEATURE_TELEMETRY;
+constexpr bool featureUpdate = KIRBY_FEATURE_UPDATE;
+constexpr bool featureMdns = KIRBY_FEATURE_MDNS;
+constexpr bool featureSntp = KIRBY_FEATURE_SNTP;
+constexpr bool featureRules = KIRBY_FEATURE_RULES;
+#endif //FEATURES
@@ -0,0 +1,10 @@
+#ifndef MQTT_DETAILS
+#define MQTT_DETAILS
+// Broker of the optional MQTT client, it stays off while the host is empty.
+// Topics hang off the prefix: state and status (retained), result and cmd/#.
+const char * mqttHost = "";
+const uint16_t mqttPort = 1883;
+const char * mqttUser = "";
+const char * mqttPassword = "";
+const char * mqttTopicPrefix = "kirby";
+#endif //MQTT_DETAILS
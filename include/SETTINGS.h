@@ -0,0 +1,54 @@
+#ifndef SETTINGS
+#define SETTINGS
+// The settings a zone keeps, each declared once. The schemas below make the
+// JSON of the API and MQTT, the files under /var-, the metrics and the
+// components of data/swagger.yaml (tools/schema/openapi.cpp regenerates
+// them). A new setting is a member plus one line in its schema.
+#include <stdint.h>
+#include <Schema.h>
+
+// Disabled leaves the strength alone, Enabled follows the curve, Predictive
+// keeps the model's forecast under a limit (the curve stands in until the
+// model is trusted)
+enum AutopilotMode : uint8_t {
+  AUTOPILOT_DISABLED = 0,
+  AUTOPILOT_ENABLED = 1,
+  AUTOPILOT_PREDICTIVE = 2
+};
+constexpr const char* autopilotModeNames[] = {"Disabled", "Enabled", "Predictive"};
+
+// Control state of a zone, shared by the HTTP handlers, the tasks and
+// interrupts (see ControlState). Integer units only, the ESP8266 has no FPU:
+// the temperature is kept in the probe's raw 1/16 °C steps and only turned
+// into a decimal at the API.
+struct ZoneState {
+  int16_t tempRaw; // 1/16 °C
+  uint32_t sampledMs; // millis() tempRaw was measured at, 0 before the first reading
+  short int currentPwm;
+  short int prevPwm;
+  uint8_t autopilotState; // AutopilotMode
+  bool calibrating;       // CalibrationTask owns currentPwm, as a raw duty
+};
+// The persisted part, /var-zone-settings; field<0>() is the pwm, field<1>() the mode
+constexpr auto zoneSettingsSchema = schema<ZoneState>("ZoneSettings",
+  "Settings of a zone, as in the zones of the MQTT state",
+  schemaNumber("pwm", &ZoneState::currentPwm, 0, 100, "fan strength in percent of its calibrated range")
+    .metric("kirby_pwm_current").component("PWMStrength").example(50),
+  schemaEnum("autopilot", &ZoneState::autopilotState, autopilotModeNames,
+    "Predictive keeps the model's forecast under a limit, see /autopilot/model")
+    .metric("kirby_autopilot_state").component("AutopilotState").example(AUTOPILOT_ENABLED));
+
+// A breakpoint of the autopilot curve: below temperature the fan runs at
+// strength, unless an earlier point already applies. Points with temperature
+// 0 are unused.
+struct CurvePoint {
+  int16_t temperature; // whole °C
+  int16_t strength;
+};
+constexpr auto curvePointSchema = schema<CurvePoint>("AutopilotSetting",
+  "A breakpoint of the autopilot curve",
+  schemaNumber("temperature", &CurvePoint::temperature, 0, 100, "whole °C up to which strength applies")
+    .label().example(36),
+  schemaNumber("strength", &CurvePoint::strength, 0, 100, "fan strength in percent of its calibrated range")
+    .metric("kirby_autopilot_setting").component("PWMStrength").example(50));
+#endif //SETTINGS
@@ -0,0 +1,9 @@
+#ifndef TELEMETRY_DETAILS
+#define TELEMETRY_DETAILS
+// Multicast telemetry for tools/telemetry_collector.py, a period of 0 turns it off.
+// 239.255.0.0/16 is site local, a TTL of 1 keeps the packets on the LAN.
+const uint8_t telemetryGroup[4] = {239, 255, 42, 42};
+const uint16_t telemetryPort = 4242;
+const uint32_t telemetryPeriodMs = 5000;
+const uint8_t telemetryTtl = 1;
+#endif //TELEMETRY_DETAILS
@@ -0,0 +1,16 @@
+#ifndef TIME_DETAILS
+#define TIME_DETAILS
+// SNTP server of the wall clock (ClockTask), it stays unsynced while the host
+// is empty. The error is about half the network delay, a server on the LAN
+// (the router often is one) keeps it within a few ms.
+const char * ntpHost = "pool.ntp.org";
+const uint16_t ntpPort = 123;
+const uint32_t ntpPollMinMs = 64000;    // after a step or a failure
+const uint32_t ntpPollMaxMs = 1024000;  // doubled up to while the offsets stay small
+const uint16_t ntpSteadyOffsetMs = 20;
+const uint16_t ntpTimeoutMs = 1000;
+const uint16_t ntpDelayMaxMs = 250;     // a reply that took longer says little about the time
+// Local time the control rules see as hour, minutes east of UTC; there is
+// no daylight saving, summer time needs a change here
+const int16_t localOffsetMin = 0;
+#endif //TIME_DETAILS
@@ -1,6 +1,18 @@
 #ifndef VAR_LOCACTIONS
 #define VAR_LOCACTIONS
-const char * locPwmCurrent = "/var-pwm-current";
+// Device state lives next to the frontend assets; /manifest and the asset
+// sync leave everything under this prefix alone
+const char * varPrefix = "/var-";
+const char * locZoneSettings = "/var-zone-settings";
 const char * locAutoPilotSettings = "/var-autopilot-settings";
+// One byte each before /var-zone-settings, migrated at boot
+const char * locPwmCurrent = "/var-pwm-current";
 const char * locAutoPilotState = "/var-autopilot-state";
+const char * locAutoPilotModel = "/var-autopilot-model";
+const char * locWifiCache = "/var-wifi-cache";
+const char * locSamplerPolicy = "/var-sampler-policy";
+const char * locFanMapping = "/var-fan-mapping";
+const char * locUploadPart = "/var-upload-part";
+// Control rules as they were posted, compiled at boot
+const char * locRules = "/var-rules";
 #endif //VAR_LOCACTIONS
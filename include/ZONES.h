@@ -0,0 +1,26 @@
+#ifndef ZONES
+#define ZONES
+// Fan channels. Every zone drives one PWM output from its own probe(s), curve
+// and mode. Probes are indices on the OneWire bus (in search order), a zone
+// with several probes follows the hottest one; -1 marks an unused slot.
+// A fan with a tach wire can report its speed on an input pin, -1 for none.
+//
+// Zone 0 keeps the single zone file names, so existing settings carry over.
+// Three tubes on an ESP-12 could look like:
+//   const uint8_t zoneCount = 3;
+//   const uint8_t zonePwmPins[zoneCount] = {2, 4, 5};
+//   const int8_t zoneProbes[zoneCount][zoneProbesMax] = {{0, -1}, {1, -1}, {2, 3}};
+//   const char * const zoneNames[zoneCount] = {"left", "middle", "right"};
+//   const int8_t zoneTachPins[zoneCount] = {12, 13, -1};
+const uint8_t zoneCount = 1;
+const uint8_t zoneProbesMax = 2;
+const uint8_t probesMax = 4;
+const uint8_t zonePwmPins[zoneCount] = {2};
+const int8_t zoneProbes[zoneCount][zoneProbesMax] = {{0, -1}};
+const char * const zoneNames[zoneCount] = {"tube"};
+const int8_t zoneTachPins[zoneCount] = {-1};
+// Switches the control rules read as in0 and in1 (a door contact, a night
+// mode toggle), wired to ground and read with the pull-up: 1 while closed.
+// -1 for none, rules that read it then do nothing.
+const int8_t ruleSwitchPins[2] = {-1, -1};
+#endif //ZONES
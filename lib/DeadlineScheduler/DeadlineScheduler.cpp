@@ -0,0 +1,177 @@
+#include "DeadlineScheduler.h"
+#include "Trace.h"
+
+SchedulerClass Scheduler;
+
+// Wrap safe "a is before b" for micros() timestamps
+static inline bool before(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) < 0;
+}
+
+void Task::runAgainIn(unsigned long ms) {
+  _deadlineUs = micros() + ms * 1000UL;
+  _oneShot = true;
+}
+
+void SchedulerClass::start(Task* task) {
+  if (task && _count < schedulerMaxTasks) {
+    task->_index = _count;
+    _tasks[_count++] = task;
+  }
+}
+
+void SchedulerClass::begin() {
+  for (uint8_t i = 0; i < _count; i++) {
+    _tasks[i]->setup();
+  }
+  uint32_t now = micros();
+  for (uint8_t i = 0; i < _count; i++) {
+    _tasks[i]->_anchorUs = now;
+    _tasks[i]->_deadlineUs = now;
+    enqueue(_tasks[i]);
+  }
+  _returnedUs = now;
+}
+
+void SchedulerClass::run() {
+  uint32_t now = micros();
+  uint32_t gap = now - _returnedUs;
+  if (gap > schedulerStallUs) {
+    _stalls++;
+  }
+  if (gap > _maxStallUs) {
+    _maxStallUs = gap;
+  }
+
+  Task* task = _queue;
+  if (!task) {
+    idle(1000);
+  } else if (before(now, task->_deadlineUs)) {
+    idle(task->_deadlineUs - now);
+  } else {
+    dequeue(task);
+    dispatch(task, now);
+    enqueue(task);
+  }
+  _returnedUs = micros();
+}
+
+void SchedulerClass::wake(Task* task) {
+  dequeue(task);
+  task->_deadlineUs = micros();
+  task->_oneShot = true;
+  enqueue(task);
+}
+
+void SchedulerClass::runDue(Task* const tasks[], uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    Task* task = tasks[i];
+    uint32_t now = micros();
+    if (!before(now, task->_deadlineUs) && dequeue(task)) {
+      dispatch(task, now);
+      enqueue(task);
+    }
+  }
+}
+
+void SchedulerClass::dispatch(Task* task, uint32_t now) {
+  TaskStats& stats = task->_stats;
+  uint32_t jitter = now - task->_deadlineUs;
+  stats.runs++;
+  stats.lastJitterUs = jitter;
+  stats.totalJitterUs += jitter;
+  if (jitter > stats.maxJitterUs) {
+    stats.maxJitterUs = jitter;
+  }
+
+  bool sampleStack = (stats.runs & (schedulerStackSampleEvery - 1)) == 1;
+  if (sampleStack) {
+    ESP.resetFreeContStack();
+  }
+
+  bool oneShot = task->_oneShot;
+  task->_oneShot = false;
+  uint64_t busyBefore = _busyUs;
+  TRACE_BEGIN(TRACE_TASK, task->_index, jitter);
+  uint32_t start = micros();
+  uint32_t startCycles = ESP.getCycleCount();
+  task->loop();
+  uint32_t cycles = ESP.getCycleCount() - startCycles;
+  uint32_t end = micros();
+  // tasks run from within loop() through runDue() account for themselves
+  uint32_t nested = _busyUs - busyBefore;
+  uint32_t ran = end - start - nested;
+  TRACE_END(TRACE_TASK, task->_index, ran);
+  stats.lastCycles = cycles;
+  if (cycles > stats.maxCycles) {
+    stats.maxCycles = cycles;
+  }
+  _busyUs += ran;
+  stats.cpuUs += ran;
+  if (ran > stats.maxRunUs) {
+    stats.maxRunUs = ran;
+  }
+  if (sampleStack) {
+    uint32_t free = ESP.getFreeContStack();
+    if (free < stats.stackFreeMin) {
+      stats.stackFreeMin = free;
+    }
+  }
+
+  if (task->_oneShot) {
+    // loop() asked to be called again before the next periodic release
+    if (before(task->_anchorUs + task->_periodUs, task->_deadlineUs)) {
+      task->_oneShot = false;
+    } else {
+      return;
+    }
+  }
+  if (oneShot && before(end, task->_anchorUs)) {
+    // an extra run in between periodic releases, keep the pending one
+    task->_deadlineUs = task->_anchorUs;
+    return;
+  }
+
+  uint32_t next = task->_anchorUs + task->_periodUs;
+  if (before(next, end)) {
+    stats.overruns++;
+    // skip the releases that already passed instead of running back to back
+    while (before(next, end)) {
+      next += task->_periodUs;
+      stats.missed++;
+    }
+  }
+  task->_anchorUs = next;
+  task->_deadlineUs = next;
+}
+
+void SchedulerClass::idle(uint32_t waitUs) {
+  uint32_t start = micros();
+  if (waitUs >= 1000) {
+    // delay() hands the CPU to the SDK, which may modem or light sleep meanwhile
+    delay(waitUs / 1000);
+  } else {
+    yield();
+  }
+  _idleUs += micros() - start;
+}
+
+void SchedulerClass::enqueue(Task* task) {
+  Task** link = &_queue;
+  while (*link && !before(task->_deadlineUs, (*link)->_deadlineUs)) {
+    link = &(*link)->_next;
+  }
+  task->_next = *link;
+  *link = task;
+}
+
+bool SchedulerClass::dequeue(Task* task) {
+  for (Task** link = &_queue; *link; link = &(*link)->_next) {
+    if (*link == task) {
+      *link = task->_next;
+      task->_next = nullptr;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,143 @@
+#ifndef DEADLINE_SCHEDULER
+#define DEADLINE_SCHEDULER
+
+#include "Arduino.h"
+
+/*
+   Cooperative, deadline ordered task scheduler.
+
+   Every task has a period and the time of its next release. The scheduler keeps
+   the tasks in a timer queue sorted by that release time, runs whichever task is
+   due and sleeps (delay(), which lets the SDK enter modem or light sleep) until
+   the next one is. Releases are anchored to the previous release rather than to
+   the end of the previous run, so periods do not drift with the run time of the
+   other tasks.
+
+   A task runs to completion: loop() must not block, use runAgainIn() to come
+   back later (e.g. when a conversion is done) instead of delay().
+
+   The one exception is a long transfer inside a task (a firmware upload):
+   it calls runDue() between pieces to keep a chosen set of tasks on time.
+*/
+
+const uint8_t schedulerMaxTasks = 12;
+// Measure the stack high-water mark on every n-th run of a task (power of two).
+// Repainting and scanning the stack costs a few tens of us, sampling keeps the
+// profiling overhead far below 1% CPU.
+const uint8_t schedulerStackSampleEvery = 16;
+// A gap between two scheduler passes longer than this counts as a loop stall
+// (time spent in the SDK, Wi-Fi stack or a blocking library call).
+const uint32_t schedulerStallUs = 50000;
+
+struct TaskStats {
+  uint32_t runs;
+  uint32_t overruns;      // runs that ended after the task's next release
+  uint32_t missed;        // releases skipped because the task was too late
+  uint32_t lastJitterUs;  // release to start of the last run
+  uint32_t maxJitterUs;
+  uint64_t totalJitterUs;
+  uint64_t cpuUs;         // cumulative run time
+  uint32_t maxRunUs;      // longest single run
+  uint32_t lastCycles;    // CPU cycles of the last run, finer than micros()
+  uint32_t maxCycles;
+  uint32_t stackFreeMin;  // least free stack seen after a sampled run, in bytes
+};
+
+class Task {
+public:
+  Task(const char* name, unsigned long periodMs) : _name(name), _periodUs(periodMs * 1000UL) {}
+  virtual ~Task() {}
+
+  const char* name() const { return _name; }
+  unsigned long periodMs() const { return _periodUs / 1000UL; }
+  const TaskStats& stats() const { return _stats; }
+
+protected:
+  virtual void setup() {}
+  virtual void loop() = 0;
+
+  // Change the period, effective from the next release
+  void setPeriod(unsigned long periodMs) { _periodUs = periodMs * 1000UL; }
+  // Run once more after ms without moving the periodic releases
+  void runAgainIn(unsigned long ms);
+
+private:
+  friend class SchedulerClass;
+
+  const char* _name;
+  uint32_t _periodUs;
+  uint32_t _anchorUs = 0;    // periodic release
+  uint32_t _deadlineUs = 0;  // next release, _anchorUs or an earlier one-shot
+  bool _oneShot = false;
+  Task* _next = nullptr;
+  uint8_t _index = 0;        // in the scheduler, for traces
+  TaskStats _stats = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, UINT32_MAX};
+};
+
+class SchedulerClass {
+public:
+  // Register a task, its setup() runs in begin(); nullptr is ignored
+  void start(Task* task);
+  // Run all setup()s and release every task now
+  void begin();
+  // Run the task that is due, or sleep until one is. Call from loop().
+  void run();
+  // Release a task now, e.g. after its inputs changed
+  void wake(Task* task);
+  // From inside a running task: run whichever of the given tasks are due. The
+  // calling task is not queued while it runs and is skipped.
+  void runDue(Task* const tasks[], uint8_t count);
+
+  uint8_t taskCount() const { return _count; }
+  Task* task(uint8_t index) const { return index < _count ? _tasks[index] : nullptr; }
+  uint64_t idleUs() const { return _idleUs; }
+  uint64_t busyUs() const { return _busyUs; }
+  uint32_t stalls() const { return _stalls; }
+  uint32_t maxStallUs() const { return _maxStallUs; }
+
+private:
+  void enqueue(Task* task);
+  bool dequeue(Task* task);
+  void dispatch(Task* task, uint32_t now);
+  void idle(uint32_t waitUs);
+
+  Task* _tasks[schedulerMaxTasks];
+  uint8_t _count = 0;
+  Task* _queue = nullptr;
+  uint64_t _idleUs = 0;
+  uint64_t _busyUs = 0;
+  uint32_t _returnedUs = 0;
+  uint32_t _stalls = 0;
+  uint32_t _maxStallUs = 0;
+};
+
+extern SchedulerClass Scheduler;
+
+/*
+   A task that only exists when a compile time feature is on:
+
+     OptionalTask<featureMqtt, MqttTask> mqtt_task;
+     Scheduler.start(mqtt_task.task());
+
+   Disabled it holds nothing and task() is nullptr, which start() ignores. T
+   is never constructed then, so its code is not emitted at all. get() gives
+   code behind `if constexpr (feature)` a typed pointer to reach the task.
+*/
+template <bool enabled, typename T>
+class OptionalTask {
+public:
+  T* get() { return &_task; }
+  Task* task() { return &_task; }
+
+private:
+  T _task;
+};
+
+template <typename T>
+class OptionalTask<false, T> {
+public:
+  T* get() { return nullptr; }
+  Task* task() { return nullptr; }
+};
+
+#endif //DEADLINE_SCHEDULER
@@ -0,0 +1,436 @@
+#include "Inflate.h"
+
+static const uint8_t gzipFlagHeaderCrc = 0x02;
+static const uint8_t gzipFlagExtra = 0x04;
+static const uint8_t gzipFlagName = 0x08;
+static const uint8_t gzipFlagComment = 0x10;
+
+static const uint16_t lengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t lengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distanceBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distanceExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+// Order in which a dynamic block sends the code length code lengths
+static const uint8_t codeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// CRC-32 (IEEE) a nibble at a time, 64 bytes of table instead of 1 KB
+static const uint32_t crcNibble[16] = {
+  0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+  0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t length) {
+  crc = ~crc;
+  while (length--) {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ crcNibble[crc & 15];
+    crc = (crc >> 4) ^ crcNibble[crc & 15];
+  }
+  return ~crc;
+}
+
+void Inflater::begin(Output output, void* context) {
+  _output = output;
+  _context = context;
+  _result = INFLATE_OK;
+  _state = HEADER;
+  _lastBlock = false;
+  _truncated = false;
+  _flags = 0;
+  _remaining = 0;
+  _bitBuf = 0;
+  _bitCount = 0;
+  _inPos = 0;
+  _inLen = 0;
+  _inputBytes = 0;
+  _pos = 0;
+  _flushed = 0;
+  _crc = 0;
+}
+
+bool Inflater::write(const uint8_t* data, size_t length) {
+  while (length > 0 && _result == INFLATE_OK) {
+    if (_inPos > 0) {
+      memmove(_in, _in + _inPos, _inLen - _inPos);
+      _inLen -= _inPos;
+      _inPos = 0;
+    }
+    size_t n = inflateInputSize - _inLen;
+    if (n > length) {
+      n = length;
+    }
+    memcpy(_in + _inLen, data, n);
+    _inLen += n;
+    _inputBytes += n;
+    data += n;
+    length -= n;
+    decode(false);
+  }
+  return _result == INFLATE_OK;
+}
+
+bool Inflater::end() {
+  if (_result == INFLATE_OK) {
+    decode(true);
+  }
+  if (_result == INFLATE_OK && _state != DONE) {
+    fail(INFLATE_TRUNCATED);
+  }
+  return _result == INFLATE_OK;
+}
+
+const char* Inflater::resultName(InflateResult result) {
+  switch (result) {
+    case INFLATE_OK: return "OK";
+    case INFLATE_BAD_HEADER: return "BAD HEADER";
+    case INFLATE_BAD_BLOCK: return "BAD BLOCK";
+    case INFLATE_BAD_CODE: return "BAD CODE";
+    case INFLATE_TOO_FAR: return "REFERENCE BEYOND WINDOW";
+    case INFLATE_BAD_TRAILER: return "BAD TRAILER";
+    case INFLATE_TRUNCATED: return "TRUNCATED";
+    case INFLATE_OUTPUT_FAILED: return "OUTPUT FAILED";
+  }
+  return "?";
+}
+
+void Inflater::decode(bool final) {
+  while (_result == INFLATE_OK && _state != DONE && (final || (size_t)(_inLen - _inPos) >= inflateLookahead)) {
+    if (final && _inPos >= _inLen && _bitCount == 0) {
+      fail(INFLATE_TRUNCATED);
+      break;
+    }
+    step();
+    if (_truncated) {
+      // Only reachable on the final piece, elsewhere the lookahead covers every unit
+      fail(INFLATE_TRUNCATED);
+    }
+  }
+}
+
+/*
+   Decodes one unit: a header field, a block header, one symbol or the
+   trailer. Units are small enough to always find their input buffered.
+*/
+void Inflater::step() {
+  switch (_state) {
+    case HEADER:
+      if (bits(8) != 0x1f || bits(8) != 0x8b || bits(8) != 8) {
+        fail(INFLATE_BAD_HEADER);
+        return;
+      }
+      _flags = bits(8);
+      bits(16); // mtime
+      bits(16);
+      bits(16); // extra flags, os
+      _state = EXTRA_LENGTH;
+      return;
+    case EXTRA_LENGTH:
+      if (_flags & gzipFlagExtra) {
+        _remaining = bits(16);
+        _state = EXTRA;
+      } else {
+        _state = NAME;
+      }
+      return;
+    case EXTRA:
+      if (_remaining == 0) {
+        _state = NAME;
+      } else {
+        bits(8);
+        _remaining--;
+      }
+      return;
+    case NAME:
+      if (!(_flags & gzipFlagName) || bits(8) == 0) {
+        _state = COMMENT;
+      }
+      return;
+    case COMMENT:
+      if (!(_flags & gzipFlagComment) || bits(8) == 0) {
+        _state = HEADER_CRC;
+      }
+      return;
+    case HEADER_CRC:
+      if (_flags & gzipFlagHeaderCrc) {
+        bits(16);
+      }
+      _state = BLOCK;
+      return;
+    case BLOCK:
+      blockHeader();
+      return;
+    case STORED:
+      if (_remaining == 0) {
+        _state = _lastBlock ? TRAILER : BLOCK;
+      } else {
+        put(bits(8));
+        _remaining--;
+      }
+      return;
+    case CODES:
+      codes();
+      return;
+    case TRAILER:
+      trailer();
+      return;
+    case DONE:
+      return;
+  }
+}
+
+void Inflater::blockHeader() {
+  _lastBlock = bits(1);
+  switch (bits(2)) {
+    case 0: {
+      align();
+      uint16_t length = bits(16);
+      uint16_t inverse = bits(16);
+      if (length != (uint16_t) ~inverse) {
+        fail(INFLATE_BAD_BLOCK);
+        return;
+      }
+      _remaining = length;
+      _state = STORED;
+      return;
+    }
+    case 1: {
+      uint8_t lengths[288 + 30];
+      memset(lengths, 8, 144);
+      memset(lengths + 144, 9, 112);
+      memset(lengths + 256, 7, 24);
+      memset(lengths + 280, 8, 8);
+      memset(lengths + 288, 5, 30);
+      build(_lengthTree, lengths, 288);
+      build(_distanceTree, lengths + 288, 30);
+      _state = CODES;
+      return;
+    }
+    case 2:
+      dynamicTrees();
+      return;
+    default:
+      fail(INFLATE_BAD_BLOCK);
+      return;
+  }
+}
+
+void Inflater::dynamicTrees() {
+  uint16_t lengthCount = bits(5) + 257;
+  uint16_t distanceCount = bits(5) + 1;
+  uint8_t codeLengthCount = bits(4) + 4;
+  if (lengthCount > 286 || distanceCount > 30) {
+    fail(INFLATE_BAD_BLOCK);
+    return;
+  }
+
+  uint8_t lengths[286 + 30];
+  memset(lengths, 0, 19);
+  for (uint8_t i = 0; i < codeLengthCount; i++) {
+    lengths[codeLengthOrder[i]] = bits(3);
+  }
+  // The code length code borrows the distance tree, it is rebuilt below
+  if (!build(_distanceTree, lengths, 19)) {
+    fail(INFLATE_BAD_BLOCK);
+    return;
+  }
+
+  uint16_t total = lengthCount + distanceCount;
+  uint16_t i = 0;
+  while (i < total) {
+    int code = symbol(_distanceTree);
+    if (code < 0) {
+      fail(INFLATE_BAD_CODE);
+      return;
+    }
+    if (code < 16) {
+      lengths[i++] = code;
+      continue;
+    }
+    uint8_t value = 0;
+    uint8_t repeat;
+    if (code == 16) {
+      if (i == 0) {
+        fail(INFLATE_BAD_BLOCK);
+        return;
+      }
+      value = lengths[i - 1];
+      repeat = 3 + bits(2);
+    } else if (code == 17) {
+      repeat = 3 + bits(3);
+    } else {
+      repeat = 11 + bits(7);
+    }
+    if (i + repeat > total) {
+      fail(INFLATE_BAD_BLOCK);
+      return;
+    }
+    memset(lengths + i, value, repeat);
+    i += repeat;
+  }
+  if (lengths[256] == 0
+      || !build(_lengthTree, lengths, lengthCount)
+      || !build(_distanceTree, lengths + lengthCount, distanceCount)) {
+    fail(INFLATE_BAD_BLOCK);
+    return;
+  }
+  _state = CODES;
+}
+
+void Inflater::codes() {
+  int code = symbol(_lengthTree);
+  if (code < 0) {
+    fail(INFLATE_BAD_CODE);
+    return;
+  }
+  if (code < 256) {
+    put(code);
+    return;
+  }
+  if (code == 256) {
+    _state = _lastBlock ? TRAILER : BLOCK;
+    return;
+  }
+  code -= 257;
+  if (code >= 29) {
+    fail(INFLATE_BAD_CODE);
+    return;
+  }
+  uint16_t length = lengthBase[code] + bits(lengthExtra[code]);
+  int distanceCode = symbol(_distanceTree);
+  if (distanceCode < 0 || distanceCode >= 30) {
+    fail(INFLATE_BAD_CODE);
+    return;
+  }
+  uint32_t distance = distanceBase[distanceCode] + bits(distanceExtra[distanceCode]);
+  if (distance > inflateWindowSize || distance > _pos) {
+    fail(INFLATE_TOO_FAR);
+    return;
+  }
+  while (length--) {
+    put(_window[(_pos - distance) & (inflateWindowSize - 1)]);
+  }
+}
+
+void Inflater::trailer() {
+  align();
+  uint32_t crc = bits(16);
+  crc |= bits(16) << 16;
+  uint32_t size = bits(16);
+  size |= bits(16) << 16;
+  flush();
+  if (_result != INFLATE_OK || _truncated) {
+    return;
+  }
+  if (crc != _crc || size != _pos) {
+    fail(INFLATE_BAD_TRAILER);
+    return;
+  }
+  _state = DONE;
+}
+
+// Up to 16 bits, LSB first; reading past the input yields zeros and marks the stream truncated
+uint32_t Inflater::bits(uint8_t count) {
+  while (_bitCount < count) {
+    if (_inPos < _inLen) {
+      _bitBuf |= (uint32_t) _in[_inPos++] << _bitCount;
+    } else {
+      _truncated = true;
+    }
+    _bitCount += 8;
+  }
+  uint32_t value = _bitBuf & ((1UL << count) - 1);
+  _bitBuf >>= count;
+  _bitCount -= count;
+  return value;
+}
+
+// Canonical Huffman decoding one bit at a time, -1 for a code the tree lacks
+int Inflater::symbol(const Tree& tree) {
+  int code = 0;
+  int first = 0;
+  int index = 0;
+  for (uint8_t length = 1; length < 16; length++) {
+    code |= bits(1);
+    int count = tree.counts[length];
+    if (code - first < count) {
+      return tree.symbols[index + code - first];
+    }
+    index += count;
+    first += count;
+    first <<= 1;
+    code <<= 1;
+  }
+  return -1;
+}
+
+// False for an over-subscribed set of lengths; incomplete ones are allowed, as zlib does for distances
+bool Inflater::build(Tree& tree, const uint8_t* lengths, uint16_t count) {
+  memset(tree.counts, 0, sizeof(tree.counts));
+  for (uint16_t i = 0; i < count; i++) {
+    tree.counts[lengths[i]]++;
+  }
+  tree.counts[0] = 0;
+  int left = 1;
+  for (uint8_t length = 1; length < 16; length++) {
+    left <<= 1;
+    left -= tree.counts[length];
+    if (left < 0) {
+      return false;
+    }
+  }
+  uint16_t offsets[16];
+  offsets[1] = 0;
+  for (uint8_t length = 1; length < 15; length++) {
+    offsets[length + 1] = offsets[length] + tree.counts[length];
+  }
+  for (uint16_t i = 0; i < count; i++) {
+    if (lengths[i] != 0) {
+      tree.symbols[offsets[lengths[i]]++] = i;
+    }
+  }
+  return true;
+}
+
+void Inflater::put(uint8_t value) {
+  _window[_pos & (inflateWindowSize - 1)] = value;
+  _pos++;
+  if (_pos - _flushed == inflateWindowSize) {
+    flush();
+  }
+}
+
+// Hands everything decoded so far to the output, in up to two pieces where the window wraps
+void Inflater::flush() {
+  while (_result == INFLATE_OK && _flushed != _pos) {
+    size_t start = _flushed & (inflateWindowSize - 1);
+    size_t n = _pos - _flushed;
+    if (n > inflateWindowSize - start) {
+      n = inflateWindowSize - start;
+    }
+    _crc = crc32Update(_crc, _window + start, n);
+    if (!_output(_window + start, n, _context)) {
+      fail(INFLATE_OUTPUT_FAILED);
+      return;
+    }
+    _flushed += n;
+  }
+}
+
+void Inflater::fail(InflateResult result) {
+  if (_result == INFLATE_OK) {
+    _result = result;
+  }
+}
@@ -0,0 +1,101 @@
+#ifndef INFLATE
+#define INFLATE
+
+#include "Arduino.h"
+
+/*
+   Streaming gzip decoder (RFC 1951 and 1952) for images that do not fit in
+   RAM. Compressed bytes are pushed in whatever pieces they arrive, the output
+   leaves through a callback, mostly in window sized pieces.
+
+   Back references are served from a window of inflateWindowSize bytes, so the
+   stream has to be compressed with at most that window (gzip uses 32 KB,
+   tools/ota_upload.py compresses with 4 KB). A longer reference fails with
+   INFLATE_TOO_FAR instead of producing garbage.
+
+   Input is only decoded while inflateLookahead bytes are buffered or the
+   stream is complete. That is more than the largest unit, a dynamic block
+   header, so the decoder never has to stop half way through one and carries
+   no state below the symbol level.
+*/
+
+const size_t inflateWindowSize = 4096;  // power of two
+const size_t inflateInputSize = 1024;
+const size_t inflateLookahead = 320;
+
+enum InflateResult : uint8_t {
+  INFLATE_OK = 0,
+  INFLATE_BAD_HEADER,
+  INFLATE_BAD_BLOCK,
+  INFLATE_BAD_CODE,
+  INFLATE_TOO_FAR,
+  INFLATE_BAD_TRAILER,
+  INFLATE_TRUNCATED,
+  INFLATE_OUTPUT_FAILED
+};
+
+class Inflater {
+public:
+  // Receives decoded bytes, returning false aborts the stream
+  typedef bool (*Output)(const uint8_t* data, size_t length, void* context);
+
+  void begin(Output output, void* context);
+  // False once the stream is broken, result() tells why
+  bool write(const uint8_t* data, size_t length);
+  // Decodes the rest and checks the trailer, true for a complete and intact stream
+  bool end();
+
+  InflateResult result() const { return _result; }
+  static const char* resultName(InflateResult result);
+  uint32_t inputBytes() const { return _inputBytes; }
+  uint32_t outputBytes() const { return _pos; }
+
+private:
+  struct Tree {
+    uint16_t counts[16];
+    uint16_t symbols[288];
+  };
+
+  enum State : uint8_t {
+    HEADER, EXTRA_LENGTH, EXTRA, NAME, COMMENT, HEADER_CRC,
+    BLOCK, STORED, CODES, TRAILER, DONE
+  };
+
+  void decode(bool final);
+  void step();
+  void blockHeader();
+  void dynamicTrees();
+  void codes();
+  void trailer();
+
+  uint32_t bits(uint8_t count);
+  void align() { _bitBuf >>= _bitCount & 7; _bitCount -= _bitCount & 7; }
+  int symbol(const Tree& tree);
+  bool build(Tree& tree, const uint8_t* lengths, uint16_t count);
+  void put(uint8_t value);
+  void flush();
+  void fail(InflateResult result);
+
+  Output _output;
+  void* _context;
+  InflateResult _result;
+  State _state;
+  bool _lastBlock;
+  bool _truncated;
+  uint8_t _flags;
+  uint16_t _remaining;    // of a stored block or gzip extra field
+  uint32_t _bitBuf;
+  uint8_t _bitCount;
+  uint16_t _inPos;
+  uint16_t _inLen;
+  uint32_t _inputBytes;
+  uint32_t _pos;          // bytes decoded
+  uint32_t _flushed;      // bytes handed to the output
+  uint32_t _crc;
+  Tree _lengthTree;
+  Tree _distanceTree;
+  uint8_t _in[inflateInputSize];
+  uint8_t _window[inflateWindowSize];
+};
+
+#endif //INFLATE
@@ -0,0 +1,123 @@
+#include "RequestArena.h"
+
+void* RequestArena::alloc(size_t size) {
+  size = (size + 3) & ~((size_t) 3);
+  if (size > _size - _used) {
+    _failures++;
+    return nullptr;
+  }
+  void* block = _buffer + _used;
+  _used += size;
+  if (_used > _highWater) {
+    _highWater = _used;
+  }
+  return block;
+}
+
+StrBuilder::StrBuilder(RequestArena& arena, size_t capacity, Flush flush) : _flush(flush) {
+  // one byte for the terminating zero
+  _buffer = (char*) arena.alloc(capacity + 1);
+  if (_buffer) {
+    _capacity = capacity;
+    _buffer[0] = 0;
+  } else {
+    _buffer = &_empty;
+    _capacity = 0;
+    _overflowed = true;
+  }
+}
+
+StrBuilder& StrBuilder::append(const char* data, size_t length) {
+  while (length) {
+    size_t room = _capacity - _length;
+    if (!room) {
+      if (!_flush || !_length) {
+        _overflowed = true;
+        break;
+      }
+      flush();
+      continue;
+    }
+    size_t n = length < room ? length : room;
+    memcpy(_buffer + _length, data, n);
+    _length += n;
+    data += n;
+    length -= n;
+  }
+  _buffer[_length] = 0;
+  return *this;
+}
+
+StrBuilder& StrBuilder::appendP(PGM_P str) {
+  char chunk[32];
+  size_t length = strlen_P(str);
+  while (length) {
+    size_t n = length < sizeof(chunk) ? length : sizeof(chunk);
+    memcpy_P(chunk, str, n);
+    append(chunk, n);
+    str += n;
+    length -= n;
+  }
+  return *this;
+}
+
+StrBuilder& StrBuilder::appendUnsigned(unsigned long long value) {
+  char digits[20];
+  uint8_t n = 0;
+  if (value <= 0xFFFFFFFFULL) {
+    // 32 bit divisions are a lot cheaper on the ESP8266
+    uint32_t small = (uint32_t) value;
+    do {
+      digits[n++] = '0' + small % 10;
+      small /= 10;
+    } while (small);
+  } else {
+    do {
+      digits[n++] = '0' + value % 10;
+      value /= 10;
+    } while (value);
+  }
+  char text[20];
+  for (uint8_t i = 0; i < n; i++) {
+    text[i] = digits[n - 1 - i];
+  }
+  return append(text, n);
+}
+
+StrBuilder& StrBuilder::appendSigned(long long value) {
+  if (value < 0) {
+    append("-", 1);
+    return appendUnsigned(0ULL - (unsigned long long) value);
+  }
+  return appendUnsigned((unsigned long long) value);
+}
+
+StrBuilder& StrBuilder::appendFixed(long value, uint8_t decimals) {
+  unsigned long scale = 1;
+  for (uint8_t i = 0; i < decimals; i++) {
+    scale *= 10;
+  }
+  if (value < 0) {
+    append("-", 1);
+  }
+  unsigned long magnitude = value < 0 ? 0UL - (unsigned long) value : (unsigned long) value;
+  appendUnsigned(magnitude / scale);
+  if (decimals) {
+    char text[10];
+    unsigned long fraction = magnitude % scale;
+    for (uint8_t i = decimals; i > 0; i--) {
+      text[i - 1] = '0' + fraction % 10;
+      fraction /= 10;
+    }
+    append(".", 1);
+    append(text, decimals);
+  }
+  return *this;
+}
+
+void StrBuilder::flush() {
+  if (_flush && _length) {
+    _flush(_buffer, _length);
+  }
+  clear();
+}
@@ -0,0 +1,100 @@
+#ifndef REQUEST_ARENA
+#define REQUEST_ARENA
+
+#include "Arduino.h"
+
+/*
+   Bump allocator for everything a request handler needs to build its reply.
+
+   The memory is a fixed block outside the heap: allocating is a pointer bump
+   and the whole arena is released at once after the request has been served,
+   so handlers no longer leave Arduino String holes behind in the ~40 KB heap.
+*/
+class RequestArena {
+public:
+  RequestArena(uint8_t* buffer, size_t size) : _buffer(buffer), _size(size) {}
+
+  // nullptr once the arena is exhausted
+  void* alloc(size_t size);
+  // Whatever is left, for one builder that wants to grow as far as possible
+  size_t available() const { return _size - _used; }
+  void reset() { _used = 0; }
+
+  size_t size() const { return _size; }
+  size_t used() const { return _used; }
+  size_t highWater() const { return _highWater; }
+  uint32_t failures() const { return _failures; }
+
+private:
+  uint8_t* _buffer;
+  size_t _size;
+  size_t _used = 0;
+  size_t _highWater = 0;
+  uint32_t _failures = 0;
+};
+
+template <size_t N>
+class StaticRequestArena : public RequestArena {
+public:
+  StaticRequestArena() : RequestArena(_storage, N) {}
+
+private:
+  uint8_t _storage[N] __attribute__((aligned(4)));
+};
+
+/*
+   Fixed capacity string builder on top of a RequestArena, with the same +=
+   interface as String. Numbers are formatted without printf.
+
+   Without a flush callback text that does not fit is dropped and overflowed()
+   is set. With one, the buffer is handed to the callback whenever it fills up
+   (e.g. to send it as an HTTP chunk), so a reply of any length streams through
+   a small buffer.
+*/
+class StrBuilder {
+public:
+  typedef void (*Flush)(const char* data, size_t length);
+
+  StrBuilder(RequestArena& arena, size_t capacity, Flush flush = nullptr);
+
+  StrBuilder& operator+=(const char* str) { return append(str, strlen(str)); }
+  StrBuilder& operator+=(const __FlashStringHelper* str) { return appendP(reinterpret_cast<PGM_P>(str)); }
+  StrBuilder& operator+=(const String& str) { return append(str.c_str(), str.length()); }
+  StrBuilder& operator+=(char c) { return append(&c, 1); }
+  StrBuilder& operator+=(short value) { return appendSigned(value); }
+  StrBuilder& operator+=(unsigned short value) { return appendUnsigned(value); }
+  StrBuilder& operator+=(int value) { return appendSigned(value); }
+  StrBuilder& operator+=(unsigned int value) { return appendUnsigned(value); }
+  StrBuilder& operator+=(long value) { return appendSigned(value); }
+  StrBuilder& operator+=(unsigned long value) { return appendUnsigned(value); }
+  StrBuilder& operator+=(long long value) { return appendSigned(value); }
+  StrBuilder& operator+=(unsigned long long value) { return appendUnsigned(value); }
+
+  StrBuilder& append(const char* data, size_t length);
+  // str may live in flash (PROGMEM) or RAM
+  StrBuilder& appendP(PGM_P str);
+  StrBuilder& appendSigned(long long value);
+  StrBuilder& appendUnsigned(unsigned long long value);
+  // value / 10^decimals, e.g. (2345, 2) -> "23.45"
+  StrBuilder& appendFixed(long value, uint8_t decimals);
+
+  // Hand what is buffered to the flush callback
+  void flush();
+  void clear() { _length = 0; _buffer[0] = 0; }
+  void truncate(size_t length) { if (length < _length) { _length = length; _buffer[_length] = 0; } }
+
+  const char* c_str() const { return _buffer; }
+  size_t length() const { return _length; }
+  size_t capacity() const { return _capacity; }
+  bool overflowed() const { return _overflowed; }
+
+private:
+  char* _buffer;
+  size_t _capacity;
+  size_t _length = 0;
+  bool _overflowed = false;
+  Flush _flush;
+  char _empty = 0;
+};
+
+#endif //REQUEST_ARENA
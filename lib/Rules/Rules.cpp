@@ -0,0 +1,759 @@
+#include "Rules.h"
+
+#include <string.h>
+
+const char* const ruleInputNames[ruleInputCount] = {"t", "t0", "t1", "t2", "t3", "duty", "hour", "in0", "in1", "zone"};
+const char* const ruleOutputNames[ruleOutputCount] = {"temp", "strength", "floor", "cap"};
+const char* const ruleFaultNames[ruleFaultCount] = {"ok", "no_input", "divide", "steps", "bad_code"};
+
+struct RuleOpInfo {
+  const char* name;
+  uint8_t operands;
+  uint8_t pops;
+  uint8_t pushes;
+};
+
+static const RuleOpInfo ruleOps[ruleOpCount] = {
+  {"push8", 1, 0, 1}, {"push16", 2, 0, 1}, {"push32", 4, 0, 1},
+  {"input", 1, 0, 1}, {"load", 1, 0, 1}, {"store", 1, 1, 0}, {"out", 1, 1, 0}, {"jz", 1, 1, 0},
+  {"add", 0, 2, 1}, {"sub", 0, 2, 1}, {"mul", 0, 2, 1}, {"div", 0, 2, 1}, {"neg", 0, 1, 1},
+  {"lt", 0, 2, 1}, {"le", 0, 2, 1}, {"gt", 0, 2, 1}, {"ge", 0, 2, 1}, {"eq", 0, 2, 1}, {"ne", 0, 2, 1},
+  {"and", 0, 2, 1}, {"or", 0, 2, 1}, {"not", 0, 1, 1},
+  {"min", 0, 2, 1}, {"max", 0, 2, 1}, {"abs", 0, 1, 1}, {"clamp", 0, 3, 1},
+};
+
+const char* ruleOpName(uint8_t op) {
+  return op < ruleOpCount ? ruleOps[op].name : nullptr;
+}
+
+uint8_t ruleOpOperands(uint8_t op) {
+  return op < ruleOpCount ? ruleOps[op].operands : 0;
+}
+
+////////////////////////////////
+// Compiler
+
+namespace {
+
+enum Token : uint8_t {
+  TOKEN_END, TOKEN_SEPARATOR, TOKEN_NUMBER, TOKEN_NAME,
+  TOKEN_PLUS, TOKEN_MINUS, TOKEN_STAR, TOKEN_SLASH, TOKEN_OPEN, TOKEN_CLOSE, TOKEN_COMMA, TOKEN_ASSIGN,
+  TOKEN_LT, TOKEN_LE, TOKEN_GT, TOKEN_GE, TOKEN_EQ, TOKEN_NE,
+  TOKEN_WHEN, TOKEN_AND, TOKEN_OR, TOKEN_NOT
+};
+
+enum Function : uint8_t { FUNCTION_MIN, FUNCTION_MAX, FUNCTION_ABS, FUNCTION_CLAMP, functionCount };
+const char* const functionNames[functionCount] = {"min", "max", "abs", "clamp"};
+
+const uint8_t nameMax = 16;
+
+struct Local {
+  uint16_t start;  // in the source
+  uint8_t length;
+};
+
+// Recursive descent straight to code; every step returns false once an error is set
+class Compiler {
+public:
+  Compiler(const char* source, size_t length, RuleProgram& program, RuleError& error)
+      : _source(source), _length(length), _program(program), _error(error) {}
+
+  bool compile() {
+    _program.length = 0;
+    _program.stackDepth = 0;
+    if (!next()) {
+      return false;
+    }
+    while (_token != TOKEN_END) {
+      if (_token == TOKEN_SEPARATOR) {
+        if (!next()) {
+          return false;
+        }
+        continue;
+      }
+      if (!statement()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  bool fail(const char* message) {
+    _error = {message, _tokenLine, (uint16_t)(_tokenStart - _tokenLineStart + 1)};
+    return false;
+  }
+
+  ////////////////////////////////
+  // Tokens
+
+  bool next() {
+    while (_position < _length) {
+      char c = _source[_position];
+      if (c == ' ' || c == '\t' || c == '\r') {
+        _position++;
+      } else if (c == '#') {
+        while (_position < _length && _source[_position] != '\n') {
+          _position++;
+        }
+      } else {
+        break;
+      }
+    }
+    _tokenStart = _position;
+    _tokenLine = _line;
+    _tokenLineStart = _lineStart;
+    if (_position >= _length) {
+      _token = TOKEN_END;
+      return true;
+    }
+    char c = _source[_position++];
+    char following = _position < _length ? _source[_position] : 0;
+    switch (c) {
+      case '\n':
+        _line++;
+        _lineStart = _position;
+        _token = TOKEN_SEPARATOR;
+        return true;
+      case ';': _token = TOKEN_SEPARATOR; return true;
+      case '+': _token = TOKEN_PLUS; return true;
+      case '-': _token = TOKEN_MINUS; return true;
+      case '*': _token = TOKEN_STAR; return true;
+      case '/': _token = TOKEN_SLASH; return true;
+      case '(': _token = TOKEN_OPEN; return true;
+      case ')': _token = TOKEN_CLOSE; return true;
+      case ',': _token = TOKEN_COMMA; return true;
+      case '<':
+      case '>':
+        _token = c == '<' ? TOKEN_LT : TOKEN_GT;
+        if (following == '=') {
+          _position++;
+          _token = c == '<' ? TOKEN_LE : TOKEN_GE;
+        }
+        return true;
+      case '=':
+      case '!':
+        if (following == '=') {
+          _position++;
+          _token = c == '=' ? TOKEN_EQ : TOKEN_NE;
+          return true;
+        }
+        if (c == '=') {
+          _token = TOKEN_ASSIGN;
+          return true;
+        }
+        break;
+      default:
+        if (c >= '0' && c <= '9') {
+          return number(c);
+        }
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') {
+          return name();
+        }
+    }
+    return fail("unexpected character");
+  }
+
+  // Decimal to Q4, rounded to the nearest 1/16
+  bool number(char first) {
+    int32_t whole = first - '0';
+    while (_position < _length && _source[_position] >= '0' && _source[_position] <= '9') {
+      whole = whole * 10 + (_source[_position++] - '0');
+      if (whole > 1000000) {
+        return fail("number too large");
+      }
+    }
+    int32_t fraction = 0;
+    int32_t scale = 1;
+    if (_position < _length && _source[_position] == '.') {
+      _position++;
+      while (_position < _length && _source[_position] >= '0' && _source[_position] <= '9') {
+        // digits beyond the sixth do not change the rounding to 1/16
+        if (scale < 1000000) {
+          fraction = fraction * 10 + (_source[_position] - '0');
+          scale *= 10;
+        }
+        _position++;
+      }
+    }
+    _number = whole * ruleOne + (int32_t)(((int64_t) fraction * ruleOne * 2 + scale) / (scale * 2));
+    _token = TOKEN_NUMBER;
+    return true;
+  }
+
+  bool name() {
+    while (_position < _length) {
+      char c = _source[_position];
+      if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) {
+        break;
+      }
+      _position++;
+    }
+    if (_position - _tokenStart > nameMax) {
+      return fail("name too long");
+    }
+    _token = is("when") ? TOKEN_WHEN : is("and") ? TOKEN_AND : is("or") ? TOKEN_OR : is("not") ? TOKEN_NOT : TOKEN_NAME;
+    return true;
+  }
+
+  // Whether the current token reads text
+  bool is(const char* text) const {
+    size_t length = _position - _tokenStart;
+    return strlen(text) == length && memcmp(_source + _tokenStart, text, length) == 0;
+  }
+
+  template <size_t N>
+  int8_t find(const char* const (&names)[N]) const {
+    for (size_t i = 0; i < N; i++) {
+      if (is(names[i])) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  int8_t findLocal() const {
+    size_t length = _position - _tokenStart;
+    for (uint8_t i = 0; i < _localCount; i++) {
+      if (_locals[i].length == length && memcmp(_source + _locals[i].start, _source + _tokenStart, length) == 0) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  bool expect(Token token, const char* message) {
+    return _token == token ? next() : fail(message);
+  }
+
+  ////////////////////////////////
+  // Code
+
+  bool emit(uint8_t byte) {
+    if (_program.length >= ruleCodeMax) {
+      return fail("rules too long");
+    }
+    _program.code[_program.length++] = byte;
+    return true;
+  }
+
+  // Tracks the stack the code emitted so far leaves
+  bool op(RuleOp op) {
+    _depth += ruleOps[op].pushes - ruleOps[op].pops;
+    if (_depth > ruleStackMax) {
+      return fail("expression too deep");
+    }
+    if (_depth > _program.stackDepth) {
+      _program.stackDepth = _depth;
+    }
+    return emit(op);
+  }
+
+  bool constant(int32_t value) {
+    if (value >= INT8_MIN && value <= INT8_MAX) {
+      return op(RULE_OP_PUSH8) && emit((uint8_t) value);
+    }
+    if (value >= INT16_MIN && value <= INT16_MAX) {
+      return op(RULE_OP_PUSH16) && emit(value & 0xff) && emit((value >> 8) & 0xff);
+    }
+    return op(RULE_OP_PUSH32) && emit(value & 0xff) && emit((value >> 8) & 0xff) &&
+           emit((value >> 16) & 0xff) && emit((value >> 24) & 0xff);
+  }
+
+  ////////////////////////////////
+  // Grammar
+
+  // name = expression [when condition]
+  bool statement() {
+    if (_token != TOKEN_NAME) {
+      return fail("expected a name to assign");
+    }
+    if (find(ruleInputNames) >= 0) {
+      return fail("inputs cannot be assigned");
+    }
+    if (find(functionNames) >= 0) {
+      return fail("functions cannot be assigned");
+    }
+    int8_t output = find(ruleOutputNames);
+    int8_t local = output < 0 ? findLocal() : -1;
+    Local target = {(uint16_t) _tokenStart, (uint8_t)(_position - _tokenStart)};
+    if (!next() || !expect(TOKEN_ASSIGN, "expected '='")) {
+      return false;
+    }
+
+    size_t expressionStart = _program.length;
+    if (!disjunction()) {
+      return false;
+    }
+    if (_token == TOKEN_WHEN) {
+      if (!next()) {
+        return false;
+      }
+      // the condition runs first, on an empty stack
+      size_t conditionStart = _program.length;
+      _depth = 0;
+      if (!disjunction() || !op(RULE_OP_JZ) || !emit(0)) {
+        return false;
+      }
+      _depth = 1;
+      // expression, condition, jz: rotate the condition and the jump in front
+      uint8_t* code = _program.code;
+      reverse(code + expressionStart, code + conditionStart);
+      reverse(code + conditionStart, code + _program.length);
+      reverse(code + expressionStart, code + _program.length);
+      size_t jump = expressionStart + (_program.length - conditionStart) - 1;
+      // past the expression and the store
+      code[jump] = conditionStart - expressionStart + 2;
+    }
+
+    if (output >= 0) {
+      if (!op(RULE_OP_OUT) || !emit(output)) {
+        return false;
+      }
+    } else {
+      if (local < 0) {
+        if (_localCount >= ruleLocalsMax) {
+          _tokenStart = target.start;
+          return fail("too many locals");
+        }
+        local = _localCount;
+        _locals[_localCount++] = target;
+      }
+      if (!op(RULE_OP_STORE) || !emit(local)) {
+        return false;
+      }
+    }
+    if (_token != TOKEN_SEPARATOR && _token != TOKEN_END) {
+      return fail("expected the end of the statement");
+    }
+    return true;
+  }
+
+  static void reverse(uint8_t* begin, uint8_t* end) {
+    while (begin < end) {
+      uint8_t swapped = *begin;
+      *begin++ = *--end;
+      *end = swapped;
+    }
+  }
+
+  // Parentheses, call arguments, - and not recurse before they emit code, so
+  // the stack check in op() does not bound them; this keeps a short source
+  // from running the compiler out of the device's stack
+  bool nest() {
+    if (++_nesting > ruleStackMax) {
+      return fail("nested too deep");
+    }
+    return true;
+  }
+
+  bool unnest(bool ok) {
+    _nesting--;
+    return ok;
+  }
+
+  bool disjunction() {
+    if (!conjunction()) {
+      return false;
+    }
+    while (_token == TOKEN_OR) {
+      if (!next() || !conjunction() || !op(RULE_OP_OR)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool conjunction() {
+    if (!negation()) {
+      return false;
+    }
+    while (_token == TOKEN_AND) {
+      if (!next() || !negation() || !op(RULE_OP_AND)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool negation() {
+    if (_token == TOKEN_NOT) {
+      return nest() && unnest(next() && negation() && op(RULE_OP_NOT));
+    }
+    return comparison();
+  }
+
+  // One comparison, a < b < c is more likely a mistake than meant
+  bool comparison() {
+    if (!sum()) {
+      return false;
+    }
+    RuleOp compare;
+    switch (_token) {
+      case TOKEN_LT: compare = RULE_OP_LT; break;
+      case TOKEN_LE: compare = RULE_OP_LE; break;
+      case TOKEN_GT: compare = RULE_OP_GT; break;
+      case TOKEN_GE: compare = RULE_OP_GE; break;
+      case TOKEN_EQ: compare = RULE_OP_EQ; break;
+      case TOKEN_NE: compare = RULE_OP_NE; break;
+      default: return true;
+    }
+    if (!next() || !sum() || !op(compare)) {
+      return false;
+    }
+    if (_token >= TOKEN_LT && _token <= TOKEN_NE) {
+      return fail("comparisons cannot be chained, use and");
+    }
+    return true;
+  }
+
+  bool sum() {
+    if (!product()) {
+      return false;
+    }
+    while (_token == TOKEN_PLUS || _token == TOKEN_MINUS) {
+      RuleOp arithmetic = _token == TOKEN_PLUS ? RULE_OP_ADD : RULE_OP_SUB;
+      if (!next() || !product() || !op(arithmetic)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool product() {
+    if (!unary()) {
+      return false;
+    }
+    while (_token == TOKEN_STAR || _token == TOKEN_SLASH) {
+      RuleOp arithmetic = _token == TOKEN_STAR ? RULE_OP_MUL : RULE_OP_DIV;
+      if (!next() || !unary() || !op(arithmetic)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool unary() {
+    if (_token != TOKEN_MINUS) {
+      return primary();
+    }
+    if (!next()) {
+      return false;
+    }
+    if (_token == TOKEN_NUMBER) {
+      int32_t value = _number;
+      return next() && constant(-value);
+    }
+    return nest() && unnest(unary() && op(RULE_OP_NEG));
+  }
+
+  bool primary() {
+    switch (_token) {
+      case TOKEN_NUMBER: {
+        int32_t value = _number;
+        return next() && constant(value);
+      }
+      case TOKEN_OPEN:
+        return nest() && unnest(next() && disjunction() && expect(TOKEN_CLOSE, "expected ')'"));
+      case TOKEN_NAME:
+        break;
+      default:
+        return fail("expected a value");
+    }
+
+    int8_t input = find(ruleInputNames);
+    if (input >= 0) {
+      return op(RULE_OP_INPUT) && emit(input) && next();
+    }
+    int8_t function = find(functionNames);
+    if (function >= 0) {
+      return call((Function) function);
+    }
+    if (find(ruleOutputNames) >= 0) {
+      return fail("outputs cannot be read");
+    }
+    int8_t local = findLocal();
+    if (local < 0) {
+      return fail("unknown name");
+    }
+    return op(RULE_OP_LOAD) && emit(local) && next();
+  }
+
+  bool call(Function function) {
+    if (!next() || !expect(TOKEN_OPEN, "expected '('") || !nest()) {
+      return false;
+    }
+    uint8_t arguments = 0;
+    while (true) {
+      if (!disjunction()) {
+        return false;
+      }
+      arguments++;
+      // min and max fold any number of arguments as they go
+      if (arguments > 1 && (function == FUNCTION_MIN || function == FUNCTION_MAX) &&
+          !op(function == FUNCTION_MIN ? RULE_OP_MIN : RULE_OP_MAX)) {
+        return false;
+      }
+      if (_token != TOKEN_COMMA) {
+        break;
+      }
+      if (!next()) {
+        return false;
+      }
+    }
+    switch (function) {
+      case FUNCTION_MIN:
+      case FUNCTION_MAX:
+        if (arguments < 2) {
+          return fail("min and max take two or more values");
+        }
+        break;
+      case FUNCTION_ABS:
+        if (arguments != 1) {
+          return fail("abs takes one value");
+        }
+        if (!op(RULE_OP_ABS)) {
+          return false;
+        }
+        break;
+      default:
+        if (arguments != 3) {
+          return fail("clamp takes a value, a low and a high");
+        }
+        if (!op(RULE_OP_CLAMP)) {
+          return false;
+        }
+    }
+    return unnest(expect(TOKEN_CLOSE, "expected ')'"));
+  }
+
+  const char* _source;
+  size_t _length;
+  RuleProgram& _program;
+  RuleError& _error;
+
+  size_t _position = 0;
+  uint16_t _line = 1;
+  size_t _lineStart = 0;
+
+  Token _token = TOKEN_END;
+  size_t _tokenStart = 0;
+  uint16_t _tokenLine = 1;
+  size_t _tokenLineStart = 0;
+  int32_t _number = 0;
+
+  Local _locals[ruleLocalsMax];
+  uint8_t _localCount = 0;
+  uint8_t _depth = 0;
+  uint8_t _nesting = 0;
+};
+
+}
+
+bool ruleCompile(const char* source, size_t length, RuleProgram& program, RuleError& error) {
+  error = {nullptr, 0, 0};
+  if (length > ruleSourceMax) {
+    error = {"rules too long", 1, 1};
+    return false;
+  }
+  Compiler compiler(source, length, program, error);
+  if (!compiler.compile()) {
+    return false;
+  }
+  if (!ruleVerify(program)) {
+    error = {"internal error, the code does not verify", 1, 1};
+    return false;
+  }
+  return true;
+}
+
+////////////////////////////////
+// Verifier
+
+bool ruleVerify(RuleProgram& program) {
+  if (program.length > ruleCodeMax) {
+    return false;
+  }
+  // stack depth expected where a jump lands, -1 where none does
+  int8_t landing[ruleCodeMax + 1];
+  memset(landing, -1, sizeof(landing));
+  uint8_t depth = 0;
+  uint8_t deepest = 0;
+  size_t pc = 0;
+  while (pc < program.length) {
+    if (landing[pc] >= 0 && landing[pc] != depth) {
+      return false;
+    }
+    uint8_t op = program.code[pc];
+    if (op >= ruleOpCount || pc + 1 + ruleOps[op].operands > program.length) {
+      return false;
+    }
+    uint8_t operand = ruleOps[op].operands ? program.code[pc + 1] : 0;
+    switch (op) {
+      case RULE_OP_INPUT:
+        if (operand >= ruleInputCount) {
+          return false;
+        }
+        break;
+      case RULE_OP_LOAD:
+      case RULE_OP_STORE:
+        if (operand >= ruleLocalsMax) {
+          return false;
+        }
+        break;
+      case RULE_OP_OUT:
+        if (operand >= ruleOutputCount) {
+          return false;
+        }
+        break;
+    }
+    if (depth < ruleOps[op].pops) {
+      return false;
+    }
+    depth = depth - ruleOps[op].pops + ruleOps[op].pushes;
+    if (depth > ruleStackMax) {
+      return false;
+    }
+    if (depth > deepest) {
+      deepest = depth;
+    }
+    if (op == RULE_OP_JZ) {
+      size_t target = pc + 2 + operand;
+      if (target > program.length || (landing[target] >= 0 && landing[target] != depth)) {
+        return false;
+      }
+      landing[target] = depth;
+    }
+    // no jump may land within the operands
+    for (size_t i = 1; i <= ruleOps[op].operands; i++) {
+      if (landing[pc + i] >= 0) {
+        return false;
+      }
+    }
+    pc += 1 + ruleOps[op].operands;
+  }
+  if (depth != 0 || (landing[program.length] >= 0 && landing[program.length] != 0)) {
+    return false;
+  }
+  program.stackDepth = deepest;
+  return true;
+}
+
+////////////////////////////////
+// Machine
+
+static inline int32_t saturate(int64_t value) {
+  // symmetric, so INT32_MIN stays free for ruleNoValue and negation cannot overflow
+  return value > INT32_MAX ? INT32_MAX : value < -INT32_MAX ? -INT32_MAX : (int32_t) value;
+}
+
+static inline int32_t truth(bool value) {
+  return value ? ruleOne : 0;
+}
+
+RuleFault ruleRun(const RuleProgram& program, const int32_t inputs[ruleInputCount], RuleResult& result,
+                  uint16_t stepsMax) {
+  int32_t stack[ruleStackMax];
+  int32_t locals[ruleLocalsMax];
+  uint8_t sp = 0;
+  for (uint8_t i = 0; i < ruleLocalsMax; i++) {
+    locals[i] = ruleNoValue;
+  }
+  result.assigned = 0;
+  result.steps = 0;
+
+  RuleFault fault = RULE_OK;
+  const uint8_t* code = program.code;
+  size_t pc = 0;
+  while (pc < program.length) {
+    if (result.steps >= stepsMax) {
+      fault = RULE_STEPS;
+      break;
+    }
+    result.steps++;
+    uint8_t op = code[pc++];
+    // binary ops work on the top two, a the deeper one
+    int32_t b = sp > 0 ? stack[sp - 1] : 0;
+    int32_t a = sp > 1 ? stack[sp - 2] : 0;
+    int32_t value;
+    switch (op) {
+      case RULE_OP_PUSH8:
+        stack[sp++] = (int8_t) code[pc++];
+        continue;
+      case RULE_OP_PUSH16:
+        stack[sp++] = (int16_t)(code[pc] | (code[pc + 1] << 8));
+        pc += 2;
+        continue;
+      case RULE_OP_PUSH32:
+        stack[sp++] = (int32_t)((uint32_t) code[pc] | ((uint32_t) code[pc + 1] << 8) |
+                                ((uint32_t) code[pc + 2] << 16) | ((uint32_t) code[pc + 3] << 24));
+        pc += 4;
+        continue;
+      case RULE_OP_INPUT:
+      case RULE_OP_LOAD:
+        value = op == RULE_OP_INPUT ? inputs[code[pc]] : locals[code[pc]];
+        pc++;
+        if (value == ruleNoValue) {
+          fault = RULE_NO_INPUT;
+          break;
+        }
+        stack[sp++] = value;
+        continue;
+      case RULE_OP_STORE:
+        locals[code[pc++]] = stack[--sp];
+        continue;
+      case RULE_OP_OUT:
+        result.value[code[pc]] = stack[--sp];
+        result.assigned |= 1 << code[pc++];
+        continue;
+      case RULE_OP_JZ:
+        value = code[pc++];
+        if (stack[--sp] == 0) {
+          pc += value;
+        }
+        continue;
+      case RULE_OP_NEG: stack[sp - 1] = -b; continue;
+      case RULE_OP_ABS: stack[sp - 1] = b < 0 ? -b : b; continue;
+      case RULE_OP_NOT: stack[sp - 1] = truth(b == 0); continue;
+      case RULE_OP_CLAMP: {
+        int32_t x = stack[sp - 3];
+        // hi wins over lo, like cap over floor
+        value = x < a ? a : x;
+        stack[sp - 3] = value > b ? b : value;
+        sp -= 2;
+        continue;
+      }
+      case RULE_OP_ADD: value = saturate((int64_t) a + b); break;
+      case RULE_OP_SUB: value = saturate((int64_t) a - b); break;
+      case RULE_OP_MUL: value = saturate(((int64_t) a * b) / ruleOne); break;
+      case RULE_OP_DIV:
+        if (b == 0) {
+          fault = RULE_DIVIDE;
+          break;
+        }
+        value = saturate((int64_t) a * ruleOne / b);
+        break;
+      case RULE_OP_LT: value = truth(a < b); break;
+      case RULE_OP_LE: value = truth(a <= b); break;
+      case RULE_OP_GT: value = truth(a > b); break;
+      case RULE_OP_GE: value = truth(a >= b); break;
+      case RULE_OP_EQ: value = truth(a == b); break;
+      case RULE_OP_NE: value = truth(a != b); break;
+      case RULE_OP_AND: value = truth(a != 0 && b != 0); break;
+      case RULE_OP_OR: value = truth(a != 0 || b != 0); break;
+      case RULE_OP_MIN: value = a < b ? a : b; break;
+      case RULE_OP_MAX: value = a > b ? a : b; break;
+      default:
+        fault = RULE_BAD_CODE;
+        break;
+    }
+    if (fault != RULE_OK) {
+      break;
+    }
+    stack[--sp - 1] = value;
+  }
+  if (fault != RULE_OK) {
+    result.assigned = 0;
+  }
+  return fault;
+}
@@ -0,0 +1,134 @@
+#ifndef CONTROL_RULES
+#define CONTROL_RULES
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+   Control rules: a small expression language, compiled on the device into
+   bytecode for a stack machine with fixed limits, run by the autopilot for
+   every zone on every control tick.
+
+     # the door switch on in0: follow the hotter probe, with a margin
+     temp = max(t0, t1) + 5 when in0
+     # night mode
+     cap = 40 when hour >= 22 or hour < 7
+
+   A program is a list of statements, one per line or separated by ';':
+   name = expression [when condition]. Assigning an output tells the
+   autopilot of the zone:
+
+     temp      the temperature curve and forecast look at, °C
+     strength  the strength to use instead of what they say
+     floor     the lowest strength
+     cap       the highest strength, it wins over floor
+
+   Any other name is a local for the statements that follow. Statements run
+   in order, a later assignment overrides an earlier one.
+
+   Inputs are t (the zone's temperature), t0..t3 (the probes on the bus),
+   duty (the zone's strength now), hour (local time of day, 22.5 is 22:30),
+   in0 and in1 (switches, 1 while closed) and zone. There are + - * /,
+   < <= > >= == !=, and, or, not with the usual precedence, and min, max,
+   abs and clamp(x, low, high). Comparisons give 1 or 0, a condition holds
+   unless it is 0.
+
+   Values are Q4 fixed point (1/16, the probe's step) in 32 bit and saturate.
+   Reading what has no value (a probe without a reading, the hour before the
+   clock is set, an unwired switch, a local whose when did not hold) or a
+   division by zero stops the run: its outputs are dropped and the zone runs
+   as if there were no rules.
+
+   The compiler keeps code within ruleCodeMax bytes, the stack within
+   ruleStackMax values and parentheses, calls, - and not within
+   ruleStackMax levels of nesting, which also bounds its own recursion. It
+   only emits forward jumps, so a run takes at most one step per
+   instruction. The machine does not rely on that: ruleVerify()
+   checks operands, jump targets and stack depth of any code before it is
+   run, and ruleRun() stops after ruleStepsMax steps or the smaller budget
+   it is given. Neither compiler nor machine allocate.
+*/
+
+const uint16_t ruleSourceMax = 1024;
+const uint8_t ruleCodeMax = 192;
+const uint8_t ruleStackMax = 16;
+const uint8_t ruleLocalsMax = 8;
+const uint16_t ruleStepsMax = 256;
+const int32_t ruleOne = 16;                  // 1.0 in Q4
+const int32_t ruleNoValue = INT32_MIN;       // an input without a value
+
+enum RuleInput : uint8_t {
+  RULE_T, RULE_T0, RULE_T1, RULE_T2, RULE_T3, RULE_DUTY, RULE_HOUR, RULE_IN0, RULE_IN1, RULE_ZONE,
+  ruleInputCount
+};
+extern const char* const ruleInputNames[ruleInputCount];
+
+enum RuleOutput : uint8_t {
+  RULE_TEMP, RULE_STRENGTH, RULE_FLOOR, RULE_CAP,
+  ruleOutputCount
+};
+extern const char* const ruleOutputNames[ruleOutputCount];
+
+enum RuleOp : uint8_t {
+  RULE_OP_PUSH8,   // int8 operand, a Q4 constant
+  RULE_OP_PUSH16,  // int16 operand, little endian
+  RULE_OP_PUSH32,  // int32 operand, little endian
+  RULE_OP_INPUT,   // RuleInput operand
+  RULE_OP_LOAD,    // local operand
+  RULE_OP_STORE,   // local operand
+  RULE_OP_OUT,     // RuleOutput operand
+  RULE_OP_JZ,      // skips operand bytes forward if the value popped is 0
+  RULE_OP_ADD, RULE_OP_SUB, RULE_OP_MUL, RULE_OP_DIV, RULE_OP_NEG,
+  RULE_OP_LT, RULE_OP_LE, RULE_OP_GT, RULE_OP_GE, RULE_OP_EQ, RULE_OP_NE,
+  RULE_OP_AND, RULE_OP_OR, RULE_OP_NOT,
+  RULE_OP_MIN, RULE_OP_MAX, RULE_OP_ABS, RULE_OP_CLAMP,
+  ruleOpCount
+};
+// Mnemonic and operand bytes of an op, for listings; nullptr and 0 for an invalid one
+const char* ruleOpName(uint8_t op);
+uint8_t ruleOpOperands(uint8_t op);
+
+struct RuleProgram {
+  uint8_t code[ruleCodeMax];
+  uint8_t length;      // 0 is no rules
+  uint8_t stackDepth;  // deepest the stack gets, from ruleVerify()
+};
+
+struct RuleError {
+  const char* message;
+  uint16_t line;    // from 1
+  uint16_t column;  // from 1
+};
+
+enum RuleFault : uint8_t {
+  RULE_OK,
+  RULE_NO_INPUT,
+  RULE_DIVIDE,
+  RULE_STEPS,
+  RULE_BAD_CODE,
+  ruleFaultCount
+};
+extern const char* const ruleFaultNames[ruleFaultCount];
+
+// The outputs a run assigned, Q4
+struct RuleResult {
+  uint8_t assigned;  // bit per RuleOutput
+  int32_t value[ruleOutputCount];
+  uint16_t steps;
+
+  bool has(RuleOutput output) const { return assigned & (1 << output); }
+};
+
+// Compiles length bytes of source. On failure program is undefined and
+// error says what and where.
+bool ruleCompile(const char* source, size_t length, RuleProgram& program, RuleError& error);
+// Whether code can run: valid ops and operands, forward jumps within the
+// code, a stack that neither underflows nor exceeds ruleStackMax, the same
+// depth on every path. Sets stackDepth.
+bool ruleVerify(RuleProgram& program);
+// Runs verified code on inputs (Q4, ruleNoValue where there is none), at
+// most stepsMax instructions of it
+RuleFault ruleRun(const RuleProgram& program, const int32_t inputs[ruleInputCount], RuleResult& result,
+                  uint16_t stepsMax = ruleStepsMax);
+
+#endif //CONTROL_RULES
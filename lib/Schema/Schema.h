@@ -0,0 +1,289 @@
+#ifndef SETTINGS_SCHEMA
+#define SETTINGS_SCHEMA
+
+#include <stdint.h>
+#include <string.h>
+#include <tuple>
+#include <type_traits>
+
+/*
+   Compile time description of a settings record, declared once (see
+   include/SETTINGS.h) and turned into its JSON, binary, metric and OpenAPI
+   forms by the templates below.
+
+   A field is a member pointer with a name, a range and optionally the names
+   of its values (an enumeration), a Prometheus metric or a component of its
+   own in the OpenAPI spec. A schema is a tuple of fields; visiting it unrolls
+   into one block of code per field at compile time, so there is no table to
+   walk and nothing is looked up by name at runtime. Nothing allocates: text
+   goes into anything with StrBuilder's +=, binary records through a fixed
+   buffer on the stack.
+
+   The OpenAPI generator is host code, tools/schema/openapi.cpp.
+*/
+
+template <typename S, typename T>
+struct SchemaField {
+  typedef S Record;
+  typedef T Type;
+
+  const char* name;
+  T S::* member;
+  long min;
+  long max;
+  const char* description;
+  const char* const* names = nullptr;  // value names of an enumeration, min..max
+  const char* metricName = nullptr;    // exported as this metric
+  const char* componentName = nullptr; // its own schema in the OpenAPI spec
+  bool isLabel = false;                // a label of the record's metrics instead of a value
+  long exampleValue = 0;               // for the OpenAPI spec, min if not given
+  bool hasExample = false;
+
+  constexpr SchemaField metric(const char* metric) const { SchemaField f = *this; f.metricName = metric; return f; }
+  constexpr SchemaField component(const char* component) const { SchemaField f = *this; f.componentName = component; return f; }
+  constexpr SchemaField label() const { SchemaField f = *this; f.isLabel = true; return f; }
+  constexpr SchemaField example(long value) const { SchemaField f = *this; f.exampleValue = value; f.hasExample = true; return f; }
+
+  constexpr bool accepts(long value) const { return value >= min && value <= max; }
+  // Name of an enumeration value, nullptr for a number or a value out of range
+  constexpr const char* nameOf(long value) const { return names && accepts(value) ? names[value - min] : nullptr; }
+  // Value of an enumeration name, or min - 1
+  long valueOf(const char* text) const {
+    for (long value = min; names && text && value <= max; value++) {
+      if (strcmp(names[value - min], text) == 0) {
+        return value;
+      }
+    }
+    return min - 1;
+  }
+};
+
+// An integer within [min, max]
+template <typename S, typename T>
+constexpr SchemaField<S, T> schemaNumber(const char* name, T S::* member, long min, long max, const char* description) {
+  return SchemaField<S, T>{name, member, min, max, description};
+}
+
+// An integer 0..count-1 that reads and writes as names[value] in JSON
+template <typename S, typename T, size_t count>
+constexpr SchemaField<S, T> schemaEnum(const char* name, T S::* member, const char* const (&names)[count], const char* description) {
+  return SchemaField<S, T>{name, member, 0, (long) count - 1, description, names};
+}
+
+template <typename S, typename... F>
+struct Schema {
+  typedef S Record;
+
+  const char* name;
+  const char* description;
+  std::tuple<F...> fields;
+  uint32_t layout;  // see layoutOf(), a constant of a constexpr schema
+
+  // Packed record in the binary format: every field little endian at its own size
+  static constexpr size_t recordSize = (sizeof(typename F::Type) + ... + 0);
+
+  // Calls fn(field) for every field, in declaration order
+  template <typename Fn>
+  constexpr void each(Fn&& fn) const {
+    std::apply([&fn](const F&... field) { (fn(field), ...); }, fields);
+  }
+
+  template <size_t index>
+  constexpr const auto& field() const { return std::get<index>(fields); }
+
+  // FNV-1a over the field names and sizes. It is part of a binary file, a
+  // file written with another set of fields is not read back into the wrong ones.
+  constexpr uint32_t layoutOf() const {
+    uint32_t hash = 2166136261u;
+    each([&hash](const auto& field) {
+      for (const char* c = field.name; *c; c++) {
+        hash = (hash ^ (uint8_t) *c) * 16777619u;
+      }
+      hash = (hash ^ (uint8_t) sizeof(typename std::decay_t<decltype(field)>::Type)) * 16777619u;
+    });
+    return hash;
+  }
+};
+
+template <typename S, typename... T>
+constexpr Schema<S, SchemaField<S, T>...> schema(const char* name, const char* description, SchemaField<S, T>... fields) {
+  Schema<S, SchemaField<S, T>...> result{name, description, std::make_tuple(fields...), 0};
+  result.layout = result.layoutOf();
+  return result;
+}
+
+////////////////////////////////
+// JSON
+
+// "name":value for every field, comma separated, for a caller that adds more
+template <typename Out, typename Sc>
+void schemaJsonFields(Out& out, const Sc& schema, const typename Sc::Record& record) {
+  bool first = true;
+  schema.each([&](const auto& field) {
+    out += first ? "\"" : ",\"";
+    first = false;
+    out += field.name;
+    out += "\":";
+    long value = record.*field.member;
+    const char* name = field.nameOf(value);
+    if (name) {
+      out += '"';
+      out += name;
+      out += '"';
+    } else {
+      out += value;
+    }
+  });
+}
+
+template <typename Out, typename Sc>
+void schemaJson(Out& out, const Sc& schema, const typename Sc::Record& record) {
+  out += '{';
+  schemaJsonFields(out, schema, record);
+  out += '}';
+}
+
+/*
+   Reads the fields of an ArduinoJson object into record. A field that is
+   missing keeps its value, one of the wrong type or out of range fails the
+   whole object. Returns the name of the first bad field, nullptr when all
+   were good; record is only changed in the latter case.
+*/
+template <typename Sc, typename Object>
+const char* schemaFromJson(const Sc& schema, const Object& object, typename Sc::Record& record) {
+  typename Sc::Record parsed = record;
+  const char* bad = nullptr;
+  schema.each([&](const auto& field) {
+    auto variant = object[field.name];
+    if (bad || variant.isNull()) {
+      return;
+    }
+    long value;
+    if (field.names) {
+      value = field.valueOf(variant.template as<const char*>());
+    } else {
+      value = variant.template is<long>() ? variant.template as<long>() : field.min - 1;
+    }
+    if (!field.accepts(value)) {
+      bad = field.name;
+      return;
+    }
+    parsed.*field.member = value;
+  });
+  if (!bad) {
+    record = parsed;
+  }
+  return bad;
+}
+
+////////////////////////////////
+// Metrics
+
+/*
+   One line per metric field, "metric{labels} value\n". labels(out) appends
+   the caller's labels (e.g. the zone), label fields follow as name="value".
+*/
+template <typename Out, typename Sc, typename Labels>
+void schemaMetrics(Out& out, const Sc& schema, const typename Sc::Record& record, Labels labels) {
+  schema.each([&](const auto& metricField) {
+    if (!metricField.metricName) {
+      return;
+    }
+    out += metricField.metricName;
+    out += '{';
+    labels(out);
+    schema.each([&](const auto& labelField) {
+      if (labelField.isLabel) {
+        out += ',';
+        out += labelField.name;
+        out += "=\"";
+        out += (long) (record.*labelField.member);
+        out += '"';
+      }
+    });
+    out += "} ";
+    out += (long) (record.*metricField.member);
+    out += '\n';
+  });
+}
+
+////////////////////////////////
+// Binary
+
+// FNV-1a over the packed records, seeded with the layout: equal for equal
+// settings, whatever the padding of the struct holds
+template <typename Sc>
+uint32_t schemaHash(const Sc& schema, const typename Sc::Record* records, uint16_t count) {
+  uint32_t hash = schema.layout;
+  for (uint16_t i = 0; i < count; i++) {
+    schema.each([&](const auto& field) {
+      const uint8_t* bytes = (const uint8_t*) &(records[i].*field.member);
+      for (size_t b = 0; b < sizeof(records[i].*field.member); b++) {
+        hash = (hash ^ bytes[b]) * 16777619u;
+      }
+    });
+  }
+  return hash;
+}
+
+// In front of the records of a binary file
+struct SchemaFileHeader {
+  uint32_t magic;
+  uint32_t layout;      // Schema::layout
+  uint16_t recordSize;
+  uint16_t count;
+};
+const uint32_t schemaFileMagic = 0x4b534331; // "KSC1"
+
+// Header and count records, false if the file took less
+template <typename File, typename Sc>
+bool schemaWrite(File& file, const Sc& schema, const typename Sc::Record* records, uint16_t count) {
+  const SchemaFileHeader header = {schemaFileMagic, schema.layout, (uint16_t) Sc::recordSize, count};
+  bool written = file.write((const uint8_t*) &header, sizeof(header)) == sizeof(header);
+  for (uint16_t i = 0; written && i < count; i++) {
+    uint8_t packed[Sc::recordSize];
+    size_t offset = 0;
+    schema.each([&](const auto& field) {
+      memcpy(packed + offset, &(records[i].*field.member), sizeof(records[i].*field.member));
+      offset += sizeof(records[i].*field.member);
+    });
+    written = file.write(packed, sizeof(packed)) == sizeof(packed);
+  }
+  return written;
+}
+
+/*
+   Up to capacity records of a file written by schemaWrite() with the same
+   schema. Returns how many, or -1 if it is not such a file, is cut short or
+   holds a value out of range, records may then be partly overwritten.
+*/
+template <typename File, typename Sc>
+int schemaRead(File& file, const Sc& schema, typename Sc::Record* records, uint16_t capacity) {
+  SchemaFileHeader header;
+  if (file.read((uint8_t*) &header, sizeof(header)) != sizeof(header) || header.magic != schemaFileMagic
+      || header.layout != schema.layout || header.recordSize != Sc::recordSize || header.count > capacity) {
+    return -1;
+  }
+  for (uint16_t i = 0; i < header.count; i++) {
+    uint8_t packed[Sc::recordSize];
+    if (file.read(packed, sizeof(packed)) != sizeof(packed)) {
+      return -1;
+    }
+    typename Sc::Record record = records[i];
+    size_t offset = 0;
+    bool valid = true;
+    schema.each([&](const auto& field) {
+      auto& member = record.*field.member;
+      memcpy(&member, packed + offset, sizeof(member));
+      offset += sizeof(member);
+      valid = valid && field.accepts(member);
+    });
+    if (!valid) {
+      return -1;
+    }
+    records[i] = record;
+  }
+  return header.count;
+}
+
+#endif //SETTINGS_SCHEMA
@@ -0,0 +1,93 @@
+#ifndef SEQLOCK
+#define SEQLOCK
+
+#include <atomic>
+#include <stdint.h>
+
+/*
+   Single writer, multi reader snapshot of a value of type T.
+
+   The value is kept twice and the sequence counter selects the copy readers
+   use, while the writer updates the other one (a "latch" seqlock). A reader
+   therefore never waits for the writer: even an interrupt handler that
+   preempts a write in progress reads the untouched copy and finishes without
+   retrying. Readers neither disable interrupts nor take a lock.
+
+   Writes must come from a single context at a time. In this firmware that is
+   task context, where the cooperative scheduler already serializes them;
+   interrupt handlers may only read.
+
+   read() returns a copy, which is fine for small values. For larger ones
+   (the autopilot curve) read in place and check for a concurrent write:
+
+     uint32_t seq;
+     do {
+       seq = curve.begin();
+       const Curve& c = curve.view(seq);
+       ...
+     } while (curve.retry(seq));
+*/
+template <typename T>
+class Seqlock {
+public:
+  Seqlock() : _seq(0) {}
+  explicit Seqlock(const T& value) : _seq(0) {
+    _copy[0] = value;
+    _copy[1] = value;
+  }
+
+  void write(const T& value) {
+    uint32_t seq = _seq.load(std::memory_order_relaxed);
+    // readers move to copy[1] while copy[0] is rewritten, then back
+    _seq.store(seq + 1, std::memory_order_release);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    _copy[0] = value;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    _seq.store(seq + 2, std::memory_order_release);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    _copy[1] = value;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+  }
+
+  // Read-modify-write from the writer's context
+  template <typename F>
+  void update(F change) {
+    T value = _copy[0];
+    change(value);
+    write(value);
+  }
+
+  T read() const {
+    T value;
+    uint32_t seq;
+    do {
+      seq = begin();
+      value = view(seq);
+    } while (retry(seq));
+    return value;
+  }
+
+  uint32_t begin() const {
+    return _seq.load(std::memory_order_acquire);
+  }
+
+  const T& view(uint32_t seq) const {
+    return _copy[seq & 1];
+  }
+
+  bool retry(uint32_t seq) const {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    return _seq.load(std::memory_order_acquire) != seq;
+  }
+
+  // Changes every time a new value is published
+  uint32_t version() const {
+    return begin() >> 1;
+  }
+
+private:
+  std::atomic<uint32_t> _seq;
+  T _copy[2];
+};
+
+#endif //SEQLOCK
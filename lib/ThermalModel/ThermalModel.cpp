@@ -0,0 +1,148 @@
+#include "ThermalModel.h"
+
+static const int32_t one = 1L << 16;            // Q16
+static const int64_t covarianceOne = 1LL << 20; // Q20
+static const int64_t covarianceStart = 4 * covarianceOne;
+static const int64_t covarianceMax = 8 * covarianceOne;
+// Variance of a window's slope, (°C/min)^2: probe noise and 1/16 °C steps
+static const int64_t slopeNoise = covarianceOne / 16;
+// Random walk of each parameter per window, (°C/min)^2
+static const int32_t drift[3] = {
+  (int32_t)(covarianceOne / 10000), // heating, 0.01 °C/min
+  (int32_t)(covarianceOne >> 16),   // cooling, 0.004 per 10 °C
+  (int32_t)(covarianceOne >> 16)    // fan, 0.004 °C/min
+};
+static const int32_t slopeMax = 16L << 16;      // °C per minute
+static const int16_t centerRaw = 30 * 16;       // regressors are centered on 30 °C
+static const uint8_t forecastSteps = 16;
+
+// 1/16 °C to °C relative to the center, Q16
+static inline int32_t centered(int32_t raw) {
+  return (raw - centerRaw) * 4096;
+}
+
+void ThermalModel::reset() {
+  memset(&_state, 0, sizeof(_state));
+  for (uint8_t i = 0; i < 3; i++) {
+    _state.p[i][i] = covarianceStart;
+  }
+  _fromRaw = INT16_MIN;
+}
+
+void ThermalModel::sample(int16_t raw, uint8_t duty, uint32_t nowMs) {
+  if (_fromRaw == INT16_MIN || nowMs - _lastMs > thermalModelGapMs) {
+    _fromRaw = raw;
+    _fromMs = nowMs;
+    _lastMs = nowMs;
+    _dutyMsSum = 0;
+    return;
+  }
+  _dutyMsSum += (uint32_t) duty * (nowMs - _lastMs);
+  _lastMs = nowMs;
+  uint32_t window = nowMs - _fromMs;
+  if (window < thermalModelWindowMs) {
+    return;
+  }
+
+  int64_t slope = (int64_t)(raw - _fromRaw) * 4096 * 60000 / window;
+  slope = constrain(slope, (int64_t) -slopeMax, (int64_t) slopeMax);
+  // the slope belongs to the middle of the window
+  int32_t x[3] = {
+    one,
+    centered(((int32_t) raw + _fromRaw) / 2) / 10,
+    (int32_t)((int64_t) _dutyMsSum * one / (100LL * window))
+  };
+  update(x, (int32_t) slope);
+
+  _fromRaw = raw;
+  _fromMs = nowMs;
+  _dutyMsSum = 0;
+}
+
+void ThermalModel::update(const int32_t x[3], int32_t y) {
+  int64_t px[3];
+  int64_t xpx = 0;
+  int64_t predicted = 0;
+  for (uint8_t i = 0; i < 3; i++) {
+    px[i] = 0;
+    for (uint8_t j = 0; j < 3; j++) {
+      px[i] += (int64_t) _state.p[i][j] * x[j];
+    }
+    px[i] >>= 16;
+    predicted += (int64_t) _state.theta[i] * x[i];
+  }
+  for (uint8_t i = 0; i < 3; i++) {
+    xpx += x[i] * px[i];
+  }
+  xpx >>= 16;
+  predicted >>= 16;
+
+  int64_t denom = slopeNoise + xpx;
+  if (denom <= 0) {
+    // rounding broke the covariance, start it over and keep the parameters
+    memset(_state.p, 0, sizeof(_state.p));
+    for (uint8_t i = 0; i < 3; i++) {
+      _state.p[i][i] = covarianceStart;
+    }
+    return;
+  }
+  int64_t error = constrain((int64_t) y - predicted, (int64_t) -slopeMax, (int64_t) slopeMax);
+  for (uint8_t i = 0; i < 3; i++) {
+    _state.theta[i] += (int32_t)(px[i] * error / denom);
+  }
+
+  // P = P - P x x' P / denom + drift
+  for (uint8_t i = 0; i < 3; i++) {
+    for (uint8_t j = i; j < 3; j++) {
+      int64_t value = _state.p[i][j] - px[i] * px[j] / denom;
+      _state.p[i][j] = (int32_t) value;
+      _state.p[j][i] = (int32_t) value;
+    }
+    _state.p[i][i] = constrain(_state.p[i][i] + drift[i], (int32_t) 1, (int32_t) covarianceMax);
+  }
+  _state.updates++;
+}
+
+bool ThermalModel::trusted() const {
+  return _state.updates >= thermalModelTrustedAfter && _state.theta[1] < 0 && _state.theta[2] < 0;
+}
+
+// Euler steps through the horizon, the result is linear in the duty
+int32_t ThermalModel::forecastQ16(int32_t tempQ16, int32_t dutyQ16, uint32_t horizonMs) const {
+  int64_t step = (int64_t) horizonMs * one / (60000LL * forecastSteps); // minutes, Q16
+  int64_t temp = tempQ16;
+  int64_t fan = ((int64_t) _state.theta[2] * dutyQ16) >> 16;
+  for (uint8_t i = 0; i < forecastSteps; i++) {
+    int64_t slope = _state.theta[0] + (((int64_t) _state.theta[1] * (temp / 10)) >> 16) + fan;
+    temp += (slope * step) >> 16;
+    temp = constrain(temp, (int64_t) -200 * one, (int64_t) 200 * one);
+  }
+  return (int32_t) temp;
+}
+
+int16_t ThermalModel::forecast(int16_t raw, uint8_t duty, uint32_t horizonMs) const {
+  int32_t temp = forecastQ16(centered(raw), (int32_t) duty * one / 100, horizonMs);
+  int32_t result = (temp + (temp < 0 ? -2048 : 2048)) / 4096 + centerRaw;
+  return (int16_t) constrain(result, (int32_t) INT16_MIN + 1, (int32_t) INT16_MAX);
+}
+
+uint8_t ThermalModel::lowestDuty(int16_t raw, int16_t limitRaw, uint32_t horizonMs) const {
+  int32_t limit = centered(limitRaw);
+  int64_t off = forecastQ16(centered(raw), 0, horizonMs);
+  int64_t full = forecastQ16(centered(raw), one, horizonMs);
+  if (off <= limit) {
+    return 0;
+  }
+  if (full >= limit) {
+    return 100;
+  }
+  // rounded up, the forecast has to end at or below the limit
+  return (uint8_t)(((off - limit) * 100 + (off - full) - 1) / (off - full));
+}
+
+long ThermalModel::timeConstantS() const {
+  if (_state.theta[1] >= 0) {
+    return -1;
+  }
+  return (long)(-600LL * one / _state.theta[1]);
+}
@@ -0,0 +1,76 @@
+#ifndef THERMAL_MODEL
+#define THERMAL_MODEL
+
+#include "Arduino.h"
+
+/*
+   Online model of a tube, learned by recursive least squares in fixed point.
+
+     dT/dt = theta0 + theta1 * (T - 30 °C) / 10 + theta2 * duty
+
+   theta0 is the heating rate at 30 °C with the fan off, theta1 the (negative)
+   inverse time constant per 10 °C and theta2 what the fan adds at full duty,
+   all in °C per minute. It is linear around the operating point only.
+
+   Instead of one forgetting factor every parameter is a random walk with its
+   own rate: theta1 and theta2 describe tube and fan and barely move, theta0
+   follows the heat input, which can step at any time. In closed loop a heat
+   step also raises the duty, with a common forgetting factor the fit would
+   credit the fan with the heating.
+
+   Regressors and parameters are Q16, the covariance Q20. The regressors are
+   scaled to single digits and every variance is capped, which keeps all
+   products within 64 bit and an unexcited model from winding up.
+
+   Samples come at whatever rate the sensor runs. The slope is taken over a
+   window of at least thermalModelWindowMs, with the duty averaged over it, so
+   the quantisation of fast samples does not swamp the estimate.
+*/
+
+const uint32_t thermalModelWindowMs = 15000;
+const uint32_t thermalModelGapMs = 300000;   // longer gaps restart the window
+const uint16_t thermalModelTrustedAfter = 32; // updates before forecasts are used
+
+struct ThermalModelState {
+  int32_t theta[3];  // Q16, °C per minute
+  int32_t p[3][3];   // Q20 covariance
+  uint32_t updates;
+};
+
+class ThermalModel {
+public:
+  ThermalModel() { reset(); }
+
+  void reset();
+  // A sample of the probe (1/16 °C) and the duty (percent) applied since the last one
+  void sample(int16_t raw, uint8_t duty, uint32_t nowMs);
+
+  // Enough updates and a plausible sign on cooling and fan
+  bool trusted() const;
+  // Temperature (1/16 °C) after horizonMs at a constant duty
+  int16_t forecast(int16_t raw, uint8_t duty, uint32_t horizonMs) const;
+  // Lowest duty (percent) whose forecast stays at or below limitRaw
+  uint8_t lowestDuty(int16_t raw, int16_t limitRaw, uint32_t horizonMs) const;
+
+  // Derived values in 1/100 units for the API
+  long heatingCentiPerMin() const { return scaleCenti(_state.theta[0]); }
+  long fanCentiPerMin() const { return scaleCenti(_state.theta[2]); }
+  // -1 while the model sees no cooling
+  long timeConstantS() const;
+
+  const ThermalModelState& state() const { return _state; }
+  void restore(const ThermalModelState& state) { _state = state; }
+
+private:
+  void update(const int32_t x[3], int32_t y);
+  int32_t forecastQ16(int32_t tempQ16, int32_t dutyQ16, uint32_t horizonMs) const;
+  static long scaleCenti(int32_t q16) { return (long)(((int64_t) q16 * 100 + (q16 < 0 ? -32768 : 32768)) / 65536); }
+
+  ThermalModelState _state;
+  int16_t _fromRaw;
+  uint32_t _fromMs;
+  uint32_t _lastMs;
+  uint32_t _dutyMsSum;
+};
+
+#endif //THERMAL_MODEL
@@ -0,0 +1,64 @@
+#include "Trace.h"
+
+// Without KIRBY_TRACE nothing refers to any of this
+#ifdef KIRBY_TRACE
+
+TraceBuffer Trace;
+
+uint32_t traceHash(const char* text) {
+  uint32_t hash = 2166136261u;
+  while (*text) {
+    hash = (hash ^ (uint8_t) *text++) * 16777619u;
+  }
+  return hash;
+}
+
+struct TraceRtcHeader {
+  uint32_t magic;
+  uint32_t head;
+};
+
+void TraceBuffer::begin() {
+  TraceRtcHeader header;
+  uint32_t restored = 0;
+  if (ESP.rtcUserMemoryRead(traceRtcOffset, (uint32_t*) &header, sizeof(header)) && header.magic == traceRtcMagic) {
+    // oldest first; mirrored again only once all are read, they would
+    // overwrite the slots still to be read
+    uint32_t count = min(header.head, (uint32_t) traceRtcRecords);
+    for (uint32_t position = header.head - count; position != header.head; position++) {
+      TraceRecord previous;
+      uint32_t block = traceRtcOffset + (sizeof(header) + (position % traceRtcRecords) * sizeof(TraceRecord)) / 4;
+      if (!ESP.rtcUserMemoryRead(block, (uint32_t*) &previous, sizeof(previous))) {
+        break;
+      }
+      uint32_t head = _head.load(std::memory_order_relaxed);
+      TraceRecord& slot = _records[head & (traceRecords - 1)];
+      slot = previous;
+      slot.sequence = head;
+      _head.store(head + 1, std::memory_order_release);
+      restored++;
+    }
+    for (uint32_t position = 0; position < restored; position++) {
+      mirror(_records[position], position);
+    }
+  }
+  record(TRACE_BOOT, restored, 0);
+}
+
+bool TraceBuffer::read(uint32_t position, TraceRecord& record) const {
+  if (position < tail() || position >= head()) {
+    return false;
+  }
+  record = _records[position & (traceRecords - 1)];
+  // overwritten while it was copied
+  return record.sequence == (uint16_t) position && position >= tail();
+}
+
+void TraceBuffer::mirror(const TraceRecord& record, uint32_t position) {
+  TraceRtcHeader header = {traceRtcMagic, position + 1};
+  uint32_t block = traceRtcOffset + (sizeof(header) + (position % traceRtcRecords) * sizeof(TraceRecord)) / 4;
+  ESP.rtcUserMemoryWrite(block, (uint32_t*) &record, sizeof(record));
+  ESP.rtcUserMemoryWrite(traceRtcOffset, (uint32_t*) &header, sizeof(header));
+}
+
+#endif // KIRBY_TRACE
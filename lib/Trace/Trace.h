@@ -0,0 +1,116 @@
+#ifndef TRACE_BUFFER
+#define TRACE_BUFFER
+
+#include <atomic>
+#include "Arduino.h"
+
+/*
+   Binary event tracing for builds with -DKIRBY_TRACE (env:esp01_trace).
+
+   A tracepoint stores one 16 byte record (micros(), event, two arguments) in
+   a ring in RAM, the oldest records are overwritten. Recording is a handful of
+   stores and never blocks, allocates or prints. GET /debug/trace streams the
+   ring, tools/trace2chrome.py turns it into a Chrome / Perfetto trace.
+
+   The newest traceRtcRecords records are mirrored to RTC user memory, which
+   survives a software or watchdog reset: begin() puts them back in front of
+   the new boot, so the trace shows what led up to a crash.
+
+   The ring has a single producer: record from task context only, never from
+   an interrupt handler. Readers check the sequence of every record they
+   copy, a record overwritten meanwhile is skipped rather than returned torn.
+
+   Without KIRBY_TRACE the TRACE macros expand to nothing, their arguments
+   are not even evaluated, and Trace is not defined.
+*/
+
+enum TraceEvent : uint16_t {
+  TRACE_BOOT = 1,     // a: records restored from the previous boot
+  TRACE_TASK,         // a: task index, b: jitter (begin) or run time (end) in us
+  TRACE_HTTP,         // a: hash of the path, b: method (begin) or arena bytes used (end)
+  TRACE_SENSOR,       // conversion of all probes, a: probes used
+  TRACE_TEMPERATURE,  // a: probe, b: raw 1/16 °C
+  TRACE_PWM,          // a: zone, b: output level in per-mille
+  TRACE_FS_WRITE,     // a: hash of the path, b: bytes (end)
+};
+// Or'ed into the event of the record that ends a span
+const uint16_t traceEnd = 0x8000;
+
+struct TraceRecord {
+  uint32_t us;
+  uint16_t event;
+  uint16_t sequence;  // low bits of the record's position in the ring
+  uint32_t a;
+  uint32_t b;
+};
+
+const uint16_t traceRecords = 128;     // power of two, 2 KB
+const uint8_t traceRtcOffset = 64;     // in 4 byte blocks, the upper half of RTC user memory
+const uint8_t traceRtcRecords = 15;    // after an 8 byte header
+const uint32_t traceRtcMagic = 0x4b545231;  // "KTR1"
+
+// FNV-1a, for paths: records have no room for strings
+uint32_t traceHash(const char* text);
+
+class TraceBuffer {
+public:
+  // Restores what the previous boot left in RTC memory and records TRACE_BOOT
+  void begin();
+
+  inline void record(uint16_t event, uint32_t a, uint32_t b) {
+    uint32_t position = _head.load(std::memory_order_relaxed);
+    TraceRecord& slot = _records[position & (traceRecords - 1)];
+    slot.us = micros();
+    slot.event = event;
+    slot.sequence = position;
+    slot.a = a;
+    slot.b = b;
+    _head.store(position + 1, std::memory_order_release);
+    mirror(slot, position);
+  }
+
+  // Position after the newest record, and of the oldest one still held
+  uint32_t head() const { return _head.load(std::memory_order_acquire); }
+  uint32_t tail() const { uint32_t head = this->head(); return head > traceRecords ? head - traceRecords : 0; }
+  // Copies the record at position, false once it has been overwritten
+  bool read(uint32_t position, TraceRecord& record) const;
+
+private:
+  void mirror(const TraceRecord& record, uint32_t position);
+
+  std::atomic<uint32_t> _head{0};
+  TraceRecord _records[traceRecords];
+};
+
+// Closes a span when it goes out of scope, see TRACE_SCOPE
+class TraceScope {
+public:
+  TraceScope(TraceBuffer& buffer, uint16_t event, uint32_t a) : _buffer(buffer), _event(event), _a(a) {
+    _buffer.record(event, a, 0);
+  }
+  ~TraceScope() { _buffer.record(_event | traceEnd, _a, 0); }
+
+private:
+  TraceBuffer& _buffer;
+  uint16_t _event;
+  uint32_t _a;
+};
+
+#ifdef KIRBY_TRACE
+extern TraceBuffer Trace;
+
+#define TRACE(event, a, b) Trace.record((event), (uint32_t) (a), (uint32_t) (b))
+#define TRACE_BEGIN(event, a, b) TRACE((event), (a), (b))
+#define TRACE_END(event, a, b) TRACE((event) | traceEnd, (a), (b))
+#define TRACE_CONCAT2(x, y) x##y
+#define TRACE_CONCAT(x, y) TRACE_CONCAT2(x, y)
+// Span from here to the end of the enclosing block
+#define TRACE_SCOPE(event, a) TraceScope TRACE_CONCAT(traceScope, __LINE__)(Trace, (event), (uint32_t) (a))
+#else
+#define TRACE(event, a, b) do {} while (0)
+#define TRACE_BEGIN(event, a, b) do {} while (0)
+#define TRACE_END(event, a, b) do {} while (0)
+#define TRACE_SCOPE(event, a) do {} while (0)
+#endif
+
+#endif //TRACE_BUFFER
@@ -0,0 +1,161 @@
+#include "WallClock.h"
+
+static const int64_t nano = 1000000000LL;
+// 1900-01-01 to 1970-01-01
+static const int64_t ntpUnixOffsetS = 2208988800LL;
+
+// Rounds towards minus infinity, so the residual stays within [0, 1e9)
+static inline int64_t floorDiv(int64_t value, int64_t divisor) {
+  int64_t quotient = value / divisor;
+  return (value % divisor < 0) ? quotient - 1 : quotient;
+}
+
+static inline int32_t clampPpb(int64_t ppb, int32_t limit) {
+  return ppb > limit ? limit : ppb < -limit ? -limit : (int32_t) ppb;
+}
+
+int64_t WallClock::unixMs(uint32_t ms) const {
+  if (!_valid) {
+    return 0;
+  }
+  int32_t elapsed = (int32_t)(ms - _anchorMs);
+  // one division for drift and slew together: with both rates summed below
+  // 1e9 ppb the result never goes backwards as ms goes forwards
+  int64_t slewed = elapsed <= 0 ? 0 : min((uint32_t) elapsed, _slewMs);
+  int64_t correction = _residual + (int64_t) elapsed * _driftPpb + slewed * _slewPpb;
+  return _anchorUnixMs + elapsed + floorDiv(correction, nano);
+}
+
+void WallClock::anchor(uint32_t ms) {
+  int32_t elapsed = (int32_t)(ms - _anchorMs);
+  if (elapsed <= 0) {
+    return;
+  }
+  uint32_t slewed = min((uint32_t) elapsed, _slewMs);
+  int64_t correction = _residual + (int64_t) elapsed * _driftPpb + (int64_t) slewed * _slewPpb;
+  int64_t whole = floorDiv(correction, nano);
+  _anchorUnixMs += elapsed + whole;
+  _residual = correction - whole * nano;
+  _anchorMs = ms;
+  _slewMs -= slewed;
+}
+
+WallClockSync WallClock::sync(int64_t serverUnixMs, uint32_t atMs, uint32_t nextSyncMs) {
+  int64_t offset = _valid ? serverUnixMs - unixMs(atMs) : 0;
+  _offsetMs = offset > INT32_MAX ? INT32_MAX : offset < INT32_MIN ? INT32_MIN : (int32_t) offset;
+  uint32_t interval = atMs - _lastSyncMs;
+  bool hadSync = synced();
+  _syncs++;
+  _lastSyncMs = atMs;
+
+  if (!_valid || offset >= wallClockStepMs || offset <= -wallClockStepMs) {
+    if (_valid) {
+      _steps++;
+    }
+    _valid = true;
+    _anchorUnixMs = serverUnixMs;
+    _anchorMs = atMs;
+    _residual = 0;
+    _slewMs = 0;
+    return WALL_CLOCK_STEPPED;
+  }
+
+  anchor(atMs);
+  if (hadSync && interval >= wallClockDriftMinMs) {
+    // what the slew has yet to correct is no rate error
+    int64_t pending = floorDiv((int64_t) _slewMs * _slewPpb, nano);
+    int64_t errorPpb = (offset - pending) * nano / interval;
+    _driftPpb = clampPpb(_driftPpb + errorPpb / 4, wallClockDriftMaxPpb);
+  }
+  // the new slew replaces what is left of the old one, the offset includes it
+  uint32_t window = max(nextSyncMs, (uint32_t) 1000);
+  int64_t slewPpb = offset * nano / window;
+  if (slewPpb > wallClockSlewMaxPpb || slewPpb < -wallClockSlewMaxPpb) {
+    slewPpb = slewPpb > 0 ? wallClockSlewMaxPpb : -wallClockSlewMaxPpb;
+    window = (uint32_t)((offset < 0 ? -offset : offset) * nano / wallClockSlewMaxPpb);
+  }
+  _slewPpb = slewPpb;
+  _slewMs = window;
+  return WALL_CLOCK_SLEWED;
+}
+
+void WallClock::tick(uint32_t nowMs) {
+  if (_valid && nowMs - _anchorMs >= wallClockReanchorMs) {
+    anchor(nowMs);
+  }
+}
+
+WallClockState WallClock::snapshot(uint32_t nowMs) const {
+  return {unixMs(nowMs), _driftPpb, _syncs};
+}
+
+void WallClock::restore(const WallClockState& state, uint32_t elapsedMs, uint32_t atMs) {
+  _valid = true;
+  _restored = true;
+  _anchorUnixMs = state.unixMs + elapsedMs;
+  _anchorMs = atMs;
+  _residual = 0;
+  _driftPpb = clampPpb(state.driftPpb, wallClockDriftMaxPpb);
+  _slewMs = 0;
+}
+
+////////////////////////////////
+// SNTP
+
+static void writeBigEndian64(uint8_t* out, uint64_t value) {
+  for (int8_t i = 7; i >= 0; i--) {
+    out[i] = value & 0xff;
+    value >>= 8;
+  }
+}
+
+static uint32_t readBigEndian32(const uint8_t* in) {
+  return ((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16) | ((uint32_t) in[2] << 8) | in[3];
+}
+
+// An NTP timestamp as Unix ms. With the top bit of the seconds clear it is
+// from the era after 2036-02-07 (RFC 4330, section 3).
+static int64_t ntpToUnixMs(const uint8_t* timestamp) {
+  uint32_t seconds = readBigEndian32(timestamp);
+  uint32_t fraction = readBigEndian32(timestamp + 4);
+  int64_t unixS = (int64_t) seconds + ((seconds & 0x80000000) ? 0 : 0x100000000LL) - ntpUnixOffsetS;
+  return unixS * 1000 + (int64_t)(((uint64_t) fraction * 1000 + 0x80000000) >> 32);
+}
+
+void sntpRequest(uint8_t packet[sntpPacketSize], uint64_t nonce) {
+  memset(packet, 0, sntpPacketSize);
+  packet[0] = (4 << 3) | 3;  // no leap warning, version 4, client
+  writeBigEndian64(packet + 40, nonce);
+}
+
+bool sntpReply(const uint8_t* packet, size_t length, uint64_t nonce, uint32_t sentMs, uint32_t receivedMs,
+               int64_t& serverUnixMs, uint32_t& delayMs) {
+  if (length < sntpPacketSize) {
+    return false;
+  }
+  uint8_t leap = packet[0] >> 6;
+  uint8_t mode = packet[0] & 7;
+  uint8_t stratum = packet[1];
+  // stratum 0 is a kiss-o'-death, e.g. RATE: ask less often
+  if (mode != 4 || leap == 3 || stratum == 0 || stratum > 15) {
+    return false;
+  }
+  uint8_t expected[8];
+  writeBigEndian64(expected, nonce);
+  if (memcmp(packet + 24, expected, sizeof(expected)) != 0) {
+    return false;
+  }
+  if (readBigEndian32(packet + 40) == 0 && readBigEndian32(packet + 44) == 0) {
+    return false;
+  }
+  int64_t received = ntpToUnixMs(packet + 32);
+  int64_t transmitted = ntpToUnixMs(packet + 40);
+  uint32_t roundTrip = receivedMs - sentMs;
+  int64_t processing = transmitted - received;
+  if (processing < 0 || processing > roundTrip) {
+    processing = 0;
+  }
+  delayMs = roundTrip - (uint32_t) processing;
+  serverUnixMs = transmitted + (delayMs + 1) / 2;
+  return true;
+}
@@ -0,0 +1,122 @@
+#ifndef WALL_CLOCK
+#define WALL_CLOCK
+
+#include "Arduino.h"
+
+/*
+   Wall clock time (Unix milliseconds) for the instants the firmware keeps as
+   millis(): a sample is stamped with millis() when it is taken and mapped to
+   the wall clock when it is exported, with whatever the clock knows by then.
+
+   The mapping is linear from an anchor, a millis() instant and its Unix time:
+
+     unix = anchorUnix + elapsed + elapsed * driftPpb / 1e9
+
+   driftPpb is how much faster the wall clock runs than the crystal behind
+   millis(). It is learned from the server exchanges (a frequency locked
+   loop): an offset that built up over the interval since the previous
+   exchange is a rate error, a quarter of it goes into the drift.
+
+   The offset itself is slewed, not stepped: an extra rate removes it over
+   the next poll interval, at most wallClockSlewMaxPpb. Timestamps therefore
+   never go backwards, which Prometheus would reject. Only the first time, or
+   when the clock is off by wallClockStepMs or more, is it stepped.
+
+   A snapshot (the time now and the drift) survives a soft reset in RTC
+   memory, see ClockTask in src/main.cpp, so the clock is valid right after
+   boot, before the network is up. synced() tells whether a server confirmed
+   it since.
+
+   SNTP (RFC 4330) messages are built and checked here as well, the UDP
+   exchange is the caller's.
+*/
+
+const int32_t wallClockDriftMaxPpb = 500000;  // a crystal beyond 500 ppm is broken
+const int32_t wallClockSlewMaxPpb = 500000;
+const int32_t wallClockStepMs = 1000;
+const uint32_t wallClockDriftMinMs = 30000;   // shorter intervals leave the drift alone
+const uint32_t wallClockReanchorMs = 86400000; // elapsed stays well within int32
+
+// What survives a reset, see WallClock::snapshot()
+struct WallClockState {
+  int64_t unixMs;
+  int32_t driftPpb;
+  uint32_t syncs;  // of the clock this one was restored from
+};
+
+// Outcome of WallClock::sync()
+enum WallClockSync : uint8_t {
+  WALL_CLOCK_SLEWED,
+  WALL_CLOCK_STEPPED
+};
+
+class WallClock {
+public:
+  // Has a time, from a server or restored
+  bool valid() const { return _valid; }
+  // A server confirmed it since boot
+  bool synced() const { return _syncs > 0; }
+
+  // Unix time in ms of a millis() instant, 0 while the clock is not valid.
+  // Instants up to 24 days either side of the anchor map correctly.
+  int64_t unixMs(uint32_t ms) const;
+
+  // The server's clock read serverUnixMs at our millis() atMs, the next
+  // sync follows in about nextSyncMs: the offset is slewed away until then
+  WallClockSync sync(int64_t serverUnixMs, uint32_t atMs, uint32_t nextSyncMs);
+  // Moves the anchor along, call at least daily
+  void tick(uint32_t nowMs);
+
+  WallClockState snapshot(uint32_t nowMs) const;
+  // A snapshot taken elapsedMs before millis() read atMs
+  void restore(const WallClockState& state, uint32_t elapsedMs, uint32_t atMs);
+
+  // Server minus clock at the last sync, before it was corrected
+  int32_t offsetMs() const { return _offsetMs; }
+  int32_t driftPpb() const { return _driftPpb; }
+  // Extra rate that removes the last offset, 0 once it is gone
+  int32_t slewPpb() const { return _slewMs ? _slewPpb : 0; }
+  uint32_t syncs() const { return _syncs; }
+  uint32_t steps() const { return _steps; }
+  // millis() of the last sync
+  uint32_t lastSyncMs() const { return _lastSyncMs; }
+  bool restored() const { return _restored; }
+
+private:
+  void anchor(uint32_t ms);
+
+  bool _valid = false;
+  bool _restored = false;
+  int64_t _anchorUnixMs = 0;
+  uint32_t _anchorMs = 0;
+  int64_t _residual = 0;   // of the correction at the anchor, in 1e-9 ms
+  int32_t _driftPpb = 0;
+  int32_t _slewPpb = 0;
+  uint32_t _slewMs = 0;    // slew left after the anchor
+  int32_t _offsetMs = 0;
+  uint32_t _syncs = 0;
+  uint32_t _steps = 0;
+  uint32_t _lastSyncMs = 0;
+};
+
+////////////////////////////////
+// SNTP
+
+const uint8_t sntpPacketSize = 48;
+const uint16_t sntpPort = 123;
+
+// A client request; nonce goes out as the transmit timestamp and must come
+// back as the originate timestamp of the reply
+void sntpRequest(uint8_t packet[sntpPacketSize], uint64_t nonce);
+
+/*
+   Checks a reply to the request with nonce: a server (mode 4) that is
+   synchronized (leap indicator not 3, stratum 1..15) answering our request.
+   The request went out at sentMs and the reply was read at receivedMs. Gives
+   the server's time at receivedMs, half the network delay after its transmit
+   timestamp, and the round trip without the server's processing time.
+*/
+bool sntpReply(const uint8_t* packet, size_t length, uint64_t nonce, uint32_t sentMs, uint32_t receivedMs,
+               int64_t& serverUnixMs, uint32_t& delayMs);
+
+#endif //WALL_CLOCK
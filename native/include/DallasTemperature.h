@@ -0,0 +1,42 @@
+// Host shim for DallasTemperature, probes report whatever the host sets
+#ifndef KIRBY_NATIVE_DALLASTEMPERATURE_H
+#define KIRBY_NATIVE_DALLASTEMPERATURE_H
+
+#include <stdint.h>
+#include "OneWire.h"
+
+#define DEVICE_DISCONNECTED_C -127
+#define DEVICE_DISCONNECTED_RAW -7040
+
+typedef uint8_t DeviceAddress[8];
+
+class DallasTemperature {
+public:
+    explicit DallasTemperature(OneWire *wire) { (void) wire; }
+    void begin() {}
+    uint8_t getDeviceCount();
+    bool getAddress(uint8_t *address, uint8_t index);
+    bool setResolution(uint8_t resolution) { _resolution = resolution; return true; }
+    uint8_t getResolution() { return _resolution; }
+    void setWaitForConversion(bool wait) { _wait = wait; }
+    bool getWaitForConversion() { return _wait; }
+    uint16_t millisToWaitForConversion(uint8_t resolution);
+    bool isConversionComplete();
+    void requestTemperatures();
+    bool requestTemperaturesByIndex(uint8_t index) { (void) index; requestTemperatures(); return true; }
+    int32_t getTemp(const uint8_t *address);
+    float getTempC(const uint8_t *address) { return getTemp(address) / 128.0f; }
+    float getTempCByIndex(uint8_t index);
+    float getTempFByIndex(uint8_t index) { return getTempCByIndex(index) * 1.8f + 32.0f; }
+
+private:
+    uint8_t _resolution = 12;
+    bool _wait = true;
+    unsigned long _requestedAt = 0;
+};
+
+// Host-only: the temperature each probe reports, in 1/128 °C like DallasTemperature::getTemp()
+void nativeSetProbeRaw(uint8_t index, int32_t raw);
+void nativeSetProbeCount(uint8_t count);
+
+#endif // KIRBY_NATIVE_DALLASTEMPERATURE_H
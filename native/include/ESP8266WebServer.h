@@ -0,0 +1,152 @@
+// Host shim for ESP8266WebServer: one request per connection over a real socket
+#ifndef KIRBY_NATIVE_ESP8266WEBSERVER_H
+#define KIRBY_NATIVE_ESP8266WEBSERVER_H
+
+#include <functional>
+#include <vector>
+#include "ESP8266WiFi.h"
+#include "FS.h"
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+#define HTTP_UPLOAD_BUFLEN 2048
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#define CONTENT_LENGTH_NOT_SET ((size_t) -2)
+
+typedef struct {
+    HTTPUploadStatus status;
+    String filename;
+    String name;
+    String type;
+    size_t totalSize;
+    size_t currentSize;
+    uint8_t buf[HTTP_UPLOAD_BUFLEN];
+} HTTPUpload;
+
+namespace mime {
+enum type { html, htm, txt, css, js, json, png, gif, jpg, jpeg, ico, svg, ttf, otf, woff, woff2, eot, sfnt, xml, pdf, zip, gz, appcache, none, maxType };
+struct Entry {
+    const char *endsWith;
+    const char *mimeType;
+};
+extern const Entry mimeTable[maxType];
+String getContentType(const String &filename);
+}
+
+class ESP8266WebServer {
+public:
+    typedef std::function<void(void)> THandlerFunction;
+    typedef std::function<String(const char *)> ContentTypeFunction;
+    enum ClientFuture { CLIENT_REQUEST_CAN_CONTINUE, CLIENT_REQUEST_IS_HANDLED, CLIENT_MUST_STOP, CLIENT_IS_GIVEN };
+    typedef std::function<ClientFuture(const String &method, const String &url, WiFiClient *client, ContentTypeFunction contentType)> HookFunction;
+
+    explicit ESP8266WebServer(int port = 80) : _server(port) {}
+
+    void begin() { _server.begin(); }
+    void begin(uint16_t port) { _server.begin(port); }
+    void close() { _server.close(); }
+    void stop() { close(); }
+    void handleClient();
+
+    void on(const String &uri, THandlerFunction handler) { on(uri, HTTP_ANY, handler); }
+    void on(const String &uri, HTTPMethod method, THandlerFunction fn) { on(uri, method, fn, nullptr); }
+    void on(const String &uri, HTTPMethod method, THandlerFunction fn, THandlerFunction ufn);
+    void onNotFound(THandlerFunction fn) { _notFound = fn; }
+    void onFileUpload(THandlerFunction ufn) { _fileUpload = ufn; }
+    void addHook(HookFunction hook) { _hooks.push_back(hook); }
+
+    const String &uri() const { return _uri; }
+    HTTPMethod method() const { return _method; }
+    WiFiClient &client() { return _client; }
+    HTTPUpload &upload() { return _upload; }
+
+    const String &arg(const String &name) const;
+    const String &arg(int i) const;
+    const String &argName(int i) const;
+    int args() const { return (int) _args.size(); }
+    bool hasArg(const String &name) const;
+    void collectHeaders(const char *headerKeys[], const size_t headerKeysCount);
+    const String &header(const String &name) const;
+    bool hasHeader(const String &name) const;
+    const String &hostHeader() const { return header("Host"); }
+
+    void send(int code, const char *content_type = nullptr, const String &content = String(""));
+    void send(int code, const String &content_type, const String &content) { send(code, content_type.c_str(), content); }
+    void send(int code, const __FlashStringHelper *content_type, const String &content) { send(code, reinterpret_cast<const char *>(content_type), content); }
+    void send(int code, const char *content_type, const char *content) { send(code, content_type, content, strlen(content)); }
+    void send(int code, const __FlashStringHelper *content_type, const char *content) { send(code, reinterpret_cast<const char *>(content_type), content); }
+    void send(int code, const char *content_type, const char *content, size_t contentLength);
+    void send(int code, const __FlashStringHelper *content_type, const char *content, size_t contentLength) { send(code, reinterpret_cast<const char *>(content_type), content, contentLength); }
+    void send_P(int code, PGM_P content_type, PGM_P content) { send(code, content_type, content); }
+    void send_P(int code, PGM_P content_type, PGM_P content, size_t contentLength) { send(code, content_type, content, contentLength); }
+    void sendHeader(const String &name, const String &value, bool first = false);
+    void setContentLength(const size_t contentLength) { _contentLength = contentLength; }
+    void sendContent(const String &content) { sendContent(content.c_str(), content.length()); }
+    void sendContent(const char *content, size_t size);
+    void sendContent_P(PGM_P content) { sendContent(content, strlen(content)); }
+    void sendContent_P(PGM_P content, size_t size) { sendContent(content, size); }
+    bool chunkedResponseModeStart(int code, const char *contentType);
+    bool chunkedResponseModeStart(int code, const String &contentType) { return chunkedResponseModeStart(code, contentType.c_str()); }
+    void chunkedResponseFinalize();
+
+    template <typename T>
+    size_t streamFile(T &file, const String &contentType, HTTPMethod requestMethod = HTTP_GET) {
+        setContentLength(file.size());
+        if (String(file.name()).endsWith(".gz") && contentType != "application/x-gzip" && contentType != "application/octet-stream") {
+            sendHeader(F("Content-Encoding"), F("gzip"));
+        }
+        send(200, contentType.c_str(), "", 0);
+        if (requestMethod == HTTP_HEAD) {
+            return 0;
+        }
+        uint8_t buf[1024];
+        size_t sent = 0;
+        size_t n;
+        while ((n = file.read(buf, sizeof(buf))) > 0) {
+            sent += _client.write(buf, n);
+        }
+        return sent;
+    }
+
+    static String urlDecode(const String &text);
+
+private:
+    struct Route {
+        String uri;
+        HTTPMethod method;
+        THandlerFunction fn;
+        THandlerFunction ufn;
+    };
+    struct Arg {
+        String key;
+        String value;
+    };
+
+    bool parseRequest();
+    const Route *findRoute() const;
+    void parseArgs(const String &data);
+    bool parseMultipart(const String &boundary, size_t length);
+    void sendHeaders(int code, const char *contentType, size_t contentLength);
+    void reset();
+
+    WiFiServer _server;
+    WiFiClient _client;
+    std::vector<Route> _routes;
+    std::vector<HookFunction> _hooks;
+    THandlerFunction _notFound;
+    THandlerFunction _fileUpload;
+    String _uri;
+    HTTPMethod _method = HTTP_GET;
+    std::vector<Arg> _args;
+    std::vector<Arg> _headers;
+    std::vector<Arg> _responseHeaders;
+    HTTPUpload _upload;
+    size_t _contentLength = CONTENT_LENGTH_NOT_SET;
+    bool _chunked = false;
+    bool _headersSent = false;
+    bool _http11 = false;
+    const Route *_route = nullptr;
+};
+
+#endif // KIRBY_NATIVE_ESP8266WEBSERVER_H
@@ -0,0 +1,86 @@
+// Host shim for the ESP8266 Wi-Fi station; the host network is always "associated"
+#ifndef KIRBY_NATIVE_ESP8266WIFI_H
+#define KIRBY_NATIVE_ESP8266WIFI_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "WiFiClient.h"
+#include "WiFiServer.h"
+#include "WiFiUdp.h"
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_WRONG_PASSWORD = 6,
+    WL_DISCONNECTED = 7
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } WiFiMode_t;
+typedef enum { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 } WiFiSleepType_t;
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+class ESP8266WiFiClass {
+public:
+    void persistent(bool persistent) { (void) persistent; }
+    bool mode(WiFiMode_t mode) { _mode = mode; return true; }
+    WiFiMode_t getMode() { return _mode; }
+    bool hostname(const char *name) { _hostname = name; return true; }
+    String hostname() { return _hostname; }
+    bool setAutoReconnect(bool autoReconnect) { (void) autoReconnect; return true; }
+    bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0) { (void) listenInterval; _sleep = type; return true; }
+    WiFiSleepType_t getSleepMode() { return _sleep; }
+    bool forceSleepBegin(uint32_t sleepUs = 0) { (void) sleepUs; return true; }
+    bool forceSleepWake() { return true; }
+
+    wl_status_t begin(const char *ssid, const char *passphrase = nullptr, int32_t channel = 0, const uint8_t *bssid = nullptr, bool connect = true);
+    bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1 = (uint32_t) 0, IPAddress dns2 = (uint32_t) 0);
+    bool disconnect(bool wifioff = false);
+    bool reconnect() { return true; }
+    wl_status_t status() { return _status; }
+    bool isConnected() { return _status == WL_CONNECTED; }
+
+    int8_t scanNetworks(bool async = false, bool show_hidden = false);
+    int8_t scanComplete() { return _scanned; }
+    void scanDelete() { _scanned = WIFI_SCAN_FAILED; }
+    String SSID(uint8_t networkItem);
+    String SSID() const { return _ssid; }
+    int32_t RSSI(uint8_t networkItem) { (void) networkItem; return -50; }
+    int32_t RSSI() { return -50; }
+    uint8_t *BSSID(uint8_t networkItem) { (void) networkItem; return _bssid; }
+    uint8_t *BSSID() { return _bssid; }
+    int32_t channel(uint8_t networkItem) { (void) networkItem; return 1; }
+    int32_t channel() { return 1; }
+
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    IPAddress gatewayIP() { return IPAddress(127, 0, 0, 1); }
+    IPAddress subnetMask() { return IPAddress(255, 0, 0, 0); }
+    IPAddress dnsIP(uint8_t dns_no = 0) { (void) dns_no; return IPAddress(127, 0, 0, 1); }
+    String macAddress() { return String("02:00:00:00:00:01"); }
+    int hostByName(const char *aHostname, IPAddress &aResult);
+    int hostByName(const char *aHostname, IPAddress &aResult, uint32_t timeout_ms) { (void) timeout_ms; return hostByName(aHostname, aResult); }
+
+    // Host-only: networks reported by the next scan, to exercise SSID selection
+    void nativeSetVisibleNetworks(const char *ssid1, const char *ssid2) { _visible[0] = ssid1; _visible[1] = ssid2; }
+    // Host-only: lease time the next DHCP address comes with
+    void nativeSetLeaseS(uint32_t seconds);
+
+private:
+    WiFiMode_t _mode = WIFI_OFF;
+    WiFiSleepType_t _sleep = WIFI_NONE_SLEEP;
+    wl_status_t _status = WL_DISCONNECTED;
+    int8_t _scanned = WIFI_SCAN_FAILED;
+    String _hostname;
+    String _ssid;
+    const char *_visible[2] = {nullptr, nullptr};
+    uint8_t _bssid[6] = {0x02, 0, 0, 0, 0, 1};
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif // KIRBY_NATIVE_ESP8266WIFI_H
@@ -0,0 +1,17 @@
+// Host shim for mDNS, responding is left to the host's own resolver
+#ifndef KIRBY_NATIVE_ESP8266MDNS_H
+#define KIRBY_NATIVE_ESP8266MDNS_H
+
+#include "Arduino.h"
+
+class MDNSResponder {
+public:
+    bool begin(const char *hostName) { (void) hostName; return true; }
+    bool addService(const char *service, const char *proto, uint16_t port) { (void) service; (void) proto; (void) port; return true; }
+    bool addServiceTxt(const char *service, const char *proto, const char *key, const char *value) { (void) service; (void) proto; (void) key; (void) value; return true; }
+    bool update() { return true; }
+};
+
+extern MDNSResponder MDNS;
+
+#endif // KIRBY_NATIVE_ESP8266MDNS_H
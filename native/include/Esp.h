@@ -0,0 +1,33 @@
+// Host shim for the ESP object of the ESP8266 core
+#ifndef KIRBY_NATIVE_ESP_H
+#define KIRBY_NATIVE_ESP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "WString.h"
+
+class EspClass {
+public:
+    uint32_t getFreeHeap();
+    uint8_t getHeapFragmentation();
+    uint32_t getMaxFreeBlockSize();
+    void getHeapStats(uint32_t *free, uint32_t *max, uint8_t *frag);
+    uint32_t getFreeContStack();
+    void resetFreeContStack();
+    uint32_t getCycleCount();
+    uint32_t getChipId() { return 0x00c0ffee; }
+    uint8_t getCpuFreqMHz() { return 80; }
+    uint32_t random() { return (uint32_t) ::random(); }
+    uint32_t getSketchSize() { return 0; }
+    uint32_t getFreeSketchSpace() { return 0x3c000; }
+    String getResetReason() { return String("Power On"); }
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+    void restart();
+    void reset() { restart(); }
+};
+
+extern EspClass ESP;
+
+#endif // KIRBY_NATIVE_ESP_H
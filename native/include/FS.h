@@ -0,0 +1,132 @@
+// Host shim for the ESP8266 FS API, backed by a directory on the host
+#ifndef KIRBY_NATIVE_FS_H
+#define KIRBY_NATIVE_FS_H
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+struct FSInfo {
+    size_t totalBytes;
+    size_t usedBytes;
+    size_t blockSize;
+    size_t pageSize;
+    size_t maxOpenFiles;
+    size_t maxPathLength;
+};
+
+struct FSStats {
+    uint32_t writeCalls;
+    uint32_t bytesWritten;
+};
+
+class File : public Stream {
+public:
+    File() {}
+    // a directory has no FILE, and shared_ptr would hand the null to fclose()
+    File(FILE *fp, const String &path, bool dir) : _fp(fp ? std::shared_ptr<FILE>(fp, fclose) : nullptr), _path(path), _dir(dir) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t *buf, size_t size);
+    void flush() override { if (_fp) fflush(_fp.get()); }
+    bool seek(uint32_t pos, SeekMode mode = SeekSet) { return _fp && fseek(_fp.get(), pos, mode) == 0; }
+    size_t position() const { return _fp ? ftell(_fp.get()) : 0; }
+    size_t size() const;
+    void close() { _fp.reset(); _dir = false; }
+    operator bool() const { return _fp || _dir; }
+    const char *name() const;
+    const char *fullName() const { return _path.c_str(); }
+    bool isFile() const { return (bool) _fp; }
+    bool isDirectory() const { return _dir; }
+
+private:
+    std::shared_ptr<FILE> _fp;
+    String _path;
+    bool _dir = false;
+};
+
+class Dir {
+public:
+    Dir() {}
+    Dir(const String &path, std::vector<std::string> entries, const std::string &root) : _path(path), _entries(entries), _root(root) {}
+    bool next() { return ++_index < (int) _entries.size(); }
+    String fileName() const { return String(_entries[_index].c_str()); }
+    size_t fileSize() const;
+    bool isFile() const { return !isDirectory(); }
+    bool isDirectory() const;
+    File openFile(const char *mode);
+    bool rewind() { _index = -1; return true; }
+
+private:
+    std::string hostPath() const;
+    String _path;
+    std::vector<std::string> _entries;
+    std::string _root;
+    int _index = -1;
+};
+
+class FSConfig {
+public:
+    FSConfig &setAutoFormat(bool val = true) { _autoFormat = val; return *this; }
+    bool _autoFormat = true;
+};
+
+class FS {
+public:
+    FS() {}
+    void setRoot(const char *root) { _root = root; }
+    const std::string &root() const { return _root; }
+    bool setConfig(const FSConfig &cfg) { (void) cfg; return true; }
+    bool begin();
+    void end() {}
+    bool format();
+    bool info(FSInfo &info);
+
+    File open(const char *path, const char *mode);
+    File open(const String &path, const char *mode) { return open(path.c_str(), mode); }
+    bool exists(const char *path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+    Dir openDir(const char *path);
+    Dir openDir(const String &path) { return openDir(path.c_str()); }
+    bool remove(const char *path);
+    bool remove(const String &path) { return remove(path.c_str()); }
+    bool rename(const char *pathFrom, const char *pathTo);
+    bool rename(const String &pathFrom, const String &pathTo) { return rename(pathFrom.c_str(), pathTo.c_str()); }
+    bool mkdir(const char *path);
+    bool mkdir(const String &path) { return mkdir(path.c_str()); }
+    bool rmdir(const char *path);
+    bool rmdir(const String &path) { return rmdir(path.c_str()); }
+
+    // Write counters, so upload paths can be measured on the host
+    FSStats stats() const;
+    void resetStats();
+
+private:
+    std::string hostPath(const char *path) const;
+    std::string _root = "data";
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+using fs::Dir;
+using fs::FSInfo;
+using fs::FSConfig;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif // KIRBY_NATIVE_FS_H
@@ -0,0 +1,22 @@
+// Host shim for the ESP8266 UART, writes to stdout
+#ifndef KIRBY_NATIVE_HARDWARESERIAL_H
+#define KIRBY_NATIVE_HARDWARESERIAL_H
+
+#include "Stream.h"
+
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long baud) { (void) baud; }
+    void setDebugOutput(bool enable) { (void) enable; }
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override;
+};
+
+extern HardwareSerial Serial;
+
+#endif // KIRBY_NATIVE_HARDWARESERIAL_H
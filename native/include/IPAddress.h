@@ -0,0 +1,23 @@
+// Host shim for IPAddress (IPv4 only)
+#ifndef KIRBY_NATIVE_IPADDRESS_H
+#define KIRBY_NATIVE_IPADDRESS_H
+
+#include <stdint.h>
+#include "WString.h"
+
+class IPAddress {
+public:
+    IPAddress() : _addr(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _addr(a | (b << 8) | (c << 16) | ((uint32_t) d << 24)) {}
+    IPAddress(uint32_t addr) : _addr(addr) {}
+    operator uint32_t() const { return _addr; }
+    uint8_t operator[](int index) const { return (_addr >> (index * 8)) & 0xff; }
+    bool isSet() const { return _addr != 0; }
+    bool fromString(const char *address);
+    String toString() const;
+
+private:
+    uint32_t _addr;
+};
+
+#endif // KIRBY_NATIVE_IPADDRESS_H
@@ -0,0 +1,12 @@
+// Host shim for LittleFS, the filesystem lives in a host directory (see native_main.cpp)
+#ifndef KIRBY_NATIVE_LITTLEFS_H
+#define KIRBY_NATIVE_LITTLEFS_H
+
+#include "FS.h"
+
+class LittleFSConfig : public fs::FSConfig {
+};
+
+extern fs::FS LittleFS;
+
+#endif // KIRBY_NATIVE_LITTLEFS_H
@@ -0,0 +1,29 @@
+// Host shim for the core's MD5Builder
+#ifndef KIRBY_NATIVE_MD5BUILDER_H
+#define KIRBY_NATIVE_MD5BUILDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "WString.h"
+
+class MD5Builder {
+public:
+    void begin();
+    void add(const uint8_t *data, uint16_t len);
+    void add(const char *data) { add(reinterpret_cast<const uint8_t *>(data), strlen(data)); }
+    void calculate();
+    void getBytes(uint8_t *output) const;
+    void getChars(char *output) const;
+    String toString() const;
+
+private:
+    void transform(const uint8_t *block);
+
+    uint32_t _state[4];
+    uint64_t _length;
+    uint8_t _buffer[64];
+    uint8_t _digest[16];
+};
+
+#endif // KIRBY_NATIVE_MD5BUILDER_H
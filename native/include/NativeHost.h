@@ -0,0 +1,39 @@
+// Controls of the native build that only exist on the host: options from the
+// command line, a virtual clock for simulations and access to the "hardware"
+#ifndef KIRBY_NATIVE_HOST_H
+#define KIRBY_NATIVE_HOST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct NativeOptions {
+    uint16_t httpPort;   // replaces port 80, 0 runs without a listening socket
+    const char *fsRoot;  // host directory LittleFS is mapped to
+    const char *ssids[4];
+    uint8_t ssidCount;
+};
+
+extern NativeOptions nativeOptions;
+
+// Parse --port, --fs and --ssid, returns false on unknown arguments
+bool nativeParseArgs(int argc, char **argv);
+
+// Virtual time: millis()/micros() only move when advanced and delay() returns
+// immediately after advancing the clock, so simulations run as fast as the CPU
+void nativeUseVirtualTime(bool enable);
+bool nativeVirtualTime();
+void nativeAdvanceMicros(uint64_t us);
+uint64_t nativeMicros64();
+
+// Where Serial output goes, nullptr drops it
+void nativeSerialTo(FILE *out);
+
+// Last level written to a pin; analogWrite() values are scaled to 0..range
+int nativePinValue(uint8_t pin);
+bool nativePinIsAnalog(uint8_t pin);
+uint32_t nativeAnalogRange();
+uint32_t nativeAnalogWrites();
+void nativeSetPinInput(uint8_t pin, int value);
+void nativeTriggerInterrupt(uint8_t pin);
+
+#endif // KIRBY_NATIVE_HOST_H
@@ -0,0 +1,15 @@
+// Host shim for OneWire, the bus itself is not modelled
+#ifndef KIRBY_NATIVE_ONEWIRE_H
+#define KIRBY_NATIVE_ONEWIRE_H
+
+#include <stdint.h>
+
+class OneWire {
+public:
+    explicit OneWire(uint8_t pin) : _pin(pin) {}
+
+private:
+    uint8_t _pin;
+};
+
+#endif // KIRBY_NATIVE_ONEWIRE_H
@@ -0,0 +1,42 @@
+// Host shim for Arduino Print
+#ifndef KIRBY_NATIVE_PRINT_H
+#define KIRBY_NATIVE_PRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "WString.h"
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return str ? write((const uint8_t *) str, strlen(str)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *) buffer, size); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const __FlashStringHelper *s) { return write(reinterpret_cast<const char *>(s)); }
+    size_t print(const String &s) { return write(s.c_str(), s.length()); }
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(unsigned char n, int base = 10) { return print((unsigned long) n, base); }
+    size_t print(int n, int base = 10) { return print((long) n, base); }
+    size_t print(unsigned int n, int base = 10) { return print((unsigned long) n, base); }
+    size_t print(long n, int base = 10) { return print(String(n, (unsigned char) base)); }
+    size_t print(unsigned long n, int base = 10) { return print(String(n, (unsigned char) base)); }
+    size_t print(long long n) { return print(String(n)); }
+    size_t print(unsigned long long n) { return print(String(n)); }
+    size_t print(double n, int digits = 2) { return print(String(n, (unsigned char) digits)); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T &v) { size_t n = print(v); return n + println(); }
+    template <typename T>
+    size_t println(const T &v, int arg) { size_t n = print(v, arg); return n + println(); }
+    size_t println(const char *s) { size_t n = print(s); return n + println(); }
+    size_t println(const __FlashStringHelper *s) { size_t n = print(s); return n + println(); }
+
+    virtual void flush() {}
+};
+
+#endif // KIRBY_NATIVE_PRINT_H
@@ -0,0 +1,22 @@
+// Host shim for Arduino Stream
+#ifndef KIRBY_NATIVE_STREAM_H
+#define KIRBY_NATIVE_STREAM_H
+
+#include "Print.h"
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *) buffer, length); }
+    String readStringUntil(char terminator);
+    String readString();
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+
+protected:
+    unsigned long _timeout = 1000;
+};
+
+#endif // KIRBY_NATIVE_STREAM_H
@@ -0,0 +1,51 @@
+// Host shim for the core's Updater: a simulated flash partition. Writes must
+// land on erased bytes like on the chip, a committed image is saved to
+// kirby-update-firmware.bin or kirby-update-filesystem.bin in the working directory.
+#ifndef KIRBY_NATIVE_UPDATER_H
+#define KIRBY_NATIVE_UPDATER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include "Print.h"
+
+#define U_FLASH 0
+#define U_FS 100
+
+#define UPDATE_ERROR_OK 0
+#define UPDATE_ERROR_WRITE 1
+#define UPDATE_ERROR_SPACE 4
+#define UPDATE_ERROR_SIZE 5
+#define UPDATE_ERROR_BOOTSTRAP 11
+
+class UpdaterClass {
+public:
+    bool begin(size_t size, int command = U_FLASH);
+    size_t write(uint8_t *data, size_t len);
+    bool end(bool evenIfRemaining = false);
+    bool isRunning() const { return _size > 0; }
+    bool isFinished() const { return _size > 0 && _written == _size; }
+    bool hasError() const { return _error != UPDATE_ERROR_OK; }
+    uint8_t getError() const { return _error; }
+    size_t size() const { return _size; }
+    size_t progress() const { return _written; }
+    size_t remaining() const { return _size - _written; }
+    void printError(Print &out);
+
+    // Host only: bytes written to the simulated partition by the last update
+    const std::vector<uint8_t> &flash() const { return _flash; }
+
+private:
+    void reset();
+
+    std::vector<uint8_t> _flash;
+    size_t _size = 0;
+    size_t _written = 0;
+    int _command = U_FLASH;
+    uint8_t _error = UPDATE_ERROR_OK;
+};
+
+extern UpdaterClass Update;
+
+#endif // KIRBY_NATIVE_UPDATER_H
@@ -0,0 +1,40 @@
+// Host shim for WiFiClient, a blocking TCP socket
+#ifndef KIRBY_NATIVE_WIFICLIENT_H
+#define KIRBY_NATIVE_WIFICLIENT_H
+
+#include <memory>
+#include "Arduino.h"
+#include "Client.h"
+#include "IPAddress.h"
+
+class WiFiClient : public Client {
+public:
+    WiFiClient() {}
+    explicit WiFiClient(int fd);
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char *host, uint16_t port) override;
+    int connect(const String &host, uint16_t port) { return connect(host.c_str(), port); }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Print::write;
+    int available() override;
+    // free space in the send buffer, what a write can take without blocking
+    int availableForWrite();
+    int read() override;
+    int read(uint8_t *buf, size_t size) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+    void setNoDelay(bool nodelay);
+    IPAddress remoteIP();
+    uint16_t remotePort();
+
+private:
+    struct Socket;
+    std::shared_ptr<Socket> _sock;
+};
+
+#endif // KIRBY_NATIVE_WIFICLIENT_H
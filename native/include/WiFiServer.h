@@ -0,0 +1,21 @@
+// Host shim for WiFiServer, a non-blocking listening socket
+#ifndef KIRBY_NATIVE_WIFISERVER_H
+#define KIRBY_NATIVE_WIFISERVER_H
+
+#include "WiFiClient.h"
+
+class WiFiServer {
+public:
+    explicit WiFiServer(uint16_t port) : _port(port) {}
+    void begin();
+    void begin(uint16_t port) { _port = port; begin(); }
+    WiFiClient available();
+    void close();
+    uint16_t port() const { return _port; }
+
+private:
+    uint16_t _port;
+    int _fd = -1;
+};
+
+#endif // KIRBY_NATIVE_WIFISERVER_H
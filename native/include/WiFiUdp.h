@@ -0,0 +1,43 @@
+// Host shim for WiFiUDP over a datagram socket
+#ifndef KIRBY_NATIVE_WIFIUDP_H
+#define KIRBY_NATIVE_WIFIUDP_H
+
+#include <vector>
+#include "Arduino.h"
+#include "IPAddress.h"
+
+class WiFiUDP : public Stream {
+public:
+    uint8_t begin(uint16_t port);
+    uint8_t beginMulticast(IPAddress interfaceAddr, IPAddress multicast, uint16_t port);
+    void stop();
+    int beginPacket(IPAddress ip, uint16_t port);
+    int beginPacket(const char *host, uint16_t port);
+    int beginPacketMulticast(IPAddress multicastAddress, uint16_t port, IPAddress interfaceAddress, int ttl = 1);
+    int endPacket();
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int parsePacket();
+    int available() override { return (int) (_rx.size() - _rxPos); }
+    int read() override { return _rxPos < _rx.size() ? _rx[_rxPos++] : -1; }
+    int read(unsigned char *buffer, size_t len);
+    int read(char *buffer, size_t len) { return read((unsigned char *) buffer, len); }
+    int peek() override { return _rxPos < _rx.size() ? _rx[_rxPos] : -1; }
+    void flush() override { _rx.clear(); _rxPos = 0; }
+    IPAddress remoteIP() { return _remoteIP; }
+    uint16_t remotePort() { return _remotePort; }
+
+private:
+    int _fd = -1;
+    std::vector<uint8_t> _tx;
+    std::vector<uint8_t> _rx;
+    size_t _rxPos = 0;
+    uint32_t _txAddr = 0;
+    uint16_t _txPort = 0;
+    int _ttl = 1;
+    IPAddress _remoteIP;
+    uint16_t _remotePort = 0;
+};
+
+#endif // KIRBY_NATIVE_WIFIUDP_H
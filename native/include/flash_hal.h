@@ -0,0 +1,11 @@
+// Host shim for the flash layout of the ESP8266 core: the 128 KB filesystem of eagle.flash.512k128.ld
+#ifndef KIRBY_NATIVE_FLASH_HAL_H
+#define KIRBY_NATIVE_FLASH_HAL_H
+
+#include <stdint.h>
+
+#define FLASH_SECTOR_SIZE 0x1000
+#define FS_start ((uint32_t) 0x5b000)
+#define FS_end ((uint32_t) 0x7b000)
+
+#endif // KIRBY_NATIVE_FLASH_HAL_H
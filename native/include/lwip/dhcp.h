@@ -0,0 +1,20 @@
+// Host shim for the parts of lwIP's DHCP client the firmware uses; the host
+// address counts as a lease unless WiFi.config() set a static one
+#ifndef KIRBY_NATIVE_LWIP_DHCP_H
+#define KIRBY_NATIVE_LWIP_DHCP_H
+
+#include <stdint.h>
+
+struct netif;
+
+struct dhcp {
+    uint32_t offered_t0_lease;  // seconds
+};
+
+// The station interface
+extern struct netif *netif_default;
+
+struct dhcp *netif_dhcp_data(struct netif *netif);
+uint8_t dhcp_supplied_address(const struct netif *netif);
+
+#endif // KIRBY_NATIVE_LWIP_DHCP_H
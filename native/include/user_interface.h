@@ -0,0 +1,42 @@
+// Host shim for the parts of the SDK's user_interface.h the firmware uses
+#ifndef KIRBY_NATIVE_USER_INTERFACE_H
+#define KIRBY_NATIVE_USER_INTERFACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum rst_reason {
+    REASON_DEFAULT_RST = 0,      // power on
+    REASON_WDT_RST = 1,          // hardware watchdog
+    REASON_EXCEPTION_RST = 2,
+    REASON_SOFT_WDT_RST = 3,
+    REASON_SOFT_RESTART = 4,     // ESP.restart()
+    REASON_DEEP_SLEEP_AWAKE = 5,
+    REASON_EXT_SYS_RST = 6       // reset pin
+};
+
+struct rst_info {
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t epc2;
+    uint32_t epc3;
+    uint32_t excvaddr;
+    uint32_t depc;
+};
+
+// The host always comes up from power on
+struct rst_info *system_get_rst_info(void);
+// RTC timer ticks, from the monotonic clock at a nominal 160 kHz
+uint32_t system_get_rtc_time(void);
+// Microseconds per RTC tick, Q12
+uint32_t system_rtc_clock_cali_proc(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KIRBY_NATIVE_USER_INTERFACE_H
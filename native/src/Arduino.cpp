@@ -0,0 +1,497 @@
+// Host implementation of the Arduino core basics: time, pins, String, Print, Serial and ESP
+#include <Arduino.h>
+#include <NativeHost.h>
+#include <user_interface.h>
+
+#include <chrono>
+#include <thread>
+#include <malloc.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+////////////////////////////////
+// Time
+
+static bool virtualTime = false;
+static uint64_t virtualUs = 0;
+static const auto started = std::chrono::steady_clock::now();
+
+void nativeUseVirtualTime(bool enable) {
+    virtualTime = enable;
+}
+
+bool nativeVirtualTime() {
+    return virtualTime;
+}
+
+void nativeAdvanceMicros(uint64_t us) {
+    virtualUs += us;
+}
+
+uint64_t nativeMicros64() {
+    if (virtualTime) {
+        return virtualUs;
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+unsigned long millis() {
+    return (unsigned long) (nativeMicros64() / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long) (uint32_t) nativeMicros64();
+}
+
+void delay(unsigned long ms) {
+    if (virtualTime) {
+        virtualUs += (uint64_t) ms * 1000;
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+    if (virtualTime) {
+        virtualUs += us;
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() {
+    if (virtualTime) {
+        // something has to move the clock while the firmware polls
+        virtualUs += 10;
+    }
+}
+
+////////////////////////////////
+// Pins
+
+static const uint8_t pinCount = 17;
+static int pinValues[pinCount];
+static bool pinAnalog[pinCount];
+static int pinInputs[pinCount];
+static void (*pinHandlers[pinCount])(void);
+static void (*pinArgHandlers[pinCount])(void *);
+static void *pinArgs[pinCount];
+static uint32_t analogRange = 255;
+static uint32_t analogWrites = 0;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void) pin;
+    (void) mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin < pinCount) {
+        pinValues[pin] = val ? HIGH : LOW;
+        pinAnalog[pin] = false;
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < pinCount ? pinInputs[pin] : LOW;
+}
+
+void analogWrite(uint8_t pin, int val) {
+    if (pin < pinCount) {
+        pinValues[pin] = val;
+        pinAnalog[pin] = true;
+        analogWrites++;
+    }
+}
+
+void analogWriteRange(uint32_t range) {
+    analogRange = range;
+}
+
+void analogWriteFreq(uint32_t freq) {
+    (void) freq;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode) {
+    (void) mode;
+    if (pin < pinCount) {
+        pinHandlers[pin] = handler;
+        pinArgHandlers[pin] = nullptr;
+    }
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode) {
+    (void) mode;
+    if (pin < pinCount) {
+        pinHandlers[pin] = nullptr;
+        pinArgHandlers[pin] = handler;
+        pinArgs[pin] = arg;
+    }
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin < pinCount) {
+        pinHandlers[pin] = nullptr;
+        pinArgHandlers[pin] = nullptr;
+    }
+}
+
+int nativePinValue(uint8_t pin) {
+    return pin < pinCount ? pinValues[pin] : 0;
+}
+
+bool nativePinIsAnalog(uint8_t pin) {
+    return pin < pinCount && pinAnalog[pin];
+}
+
+uint32_t nativeAnalogRange() {
+    return analogRange;
+}
+
+uint32_t nativeAnalogWrites() {
+    return analogWrites;
+}
+
+void nativeSetPinInput(uint8_t pin, int value) {
+    if (pin < pinCount) {
+        pinInputs[pin] = value;
+    }
+}
+
+void nativeTriggerInterrupt(uint8_t pin) {
+    if (pin < pinCount && pinHandlers[pin]) {
+        pinHandlers[pin]();
+    } else if (pin < pinCount && pinArgHandlers[pin]) {
+        pinArgHandlers[pin](pinArgs[pin]);
+    }
+}
+
+////////////////////////////////
+// String
+
+String::String(long value, unsigned char base) {
+    char buf[2 + 8 * sizeof(long)];
+    if (base == 10) {
+        snprintf(buf, sizeof(buf), "%ld", value);
+    } else {
+        String unsignedValue((unsigned long) value, base);
+        s = unsignedValue.s;
+        return;
+    }
+    s = buf;
+}
+
+String::String(unsigned long value, unsigned char base) {
+    char buf[1 + 8 * sizeof(unsigned long)];
+    char *p = buf + sizeof(buf) - 1;
+    *p = 0;
+    if (base < 2) {
+        base = 10;
+    }
+    do {
+        unsigned digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while (value);
+    s = p;
+}
+
+String::String(long long value) {
+    s = std::to_string(value);
+}
+
+String::String(unsigned long long value) {
+    s = std::to_string(value);
+}
+
+String::String(float value, unsigned char decimalPlaces) : String((double) value, decimalPlaces) {}
+
+String::String(double value, unsigned char decimalPlaces) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+    s = buf;
+}
+
+bool String::equalsIgnoreCase(const String &str) const {
+    return strcasecmp(s.c_str(), str.s.c_str()) == 0;
+}
+
+void String::getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index) const {
+    if (!bufsize || !buf) {
+        return;
+    }
+    if (index >= s.size()) {
+        buf[0] = 0;
+        return;
+    }
+    unsigned int n = std::min((unsigned int) (s.size() - index), bufsize - 1);
+    memcpy(buf, s.data() + index, n);
+    buf[n] = 0;
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const {
+    size_t pos = s.find(ch, fromIndex);
+    return pos == std::string::npos ? -1 : (int) pos;
+}
+
+int String::indexOf(const String &str, unsigned int fromIndex) const {
+    size_t pos = s.find(str.s, fromIndex);
+    return pos == std::string::npos ? -1 : (int) pos;
+}
+
+int String::lastIndexOf(char ch) const {
+    size_t pos = s.rfind(ch);
+    return pos == std::string::npos ? -1 : (int) pos;
+}
+
+int String::lastIndexOf(const String &str) const {
+    size_t pos = s.rfind(str.s);
+    return pos == std::string::npos ? -1 : (int) pos;
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const {
+    if (beginIndex > endIndex) {
+        std::swap(beginIndex, endIndex);
+    }
+    if (beginIndex >= s.size()) {
+        return String();
+    }
+    endIndex = std::min(endIndex, (unsigned int) s.size());
+    return String(s.c_str() + beginIndex, endIndex - beginIndex);
+}
+
+void String::replace(const String &find, const String &replace) {
+    if (find.s.empty()) {
+        return;
+    }
+    size_t pos = 0;
+    while ((pos = s.find(find.s, pos)) != std::string::npos) {
+        s.replace(pos, find.s.size(), replace.s);
+        pos += replace.s.size();
+    }
+}
+
+void String::toLowerCase() {
+    for (char &c : s) {
+        c = tolower((unsigned char) c);
+    }
+}
+
+void String::toUpperCase() {
+    for (char &c : s) {
+        c = toupper((unsigned char) c);
+    }
+}
+
+void String::trim() {
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        s.clear();
+        return;
+    }
+    size_t end = s.find_last_not_of(" \t\r\n");
+    s = s.substr(begin, end - begin + 1);
+}
+
+String operator+(const String &lhs, const String &rhs) {
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+String operator+(const String &lhs, const char *rhs) {
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+String operator+(const char *lhs, const String &rhs) {
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+String operator+(const String &lhs, char rhs) {
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+String operator+(const String &lhs, const __FlashStringHelper *rhs) {
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+String operator+(const __FlashStringHelper *lhs, const String &rhs) {
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+////////////////////////////////
+// Print, Stream and Serial
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::printf(const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0) {
+        return 0;
+    }
+    if ((size_t) len < sizeof(buf)) {
+        return write((const uint8_t *) buf, len);
+    }
+    std::string big(len + 1, 0);
+    va_start(args, format);
+    vsnprintf(&big[0], big.size(), format, args);
+    va_end(args);
+    return write((const uint8_t *) big.data(), len);
+}
+
+size_t Stream::readBytes(char *buffer, size_t length) {
+    size_t n = 0;
+    while (n < length) {
+        int c = read();
+        if (c < 0) {
+            break;
+        }
+        buffer[n++] = (char) c;
+    }
+    return n;
+}
+
+String Stream::readStringUntil(char terminator) {
+    String ret;
+    int c;
+    while ((c = read()) >= 0 && c != terminator) {
+        ret += (char) c;
+    }
+    return ret;
+}
+
+String Stream::readString() {
+    String ret;
+    int c;
+    while ((c = read()) >= 0) {
+        ret += (char) c;
+    }
+    return ret;
+}
+
+static FILE *serialOut = stdout;
+
+void nativeSerialTo(FILE *out) {
+    serialOut = out;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    return serialOut ? fwrite(&c, 1, 1, serialOut) : 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+    return serialOut ? fwrite(buffer, 1, size, serialOut) : size;
+}
+
+void HardwareSerial::flush() {
+    if (serialOut) {
+        fflush(serialOut);
+    }
+}
+
+////////////////////////////////
+// ESP
+// Heap figures come from the host allocator, they show trends, not ESP8266 numbers.
+
+uint32_t EspClass::getFreeHeap() {
+    struct mallinfo2 info = mallinfo2();
+    return (uint32_t) std::min<size_t>(info.fordblks, UINT32_MAX);
+}
+
+uint32_t EspClass::getMaxFreeBlockSize() {
+    struct mallinfo2 info = mallinfo2();
+    // the top chunk is the largest block the host allocator can hand out without growing
+    return (uint32_t) std::min<size_t>(info.keepcost, UINT32_MAX);
+}
+
+uint8_t EspClass::getHeapFragmentation() {
+    uint32_t free = getFreeHeap();
+    uint32_t max = getMaxFreeBlockSize();
+    return free ? 100 - (uint8_t) ((uint64_t) max * 100 / free) : 0;
+}
+
+void EspClass::getHeapStats(uint32_t *free, uint32_t *max, uint8_t *frag) {
+    if (free) {
+        *free = getFreeHeap();
+    }
+    if (max) {
+        *max = getMaxFreeBlockSize();
+    }
+    if (frag) {
+        *frag = getHeapFragmentation();
+    }
+}
+
+uint32_t EspClass::getFreeContStack() {
+    // the host stack is not painted, report the ESP8266 cont stack size
+    return 4096;
+}
+
+void EspClass::resetFreeContStack() {
+}
+
+uint32_t EspClass::getCycleCount() {
+    // 80 MHz worth of cycles
+    if (virtualTime) {
+        return (uint32_t) (virtualUs * 80);
+    }
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+    return (uint32_t) (ns * 80 / 1000);
+}
+
+static uint32_t rtcMemory[128];
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+    if (offset * 4 + size > sizeof(rtcMemory) || (size & 3)) {
+        return false;
+    }
+    memcpy(data, rtcMemory + offset, size);
+    return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+    if (offset * 4 + size > sizeof(rtcMemory) || (size & 3)) {
+        return false;
+    }
+    memcpy(rtcMemory + offset, data, size);
+    return true;
+}
+
+static struct rst_info resetInfo = {REASON_DEFAULT_RST, 0, 0, 0, 0, 0, 0};
+
+struct rst_info *system_get_rst_info(void) {
+    return &resetInfo;
+}
+
+uint32_t system_get_rtc_time(void) {
+    return (uint32_t) (nativeMicros64() * 4 / 25);
+}
+
+uint32_t system_rtc_clock_cali_proc(void) {
+    return 25 * 4096 / 4;  // 6.25 us
+}
+
+void EspClass::restart() {
+    fflush(stdout);
+    exit(0);
+}
@@ -0,0 +1,71 @@
+// Host implementation of DallasTemperature, conversions take as long as on a DS18B20
+#include <DallasTemperature.h>
+#include <Arduino.h>
+
+static const uint8_t probeMax = 8;
+// 25 °C until the host says otherwise
+static int32_t probeRaw[probeMax] = {3200, 3200, 3200, 3200, 3200, 3200, 3200, 3200};
+static uint8_t probeCount = 1;
+
+void nativeSetProbeRaw(uint8_t index, int32_t raw) {
+    if (index < probeMax) {
+        probeRaw[index] = raw;
+    }
+}
+
+void nativeSetProbeCount(uint8_t count) {
+    probeCount = count < probeMax ? count : probeMax;
+}
+
+uint8_t DallasTemperature::getDeviceCount() {
+    return probeCount;
+}
+
+bool DallasTemperature::getAddress(uint8_t *address, uint8_t index) {
+    if (index >= probeCount) {
+        return false;
+    }
+    // family code of a DS18B20 followed by the index as serial number
+    memset(address, 0, 8);
+    address[0] = 0x28;
+    address[1] = index;
+    return true;
+}
+
+uint16_t DallasTemperature::millisToWaitForConversion(uint8_t resolution) {
+    switch (resolution) {
+        case 9: return 94;
+        case 10: return 188;
+        case 11: return 375;
+        default: return 750;
+    }
+}
+
+bool DallasTemperature::isConversionComplete() {
+    return millis() - _requestedAt >= millisToWaitForConversion(_resolution);
+}
+
+void DallasTemperature::requestTemperatures() {
+    _requestedAt = millis();
+    if (_wait) {
+        delay(millisToWaitForConversion(_resolution));
+    }
+}
+
+int32_t DallasTemperature::getTemp(const uint8_t *address) {
+    uint8_t index = address[1];
+    if (address[0] != 0x28 || index >= probeCount) {
+        return DEVICE_DISCONNECTED_RAW;
+    }
+    // drop the bits the configured resolution does not have
+    int32_t raw = probeRaw[index];
+    return raw & ~((1 << (12 - _resolution)) * 8 - 1);
+}
+
+float DallasTemperature::getTempCByIndex(uint8_t index) {
+    DeviceAddress address;
+    if (!getAddress(address, index)) {
+        return DEVICE_DISCONNECTED_C;
+    }
+    return getTempC(address);
+}
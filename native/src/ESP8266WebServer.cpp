@@ -0,0 +1,461 @@
+// Host implementation of ESP8266WebServer, close to the core's request handling:
+// hooks first, then the first matching route, then the not found handler
+#include <ESP8266WebServer.h>
+
+namespace mime {
+
+const Entry mimeTable[maxType] = {
+    {".html", "text/html"},
+    {".htm", "text/html"},
+    {".txt", "text/plain"},
+    {".css", "text/css"},
+    {".js", "application/javascript"},
+    {".json", "application/json"},
+    {".png", "image/png"},
+    {".gif", "image/gif"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".ico", "image/x-icon"},
+    {".svg", "image/svg+xml"},
+    {".ttf", "application/x-font-ttf"},
+    {".otf", "application/x-font-opentype"},
+    {".woff", "application/font-woff"},
+    {".woff2", "application/font-woff2"},
+    {".eot", "application/vnd.ms-fontobject"},
+    {".sfnt", "application/font-sfnt"},
+    {".xml", "text/xml"},
+    {".pdf", "application/pdf"},
+    {".zip", "application/zip"},
+    {".gz", "application/x-gzip"},
+    {".appcache", "text/cache-manifest"},
+    {"", "application/octet-stream"},
+};
+
+String getContentType(const String &filename) {
+    for (size_t i = 0; i < maxType; i++) {
+        if (filename.endsWith(mimeTable[i].endsWith)) {
+            return String(mimeTable[i].mimeType);
+        }
+    }
+    return String(mimeTable[none].mimeType);
+}
+
+} // namespace mime
+
+static const String emptyString;
+
+static const char *reasonPhrase(int code) {
+    switch (code) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 412: return "Precondition Failed";
+        case 413: return "Payload Too Large";
+        case 415: return "Unsupported Media Type";
+        case 428: return "Precondition Required";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        case 507: return "Insufficient Storage";
+        default: return "";
+    }
+}
+
+static HTTPMethod parseMethod(const String &method) {
+    if (method == "GET") return HTTP_GET;
+    if (method == "HEAD") return HTTP_HEAD;
+    if (method == "POST") return HTTP_POST;
+    if (method == "PUT") return HTTP_PUT;
+    if (method == "PATCH") return HTTP_PATCH;
+    if (method == "DELETE") return HTTP_DELETE;
+    if (method == "OPTIONS") return HTTP_OPTIONS;
+    return HTTP_ANY;
+}
+
+static String readLine(WiFiClient &client) {
+    String line = client.readStringUntil('\n');
+    if (line.endsWith("\r")) {
+        line.remove(line.length() - 1);
+    }
+    return line;
+}
+
+void ESP8266WebServer::on(const String &uri, HTTPMethod method, THandlerFunction fn, THandlerFunction ufn) {
+    _routes.push_back({uri, method, fn, ufn});
+}
+
+void ESP8266WebServer::reset() {
+    _uri.clear();
+    _method = HTTP_GET;
+    _args.clear();
+    _headers.clear();
+    _responseHeaders.clear();
+    _contentLength = CONTENT_LENGTH_NOT_SET;
+    _chunked = false;
+    _headersSent = false;
+    _http11 = false;
+    _route = nullptr;
+}
+
+void ESP8266WebServer::handleClient() {
+    _client = _server.available();
+    if (!_client) {
+        return;
+    }
+    reset();
+    if (!parseRequest()) {
+        send(400, "text/plain", "Bad Request");
+        _client.stop();
+        return;
+    }
+
+    String methodName = _method == HTTP_GET ? "GET" : _method == HTTP_POST ? "POST" : _method == HTTP_PUT ? "PUT" : _method == HTTP_DELETE ? "DELETE" : _method == HTTP_HEAD ? "HEAD" : _method == HTTP_PATCH ? "PATCH" : "OPTIONS";
+    for (HookFunction &hook : _hooks) {
+        ClientFuture future = hook(methodName, _uri, &_client, mime::getContentType);
+        if (future == CLIENT_IS_GIVEN) {
+            _client = WiFiClient();
+            return;
+        }
+        if (future != CLIENT_REQUEST_CAN_CONTINUE) {
+            _client.stop();
+            return;
+        }
+    }
+
+    if (_route && _route->fn) {
+        _route->fn();
+    } else if (_notFound) {
+        _notFound();
+    } else {
+        send(404, "text/plain", String("Not found: ") + _uri);
+    }
+    if (_chunked) {
+        chunkedResponseFinalize();
+    }
+    _client.stop();
+}
+
+const ESP8266WebServer::Route *ESP8266WebServer::findRoute() const {
+    for (const Route &route : _routes) {
+        if (route.uri == _uri && (route.method == HTTP_ANY || route.method == _method)) {
+            return &route;
+        }
+    }
+    return nullptr;
+}
+
+bool ESP8266WebServer::parseRequest() {
+    String requestLine = readLine(_client);
+    int methodEnd = requestLine.indexOf(' ');
+    int uriEnd = requestLine.indexOf(' ', methodEnd + 1);
+    if (methodEnd < 0 || uriEnd < 0) {
+        return false;
+    }
+    _method = parseMethod(requestLine.substring(0, methodEnd));
+    _http11 = requestLine.substring(uriEnd + 1) == "HTTP/1.1";
+    String url = requestLine.substring(methodEnd + 1, uriEnd);
+    int query = url.indexOf('?');
+    if (query >= 0) {
+        _uri = url.substring(0, query);
+        parseArgs(url.substring(query + 1));
+    } else {
+        _uri = url;
+    }
+
+    size_t length = 0;
+    String contentType;
+    for (;;) {
+        String line = readLine(_client);
+        if (line.isEmpty()) {
+            break;
+        }
+        int colon = line.indexOf(':');
+        if (colon < 0) {
+            continue;
+        }
+        String name = line.substring(0, colon);
+        String value = line.substring(colon + 1);
+        value.trim();
+        if (name.equalsIgnoreCase("Content-Length")) {
+            length = value.toInt();
+        } else if (name.equalsIgnoreCase("Content-Type")) {
+            contentType = value;
+        }
+        _headers.push_back({name, value});
+    }
+
+    _route = findRoute();
+    if (!length) {
+        return true;
+    }
+    if (contentType.startsWith("multipart/form-data")) {
+        int boundary = contentType.indexOf("boundary=");
+        if (boundary < 0) {
+            return false;
+        }
+        String name = contentType.substring(boundary + 9);
+        if (name.startsWith("\"")) {
+            name = name.substring(1, name.length() - 1);
+        }
+        return parseMultipart(name, length);
+    }
+
+    std::string body(length, 0);
+    size_t got = 0;
+    while (got < length) {
+        int n = _client.read((uint8_t *) &body[got], length - got);
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    String plain(body.data(), body.size());
+    if (contentType.startsWith("application/x-www-form-urlencoded")) {
+        parseArgs(plain);
+    }
+    _args.push_back({String("plain"), plain});
+    return true;
+}
+
+void ESP8266WebServer::parseArgs(const String &data) {
+    int pos = 0;
+    while (pos < (int) data.length()) {
+        int end = data.indexOf('&', pos);
+        if (end < 0) {
+            end = data.length();
+        }
+        String pair = data.substring(pos, end);
+        int equals = pair.indexOf('=');
+        if (equals < 0) {
+            _args.push_back({urlDecode(pair), String()});
+        } else {
+            _args.push_back({urlDecode(pair.substring(0, equals)), urlDecode(pair.substring(equals + 1))});
+        }
+        pos = end + 1;
+    }
+}
+
+bool ESP8266WebServer::parseMultipart(const String &boundary, size_t length) {
+    // uploads on the device are at most a filesystem image, buffering the body is fine here
+    std::string body(length, 0);
+    size_t got = 0;
+    while (got < length) {
+        int n = _client.read((uint8_t *) &body[got], length - got);
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+
+    THandlerFunction upload = _route && _route->ufn ? _route->ufn : _fileUpload;
+    std::string delimiter = std::string("--") + boundary.c_str();
+    size_t pos = body.find(delimiter);
+    while (pos != std::string::npos) {
+        pos += delimiter.size();
+        if (body.compare(pos, 2, "--") == 0) {
+            break;
+        }
+        pos = body.find("\r\n", pos);
+        if (pos == std::string::npos) {
+            return false;
+        }
+        pos += 2;
+        size_t headersEnd = body.find("\r\n\r\n", pos);
+        if (headersEnd == std::string::npos) {
+            return false;
+        }
+        std::string headers = body.substr(pos, headersEnd - pos);
+        size_t dataStart = headersEnd + 4;
+        size_t next = body.find("\r\n" + delimiter, dataStart);
+        if (next == std::string::npos) {
+            return false;
+        }
+
+        auto field = [&headers](const char *key) {
+            std::string needle = std::string("; ") + key + "=\"";
+            size_t at = headers.find(needle);
+            if (at == std::string::npos) {
+                return String();
+            }
+            at += needle.size();
+            size_t end = headers.find('"', at);
+            return String(headers.c_str() + at, end - at);
+        };
+        String name = field("name");
+        String filename = field("filename");
+
+        if (headers.find("; filename=") == std::string::npos) {
+            _args.push_back({name, String(body.data() + dataStart, next - dataStart)});
+        } else if (upload) {
+            _upload.status = UPLOAD_FILE_START;
+            _upload.name = name;
+            _upload.filename = filename;
+            size_t typeAt = headers.find("Content-Type:");
+            _upload.type = typeAt == std::string::npos ? String("application/octet-stream") : String(headers.substr(typeAt + 13, headers.find("\r\n", typeAt) - typeAt - 13).c_str());
+            _upload.type.trim();
+            _upload.totalSize = 0;
+            _upload.currentSize = 0;
+            upload();
+            for (size_t at = dataStart; at < next; at += HTTP_UPLOAD_BUFLEN) {
+                _upload.status = UPLOAD_FILE_WRITE;
+                _upload.currentSize = std::min((size_t) HTTP_UPLOAD_BUFLEN, next - at);
+                memcpy(_upload.buf, body.data() + at, _upload.currentSize);
+                _upload.totalSize += _upload.currentSize;
+                upload();
+            }
+            _upload.status = UPLOAD_FILE_END;
+            _upload.currentSize = 0;
+            upload();
+        }
+        pos = next + 2;
+    }
+    return true;
+}
+
+const String &ESP8266WebServer::arg(const String &name) const {
+    for (const Arg &a : _args) {
+        if (a.key == name) {
+            return a.value;
+        }
+    }
+    return emptyString;
+}
+
+const String &ESP8266WebServer::arg(int i) const {
+    return i >= 0 && i < (int) _args.size() ? _args[i].value : emptyString;
+}
+
+const String &ESP8266WebServer::argName(int i) const {
+    return i >= 0 && i < (int) _args.size() ? _args[i].key : emptyString;
+}
+
+bool ESP8266WebServer::hasArg(const String &name) const {
+    for (const Arg &a : _args) {
+        if (a.key == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ESP8266WebServer::collectHeaders(const char *headerKeys[], const size_t headerKeysCount) {
+    // every request header is kept on the host
+    (void) headerKeys;
+    (void) headerKeysCount;
+}
+
+const String &ESP8266WebServer::header(const String &name) const {
+    for (const Arg &h : _headers) {
+        if (h.key.equalsIgnoreCase(name)) {
+            return h.value;
+        }
+    }
+    return emptyString;
+}
+
+bool ESP8266WebServer::hasHeader(const String &name) const {
+    for (const Arg &h : _headers) {
+        if (h.key.equalsIgnoreCase(name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ESP8266WebServer::sendHeader(const String &name, const String &value, bool first) {
+    if (first) {
+        _responseHeaders.insert(_responseHeaders.begin(), {name, value});
+    } else {
+        _responseHeaders.push_back({name, value});
+    }
+}
+
+void ESP8266WebServer::sendHeaders(int code, const char *contentType, size_t contentLength) {
+    String head = String("HTTP/1.") + (_http11 ? "1 " : "0 ") + String(code) + " " + reasonPhrase(code) + "\r\n";
+    head += String("Content-Type: ") + (contentType && *contentType ? contentType : "text/html") + "\r\n";
+    if (_contentLength == CONTENT_LENGTH_UNKNOWN) {
+        if (_http11) {
+            head += "Transfer-Encoding: chunked\r\n";
+            _chunked = true;
+        }
+    } else {
+        size_t length = _contentLength == CONTENT_LENGTH_NOT_SET ? contentLength : _contentLength;
+        head += String("Content-Length: ") + String((unsigned long) length) + "\r\n";
+    }
+    for (const Arg &h : _responseHeaders) {
+        head += h.key + ": " + h.value + "\r\n";
+    }
+    head += "Connection: close\r\n\r\n";
+    _client.write(head.c_str(), head.length());
+    _responseHeaders.clear();
+    _headersSent = true;
+}
+
+void ESP8266WebServer::send(int code, const char *content_type, const String &content) {
+    send(code, content_type, content.c_str(), content.length());
+}
+
+void ESP8266WebServer::send(int code, const char *content_type, const char *content, size_t contentLength) {
+    sendHeaders(code, content_type, contentLength);
+    if (contentLength && _method != HTTP_HEAD) {
+        sendContent(content, contentLength);
+    }
+}
+
+void ESP8266WebServer::sendContent(const char *content, size_t size) {
+    if (!_chunked) {
+        _client.write((const uint8_t *) content, size);
+        return;
+    }
+    if (!size) {
+        // an empty chunk would end the response
+        return;
+    }
+    char chunkSize[12];
+    int n = snprintf(chunkSize, sizeof(chunkSize), "%zx\r\n", size);
+    _client.write((const uint8_t *) chunkSize, n);
+    _client.write((const uint8_t *) content, size);
+    _client.write((const uint8_t *) "\r\n", 2);
+}
+
+bool ESP8266WebServer::chunkedResponseModeStart(int code, const char *contentType) {
+    if (!_http11) {
+        return false;
+    }
+    setContentLength(CONTENT_LENGTH_UNKNOWN);
+    send(code, contentType, "", 0);
+    return true;
+}
+
+void ESP8266WebServer::chunkedResponseFinalize() {
+    if (_chunked) {
+        _client.write((const uint8_t *) "0\r\n\r\n", 5);
+        _chunked = false;
+    }
+}
+
+String ESP8266WebServer::urlDecode(const String &text) {
+    String decoded;
+    const char *p = text.c_str();
+    while (*p) {
+        if (*p == '+') {
+            decoded += ' ';
+        } else if (*p == '%' && isxdigit((unsigned char) p[1]) && isxdigit((unsigned char) p[2])) {
+            char hex[3] = {p[1], p[2], 0};
+            decoded += (char) strtol(hex, nullptr, 16);
+            p += 2;
+        } else {
+            decoded += *p;
+        }
+        p++;
+    }
+    return decoded;
+}
@@ -0,0 +1,242 @@
+// Host implementation of the FS API: every path is mapped below LittleFS.setRoot()
+#include <FS.h>
+#include <LittleFS.h>
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+fs::FS LittleFS;
+
+namespace fs {
+
+static FSStats writeStats;
+
+static bool isHostDirectory(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static size_t hostFileSize(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? (size_t) st.st_size : 0;
+}
+
+static bool makeParents(const std::string &path) {
+    for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+        std::string parent = path.substr(0, pos);
+        if (mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////
+// File
+
+size_t File::write(const uint8_t *buf, size_t size) {
+    if (!_fp) {
+        return 0;
+    }
+    size_t n = fwrite(buf, 1, size, _fp.get());
+    writeStats.writeCalls++;
+    writeStats.bytesWritten += n;
+    return n;
+}
+
+int File::available() {
+    if (!_fp) {
+        return 0;
+    }
+    long pos = ftell(_fp.get());
+    return (int) (size() - pos);
+}
+
+int File::read() {
+    if (!_fp) {
+        return -1;
+    }
+    int c = fgetc(_fp.get());
+    return c == EOF ? -1 : c;
+}
+
+int File::peek() {
+    if (!_fp) {
+        return -1;
+    }
+    int c = fgetc(_fp.get());
+    if (c == EOF) {
+        return -1;
+    }
+    ungetc(c, _fp.get());
+    return c;
+}
+
+size_t File::read(uint8_t *buf, size_t size) {
+    return _fp ? fread(buf, 1, size, _fp.get()) : 0;
+}
+
+size_t File::size() const {
+    if (!_fp) {
+        return 0;
+    }
+    // the stream may hold buffered writes that are not on disk yet
+    fflush(_fp.get());
+    struct stat st;
+    return fstat(fileno(_fp.get()), &st) == 0 ? (size_t) st.st_size : 0;
+}
+
+const char *File::name() const {
+    const char *slash = strrchr(_path.c_str(), '/');
+    return slash ? slash + 1 : _path.c_str();
+}
+
+////////////////////////////////
+// Dir
+
+std::string Dir::hostPath() const {
+    std::string path = _root + _path.c_str();
+    if (path.back() != '/') {
+        path += '/';
+    }
+    return path + _entries[_index];
+}
+
+size_t Dir::fileSize() const {
+    return hostFileSize(hostPath());
+}
+
+bool Dir::isDirectory() const {
+    return isHostDirectory(hostPath());
+}
+
+File Dir::openFile(const char *mode) {
+    String path = _path;
+    if (!path.endsWith("/")) {
+        path += '/';
+    }
+    path += fileName();
+    return LittleFS.open(path, mode);
+}
+
+////////////////////////////////
+// FS
+
+std::string FS::hostPath(const char *path) const {
+    std::string host = _root;
+    if (!path || path[0] != '/') {
+        host += '/';
+    }
+    return host + (path ? path : "");
+}
+
+bool FS::begin() {
+    return makeParents(_root + "/");
+}
+
+bool FS::format() {
+    // refuse to wipe a host directory, an empty root is what a fresh image looks like anyway
+    return begin();
+}
+
+static size_t usedBytes(const std::string &path) {
+    size_t used = 0;
+    DIR *dir = opendir(path.c_str());
+    if (!dir) {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+            continue;
+        }
+        std::string child = path + "/" + entry->d_name;
+        // LittleFS spends at least one block per file
+        used += isHostDirectory(child) ? usedBytes(child) : std::max<size_t>(4096, (hostFileSize(child) + 4095) & ~(size_t) 4095);
+    }
+    closedir(dir);
+    return used;
+}
+
+bool FS::info(FSInfo &info) {
+    if (!isHostDirectory(_root)) {
+        return false;
+    }
+    // report the size of the esp01 filesystem partition, not the host disk
+    info.blockSize = 4096;
+    info.pageSize = 256;
+    info.totalBytes = 128 * 1024;
+    info.usedBytes = usedBytes(_root);
+    info.maxOpenFiles = 5;
+    info.maxPathLength = 32;
+    return true;
+}
+
+File FS::open(const char *path, const char *mode) {
+    std::string host = hostPath(path);
+    if (isHostDirectory(host)) {
+        return File(nullptr, String(path), true);
+    }
+    if (mode[0] != 'r' && !makeParents(host)) {
+        return File();
+    }
+    // the firmware uses text modes, the host must not translate anything
+    std::string hostMode = std::string(mode) + "b";
+    FILE *fp = fopen(host.c_str(), hostMode.c_str());
+    if (!fp) {
+        return File();
+    }
+    return File(fp, String(path), false);
+}
+
+bool FS::exists(const char *path) {
+    return access(hostPath(path).c_str(), F_OK) == 0;
+}
+
+Dir FS::openDir(const char *path) {
+    std::vector<std::string> entries;
+    DIR *dir = opendir(hostPath(path).c_str());
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+                entries.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    // LittleFS returns entries in name order, readdir() does not
+    std::sort(entries.begin(), entries.end());
+    return Dir(String(path), entries, _root);
+}
+
+bool FS::remove(const char *path) {
+    return ::unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *pathFrom, const char *pathTo) {
+    std::string to = hostPath(pathTo);
+    return makeParents(to) && ::rename(hostPath(pathFrom).c_str(), to.c_str()) == 0;
+}
+
+bool FS::mkdir(const char *path) {
+    std::string host = hostPath(path);
+    return makeParents(host) && (::mkdir(host.c_str(), 0755) == 0 || errno == EEXIST);
+}
+
+bool FS::rmdir(const char *path) {
+    return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+FSStats FS::stats() const {
+    return writeStats;
+}
+
+void FS::resetStats() {
+    writeStats = FSStats();
+}
+
+} // namespace fs
@@ -0,0 +1,32 @@
+// Command line options of the native build
+#include <NativeHost.h>
+#include <Arduino.h>
+
+NativeOptions nativeOptions = {8080, "native/fs", {nullptr, nullptr, nullptr, nullptr}, 0};
+
+static const char *defaultSsid = "primaryssid";
+
+bool nativeParseArgs(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--port") && hasValue) {
+            nativeOptions.httpPort = (uint16_t) atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--fs") && hasValue) {
+            nativeOptions.fsRoot = argv[++i];
+        } else if (!strcmp(argv[i], "--ssid") && hasValue) {
+            if (nativeOptions.ssidCount < 4) {
+                nativeOptions.ssids[nativeOptions.ssidCount++] = argv[++i];
+            } else {
+                ++i;
+            }
+        } else {
+            fprintf(stderr, "usage: %s [--port N] [--fs DIR] [--ssid NAME]...\n", argv[0]);
+            return false;
+        }
+    }
+    if (!nativeOptions.ssidCount) {
+        // the network WIFI_DETAILS.h ships with, so the station connects out of the box
+        nativeOptions.ssids[nativeOptions.ssidCount++] = defaultSsid;
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+// Host implementation of the Updater against a simulated partition
+#include <Updater.h>
+#include <flash_hal.h>
+
+#include <stdio.h>
+#include <string.h>
+
+UpdaterClass Update;
+
+bool UpdaterClass::begin(size_t size, int command) {
+    reset();
+    _error = UPDATE_ERROR_OK;
+    size_t limit = command == U_FS ? FS_end - FS_start : 0x3b000;
+    if (size == 0 || size > limit) {
+        _error = UPDATE_ERROR_SPACE;
+        return false;
+    }
+    _size = size;
+    _command = command;
+    // an erased partition, like the real Updater erases sector by sector ahead of writing
+    _flash.assign(size, 0xff);
+    return true;
+}
+
+size_t UpdaterClass::write(uint8_t *data, size_t len) {
+    if (!_size || hasError()) {
+        return 0;
+    }
+    if (len > _size - _written) {
+        _error = UPDATE_ERROR_SPACE;
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        uint8_t &cell = _flash[_written + i];
+        if (cell != 0xff) {
+            // flash bits only go from 1 to 0, a second write to a byte is a bug
+            _error = UPDATE_ERROR_WRITE;
+            return 0;
+        }
+        cell = data[i];
+    }
+    _written += len;
+    return len;
+}
+
+bool UpdaterClass::end(bool evenIfRemaining) {
+    if (!_size) {
+        return false;
+    }
+    if (hasError() || (!evenIfRemaining && !isFinished())) {
+        reset();
+        return false;
+    }
+    if (_written == 0) {
+        _error = UPDATE_ERROR_SIZE;
+        reset();
+        return false;
+    }
+    if (_command == U_FLASH) {
+        _flash.resize(_written);
+    }
+    const char *path = _command == U_FS ? "kirby-update-filesystem.bin" : "kirby-update-firmware.bin";
+    FILE *file = fopen(path, "wb");
+    if (!file || fwrite(_flash.data(), 1, _flash.size(), file) != _flash.size()) {
+        _error = UPDATE_ERROR_WRITE;
+    }
+    if (file) {
+        fclose(file);
+    }
+    _size = 0;
+    _written = 0;
+    return !hasError();
+}
+
+void UpdaterClass::printError(Print &out) {
+    out.printf("Update error %u\n", _error);
+}
+
+void UpdaterClass::reset() {
+    _size = 0;
+    _written = 0;
+}
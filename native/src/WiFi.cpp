@@ -0,0 +1,462 @@
+// Host implementation of the Wi-Fi station, TCP and UDP over BSD sockets
+#include <ESP8266WiFi.h>
+#include <ESP8266mDNS.h>
+#include <NativeHost.h>
+#include <lwip/dhcp.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+ESP8266WiFiClass WiFi;
+MDNSResponder MDNS;
+
+// A lease of one day, like most home routers
+struct netif {
+    struct dhcp dhcp;
+    bool isStatic;
+};
+static struct netif station = {{86400}, false};
+struct netif *netif_default = &station;
+
+////////////////////////////////
+// IPAddress
+
+bool IPAddress::fromString(const char *address) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, address, &addr) != 1) {
+        return false;
+    }
+    _addr = addr.s_addr;
+    return true;
+}
+
+String IPAddress::toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(buf);
+}
+
+////////////////////////////////
+// Station
+
+wl_status_t ESP8266WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect) {
+    (void) passphrase;
+    (void) channel;
+    (void) bssid;
+    _ssid = ssid;
+    _status = connect ? WL_CONNECTED : WL_DISCONNECTED;
+    return _status;
+}
+
+bool ESP8266WiFiClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+    // 0.0.0.0 goes back to DHCP
+    station.isStatic = (uint32_t) local_ip != 0;
+    (void) gateway;
+    (void) subnet;
+    (void) dns1;
+    (void) dns2;
+    return true;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifioff) {
+    _status = WL_DISCONNECTED;
+    if (wifioff) {
+        _mode = WIFI_OFF;
+    }
+    return true;
+}
+
+int8_t ESP8266WiFiClass::scanNetworks(bool async, bool show_hidden) {
+    (void) async;
+    (void) show_hidden;
+    int8_t found = 0;
+    if (_visible[0] || _visible[1]) {
+        found = _visible[1] ? 2 : 1;
+    } else {
+        found = nativeOptions.ssidCount;
+    }
+    // a scan always completes at once, async callers see the result on the next poll
+    _scanned = found;
+    return found;
+}
+
+void ESP8266WiFiClass::nativeSetLeaseS(uint32_t seconds) {
+    station.dhcp.offered_t0_lease = seconds;
+}
+
+struct dhcp *netif_dhcp_data(struct netif *netif) {
+    return netif ? &netif->dhcp : nullptr;
+}
+
+uint8_t dhcp_supplied_address(const struct netif *netif) {
+    return netif && !netif->isStatic && WiFi.status() == WL_CONNECTED;
+}
+
+String ESP8266WiFiClass::SSID(uint8_t networkItem) {
+    if (_visible[0] || _visible[1]) {
+        return String(networkItem < 2 && _visible[networkItem] ? _visible[networkItem] : "");
+    }
+    return String(networkItem < nativeOptions.ssidCount ? nativeOptions.ssids[networkItem] : "");
+}
+
+int ESP8266WiFiClass::hostByName(const char *aHostname, IPAddress &aResult) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    struct addrinfo *res = nullptr;
+    if (getaddrinfo(aHostname, nullptr, &hints, &res) != 0 || !res) {
+        return 0;
+    }
+    aResult = IPAddress((uint32_t) ((struct sockaddr_in *) res->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(res);
+    return 1;
+}
+
+////////////////////////////////
+// WiFiClient
+
+struct WiFiClient::Socket {
+    explicit Socket(int fd) : fd(fd) {}
+    ~Socket() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    int fd;
+    int peeked = -1;
+};
+
+WiFiClient::WiFiClient(int fd) : _sock(std::make_shared<Socket>(fd)) {
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = (uint32_t) ip;
+    if (::connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        ::close(fd);
+        return 0;
+    }
+    _sock = std::make_shared<Socket>(fd);
+    return 1;
+}
+
+int WiFiClient::connect(const char *host, uint16_t port) {
+    IPAddress ip;
+    if (!WiFi.hostByName(host, ip)) {
+        return 0;
+    }
+    return connect(ip, port);
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size) {
+    if (!_sock) {
+        return 0;
+    }
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t n = ::send(_sock->fd, buf + sent, size - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+int WiFiClient::available() {
+    if (!_sock) {
+        return 0;
+    }
+    if (_sock->peeked >= 0) {
+        return 1;
+    }
+    uint8_t c;
+    ssize_t n = recv(_sock->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 ? 1 : 0;
+}
+
+int WiFiClient::availableForWrite() {
+    int size = 0;
+    int queued = 0;
+    socklen_t len = sizeof(size);
+    if (!_sock || getsockopt(_sock->fd, SOL_SOCKET, SO_SNDBUF, &size, &len) != 0 || ioctl(_sock->fd, SIOCOUTQ, &queued) != 0) {
+        return 0;
+    }
+    return size > queued ? size - queued : 0;
+}
+
+int WiFiClient::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size) {
+    if (!_sock || !size) {
+        return -1;
+    }
+    size_t got = 0;
+    if (_sock->peeked >= 0) {
+        buf[got++] = (uint8_t) _sock->peeked;
+        _sock->peeked = -1;
+        if (got == size) {
+            return got;
+        }
+    }
+    // block up to the stream timeout for the first byte, like the core's readBytes()
+    struct pollfd pfd = {_sock->fd, POLLIN, 0};
+    if (!got && poll(&pfd, 1, (int) _timeout) <= 0) {
+        return -1;
+    }
+    ssize_t n = recv(_sock->fd, buf + got, size - got, got ? MSG_DONTWAIT : 0);
+    if (n > 0) {
+        got += n;
+    }
+    return got ? (int) got : -1;
+}
+
+int WiFiClient::peek() {
+    if (!_sock) {
+        return -1;
+    }
+    if (_sock->peeked < 0) {
+        uint8_t c;
+        if (read(&c, 1) != 1) {
+            return -1;
+        }
+        _sock->peeked = c;
+    }
+    return _sock->peeked;
+}
+
+void WiFiClient::stop() {
+    _sock.reset();
+}
+
+uint8_t WiFiClient::connected() {
+    if (!_sock) {
+        return 0;
+    }
+    if (_sock->peeked >= 0) {
+        return 1;
+    }
+    uint8_t c;
+    ssize_t n = recv(_sock->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+void WiFiClient::setNoDelay(bool nodelay) {
+    if (_sock) {
+        int flag = nodelay;
+        setsockopt(_sock->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+}
+
+IPAddress WiFiClient::remoteIP() {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (!_sock || getpeername(_sock->fd, (struct sockaddr *) &addr, &len) != 0) {
+        return IPAddress();
+    }
+    return IPAddress((uint32_t) addr.sin_addr.s_addr);
+}
+
+uint16_t WiFiClient::remotePort() {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (!_sock || getpeername(_sock->fd, (struct sockaddr *) &addr, &len) != 0) {
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+////////////////////////////////
+// WiFiServer
+
+void WiFiServer::begin() {
+    close();
+    // port 80 needs privileges on the host, --port moves it
+    if (_port == 80 && !nativeOptions.httpPort) {
+        return;
+    }
+    uint16_t port = _port == 80 ? nativeOptions.httpPort : _port;
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_fd < 0) {
+        return;
+    }
+    int reuse = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(_fd, 8) != 0) {
+        fprintf(stderr, "native: cannot listen on port %u: %s\n", port, strerror(errno));
+        close();
+        return;
+    }
+    fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+    printf("native: HTTP server on port %u\n", port);
+}
+
+WiFiClient WiFiServer::available() {
+    if (_fd < 0) {
+        return WiFiClient();
+    }
+    int fd = accept(_fd, nullptr, nullptr);
+    if (fd < 0) {
+        return WiFiClient();
+    }
+    return WiFiClient(fd);
+}
+
+void WiFiServer::close() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+////////////////////////////////
+// WiFiUDP
+
+uint8_t WiFiUDP::begin(uint16_t port) {
+    stop();
+    _fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd < 0) {
+        return 0;
+    }
+    int reuse = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        stop();
+        return 0;
+    }
+    fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+    return 1;
+}
+
+uint8_t WiFiUDP::beginMulticast(IPAddress interfaceAddr, IPAddress multicast, uint16_t port) {
+    if (!begin(port)) {
+        return 0;
+    }
+    struct ip_mreq mreq;
+    mreq.imr_multiaddr.s_addr = (uint32_t) multicast;
+    mreq.imr_interface.s_addr = (uint32_t) interfaceAddr;
+    if (setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+        stop();
+        return 0;
+    }
+    return 1;
+}
+
+void WiFiUDP::stop() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    _rx.clear();
+    _rxPos = 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+    if (_fd < 0) {
+        _fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (_fd < 0) {
+            return 0;
+        }
+    }
+    _txAddr = (uint32_t) ip;
+    _txPort = port;
+    _tx.clear();
+    return 1;
+}
+
+int WiFiUDP::beginPacket(const char *host, uint16_t port) {
+    IPAddress ip;
+    if (!WiFi.hostByName(host, ip)) {
+        return 0;
+    }
+    return beginPacket(ip, port);
+}
+
+int WiFiUDP::beginPacketMulticast(IPAddress multicastAddress, uint16_t port, IPAddress interfaceAddress, int ttl) {
+    (void) interfaceAddress;
+    if (!beginPacket(multicastAddress, port)) {
+        return 0;
+    }
+    if (ttl != _ttl) {
+        unsigned char hostTtl = (unsigned char) ttl;
+        setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_TTL, &hostTtl, sizeof(hostTtl));
+        _ttl = ttl;
+    }
+    return 1;
+}
+
+int WiFiUDP::endPacket() {
+    if (_fd < 0) {
+        return 0;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_txPort);
+    addr.sin_addr.s_addr = _txAddr;
+    ssize_t n = sendto(_fd, _tx.data(), _tx.size(), 0, (struct sockaddr *) &addr, sizeof(addr));
+    _tx.clear();
+    return n >= 0;
+}
+
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size) {
+    _tx.insert(_tx.end(), buffer, buffer + size);
+    return size;
+}
+
+int WiFiUDP::parsePacket() {
+    if (_fd < 0) {
+        return 0;
+    }
+    uint8_t buf[1500];
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    ssize_t n = recvfrom(_fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *) &addr, &len);
+    if (n <= 0) {
+        return 0;
+    }
+    _rx.assign(buf, buf + n);
+    _rxPos = 0;
+    _remoteIP = IPAddress((uint32_t) addr.sin_addr.s_addr);
+    _remotePort = ntohs(addr.sin_port);
+    return (int) n;
+}
+
+int WiFiUDP::read(unsigned char *buffer, size_t len) {
+    size_t n = std::min(len, _rx.size() - _rxPos);
+    memcpy(buffer, _rx.data() + _rxPos, n);
+    _rxPos += n;
+    return (int) n;
+}
@@ -0,0 +1,24 @@
+// Entry point of the native build: the sketch's setup() and loop() on the host.
+// The simulator and the unit tests (pio test defines PIO_UNIT_TESTING) bring their own.
+#if !defined(KIRBY_NATIVE_NO_MAIN) && !defined(PIO_UNIT_TESTING)
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <NativeHost.h>
+
+void setup();
+void loop();
+
+int main(int argc, char **argv) {
+    if (!nativeParseArgs(argc, argv)) {
+        return 2;
+    }
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    LittleFS.setRoot(nativeOptions.fsRoot);
+    setup();
+    for (;;) {
+        loop();
+    }
+}
+
+#endif // !KIRBY_NATIVE_NO_MAIN && !PIO_UNIT_TESTING
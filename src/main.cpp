@@ -4,11 +4,29 @@
 
 #include <ESP8266WiFi.h>
 #include <WiFiClient.h>
+#include <WiFiUdp.h>
 #include <ESP8266WebServer.h>
 #include <ESP8266mDNS.h>
 #include <WIFI_DETAILS.h>
-#include <Scheduler.h>
+#include <DeadlineScheduler.h>
+#include <Seqlock.h>
+#include <RequestArena.h>
+#include <ThermalModel.h>
+#include <Inflate.h>
+#include <Trace.h>
+#include <WallClock.h>
+#include <Rules.h>
 #include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <Updater.h>
+#include <MD5Builder.h>
+#include <flash_hal.h>
+#include <lwip/dhcp.h>
+#include <errno.h>
+#include <new>
+extern "C" {
+#include <user_interface.h>
+}
 
 StaticJsonDocument<200> doc;
 
@@ -22,6 +40,12 @@ LittleFSConfig fileSystemConfig = LittleFSConfig();
 #endif
 #include <WIFI_DETAILS.h>
 #include <VAR_LOCATIONS.h>
+#include <ZONES.h>
+#include <MQTT_DETAILS.h>
+#include <TELEMETRY_DETAILS.h>
+#include <TIME_DETAILS.h>
+#include <FEATURES.h>
+#include <SETTINGS.h>
 
 
 #define DBG_OUTPUT_PORT Serial
@@ -45,7 +69,31 @@ ESP8266WebServer server(80);
 static bool fsOK;
 String unsupportedFiles = String();
 
-File uploadFile;
+const uint8_t pathMax = 64; // full paths the file handlers build
+uint32_t fsGeneration = 0;   // bumped by every create, rename, upload and delete
+
+// Directory listing, see handleFileList and FsWalk
+const uint8_t fsWalkDepthMax = 4;           // folder levels walked below the listed one
+const uint8_t listPageMax = 32;             // entries per /list reply
+const uint8_t dirIndexMax = 64;             // entries the listing index holds
+const uint16_t dirIndexPoolSize = 1024;     // for their names
+const unsigned long dirIndexMaxAgeMs = 60000;
+
+// File upload to /edit, see handleFileUpload
+const size_t uploadWriteSize = 1024; // coalesced filesystem writes, a multiple of the 256 byte flash page
+struct UploadSession {
+  File file;            // locUploadPart, renamed over target once verified
+  char target[pathMax];
+  uint8_t* buffer;      // uploadWriteSize from the request arena, nullptr writes through
+  size_t buffered;
+  int code;             // HTTP status of the first failure
+  const char* error;    // first failure, nullptr while fine
+  MD5Builder md5;       // of the upload, compared to ?md5=
+};
+UploadSession uploadSession;
+uint32_t uploadWrites = 0;   // filesystem writes made by uploads
+uint32_t uploadBytes = 0;
+uint32_t uploadFailures = 0;
 
 static const char TEXT_PLAIN[] PROGMEM = "text/plain";
 static const char FS_INIT_ERROR[] PROGMEM = "FS INIT ERROR";
@@ -53,7 +101,33 @@ static const char FILE_NOT_FOUND[] PROGMEM = "FileNotFound";
 static const char WRONG_METHOD[] PROGMEM = "WrongMethod";
 
 // WIFI
-short const int wifiSleepMS = 2000;
+short const int wifiSleepMS = 50;
+const unsigned long wifiFastConnectTimeoutMs = 4000;
+const unsigned long wifiConnectTimeoutMs = 10000;
+const unsigned long wifiBackoffMs = 5000;
+const uint32_t wifiLeaseMarginS = 60;       // no static address this close to the end of its lease
+const uint32_t wifiCacheMagic = 0x4b495232; // "KIR2"
+
+// Last successful association, replayed on (re)connect to skip scan and DHCP.
+// The address is a DHCP lease, it is only replayed until the lease ends.
+struct WifiCache {
+  uint32_t magic;
+  uint8_t ssidIndex;
+  uint8_t channel;
+  uint8_t bssid[6];
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t leaseS;
+  uint32_t leaseEndS;  // Unix time, 0 = unknown
+};
+WifiCache wifiCache;
+
+// Boot phases, in ms since boot (0 = not reached yet)
+unsigned long bootFsMountedMs = 0;
+unsigned long bootFirstControlMs = 0;
+unsigned long bootNetworkMs = 0;
 
 // Temperature
 #include <OneWire.h>
@@ -61,61 +135,568 @@ short const int wifiSleepMS = 2000;
 #define ONE_WIRE_BUS 0
 OneWire oneWire(ONE_WIRE_BUS);
 DallasTemperature sensors(&oneWire);
-float tempCelcius=0;
 // float Fahrenheit=0;
 short const int probeSleepMs = 3000;
+const int16_t tempRawPerDegree = 16; // DS18B20 at 12 bit
+const int16_t tempRawInvalid = INT16_MIN;
+DeviceAddress probeAddresses[probesMax];
+bool probeFound[probesMax];
+
+// Adaptive sampling, see SensorTask
+struct SamplerPolicy {
+  uint32_t magic;
+  uint16_t minMs;           // fastest period, never below the probe's conversion time
+  uint16_t maxMs;           // period while flat and far from any breakpoint
+  uint16_t nearCenti;       // this close to a curve breakpoint samples at minMs
+  uint16_t flatCentiPerMin; // slope that still gets maxMs, steeper ones scale down
+  uint8_t leadSamples;      // samples wanted before the next breakpoint can be reached
+};
+const uint32_t samplerPolicyMagic = 0x4b535031; // "KSP1"
+const SamplerPolicy samplerPolicyDefault = {samplerPolicyMagic, 1000, 30000, 50, 25, 4};
+SamplerPolicy samplerPolicy = samplerPolicyDefault;
+const uint16_t samplerReadMarginMs = 50;      // conversion to read back
+const uint32_t samplerSlopeTauMs = 20000;     // slope filter time constant
+const int32_t samplerSlopeClamp = 10000;      // 100 °C/min, keeps the filter in 32 bit
+const uint8_t samplerIdleListenInterval = 3;  // DTIMs the radio may sleep through when idle
+unsigned long samplerPeriodMs = probeSleepMs;
+int32_t samplerSlope[zoneCount];              // 1/100 °C per minute, filtered
+
+// PWM, one output per zone (see ZONES.h)
+short int pwmTaskDelayMs = 100;
+const uint16_t pwmDutyRange = 1000; // analogWrite() in per-mille
+
+// Fan characterisation, measured by CalibrationTask. Once a fan is calibrated
+// the strength 1..100 is spread between the duty that keeps it turning and the
+// duty past which it gets no faster, so every step of the curve does something.
+struct FanMapping {
+  uint32_t magic;
+  uint8_t startDuty;      // percent that gets a stopped fan turning
+  uint8_t holdDuty;       // percent that keeps a turning fan from stalling
+  uint8_t saturationDuty; // percent past which it gets no faster
+  uint8_t method;         // CalibrationMethod
+  uint16_t rpmMax;        // at full duty, 0 without a tach
+};
+const uint32_t fanMappingMagic = 0x4b464d31; // "KFM1"
+FanMapping fanMappings[zoneCount];           // magic 0 while uncalibrated
+const unsigned long fanKickMs = 1000;        // start duty after a standstill
+const uint8_t tachPulsesPerRev = 2;
+volatile uint32_t tachPulses[zoneCount];
+uint16_t tachRpm[zoneCount];
 
-// PWM
-short const int PWMGPIO = 2;
-short int currentPwm;
-short int prevPwm;
-short int pwmTaskDelayMs = 1;
+// Calibration, one zone at a time
+enum CalibrationMethod : uint8_t {
+  CALIBRATION_TACH = 1,        // the fan's own speed
+  CALIBRATION_TEMPERATURE = 2  // how fast it cools the tube, for fans without a tach wire
+};
+enum CalibrationPhase : uint8_t {
+  CALIBRATION_IDLE = 0,
+  CALIBRATION_REQUESTED,
+  CALIBRATION_REFERENCE, // off, then full
+  CALIBRATION_HOLD,      // full downwards until it stalls
+  CALIBRATION_START,     // from standstill upwards until it starts
+  CALIBRATION_DONE,
+  CALIBRATION_FAILED
+};
+struct CalibrationStatus {
+  uint8_t zone;
+  uint8_t phase;  // CalibrationPhase
+  uint8_t method; // CalibrationMethod
+  uint8_t duty;   // percent under test
+  bool abort;
+  const char* error;
+};
+CalibrationStatus calibration = {0, CALIBRATION_IDLE, 0, 0, false, nullptr};
+const int16_t calibrationGuardRaw = 60 * 16; // the tube must not cook while its fan is off
+const uint16_t calibrationMinRpm = 100;      // slower counts as stalled
+const uint8_t calibrationSaturationPercent = 95;
+bool write_persistent_fan_mapping(uint8_t zone);
+// Starts CalibrationTask on a zone, false while one is running
+bool startCalibration(uint8_t zone);
 
 // Auto pilot
-bool autopilotState = false;
 short const int autopilotDelay = 2000;
 const short int autopilotSettingsSize = 20;
-short int autopilotSettings[autopilotSettingsSize][2];// ;//= {{0,0}}; // 0 degrees celsius = 0 pwm strength
+struct AutopilotSettings {
+  CurvePoint points[autopilotSettingsSize];
+};
+Seqlock<AutopilotSettings> autopilotSettings[zoneCount];
+bool write_persistent_autopilot_settings(uint8_t zone, const AutopilotSettings& settings);
+bool write_persistent_zone_settings(uint8_t zone, const ZoneState& state);
+struct PredictiveSettings {
+  int16_t limitRaw;    // 1/16 °C
+  uint16_t horizonS;
+};
+const PredictiveSettings predictiveSettingsDefault = {35 * 16, 300};
+PredictiveSettings predictiveSettings[zoneCount];
+const uint8_t predictiveDeadband = 5;           // percent a new duty has to differ by
+const uint8_t predictiveDither = 10;            // percent, while the model learns
+const unsigned long predictiveDitherMs = 60000; // half period of the dither
+ThermalModel thermalModels[zoneCount];
+const uint32_t thermalModelMagic = 0x4b544d31;   // "KTM1"
+const unsigned long thermalModelSaveMs = 1800000; // flash wear, the model only drifts slowly
+bool write_persistent_thermal_model(uint8_t zone);
+// Control rules, see runRules() and lib/Rules. One program for all zones,
+// published like the curves; the last result of each zone is kept for
+// /metrics.
+Seqlock<RuleProgram> rulesProgram;
+uint32_t rulesTag = 2166136261u;  // of the source, see rulesSourceTag()
+RuleResult rulesResults[zoneCount];
+uint32_t rulesRuns = 0;
+uint32_t rulesFaults[ruleFaultCount];
+uint16_t rulesStepsMax = 0;
+uint32_t rulesRunUsMax = 0;
+void read_persistent_rules();
+bool write_persistent_rules(const char* source, size_t length);
+// Runs the autopilot now instead of on its next release, see AutopilotTask
+void wakeAutopilot();
+// Runs the control tasks that are due from within a long request, see handleUpdateUpload
+void runControlTasks();
+
+// MQTT, see MqttTask
+const unsigned long mqttPollMs = 250;          // how soon a command is picked up
+const unsigned long mqttHeartbeatMs = 60000;   // unchanged state is republished this often
+const unsigned long mqttMinIntervalMs = 1000;  // changes within it go out in one message
+const unsigned long mqttBackoffMinMs = 2000;
+const unsigned long mqttBackoffMaxMs = 60000;
+const uint16_t mqttConnectTimeoutMs = 1000;    // a dead broker blocks the tasks this long per attempt
+const uint16_t mqttBufferSize = 512;           // largest message either way, bigger ones are dropped
+const int16_t mqttTempDeadbandRaw = 2;         // 1/8 °C, probe noise is no change
+const uint8_t mqttOutboxSize = 4;              // command results waiting for the socket
+bool mqttConnected = false;
+uint32_t mqttPublished = 0;
+uint32_t mqttDropped = 0;
+uint32_t mqttCommands = 0;
+uint32_t mqttConnects = 0;
+
+// Telemetry datagram, see TelemetryTask and tools/telemetry_collector.py.
+// Packed little endian; a new field means a new version, appended to the
+// header or to each zone, so collectors can still read the fields they know.
+const uint16_t telemetryMagic = 0x544b; // "KT" on the wire
+const uint8_t telemetryVersion = 1;
+const uint8_t telemetryCalibrating = 0x80; // mode flag
+struct __attribute__((packed)) TelemetryZone {
+  int16_t tempRaw;  // 1/16 °C, INT16_MIN without a reading
+  uint8_t pwm;      // strength
+  uint8_t mode;     // AutopilotMode, telemetryCalibrating while calibrating
+  uint16_t rpm;     // 0 without a tach
+};
+struct __attribute__((packed)) TelemetryPacket {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t zoneCount;
+  uint32_t deviceId; // chip id
+  uint32_t sequence; // gaps are lost packets, it restarts with the device
+  uint32_t uptimeMs;
+  TelemetryZone zones[::zoneCount];
+};
+uint32_t telemetrySent = 0;
+uint32_t telemetryFailed = 0;
+
+// Wall clock, see ClockTask and lib/WallClock. Samples keep their millis(),
+// the clock turns them into Unix time when they are exported.
+const uint32_t clockTickMs = 1000;
+const uint8_t clockRtcOffset = 32;          // in 4 byte blocks, eboot keeps an update's command in the first 128 bytes
+const uint32_t clockRtcMagic = 0x4b434b31;  // "KCK1"
+const uint32_t clockRestoreMaxMs = 3600000; // a longer reset gap is no soft reset
+WallClock wallClock;
+uint32_t ntpFailures = 0;
+uint32_t ntpDelayMs = 0;  // of the last reply used
+
+// Firmware and filesystem updates over HTTP, see handleUpdateUpload
+const unsigned long updateRestartDelayMs = 500; // lets the reply go out first
+struct UpdateSession {
+  bool filesystem;
+  bool gzip;           // a filesystem image inflated on its way to flash
+  bool complete;       // written, verified and committed
+  int code;            // HTTP status of the first failure
+  const char* error;   // first failure, nullptr while fine
+  uint32_t received;   // bytes as uploaded
+  Inflater* inflater;  // only while a gzip image is written, it takes 6 KB
+  MD5Builder md5;      // of the upload, compared to ?md5=
+};
+UpdateSession updateSession;
+bool updateRestartPending = false;
+unsigned long updateRestartAtMs = 0;
+uint32_t updateFailures = 0;
+
+// Control state, shared by the HTTP handlers, the tasks and interrupts.
+// Written from task context only, see Seqlock.h. ZoneState is declared with
+// its schema in include/SETTINGS.h.
+// All zones in one snapshot, so the tasks read and publish them in one pass
+struct ControlState {
+  ZoneState zones[zoneCount];
+  int16_t probeRaw[probesMax];  // every probe on the bus, tempRawInvalid without a reading
+};
+Seqlock<ControlState> controlState;
+
+// 1/16 °C to 1/100 °C, rounded, for the API
+long tempRawToCenti(int16_t raw) {
+  long scaled = (long) raw * 100;
+  return (scaled + (scaled < 0 ? -tempRawPerDegree / 2 : tempRawPerDegree / 2)) / tempRawPerDegree;
+}
+
+// A strength, floor or cap from the rules as a duty
+short int ruleDuty(int32_t value){
+  if(value <= 0){
+    return 0;
+  }
+  return value >= 100 * ruleOne ? 100 : (value + ruleOne / 2) / ruleOne;
+}
+
+// A temperature from the rules in 1/16 °C, which Q4 already is
+int16_t ruleTempRaw(int32_t value){
+  return constrain(value, (int32_t) INT16_MIN + 1, (int32_t) INT16_MAX);
+}
+
+// Profiling
+short const int heapSampleDelayMs = 1000;
+uint32_t heapFree = 0;
+uint32_t heapFreeMin = UINT32_MAX;
+uint32_t heapMaxBlock = 0;
+uint32_t heapMaxBlockMin = UINT32_MAX;
+uint8_t heapFragmentation = 0;
+uint8_t heapFragmentationMax = 0;
+
+////////////////////////////////
+// Request arena
+// Handlers build their replies in this fixed block instead of on the heap.
+// It is released as a whole once the request has been served.
+const size_t requestArenaSize = 1536;
+StaticRequestArena<requestArenaSize> requestArena;
+
+// Chunk size for replies that are streamed (metrics, listings)
+const size_t replyChunkSize = 512;
 
+void sendChunk(const char* data, size_t length) {
+  server.sendContent(data, length);
+}
 
 ////////////////////////////////
 // Utils to return HTTP codes, and determine content-type
+// Messages may live in flash (F(), PROGMEM) or RAM.
+
+void replyWithMsg(int code, PGM_P msg, bool newline) {
+  StrBuilder body(requestArena, strlen_P(msg) + 2);
+  body.appendP(msg);
+  if (newline) {
+    DBG_OUTPUT_PORT.println(body.c_str());
+    body += "\r\n";
+  }
+  server.send_P(code, TEXT_PLAIN, body.c_str(), body.length());
+}
 
 void replyOK() {
-  server.send(200, FPSTR(TEXT_PLAIN), "");
+  server.send_P(200, TEXT_PLAIN, "", 0);
+}
+
+void replyOKWithMsg(PGM_P msg) {
+  replyWithMsg(200, msg, false);
+}
+
+void replyOKWithMsg(const __FlashStringHelper* msg) {
+  replyOKWithMsg(reinterpret_cast<PGM_P>(msg));
+}
+
+void replyNotFound(PGM_P msg) {
+  replyWithMsg(404, msg, false);
+}
+
+void replyNotFound(const __FlashStringHelper* msg) {
+  replyNotFound(reinterpret_cast<PGM_P>(msg));
+}
+
+void replyBadRequest(PGM_P msg) {
+  replyWithMsg(400, msg, true);
+}
+
+void replyBadRequest(const __FlashStringHelper* msg) {
+  replyBadRequest(reinterpret_cast<PGM_P>(msg));
+}
+
+void replyServerError(PGM_P msg) {
+  replyWithMsg(500, msg, true);
+}
+
+void replyServerError(const __FlashStringHelper* msg) {
+  replyServerError(reinterpret_cast<PGM_P>(msg));
+}
+
+/*
+   Content type from the core's mime table, without building a String
+*/
+PGM_P contentTypeFor(const char* path) {
+  size_t pathLength = strlen(path);
+  for (int i = 0; i < mime::maxType - 1; i++) {
+    PGM_P suffix = mime::mimeTable[i].endsWith;
+    size_t suffixLength = strlen_P(suffix);
+    if (suffixLength && pathLength >= suffixLength && strcmp_P(path + pathLength - suffixLength, suffix) == 0) {
+      return mime::mimeTable[i].mimeType;
+    }
+  }
+  return mime::mimeTable[mime::maxType - 1].mimeType;
+}
+
+/*
+   URL decode into the request arena ('+' and %XX escapes)
+*/
+const char* urlDecode(const String& text) {
+  StrBuilder decoded(requestArena, text.length());
+  const char* in = text.c_str();
+  while (*in) {
+    char c = *in++;
+    if (c == '+') {
+      c = ' ';
+    } else if (c == '%' && isxdigit(in[0]) && isxdigit(in[1])) {
+      char hex[3] = {in[0], in[1], 0};
+      c = (char) strtol(hex, nullptr, 16);
+      in += 2;
+    }
+    decoded += c;
+  }
+  return decoded.c_str();
+}
+
+/*
+   Whole decimal number, false for anything after the digits or a value out
+   of the range of long
+*/
+bool parseLong(const char* text, long& value) {
+  char* end;
+  errno = 0;
+  value = strtol(text, &end, 10);
+  return end != text && *end == '\0' && errno != ERANGE;
+}
+
+/*
+   Zone index or name, -1 if there is no such zone
+*/
+int8_t parseZone(const char* zone) {
+  if (isdigit(zone[0])) {
+    int index = atoi(zone);
+    return index < zoneCount ? index : -1;
+  }
+  for (uint8_t i = 0; i < zoneCount; i++) {
+    if (strcmp(zone, zoneNames[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+   Zone a request addresses, by index or name (?zone=1, ?zone=left), 0 if it
+   names none and -1 if it names one that does not exist
+*/
+int8_t requestZone() {
+  if (!server.hasArg("zone")) {
+    return 0;
+  }
+  return parseZone(server.arg("zone").c_str());
+}
+
+/*
+   Persistence file of a zone, zone 0 keeps the single zone name
+*/
+const char* zoneLocation(const char* location, uint8_t zone, char* path, size_t size) {
+  if (zone == 0) {
+    return location;
+  }
+  snprintf(path, size, "%s-%u", location, zone);
+  return path;
+}
+
+////////////////////////////////
+// Commands
+// What PUT /pwm, PUT /autopilot/{state} and POST /autopilot do, shared with
+// the MQTT command topics
+
+enum CommandResult : uint8_t {
+  COMMAND_OK = 0,
+  COMMAND_CALIBRATING,
+  COMMAND_BAD_VALUE,
+  COMMAND_PERSISTENCE_FAILED,
+  COMMAND_UNCHANGED  // already set, nothing was written
+};
+const char* const commandResultNames[] = {"OK", "CALIBRATING", "BAD VALUE", "PERSISTENCE FAILED", "UNCHANGED"};
+
+// Entity tags of a zone's settings (GET /pwm) and of its curve (GET
+// /autopilot), equal settings give equal tags
+uint32_t zoneSettingsTag(const ZoneState& state){
+  return schemaHash(zoneSettingsSchema, &state, 1);
+}
+uint32_t curveTag(const AutopilotSettings& settings){
+  return schemaHash(curvePointSchema, settings.points, autopilotSettingsSize);
+}
+
+// Takes the value wide so it is range checked before it goes into the field
+CommandResult setPwm(uint8_t zone, long value){
+  const ZoneState current = controlState.read().zones[zone];
+  if (current.calibrating){
+    return COMMAND_CALIBRATING;
+  }
+  if (!zoneSettingsSchema.field<0>().accepts(value)){
+    return COMMAND_BAD_VALUE;
+  }
+  short int currentPwm = value;
+  if (current.currentPwm == currentPwm){
+    return COMMAND_UNCHANGED;
+  }
+  controlState.update([zone, currentPwm](ControlState& control) {
+    control.zones[zone].currentPwm = currentPwm;
+  });
+  if (!write_persistent_zone_settings(zone, controlState.read().zones[zone])) {
+    return COMMAND_PERSISTENCE_FAILED;
+  }
+  DBG_OUTPUT_PORT.printf("New current PWM written for zone %d: %d\n", zone, currentPwm);
+  return COMMAND_OK;
+}
+
+// Enabled, Disabled or Predictive, -1 for anything else
+int8_t parseAutopilotMode(const char* name){
+  long mode = zoneSettingsSchema.field<1>().valueOf(name);
+  return mode >= 0 ? mode : -1;
 }
 
-void replyOKWithMsg(String msg) {
-  server.send(200, FPSTR(TEXT_PLAIN), msg);
+CommandResult setAutopilotState(uint8_t zone, uint8_t autopilotState){
+  if (controlState.read().zones[zone].autopilotState == autopilotState){
+    return COMMAND_UNCHANGED;
+  }
+  controlState.update([zone, autopilotState](ControlState& control) {
+    control.zones[zone].autopilotState = autopilotState;
+  });
+  wakeAutopilot();
+  return write_persistent_zone_settings(zone, controlState.read().zones[zone]) ? COMMAND_OK : COMMAND_PERSISTENCE_FAILED;
 }
 
-void replyNotFound(String msg) {
-  server.send(404, FPSTR(TEXT_PLAIN), msg);
+/*
+   The curve in doc, an array of up to autopilotSettingsSize points
+*/
+CommandResult setAutopilotCurve(uint8_t zone){
+  JsonArrayConst points = doc.as<JsonArrayConst>();
+  if (points.isNull() || points.size() > autopilotSettingsSize){
+    return COMMAND_BAD_VALUE;
+  }
+  // Build the new curve aside and publish it at once, so the autopilot never
+  // evaluates a half written one
+  AutopilotSettings settings = {};
+  byte count = 0;
+  for (JsonVariantConst point : points){
+    if (!point.is<JsonObjectConst>() || schemaFromJson(curvePointSchema, point.as<JsonObjectConst>(), settings.points[count++])){
+      return COMMAND_BAD_VALUE;
+    }
+  }
+  const AutopilotSettings current = autopilotSettings[zone].read();
+  if (memcmp(&current, &settings, sizeof(settings)) == 0){
+    return COMMAND_UNCHANGED;
+  }
+  autopilotSettings[zone].write(settings);
+  wakeAutopilot();
+  return write_persistent_autopilot_settings(zone, settings) ? COMMAND_OK : COMMAND_PERSISTENCE_FAILED;
 }
 
-void replyBadRequest(String msg) {
-  DBG_OUTPUT_PORT.println(msg);
-  server.send(400, FPSTR(TEXT_PLAIN), msg + "\r\n");
+// FNV-1a of the rules' source, the ETag of GET /rules; equal text gives equal tags
+uint32_t rulesSourceTag(const char* source, size_t length){
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t) source[i]) * 16777619u;
+  }
+  return hash;
 }
 
-void replyServerError(String msg) {
-  DBG_OUTPUT_PORT.println(msg);
-  server.send(500, FPSTR(TEXT_PLAIN), msg + "\r\n");
+/*
+   Compiles source into program and, unless check, publishes it as the rules
+   of all zones and stores it. An empty source removes them. BAD VALUE comes
+   with what error says.
+*/
+CommandResult setRules(const char* source, size_t length, bool check, RuleProgram& program, RuleError& error){
+  if (!ruleCompile(source, length, program, error)){
+    return COMMAND_BAD_VALUE;
+  }
+  uint32_t tag = rulesSourceTag(source, length);
+  if (check){
+    return COMMAND_OK;
+  }
+  if (tag == rulesTag){
+    return COMMAND_UNCHANGED;
+  }
+  rulesProgram.write(program);
+  rulesTag = tag;
+  wakeAutopilot();
+  return write_persistent_rules(source, length) ? COMMAND_OK : COMMAND_PERSISTENCE_FAILED;
 }
 
 ////////////////////////////////
 // Request handlers
 
+// 200 with msg, or the command's error
+void replyCommand(CommandResult result, const char* msg) {
+  if (result == COMMAND_OK) {
+    return replyOKWithMsg(msg);
+  }
+  if (result == COMMAND_UNCHANGED) {
+    return replyOKWithMsg(commandResultNames[result]);
+  }
+  if (result == COMMAND_PERSISTENCE_FAILED) {
+    return replyServerError(commandResultNames[result]);
+  }
+  replyBadRequest(commandResultNames[result]);
+}
+
+// ETag: "<tag in hex>"
+void sendETag(uint32_t tag) {
+  char value[12];
+  snprintf(value, sizeof(value), "\"%08lx\"", (unsigned long) tag);
+  server.sendHeader(F("ETag"), value);
+}
+
+/*
+   False if the request carries an If-Match without tag or "*" in it: the
+   client changes what it read before someone else changed it (RFC 9110
+   13.1.1). Weak tags never match.
+*/
+bool ifMatch(uint32_t tag) {
+  const String& header = server.header("If-Match");
+  char value[12];
+  int valueLength = snprintf(value, sizeof(value), "\"%08lx\"", (unsigned long) tag);
+  const char* p = header.c_str();
+  if (!*p) {
+    return true;
+  }
+  while (*p) {
+    while (*p == ' ' || *p == ',') {
+      p++;
+    }
+    if (*p == '*') {
+      return true;
+    }
+    const char* end = strchr(p, ',');
+    int length = end ? end - p : strlen(p);
+    while (length && p[length - 1] == ' ') {
+      length--;
+    }
+    if (length == valueLength && strncmp(p, value, length) == 0) {
+      return true;
+    }
+    p = end ? end : p + length;
+  }
+  return false;
+}
+
+// 412 with the tag the client should have sent
+void replyPreconditionFailed(uint32_t tag) {
+  sendETag(tag);
+  replyWithMsg(412, PSTR("PRECONDITION FAILED"), true);
+}
+
 /*
    Return the FS type, status and size info
 */
 void handleStatus() {
   DBG_OUTPUT_PORT.println("New /status request");
   FSInfo fs_info;
-  String json;
-  json.reserve(128);
+  StrBuilder json(requestArena, 160);
 
-  json = "{\"type\":\"";
+  json += "{\"type\":\"";
   json += fsName;
   json += "\", \"isOk\":";
   if (fsOK) {
@@ -132,13 +713,189 @@ void handleStatus() {
   json += unsupportedFiles;
   json += "\"}";
 
-  server.send(200, "application/json", json);
+  server.send(200, "application/json", json.c_str(), json.length());
+}
+
+
+/*
+   Pre-order walk of a folder and its subfolders down to maxDepth levels below
+   it, iterative: one open Dir per level and one path buffer, so the stack use
+   is fixed however the tree is nested. Entries whose full path would not fit
+   in pathMax are skipped; the file handlers cannot create those anyway.
+   Nothing is opened before the first next().
+*/
+class FsWalk {
+public:
+  FsWalk(const char* root, uint8_t maxDepth) : _maxDepth(min(maxDepth, fsWalkDepthMax)) {
+    size_t length = strlen(root);
+    // "/" walks as "", so every path comes out as "/name"
+    while (length && root[length - 1] == '/') {
+      length--;
+    }
+    if (length >= pathMax) {
+      length = 0;
+      _done = true;
+    }
+    memcpy(_path, root, length);
+    _path[length] = 0;
+    _lengths[0] = _rootLength = length;
+  }
+
+  bool next();
+  // Full path of the current entry
+  const char* path() const { return _path; }
+  // Path below the walked folder, without the leading '/'
+  const char* relative() const { return _path + _rootLength + 1; }
+  // 0 for the walked folder's own entries
+  uint8_t depth() const { return _level; }
+  bool isDirectory() const { return _isDirectory; }
+  size_t fileSize() const { return _size; }
+  File openFile(const char* mode) { return _dirs[_level].openFile(mode); }
+
+private:
+  Dir _dirs[fsWalkDepthMax + 1];
+  uint8_t _lengths[fsWalkDepthMax + 1];  // of _path at each level
+  char _path[pathMax];
+  uint8_t _rootLength;
+  uint8_t _maxDepth;
+  uint8_t _level = 0;
+  bool _started = false;
+  bool _descend = false;
+  bool _done = false;
+  bool _isDirectory = false;
+  size_t _size = 0;
+};
+
+bool FsWalk::next() {
+  if (_done) {
+    return false;
+  }
+  if (!_started) {
+    _started = true;
+    _dirs[0] = fileSystem->openDir(_rootLength ? _path : "/");
+  }
+  if (_descend) {
+    // the previous entry was a folder to go into
+    _descend = false;
+    _level++;
+    _lengths[_level] = strlen(_path);
+    _dirs[_level] = fileSystem->openDir(_path);
+  }
+  while (true) {
+    Dir& dir = _dirs[_level];
+    if (dir.next()) {
+      const String& name = dir.fileName();
+      uint8_t length = _lengths[_level];
+      if (length + 1 + name.length() >= sizeof(_path)) {
+        continue;
+      }
+      _path[length] = '/';
+      memcpy(_path + length + 1, name.c_str(), name.length() + 1);
+      _isDirectory = dir.isDirectory();
+      _size = _isDirectory ? 0 : dir.fileSize();
+      _descend = _isDirectory && _level < _maxDepth;
+      return true;
+    }
+    if (_level == 0) {
+      _done = true;
+      return false;
+    }
+    dir = Dir();
+    _level--;
+  }
 }
 
 
+/*
+   The last listing, so paging through a folder does not walk it again for
+   every page. Rebuilt when another folder or depth is listed, and dropped by
+   any create, rename, upload or delete (fsGeneration). The firmware rewrites
+   its own state files behind the handlers' back, a size that changed that way
+   shows up once the index is dirIndexMaxAgeMs old.
+   A folder with more entries than fit is indexed up to the limit, later pages
+   are walked to.
+*/
+struct DirIndexEntry {
+  uint16_t name;    // offset in the pool
+  bool directory;
+  uint32_t size;
+};
+struct DirIndex {
+  uint16_t build;         // identifies the index in cursors, 0 while there is none
+  uint32_t generation;
+  unsigned long builtMs;
+  char dir[pathMax];
+  uint8_t depth;
+  bool complete;          // false when the walk went on past the last entry
+  uint8_t count;
+  uint16_t poolUsed;
+  DirIndexEntry entries[dirIndexMax];
+  char pool[dirIndexPoolSize];  // relative paths, each 0 terminated
+};
+DirIndex dirIndex;
+uint32_t dirIndexBuilds = 0;
+uint32_t dirIndexHits = 0;
+
+bool dirIndexFresh(const char* dir, uint8_t depth) {
+  const DirIndex& index = dirIndex;
+  return index.build && index.generation == fsGeneration && millis() - index.builtMs < dirIndexMaxAgeMs
+         && index.depth == depth && strcmp(index.dir, dir) == 0;
+}
+
+void buildDirIndex(const char* dir, uint8_t depth) {
+  DirIndex& index = dirIndex;
+  index.count = 0;
+  index.poolUsed = 0;
+  index.complete = true;
+  FsWalk walk(dir, depth);
+  while (walk.next()) {
+    size_t length = strlen(walk.relative()) + 1;
+    if (index.count == dirIndexMax || index.poolUsed + length > sizeof(index.pool)) {
+      index.complete = false;
+      break;
+    }
+    DirIndexEntry& entry = index.entries[index.count++];
+    entry.name = index.poolUsed;
+    entry.directory = walk.isDirectory();
+    entry.size = walk.fileSize();
+    memcpy(index.pool + index.poolUsed, walk.relative(), length);
+    index.poolUsed += length;
+  }
+  snprintf(index.dir, sizeof(index.dir), "%s", dir);
+  index.depth = depth;
+  index.generation = fsGeneration;
+  index.builtMs = millis();
+  index.build = index.build == UINT16_MAX ? 1 : index.build + 1;
+  dirIndexBuilds++;
+}
+
+void appendListEntry(StrBuilder& output, bool& first, bool directory, size_t size, const char* name) {
+  if (!first) {
+    output += ',';
+  }
+  first = false;
+
+  output += "{\"type\":\"";
+  if (directory) {
+    output += "dir";
+  } else {
+    output += F("file\",\"size\":\"");
+    output += (unsigned long) size;
+  }
+
+  output += F("\",\"name\":\"");
+  output += name;
+  output += "\"}";
+}
+
 /*
    Return the list of files in the directory specified by the "dir" query string parameter.
-   Also demonstrates the use of chuncked responses.
+   ?depth=n also lists the subfolders n levels down (up to fsWalkDepthMax),
+   names are then relative to dir, e.g. "js/app.js".
+   At most ?limit= (default and maximum listPageMax) entries are returned,
+   when there are more the X-Next-Cursor header holds the ?cursor= for the
+   next page. A cursor from before the folder changed gets 409 STALE CURSOR,
+   the listing has to start over.
 */
 void handleFileList() {
   if (!fsOK) {
@@ -149,88 +906,172 @@ void handleFileList() {
     return replyBadRequest(F("DIR ARG MISSING"));
   }
 
-  String path = server.arg("dir");
-  if (path != "/" && !fileSystem->exists(path)) {
-    return replyBadRequest("BAD PATH");
+  const String& path = server.arg("dir");
+  if (path.length() >= pathMax || (path != "/" && !fileSystem->exists(path))) {
+    return replyBadRequest(F("BAD PATH"));
   }
+  uint8_t depth = server.hasArg("depth") ? constrain(server.arg("depth").toInt(), 0, fsWalkDepthMax) : 0;
+  uint8_t limit = server.hasArg("limit") ? constrain(server.arg("limit").toInt(), 1, listPageMax) : listPageMax;
 
-  DBG_OUTPUT_PORT.println(String("handleFileList: ") + path);
-  Dir dir = fileSystem->openDir(path);
-  path.clear();
+  DBG_OUTPUT_PORT.print(F("handleFileList: "));
+  DBG_OUTPUT_PORT.println(path);
+
+  DirIndex& index = dirIndex;
+  bool fresh = dirIndexFresh(path.c_str(), depth);
+  unsigned position = 0;
+  if (server.hasArg("cursor")) {
+    unsigned build;
+    if (sscanf(server.arg("cursor").c_str(), "%u.%u", &build, &position) != 2) {
+      return replyBadRequest(F("BAD CURSOR"));
+    }
+    if (!fresh || build != index.build) {
+      return replyWithMsg(409, PSTR("STALE CURSOR"), true);
+    }
+  }
+  if (fresh) {
+    dirIndexHits++;
+  } else {
+    buildDirIndex(path.c_str(), depth);
+  }
+
+  // more entries after this page; a page past the index is walked to, and
+  // as it is sent while walking its cursor may lead to an empty last page
+  bool more;
+  bool walked = position + limit > index.count && !index.complete;
+  FsWalk walk(path.c_str(), depth);
+  if (!walked) {
+    more = position + limit < index.count || !index.complete;
+  } else {
+    more = true;
+    for (unsigned skipped = 0; more && skipped < position; skipped++) {
+      more = walk.next();
+    }
+  }
 
+  if (more) {
+    char cursor[12];
+    snprintf(cursor, sizeof(cursor), "%u.%u", index.build, position + limit);
+    server.sendHeader(F("X-Next-Cursor"), cursor);
+  }
   // use HTTP/1.1 Chunked response to avoid building a huge temporary string
   if (!server.chunkedResponseModeStart(200, "text/json")) {
     server.send(505, F("text/html"), F("HTTP1.1 required"));
     return;
   }
 
-  // use the same string for every line
-  String output;
-  output.reserve(64);
-  while (dir.next()) {
-    if (output.length()) {
-      // send string from previous iteration
-      // as an HTTP chunk
-      server.sendContent(output);
-      output = ',';
-    } else {
-      output = '[';
-    }
-
-    output += "{\"type\":\"";
-    if (dir.isDirectory()) {
-      output += "dir";
-    } else {
-      output += F("file\",\"size\":\"");
-      output += dir.fileSize();
+  // one buffer for every line, sent as an HTTP chunk whenever it fills up
+  StrBuilder output(requestArena, replyChunkSize, sendChunk);
+  output += '[';
+  bool first = true;
+  if (walked) {
+    for (uint8_t n = 0; n < limit && walk.next(); n++) {
+      appendListEntry(output, first, walk.isDirectory(), walk.fileSize(), walk.relative());
     }
-
-    output += F("\",\"name\":\"");
-    // Always return names without leading "/"
-    if (dir.fileName()[0] == '/') {
-      output += &(dir.fileName()[1]);
-    } else {
-      output += dir.fileName();
+  } else {
+    for (unsigned i = position; i < position + limit && i < index.count; i++) {
+      const DirIndexEntry& entry = index.entries[i];
+      appendListEntry(output, first, entry.directory, entry.size, index.pool + entry.name);
     }
-
-    output += "\"}";
   }
 
   // send last string
   output += "]";
-  server.sendContent(output);
+  output.flush();
   server.chunkedResponseFinalize();
 }
 
 
+/*
+   Content hashes of the frontend assets, for tools/sync_assets.py:
+   {"files":[{"path":"/index.htm","size":221,"md5":"..."}]}
+   Device state (varPrefix) is left out.
+*/
+void handleManifest() {
+  DBG_OUTPUT_PORT.println("New /manifest request");
+  if (!fsOK) {
+    return replyServerError(FPSTR(FS_INIT_ERROR));
+  }
+  if (!server.chunkedResponseModeStart(200, "application/json")) {
+    server.send(505, F("text/html"), F("HTTP1.1 required"));
+    return;
+  }
+  StrBuilder output(requestArena, replyChunkSize, sendChunk);
+  output += F("{\"files\":[");
+  bool first = true;
+  FsWalk walk("/", fsWalkDepthMax);
+  while (walk.next()) {
+    if (walk.isDirectory() || strncmp(walk.path(), varPrefix, strlen(varPrefix)) == 0) {
+      continue;
+    }
+    File file = walk.openFile("r");
+    if (!file) {
+      continue;
+    }
+    MD5Builder md5;
+    md5.begin();
+    uint8_t buffer[256];
+    size_t size = 0;
+    size_t n;
+    while ((n = file.read(buffer, sizeof(buffer))) > 0) {
+      md5.add(buffer, n);
+      size += n;
+    }
+    file.close();
+    md5.calculate();
+    char hex[33];
+    md5.getChars(hex);
+
+    if (!first) {
+      output += ',';
+    }
+    first = false;
+    output += F("{\"path\":\"");
+    output += walk.path();
+    output += F("\",\"size\":");
+    output += (unsigned long) size;
+    output += F(",\"md5\":\"");
+    output += hex;
+    output += F("\"}");
+    // hashing a large file takes a while
+    runControlTasks();
+  }
+  output += F("]}");
+  output.flush();
+  server.chunkedResponseFinalize();
+}
+
 /*
    Read the given file from the filesystem and stream it back to the client
 */
-bool handleFileRead(String path) {
-  DBG_OUTPUT_PORT.println(String("handleFileRead: ") + path);
+bool handleFileRead(const char* uri) {
+  DBG_OUTPUT_PORT.print(F("handleFileRead: "));
+  DBG_OUTPUT_PORT.println(uri);
   if (!fsOK) {
     replyServerError(FPSTR(FS_INIT_ERROR));
     return true;
   }
 
-  if (path.endsWith("/")) {
+  // room for "index.htm" and ".gz"
+  StrBuilder path(requestArena, strlen(uri) + 12);
+  path += uri;
+  if (uri[0] && uri[strlen(uri) - 1] == '/') {
     path += "index.htm";
   }
 
-  String contentType;
+  PGM_P contentType;
   if (server.hasArg("download")) {
-    contentType = F("application/octet-stream");
+    contentType = PSTR("application/octet-stream");
   } else {
-    contentType = mime::getContentType(path);
+    contentType = contentTypeFor(path.c_str());
   }
 
-  if (!fileSystem->exists(path)) {
+  if (!fileSystem->exists(path.c_str())) {
     // File not found, try gzip version
-    path = path + ".gz";
+    path += ".gz";
   }
-  if (fileSystem->exists(path)) {
-    File file = fileSystem->open(path, "r");
-    if (server.streamFile(file, contentType) != file.size()) {
+  if (fileSystem->exists(path.c_str())) {
+    File file = fileSystem->open(path.c_str(), "r");
+    if (server.streamFile(file, FPSTR(contentType)) != file.size()) {
       DBG_OUTPUT_PORT.println("Sent less data than expected!");
     }
     file.close();
@@ -242,105 +1083,904 @@ bool handleFileRead(String path) {
 
 
 
-void handleMetrics(){
-  DBG_OUTPUT_PORT.println("New /metrics request");
-  String metrics;
-  metrics += "kirby_temperature_current " + String(tempCelcius) + "\n";
-  metrics += "kirby_pwm_prev " + String(prevPwm) + "\n";
-  metrics += "kirby_pwm_current " + String(currentPwm) + "\n";
-  metrics += "kirby_autopilot_state " + String(autopilotState) + "\n";
-  for(byte i=0; i< autopilotSettingsSize ; i++){
-    if(autopilotSettings[i][1]){
-      metrics += "kirby_autopilot_setting{temperature=\"" + String(autopilotSettings[i][0]) + "\"} " + String(autopilotSettings[i][1]) + "\n";
-    }
+/*
+   As some FS (e.g. LittleFS) delete the parent folder when the last child has been removed,
+   cut path back to the closest parent still existing
+*/
+void truncateToExistingParent(StrBuilder& path) {
+  while (path.length() && !fileSystem->exists(path.c_str())) {
+    const char* slash = strrchr(path.c_str(), '/');
+    path.truncate(slash && slash > path.c_str() ? slash - path.c_str() : 0);
   }
-  // metrics += "kirby_autopilot_setting{strength=\"100\"} " + String(autopilotState);
-  server.send(200, "text/html", metrics);
-
+  DBG_OUTPUT_PORT.print(F("Last existing parent: "));
+  DBG_OUTPUT_PORT.println(path.c_str());
 }
 
-void handlePWM(){
-  DBG_OUTPUT_PORT.println("New /pwm request\n ");
-  String path = server.arg("dir");
-  DBG_OUTPUT_PORT.println(path);
-  if (server.method() == HTTP_GET && path == "/pwm"){
-    server.send(200, "application/json", String(currentPwm));
-    return;
-  }
-  if (server.method() != HTTP_PUT && server.method() != HTTP_GET){
-    return replyServerError(FPSTR(WRONG_METHOD));
+/*
+   Handle the creation/rename of a new file
+   Operation      | req.responseText
+   ---------------+--------------------------------------------------------------
+   Create file    | parent of created file
+   Create folder  | parent of created folder
+   Rename file    | parent of source file
+   Move file      | parent of source file, or remaining ancestor
+   Rename folder  | parent of source folder
+   Move folder    | parent of source folder, or remaining ancestor
+*/
+void handleFileCreate() {
+  if (!fsOK) {
+    return replyServerError(FPSTR(FS_INIT_ERROR));
   }
 
-  if (path == "/" || path == "/pwm" || path == "/pwm/"){
-    return replyBadRequest("BAD PATH");
+  const String& pathArg = server.arg("path");
+  if (pathArg.isEmpty()) {
+    return replyBadRequest(F("PATH ARG MISSING"));
+  }
+  if (pathArg == "/") {
+    return replyBadRequest(F("BAD PATH"));
+  }
+  if (fileSystem->exists(pathArg)) {
+    return replyBadRequest(F("PATH FILE EXISTS"));
   }
-  // char delimiter[] = "/";
-  char charUri[server.uri().length()];
-  server.uri().toCharArray(charUri, server.uri().length()+1);
+  StrBuilder path(requestArena, pathArg.length());
+  path += pathArg;
 
-  // Returns first token 
-  char* token = strtok(charUri, "/"); 
-  byte i = 0;
+  const String& srcArg = server.arg("src");
+  if (srcArg.isEmpty()) {
+    // No source specified: creation
+    DBG_OUTPUT_PORT.print(F("handleFileCreate: "));
+    DBG_OUTPUT_PORT.println(path.c_str());
+    if (path.c_str()[path.length() - 1] == '/') {
+      // Create a folder
+      path.truncate(path.length() - 1);
+      if (!fileSystem->mkdir(path.c_str())) {
+        return replyServerError(F("MKDIR FAILED"));
+      }
+    } else {
+      // Create a file
+      File file = fileSystem->open(path.c_str(), "w");
+      if (!file) {
+        return replyServerError(F("CREATE FAILED"));
+      }
+      file.close();
+    }
+    fsGeneration++;
+    const char* slash = strrchr(path.c_str(), '/');
+    if (slash) {
+      path.truncate(slash - path.c_str());
+    }
+    replyOKWithMsg(path.c_str());
+  } else {
+    // Source specified: rename
+    if (srcArg == "/") {
+      return replyBadRequest(F("BAD SRC"));
+    }
+    if (!fileSystem->exists(srcArg)) {
+      return replyBadRequest(F("SRC FILE NOT FOUND"));
+    }
+    StrBuilder src(requestArena, srcArg.length());
+    src += srcArg;
 
-  // FIXME: Remove while loop, for now: if it sits it fits
-  while (token != NULL) { 
-        if(i==1){
-          currentPwm = String(token).toInt();
-          // newPwmVal = token;
-        }
-        printf("%s\n", token); 
-        token = strtok(NULL, "/");
-        i++;
-  } 
+    DBG_OUTPUT_PORT.printf("handleFileCreate: %s from %s\n", path.c_str(), src.c_str());
 
-  // // Persist new value
-  File file = fileSystem->open(locPwmCurrent, "w");
-  if (file) {
-    file.write(currentPwm);
-    file.close();
-    DBG_OUTPUT_PORT.println("New current PWM written: " + currentPwm);
-    return replyOKWithMsg(String(currentPwm));
-  } else {
-    return replyServerError(F("PERSISTENCE FAILED"));
+    if (path.c_str()[path.length() - 1] == '/') {
+      path.truncate(path.length() - 1);
+    }
+    if (src.c_str()[src.length() - 1] == '/') {
+      src.truncate(src.length() - 1);
+    }
+    if (!fileSystem->rename(src.c_str(), path.c_str())) {
+      return replyServerError(F("RENAME FAILED"));
+    }
+    fsGeneration++;
+    truncateToExistingParent(src);
+    replyOKWithMsg(src.c_str());
   }
-  
 }
 
-void handleAutoPilot(){
-  DBG_OUTPUT_PORT.println("New /autopilot request");
-  if (server.method() == HTTP_GET){
-    String json = "[\n";
-    for(byte i=0; i<autopilotSettingsSize; i++){
-      if(autopilotSettings[i][0] != 0){
-        if(i>0){
-          json += ",\n";
-        }
-        json += "\t{";
+/*
+   Delete the file or folder designed by the given path.
+   If it's a file, delete it.
+   If it's a folder, delete all nested contents first then the folder itself.
+   This runs without recursion and keeps nothing but the current path: the
+   files of a folder are removed, then the first subfolder is entered, and an
+   empty folder is removed and left for its parent. Every pass removes
+   something or goes one level deeper, so a folder that cannot be emptied
+   ends the walk instead of looping. False if anything was left behind.
+*/
+bool deleteRecursive(const char* root) {
+  File file = fileSystem->open(root, "r");
+  bool isDir = file.isDirectory();
+  file.close();
 
-        json += "\t\t\"temperature\" : \"";
-        json += autopilotSettings[i][0];
-        json += "\", \n";
-        
-        json += "\t\t\"strength\" : \"";
-        json += autopilotSettings[i][1];
-        json += "\", \n";
+  // If it's a plain file, delete it
+  if (!isDir) {
+    return fileSystem->remove(root);
+  }
 
-        json += "\t}";
+  char path[pathMax];
+  size_t rootLength = strlen(root);
+  if (rootLength >= sizeof(path)) {
+    return false;
+  }
+  memcpy(path, root, rootLength + 1);
+  while (true) {
+    size_t length = strlen(path);
+    bool removed = false;
+    bool descend = false;
+    Dir dir = fileSystem->openDir(path);
+    while (dir.next()) {
+      const String& name = dir.fileName();
+      if (length + 1 + name.length() >= sizeof(path)) {
+        return false;
+      }
+      path[length] = '/';
+      memcpy(path + length + 1, name.c_str(), name.length() + 1);
+      if (dir.isDirectory()) {
+        descend = true;
+        break;
       }
+      if (!fileSystem->remove(path)) {
+        return false;
+      }
+      removed = true;
+      path[length] = 0;
     }
-    json += "\n]";
-    server.send(200, "application/json", json);
-    return;
-  }
-  // TODO: use state toggle
-  if (server.method() == HTTP_PUT){
-    
+    if (descend) {
+      continue;
+    }
+    if (removed) {
+      // removing while listing may skip entries, look again
+      continue;
+    }
+    // LittleFS drops a folder with its last file, it may be gone already
+    fileSystem->rmdir(path);
+    if (fileSystem->exists(path)) {
+      return false;
+    }
+    if (length <= rootLength) {
+      return true;
+    }
+    *strrchr(path, '/') = 0;
   }
-  if (server.method() == HTTP_POST){
-    DBG_OUTPUT_PORT.println("Uploading new autopilot settings");
-    
-    // Deserialize the JSON document
-    DeserializationError error = deserializeJson(doc, server.arg(0));
+}
+
+/*
+   Handle a file deletion request
+   Operation      | req.responseText
+   ---------------+--------------------------------------------------------------
+   Delete file    | parent of deleted file, or remaining ancestor
+   Delete folder  | parent of deleted folder, or remaining ancestor
+*/
+void handleFileDelete() {
+  if (!fsOK) {
+    return replyServerError(FPSTR(FS_INIT_ERROR));
+  }
+
+  const String& pathArg = server.arg(0);
+  if (server.args() == 0 || pathArg.isEmpty() || pathArg == "/") {
+    return replyBadRequest(F("BAD PATH"));
+  }
+
+  DBG_OUTPUT_PORT.print(F("handleFileDelete: "));
+  DBG_OUTPUT_PORT.println(pathArg);
+  if (!fileSystem->exists(pathArg)) {
+    return replyNotFound(FPSTR(FILE_NOT_FOUND));
+  }
+  StrBuilder path(requestArena, pathArg.length());
+  path += pathArg;
+  bool deleted = deleteRecursive(path.c_str());
+  fsGeneration++;
+  if (!deleted) {
+    return replyServerError(F("DELETE FAILED"));
+  }
+
+  truncateToExistingParent(path);
+  replyOKWithMsg(path.c_str());
+}
+
+void failUpload(int code, const char* error) {
+  if (!uploadSession.error) {
+    uploadSession.code = code;
+    uploadSession.error = error;
+  }
+}
+
+bool writeUploadOut(const uint8_t* data, size_t length) {
+  TRACE_SCOPE(TRACE_FS_WRITE, traceHash(locUploadPart));
+  uploadWrites++;
+  uploadBytes += length;
+  return uploadSession.file.write(data, length) == length;
+}
+
+/*
+   Appends to the part file in whole uploadWriteSize units, so every write
+   starts on a page boundary and a run of small pieces becomes one write.
+   Pieces that are already whole units go through without a copy.
+*/
+bool writeUpload(const uint8_t* data, size_t length) {
+  UploadSession& session = uploadSession;
+  while (length > 0) {
+    if (!session.buffer || (session.buffered == 0 && length >= uploadWriteSize)) {
+      size_t n = session.buffer ? length - length % uploadWriteSize : length;
+      if (!writeUploadOut(data, n)) {
+        return false;
+      }
+      data += n;
+      length -= n;
+      continue;
+    }
+    size_t n = min(length, uploadWriteSize - session.buffered);
+    memcpy(session.buffer + session.buffered, data, n);
+    session.buffered += n;
+    data += n;
+    length -= n;
+    if (session.buffered == uploadWriteSize) {
+      session.buffered = 0;
+      if (!writeUploadOut(session.buffer, uploadWriteSize)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void finishUpload() {
+  UploadSession& session = uploadSession;
+  if (session.file) {
+    session.file.close();
+  }
+  // the target, or at least the part file came and went
+  fsGeneration++;
+  if (session.error) {
+    fileSystem->remove(locUploadPart);
+    uploadFailures++;
+    DBG_OUTPUT_PORT.printf("Upload of %s failed: %s\n", session.target, session.error);
+  }
+  session.buffer = nullptr;
+}
+
+/*
+   Handle a file upload request, the file is named by the upload's filename.
+   It is staged in locUploadPart and only renamed over the target once it
+   is complete and matches ?md5=, which is required, so an interrupted
+   upload never replaces or truncates the file that is being served.
+*/
+void handleFileUpload() {
+  HTTPUpload& upload = server.upload();
+  UploadSession& session = uploadSession;
+  if (upload.status == UPLOAD_FILE_START) {
+    if (session.file) {
+      session.file.close();
+    }
+    session.error = nullptr;
+    session.buffer = nullptr;
+    session.buffered = 0;
+    // Make sure paths always start with "/"
+    int length = snprintf(session.target, sizeof(session.target), "%s%s", upload.filename.c_str()[0] == '/' ? "" : "/", upload.filename.c_str());
+    if (length < 0 || (size_t) length >= sizeof(session.target)) {
+      return failUpload(400, PSTR("NAME TOO LONG"));
+    }
+    if (!fsOK) {
+      return failUpload(500, FS_INIT_ERROR);
+    }
+    DBG_OUTPUT_PORT.print(F("handleFileUpload Name: "));
+    DBG_OUTPUT_PORT.println(session.target);
+    if (strncmp(session.target, varPrefix, strlen(varPrefix)) == 0) {
+      return failUpload(400, PSTR("BAD PATH"));
+    }
+    // without it a truncated upload would be taken for the whole file
+    if (!server.hasArg("md5")) {
+      return failUpload(400, PSTR("MD5 REQUIRED"));
+    }
+    session.file = fileSystem->open(locUploadPart, "w");
+    if (!session.file) {
+      return failUpload(500, PSTR("CREATE FAILED"));
+    }
+    // lives as long as the request; without it every piece is written as it comes
+    session.buffer = (uint8_t*) requestArena.alloc(uploadWriteSize);
+    session.md5.begin();
+  } else if (upload.status == UPLOAD_FILE_WRITE) {
+    if (session.error) {
+      return;
+    }
+    session.md5.add(upload.buf, upload.currentSize);
+    if (!writeUpload(upload.buf, upload.currentSize)) {
+      failUpload(500, PSTR("WRITE FAILED"));
+    }
+    runControlTasks();
+  } else if (upload.status == UPLOAD_FILE_END) {
+    if (!session.error && session.buffered && !writeUploadOut(session.buffer, session.buffered)) {
+      failUpload(500, PSTR("WRITE FAILED"));
+    }
+    if (!session.error) {
+      session.md5.calculate();
+      if (!server.arg("md5").equalsIgnoreCase(session.md5.toString())) {
+        failUpload(400, PSTR("MD5 MISMATCH"));
+      }
+    }
+    if (session.file) {
+      session.file.close();
+    }
+    if (!session.error && !fileSystem->rename(locUploadPart, session.target)) {
+      failUpload(500, PSTR("RENAME FAILED"));
+    }
+    finishUpload();
+    DBG_OUTPUT_PORT.printf("Upload: END, Size: %u\n", (unsigned) upload.totalSize);
+  } else if (upload.status == UPLOAD_FILE_ABORTED) {
+    failUpload(400, PSTR("ABORTED"));
+    finishUpload();
+  }
+}
+
+// Reply to POST /edit once the upload is through
+void handleFileUploadDone() {
+  const char* error = uploadSession.error;
+  uploadSession.error = nullptr;
+  if (error) {
+    return uploadSession.code == 500 ? replyServerError(error) : replyBadRequest(error);
+  }
+  replyOK();
+}
+
+/*
+   This specific handler returns the index.htm (or a gzipped version) from the /edit folder.
+   Otherwise, fails with a 404
+*/
+void handleGetEdit() {
+  if (handleFileRead("/edit/index.htm")) {
+    return;
+  }
+  replyNotFound(FPSTR(FILE_NOT_FOUND));
+}
+
+void appendZoneLabels(StrBuilder& metrics, uint8_t zone){
+  metrics += F("zone=\"");
+  metrics += (int) zone;
+  metrics += F("\",name=\"");
+  metrics += zoneNames[zone];
+  metrics += '"';
+}
+
+// Unix ms of a millis() instant as JSON, null while the wall clock is unknown
+void appendUnixMs(StrBuilder& json, uint32_t ms){
+  if(ms && wallClock.valid()){
+    json += wallClock.unixMs(ms);
+  } else {
+    json += F("null");
+  }
+}
+
+// " <Unix ms>" after the value of a sample taken at millis() ms. Without a
+// wall clock nothing, Prometheus then uses the time of the scrape.
+void appendTimestamp(StrBuilder& metrics, uint32_t ms){
+  if constexpr (featureSntp) {
+    if(ms && wallClock.valid()){
+      metrics += ' ';
+      metrics += wallClock.unixMs(ms);
+    }
+  }
+}
+
+void handleMetrics(){
+  DBG_OUTPUT_PORT.println("New /metrics request");
+  if (!server.chunkedResponseModeStart(200, "text/html")) {
+    server.send(505, F("text/html"), F("HTTP1.1 required"));
+    return;
+  }
+  StrBuilder metrics(requestArena, replyChunkSize, sendChunk);
+  const ControlState state = controlState.read();
+  for(uint8_t zone=0; zone<zoneCount; zone++){
+    const ZoneState& zoneState = state.zones[zone];
+    // no sample at all until the probe has been read
+    if(zoneState.tempRaw != tempRawInvalid){
+      metrics += F("kirby_temperature_current{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+      metrics.appendFixed(tempRawToCenti(zoneState.tempRaw), 2);
+      appendTimestamp(metrics, zoneState.sampledMs);
+      metrics += '\n';
+    }
+    metrics += F("kirby_pwm_prev{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+    metrics += zoneState.prevPwm;
+    metrics += '\n';
+    schemaMetrics(metrics, zoneSettingsSchema, zoneState, [zone](StrBuilder& out) { appendZoneLabels(out, zone); });
+    metrics += F("kirby_temperature_slope_per_minute{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+    metrics.appendFixed(samplerSlope[zone], 2);
+    appendTimestamp(metrics, zoneState.sampledMs);
+    const ThermalModel& model = thermalModels[zone];
+    metrics += F("\nkirby_model_updates_total{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+    metrics += model.state().updates;
+    metrics += F("\nkirby_model_trusted{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+    metrics += (int) model.trusted();
+    metrics += F("\nkirby_model_time_constant_seconds{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+    metrics += model.timeConstantS();
+    metrics += F("\nkirby_model_heating_per_minute{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+    metrics.appendFixed(model.heatingCentiPerMin(), 2);
+    metrics += F("\nkirby_model_fan_per_minute{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+    metrics.appendFixed(model.fanCentiPerMin(), 2);
+    if(zoneState.tempRaw != tempRawInvalid){
+      metrics += F("\nkirby_model_forecast{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+      metrics.appendFixed(tempRawToCenti(model.forecast(zoneState.tempRaw, zoneState.currentPwm, predictiveSettings[zone].horizonS * 1000UL)), 2);
+    }
+    if(zoneTachPins[zone] >= 0){
+      metrics += F("\nkirby_fan_rpm{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+      metrics += tachRpm[zone];
+    }
+    const FanMapping& mapping = fanMappings[zone];
+    metrics += F("\nkirby_fan_calibrated{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+    metrics += (int) (mapping.magic != 0);
+    if(mapping.magic){
+      metrics += F("\nkirby_fan_start_duty{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+      metrics += mapping.startDuty;
+      metrics += F("\nkirby_fan_hold_duty{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+      metrics += mapping.holdDuty;
+      metrics += F("\nkirby_fan_saturation_duty{"); appendZoneLabels(metrics, zone); metrics += F("} ");
+      metrics += mapping.saturationDuty;
+    }
+    if constexpr (featureRules) {
+      // as the autopilot applied them on its last pass
+      const RuleResult& rules = rulesResults[zone];
+      for(uint8_t output=0; output<ruleOutputCount; output++){
+        if(rules.has((RuleOutput) output)){
+          metrics += F("\nkirby_rules_output{"); appendZoneLabels(metrics, zone);
+          metrics += F(",output=\""); metrics += ruleOutputNames[output]; metrics += F("\"} ");
+          if(output == RULE_TEMP){
+            metrics.appendFixed(tempRawToCenti(ruleTempRaw(rules.value[output])), 2);
+          } else {
+            metrics += ruleDuty(rules.value[output]);
+          }
+        }
+      }
+    }
+    metrics += '\n';
+  }
+  metrics += F("kirby_sampler_period_ms ");
+  metrics += samplerPeriodMs;
+  metrics += '\n';
+  metrics += F("kirby_boot_phase_ms{phase=\"fs_mounted\"} ");
+  metrics += bootFsMountedMs;
+  metrics += F("\nkirby_boot_phase_ms{phase=\"first_control\"} ");
+  metrics += bootFirstControlMs;
+  metrics += F("\nkirby_boot_phase_ms{phase=\"network\"} ");
+  metrics += bootNetworkMs;
+  metrics += F("\nkirby_wifi_connected ");
+  metrics += (int) (WiFi.status() == WL_CONNECTED);
+  if constexpr (featureMqtt) {
+    metrics += F("\nkirby_mqtt_connected ");
+    metrics += (int) mqttConnected;
+    metrics += F("\nkirby_mqtt_connects_total ");
+    metrics += mqttConnects;
+    metrics += F("\nkirby_mqtt_published_total ");
+    metrics += mqttPublished;
+    metrics += F("\nkirby_mqtt_dropped_total ");
+    metrics += mqttDropped;
+    metrics += F("\nkirby_mqtt_commands_total ");
+    metrics += mqttCommands;
+  }
+  if constexpr (featureTelemetry) {
+    metrics += F("\nkirby_telemetry_sent_total ");
+    metrics += telemetrySent;
+    metrics += F("\nkirby_telemetry_failed_total ");
+    metrics += telemetryFailed;
+  }
+  if constexpr (featureUpdate) {
+    metrics += F("\nkirby_update_failures_total ");
+    metrics += updateFailures;
+  }
+  if constexpr (featureSntp) {
+    metrics += F("\nkirby_clock_valid ");
+    metrics += (int) wallClock.valid();
+    metrics += F("\nkirby_clock_synced ");
+    metrics += (int) wallClock.synced();
+    metrics += F("\nkirby_clock_restored ");
+    metrics += (int) wallClock.restored();
+    metrics += F("\nkirby_clock_offset_ms ");
+    metrics += wallClock.offsetMs();
+    metrics += F("\nkirby_clock_drift_ppb ");
+    metrics += wallClock.driftPpb();
+    metrics += F("\nkirby_clock_slew_ppb ");
+    metrics += wallClock.slewPpb();
+    metrics += F("\nkirby_clock_delay_ms ");
+    metrics += ntpDelayMs;
+    metrics += F("\nkirby_clock_syncs_total ");
+    metrics += wallClock.syncs();
+    metrics += F("\nkirby_clock_steps_total ");
+    metrics += wallClock.steps();
+    metrics += F("\nkirby_clock_sync_failures_total ");
+    metrics += ntpFailures;
+    if(wallClock.synced()){
+      metrics += F("\nkirby_clock_last_sync_seconds_ago ");
+      metrics += (millis() - wallClock.lastSyncMs()) / 1000;
+    }
+  }
+  if constexpr (featureRules) {
+    const RuleProgram program = rulesProgram.read();
+    metrics += F("\nkirby_rules_loaded ");
+    metrics += (int) (program.length > 0);
+    metrics += F("\nkirby_rules_code_bytes ");
+    metrics += program.length;
+    metrics += F("\nkirby_rules_stack_depth ");
+    metrics += program.stackDepth;
+    metrics += F("\nkirby_rules_runs_total ");
+    metrics += rulesRuns;
+    for(uint8_t fault=RULE_OK + 1; fault<ruleFaultCount; fault++){
+      metrics += F("\nkirby_rules_faults_total{fault=\""); metrics += ruleFaultNames[fault]; metrics += F("\"} ");
+      metrics += rulesFaults[fault];
+    }
+    metrics += F("\nkirby_rules_steps_max ");
+    metrics += rulesStepsMax;
+    metrics += F("\nkirby_rules_run_us_max ");
+    metrics += rulesRunUsMax;
+  }
+  metrics += F("\nkirby_upload_writes_total ");
+  metrics += uploadWrites;
+  metrics += F("\nkirby_upload_bytes_total ");
+  metrics += uploadBytes;
+  metrics += F("\nkirby_upload_failures_total ");
+  metrics += uploadFailures;
+  metrics += F("\nkirby_list_index_builds_total ");
+  metrics += dirIndexBuilds;
+  metrics += F("\nkirby_list_index_hits_total ");
+  metrics += dirIndexHits;
+  metrics += '\n';
+  for(uint8_t i=0; i<Scheduler.taskCount(); i++){
+    Task* task = Scheduler.task(i);
+    const TaskStats& stats = task->stats();
+    const char* name = task->name();
+    metrics += F("kirby_task_runs_total{task=\""); metrics += name; metrics += F("\"} "); metrics += stats.runs;
+    metrics += F("\nkirby_task_overruns_total{task=\""); metrics += name; metrics += F("\"} "); metrics += stats.overruns;
+    metrics += F("\nkirby_task_missed_total{task=\""); metrics += name; metrics += F("\"} "); metrics += stats.missed;
+    metrics += F("\nkirby_task_jitter_us_last{task=\""); metrics += name; metrics += F("\"} "); metrics += stats.lastJitterUs;
+    metrics += F("\nkirby_task_jitter_us_max{task=\""); metrics += name; metrics += F("\"} "); metrics += stats.maxJitterUs;
+    metrics += F("\nkirby_task_jitter_us_avg{task=\""); metrics += name; metrics += F("\"} "); metrics += stats.runs ? (uint32_t)(stats.totalJitterUs / stats.runs) : 0;
+    metrics += F("\nkirby_task_cpu_ms_total{task=\""); metrics += name; metrics += F("\"} "); metrics += (uint32_t)(stats.cpuUs / 1000);
+    metrics += F("\nkirby_task_run_us_max{task=\""); metrics += name; metrics += F("\"} "); metrics += stats.maxRunUs;
+    metrics += F("\nkirby_task_cycles_last{task=\""); metrics += name; metrics += F("\"} "); metrics += stats.lastCycles;
+    metrics += F("\nkirby_task_cycles_max{task=\""); metrics += name; metrics += F("\"} "); metrics += stats.maxCycles;
+    metrics += '\n';
+    if(stats.stackFreeMin != UINT32_MAX){
+      metrics += F("kirby_task_stack_free_bytes_min{task=\""); metrics += name; metrics += F("\"} "); metrics += stats.stackFreeMin;
+      metrics += '\n';
+    }
+  }
+  metrics += F("kirby_scheduler_idle_ms_total "); metrics += (uint32_t)(Scheduler.idleUs() / 1000);
+  metrics += F("\nkirby_scheduler_busy_ms_total "); metrics += (uint32_t)(Scheduler.busyUs() / 1000);
+  metrics += F("\nkirby_scheduler_stalls_total "); metrics += Scheduler.stalls();
+  metrics += F("\nkirby_scheduler_stall_us_max "); metrics += Scheduler.maxStallUs();
+  metrics += F("\nkirby_heap_free_bytes "); metrics += heapFree;
+  metrics += F("\nkirby_heap_free_bytes_min "); metrics += heapFreeMin;
+  metrics += F("\nkirby_heap_max_block_bytes "); metrics += heapMaxBlock;
+  metrics += F("\nkirby_heap_max_block_bytes_min "); metrics += heapMaxBlockMin;
+  metrics += F("\nkirby_heap_fragmentation_percent "); metrics += heapFragmentation;
+  metrics += F("\nkirby_heap_fragmentation_percent_max "); metrics += heapFragmentationMax;
+  metrics += F("\nkirby_request_arena_bytes_max "); metrics += requestArena.highWater();
+  metrics += F("\nkirby_request_arena_failures_total "); metrics += requestArena.failures();
+  metrics += '\n';
+  for(uint8_t zone=0; zone<zoneCount; zone++){
+    // the curve is copied out, a chunk may be flushed half way through the loop
+    const AutopilotSettings settings = autopilotSettings[zone].read();
+    for(byte i=0; i< autopilotSettingsSize ; i++){
+      if(settings.points[i].temperature){
+        schemaMetrics(metrics, curvePointSchema, settings.points[i], [zone](StrBuilder& out) { appendZoneLabels(out, zone); });
+      }
+    }
+  }
+  metrics.flush();
+  server.chunkedResponseFinalize();
+
+}
+
+/*
+   Per task CPU time, run length, release jitter and stack high-water mark,
+   plus heap and scheduler health
+*/
+void handleDebugTasks(){
+  DBG_OUTPUT_PORT.println("New /debug/tasks request");
+  // a task takes about 200 bytes, sent in chunks however many there are
+  if (!server.chunkedResponseModeStart(200, "application/json")) {
+    server.send(505, F("text/html"), F("HTTP1.1 required"));
+    return;
+  }
+  StrBuilder json(requestArena, replyChunkSize, sendChunk);
+  json += F("{\"uptimeMs\":");
+  json += millis();
+  json += F(",\"idleMs\":");
+  json += (uint32_t)(Scheduler.idleUs() / 1000);
+  json += F(",\"busyMs\":");
+  json += (uint32_t)(Scheduler.busyUs() / 1000);
+  json += F(",\"stalls\":");
+  json += Scheduler.stalls();
+  json += F(",\"maxStallUs\":");
+  json += Scheduler.maxStallUs();
+  json += F(",\"heap\":{\"free\":");
+  json += heapFree;
+  json += F(",\"freeMin\":");
+  json += heapFreeMin;
+  json += F(",\"maxBlock\":");
+  json += heapMaxBlock;
+  json += F(",\"maxBlockMin\":");
+  json += heapMaxBlockMin;
+  json += F(",\"fragmentation\":");
+  json += heapFragmentation;
+  json += F(",\"fragmentationMax\":");
+  json += heapFragmentationMax;
+  json += F("},\"tasks\":[");
+  for(uint8_t i=0; i<Scheduler.taskCount(); i++){
+    Task* task = Scheduler.task(i);
+    const TaskStats& stats = task->stats();
+    if(i>0){
+      json += ',';
+    }
+    json += F("{\"name\":\"");
+    json += task->name();
+    json += F("\",\"periodMs\":");
+    json += task->periodMs();
+    json += F(",\"runs\":");
+    json += stats.runs;
+    json += F(",\"cpuUs\":");
+    json += stats.cpuUs;
+    json += F(",\"maxRunUs\":");
+    json += stats.maxRunUs;
+    json += F(",\"lastCycles\":");
+    json += stats.lastCycles;
+    json += F(",\"maxCycles\":");
+    json += stats.maxCycles;
+    json += F(",\"stackFreeMin\":");
+    json += stats.stackFreeMin != UINT32_MAX ? (long)stats.stackFreeMin : -1L;
+    json += F(",\"overruns\":");
+    json += stats.overruns;
+    json += F(",\"missed\":");
+    json += stats.missed;
+    json += F(",\"maxJitterUs\":");
+    json += stats.maxJitterUs;
+    json += '}';
+  }
+  json += "]}";
+  json.flush();
+  server.chunkedResponseFinalize();
+}
+
+////////////////////////////////
+// Tracing, see lib/Trace. Only with -DKIRBY_TRACE.
+#ifdef KIRBY_TRACE
+bool traceRequestOpen = false;
+uint32_t traceRequestPath;
+
+// Web server hook, runs for every request once its first line has been read
+ESP8266WebServer::ClientFuture traceRequestBegin(const String& method, const String& url, WiFiClient*, ESP8266WebServer::ContentTypeFunction) {
+  // "GET", "POST", ... as up to four characters
+  uint32_t methodName = 0;
+  memcpy(&methodName, method.c_str(), min((size_t) method.length(), sizeof(methodName)));
+  traceRequestPath = traceHash(url.c_str());
+  traceRequestOpen = true;
+  TRACE_BEGIN(TRACE_HTTP, traceRequestPath, methodName);
+  return ESP8266WebServer::CLIENT_REQUEST_CAN_CONTINUE;
+}
+
+void traceRequestEnd() {
+  if (traceRequestOpen) {
+    traceRequestOpen = false;
+    TRACE_END(TRACE_HTTP, traceRequestPath, requestArena.used());
+  }
+}
+
+struct __attribute__((packed)) TraceDumpHeader {
+  uint32_t magic;       // "KTRD"
+  uint8_t version;
+  uint8_t recordSize;
+  uint8_t taskCount;
+  uint8_t reserved;
+  uint32_t nowUs;       // micros() when the dump was taken
+  uint32_t first;       // position of the first record, ?since= of a later dump
+  uint32_t skipped;     // records after ?since= that were overwritten first
+  int64_t unixMs;       // wall clock at nowUs, 0 while unknown (version 2)
+};
+
+/*
+   The trace ring as binary, for tools/trace2chrome.py: a TraceDumpHeader,
+   the task names (a length byte, then the name), then the records from
+   ?since= or the oldest held up to the newest, as they are in memory.
+   A record overwritten while it is sent goes out with event 0.
+*/
+void handleTrace() {
+  uint32_t head = Trace.head();
+  uint32_t first = Trace.tail();
+  uint32_t nowUs = micros();
+  int64_t unixMs = 0;
+  if constexpr (featureSntp) {
+    unixMs = wallClock.unixMs(millis());
+  }
+  TraceDumpHeader header = {0x4452544b, 2, sizeof(TraceRecord), Scheduler.taskCount(), 0, nowUs, first, 0, unixMs};
+  if (server.hasArg("since")) {
+    uint32_t since = strtoul(server.arg("since").c_str(), nullptr, 10);
+    if (since < first) {
+      header.skipped = first - since;
+    } else {
+      first = min(since, head);
+    }
+  }
+  header.first = first;
+
+  if (!server.chunkedResponseModeStart(200, "application/octet-stream")) {
+    server.send(505, F("text/html"), F("HTTP1.1 required"));
+    return;
+  }
+  StrBuilder output(requestArena, replyChunkSize, sendChunk);
+  output.append((const char*) &header, sizeof(header));
+  for (uint8_t i = 0; i < Scheduler.taskCount(); i++) {
+    const char* name = Scheduler.task(i)->name();
+    output += (char) strlen(name);
+    output += name;
+  }
+  for (uint32_t position = first; position != head; position++) {
+    TraceRecord record;
+    if (!Trace.read(position, record)) {
+      record = {};
+    }
+    output.append((const char*) &record, sizeof(record));
+  }
+  output.flush();
+  server.chunkedResponseFinalize();
+}
+#else
+inline void traceRequestEnd() {}
+#endif
+
+void handlePWM(){
+  DBG_OUTPUT_PORT.println("New /pwm request");
+  const String& uri = server.uri();
+  int8_t zone = requestZone();
+  if (zone < 0){
+    return replyBadRequest(F("BAD ZONE"));
+  }
+  const ZoneState state = controlState.read().zones[zone];
+  if (server.method() == HTTP_GET && (uri == "/pwm" || uri == "/pwm/")){
+    StrBuilder value(requestArena, 8);
+    value += state.currentPwm;
+    sendETag(zoneSettingsTag(state));
+    server.send(200, "application/json", value.c_str(), value.length());
+    return;
+  }
+  if (server.method() != HTTP_PUT && server.method() != HTTP_GET){
+    return replyServerError(FPSTR(WRONG_METHOD));
+  }
+
+  // /pwm/{strength}
+  if (!uri.startsWith("/pwm/") || !isdigit(uri.c_str()[5])){
+    return replyBadRequest(F("BAD PATH"));
+  }
+  if (!ifMatch(zoneSettingsTag(state))){
+    return replyPreconditionFailed(zoneSettingsTag(state));
+  }
+  long currentPwm;
+  if (!parseLong(uri.c_str() + 5, currentPwm)){
+    return replyBadRequest(commandResultNames[COMMAND_BAD_VALUE]);
+  }
+  StrBuilder value(requestArena, 12);
+  value += currentPwm;
+  CommandResult result = setPwm(zone, currentPwm);
+  sendETag(zoneSettingsTag(controlState.read().zones[zone]));
+  replyCommand(result, value.c_str());
+}
+
+/*
+   Predictive mode of a zone: GET returns its limit, horizon and what the model
+   has learned, POST sets limit (whole °C) and horizonS, "reset" relearns
+*/
+void handleAutopilotModel(uint8_t zone){
+  if (server.method() == HTTP_POST){
+    DeserializationError error = deserializeJson(doc, server.arg("plain"));
+    if (error) {
+      return replyBadRequest(error.f_str());
+    }
+    PredictiveSettings settings = predictiveSettings[zone];
+    // read wide and range checked before they go into the narrow fields
+    long limit = doc["limit"] | (long) (settings.limitRaw / tempRawPerDegree);
+    long horizonS = doc["horizonS"] | (long) settings.horizonS;
+    if (limit <= 0 || limit >= 100 || horizonS <= 0 || horizonS > UINT16_MAX){
+      return replyBadRequest(F("BAD SETTINGS"));
+    }
+    settings.limitRaw = limit * tempRawPerDegree;
+    settings.horizonS = horizonS;
+    predictiveSettings[zone] = settings;
+    if (doc["reset"] | false){
+      thermalModels[zone].reset();
+    }
+    if (!write_persistent_thermal_model(zone)){
+      return replyServerError(F("PERSISTENCE FAILED"));
+    }
+    wakeAutopilot();
+  } else if (server.method() != HTTP_GET){
+    return replyServerError(FPSTR(WRONG_METHOD));
+  }
+  const ThermalModel& model = thermalModels[zone];
+  const ZoneState zoneState = controlState.read().zones[zone];
+  uint32_t horizonMs = predictiveSettings[zone].horizonS * 1000UL;
+  StrBuilder json(requestArena, 256);
+  json += F("{\"limit\":");
+  json += predictiveSettings[zone].limitRaw / tempRawPerDegree;
+  json += F(",\"horizonS\":");
+  json += predictiveSettings[zone].horizonS;
+  json += F(",\"trusted\":");
+  json += model.trusted() ? F("true") : F("false");
+  json += F(",\"updates\":");
+  json += model.state().updates;
+  json += F(",\"timeConstantS\":");
+  json += model.timeConstantS();
+  json += F(",\"heatingPerMinute\":");
+  json.appendFixed(model.heatingCentiPerMin(), 2);
+  json += F(",\"fanPerMinute\":");
+  json.appendFixed(model.fanCentiPerMin(), 2);
+  json += F(",\"forecast\":");
+  if (zoneState.tempRaw == tempRawInvalid) {
+    json += F("null,\"lowestDuty\":null");
+  } else {
+    json.appendFixed(tempRawToCenti(model.forecast(zoneState.tempRaw, zoneState.currentPwm, horizonMs)), 2);
+    json += F(",\"lowestDuty\":");
+    json += model.lowestDuty(zoneState.tempRaw, predictiveSettings[zone].limitRaw, horizonMs);
+  }
+  json += '}';
+  server.send(200, "application/json", json.c_str(), json.length());
+}
+
+void handleAutoPilot(){
+  DBG_OUTPUT_PORT.println("New /autopilot request");
+  int8_t zone = requestZone();
+  if (zone < 0){
+    return replyBadRequest(F("BAD ZONE"));
+  }
+  if (server.uri() == "/autopilot/model"){
+    return handleAutopilotModel(zone);
+  }
+  if (server.method() == HTTP_GET){
+    StrBuilder json(requestArena, 48 * autopilotSettingsSize);
+    uint32_t seq;
+    uint32_t tag;
+    do {
+      seq = autopilotSettings[zone].begin();
+      const AutopilotSettings& settings = autopilotSettings[zone].view(seq);
+      json.clear();
+      json += '[';
+      bool first = true;
+      for(byte i=0; i<autopilotSettingsSize; i++){
+        if(settings.points[i].temperature != 0){
+          if(!first){
+            json += ',';
+          }
+          first = false;
+          schemaJson(json, curvePointSchema, settings.points[i]);
+        }
+      }
+      json += ']';
+      tag = curveTag(settings);
+    } while (autopilotSettings[zone].retry(seq));
+    sendETag(tag);
+    server.send(200, "application/json", json.c_str(), json.length());
+    return;
+  }
+  // /autopilot/{state}, Enabled, Disabled or Predictive
+  if (server.method() == HTTP_PUT){
+    const char* state = server.uri().c_str() + 10;
+    int8_t autopilotState = state[0] == '/' ? parseAutopilotMode(state + 1) : -1;
+    if (autopilotState < 0){
+      return replyBadRequest(F("BAD STATE"));
+    }
+    uint32_t tag = zoneSettingsTag(controlState.read().zones[zone]);
+    if (!ifMatch(tag)){
+      return replyPreconditionFailed(tag);
+    }
+    CommandResult result = setAutopilotState(zone, autopilotState);
+    sendETag(zoneSettingsTag(controlState.read().zones[zone]));
+    return replyCommand(result, state + 1);
+  }
+  if (server.method() == HTTP_POST){
+    DBG_OUTPUT_PORT.println("Uploading new autopilot settings");
+    uint32_t tag = curveTag(autopilotSettings[zone].read());
+    if (!ifMatch(tag)){
+      return replyPreconditionFailed(tag);
+    }
+
+    // Deserialize the JSON document
+    DeserializationError error = deserializeJson(doc, server.arg("plain"));
 
     // Test if parsing succeeds.
     if (error) {
@@ -348,41 +1988,331 @@ void handleAutoPilot(){
       DBG_OUTPUT_PORT.println(error.f_str());
       return replyServerError(error.f_str());
     }
+    CommandResult result = setAutopilotCurve(zone);
+    sendETag(curveTag(autopilotSettings[zone].read()));
+    return replyCommand(result, "New autopilot settings configured");
+  }
+  return replyServerError(FPSTR(WRONG_METHOD));
+}
 
-    // Persist new value
-    File file = fileSystem->open(locAutoPilotSettings, "r");
-    fileSystem->remove(locAutoPilotSettings);
+/*
+   GET returns the sampling policy and the period in effect, POST changes any
+   of its fields
+*/
+void handleSampler(){
+  DBG_OUTPUT_PORT.println("New /sampler request");
+  if (server.method() == HTTP_POST){
+    DeserializationError error = deserializeJson(doc, server.arg("plain"));
+    if (error) {
+      return replyBadRequest(error.f_str());
+    }
+    // read wide and range checked before they go into the narrow fields
+    long minMs = doc["minMs"] | (long) samplerPolicy.minMs;
+    long maxMs = doc["maxMs"] | (long) samplerPolicy.maxMs;
+    long nearCenti = doc["nearCenti"] | (long) samplerPolicy.nearCenti;
+    long flatCentiPerMin = doc["flatCentiPerMin"] | (long) samplerPolicy.flatCentiPerMin;
+    long leadSamples = doc["leadSamples"] | (long) samplerPolicy.leadSamples;
+    if (minMs <= 0 || maxMs < minMs || maxMs > UINT16_MAX || nearCenti < 0 || nearCenti > UINT16_MAX
+        || flatCentiPerMin <= 0 || flatCentiPerMin > UINT16_MAX || leadSamples <= 0 || leadSamples > UINT8_MAX){
+      return replyBadRequest(F("BAD POLICY"));
+    }
+    samplerPolicy.minMs = minMs;
+    samplerPolicy.maxMs = maxMs;
+    samplerPolicy.nearCenti = nearCenti;
+    samplerPolicy.flatCentiPerMin = flatCentiPerMin;
+    samplerPolicy.leadSamples = leadSamples;
+    TRACE_SCOPE(TRACE_FS_WRITE, traceHash(locSamplerPolicy));
+    File file = fileSystem->open(locSamplerPolicy, "w");
+    if (!file) {
+      return replyServerError(F("PERSISTENCE FAILED"));
+    }
+    size_t written = file.write((const uint8_t*) &samplerPolicy, sizeof(SamplerPolicy));
     file.close();
+    if (written != sizeof(SamplerPolicy)) {
+      return replyServerError(F("PERSISTENCE FAILED"));
+    }
+  } else if (server.method() != HTTP_GET){
+    return replyServerError(FPSTR(WRONG_METHOD));
+  }
+  StrBuilder json(requestArena, 160);
+  json += F("{\"minMs\":");
+  json += samplerPolicy.minMs;
+  json += F(",\"maxMs\":");
+  json += samplerPolicy.maxMs;
+  json += F(",\"nearCenti\":");
+  json += samplerPolicy.nearCenti;
+  json += F(",\"flatCentiPerMin\":");
+  json += samplerPolicy.flatCentiPerMin;
+  json += F(",\"leadSamples\":");
+  json += samplerPolicy.leadSamples;
+  json += F(",\"periodMs\":");
+  json += samplerPeriodMs;
+  json += '}';
+  server.send(200, "application/json", json.c_str(), json.length());
+}
 
-    file = fileSystem->open(locAutoPilotSettings, "w");
-    if (file) {
-      file.write("temperature,strength\n"); // csv headers
-      for(byte i=0; i<doc.size(); i++){
-        autopilotSettings[i][0] = doc[i]["temperature"];
-        autopilotSettings[i][1] = doc[i]["strength"];
-        
-        // TODO: Make more efficient
-        String csvString;
-        csvString += autopilotSettings[i][0]; 
-        csvString += ","; 
-        csvString += autopilotSettings[i][1];  
-        csvString += " "; 
-        char charBuf[csvString.length() + 1];
-        csvString.toCharArray(charBuf, csvString.length());
-        // DBG_OUTPUT_PORT.println("charBuf");
-        // DBG_OUTPUT_PORT.println(charBuf);
-        file.write(charBuf);
-        file.write("\n");
+/*
+   Control rules of all zones, as text: GET returns them, POST compiles and
+   stores the body (?check=1 only compiles it) and DELETE removes them. A
+   compile error is a 400 with its line and column.
+*/
+void handleRules(){
+  DBG_OUTPUT_PORT.println("New /rules request");
+  if (server.method() == HTTP_GET){
+    sendETag(rulesTag);
+    File file = fileSystem->open(locRules, "r");
+    if (!file){
+      return replyOK();
+    }
+    server.streamFile(file, FPSTR(TEXT_PLAIN));
+    file.close();
+    return;
+  }
+  if (server.method() != HTTP_POST && server.method() != HTTP_DELETE){
+    return replyServerError(FPSTR(WRONG_METHOD));
+  }
+  if (!ifMatch(rulesTag)){
+    return replyPreconditionFailed(rulesTag);
+  }
+  bool check = server.method() == HTTP_POST && server.arg("check") == "1";
+  const String& source = server.arg("plain");
+  size_t length = server.method() == HTTP_POST ? source.length() : 0;
+  RuleProgram program;
+  RuleError error;
+  CommandResult result = setRules(source.c_str(), length, check, program, error);
+  if (result == COMMAND_BAD_VALUE){
+    StrBuilder message(requestArena, 96);
+    message += F("line ");
+    message += error.line;
+    message += F(", column ");
+    message += error.column;
+    message += F(": ");
+    message += error.message;
+    DBG_OUTPUT_PORT.println(message.c_str());
+    message += "\r\n";
+    return server.send_P(400, TEXT_PLAIN, message.c_str(), message.length());
+  }
+  StrBuilder message(requestArena, 64);
+  message += check ? F("Rules are valid") : length ? F("New rules configured") : F("Rules removed");
+  if (length){
+    message += F(", ");
+    message += program.length;
+    message += F(" bytes of code");
+  }
+  sendETag(rulesTag);
+  replyCommand(result, message.c_str());
+}
+
+/*
+   Fan calibration of a zone: GET returns its progress and the stored mapping,
+   POST starts one in the background, {"abort":true} stops it and
+   {"reset":true} forgets the mapping
+*/
+void handleCalibrate(){
+  DBG_OUTPUT_PORT.println("New /calibrate request");
+  int8_t zone = requestZone();
+  if (zone < 0){
+    return replyBadRequest(F("BAD ZONE"));
+  }
+  bool running = calibration.phase >= CALIBRATION_REQUESTED && calibration.phase <= CALIBRATION_START;
+  if (server.method() == HTTP_POST){
+    // an empty body just starts it
+    doc.clear();
+    if (server.arg("plain").length()){
+      DeserializationError error = deserializeJson(doc, server.arg("plain"));
+      if (error) {
+        return replyBadRequest(error.f_str());
       }
-      file.close();
-      return replyOKWithMsg(String("New autopilot settings configured"));
+    }
+    if (doc["abort"] | false){
+      if (running && calibration.zone == zone){
+        calibration.abort = true;
+      }
+    } else if (doc["reset"] | false){
+      if (running && calibration.zone == zone){
+        return replyBadRequest(F("CALIBRATING"));
+      }
+      fanMappings[zone] = {};
+      char path[32];
+      fileSystem->remove(zoneLocation(locFanMapping, zone, path, sizeof(path)));
+    } else if (!startCalibration(zone)){
+      return replyBadRequest(F("BUSY"));
+    }
+  } else if (server.method() != HTTP_GET){
+    return replyServerError(FPSTR(WRONG_METHOD));
+  }
+  static const char* const phaseNames[] = {"idle", "requested", "reference", "hold", "start", "done", "failed"};
+  bool own = calibration.zone == zone;
+  const FanMapping& mapping = fanMappings[zone];
+  StrBuilder json(requestArena, 224);
+  json += F("{\"state\":\"");
+  json += own ? phaseNames[calibration.phase] : phaseNames[CALIBRATION_IDLE];
+  json += F("\",\"method\":");
+  uint8_t method = own && calibration.phase != CALIBRATION_IDLE ? calibration.method : mapping.method;
+  json += method == CALIBRATION_TACH ? F("\"tach\"") : method == CALIBRATION_TEMPERATURE ? F("\"temperature\"") : F("null");
+  json += F(",\"duty\":");
+  json += own ? calibration.duty : 0;
+  json += F(",\"error\":");
+  if (own && calibration.error){
+    json += '"';
+    json += calibration.error;
+    json += '"';
+  } else {
+    json += F("null");
+  }
+  json += F(",\"calibrated\":");
+  json += mapping.magic ? F("true") : F("false");
+  json += F(",\"startDuty\":");
+  json += mapping.startDuty;
+  json += F(",\"holdDuty\":");
+  json += mapping.holdDuty;
+  json += F(",\"saturationDuty\":");
+  json += mapping.saturationDuty;
+  json += F(",\"rpmMax\":");
+  json += mapping.rpmMax;
+  json += F(",\"rpm\":");
+  json += tachRpm[zone];
+  json += '}';
+  server.send(200, "application/json", json.c_str(), json.length());
+}
+
+void failUpdate(int code, const char* error){
+  if (!updateSession.error){
+    updateSession.code = code;
+    updateSession.error = error;
+  }
+}
+
+// Inflated filesystem image to flash
+bool writeUpdate(const uint8_t* data, size_t length, void*){
+  return Update.write(const_cast<uint8_t*>(data), length) == length;
+}
+
+void finishUpdate(){
+  UpdateSession& session = updateSession;
+  if (session.error){
+    Update.end(false);
+    updateFailures++;
+    if (session.filesystem){
+      // whatever is left of it; a half written image needs another upload
+      fsOK = fileSystem->begin();
+      fsGeneration++;
+    }
+    DBG_OUTPUT_PORT.printf("Update failed after %u bytes: %s\n", session.received, session.error);
+  } else {
+    DBG_OUTPUT_PORT.printf("Update of %u bytes written\n", session.received);
+  }
+  delete session.inflater;
+  session.inflater = nullptr;
+}
+
+/*
+   Upload side of POST /update?type=firmware|filesystem&md5=<hex>: the image
+   goes to flash in the pieces the server receives, never whole in RAM, and
+   is only committed when it matches md5, which is required.
+   The core inflates a gzip firmware when it installs it at boot, so that is
+   written as is. A filesystem image is written in place, a gzip one is
+   inflated here on the way. The control tasks run between pieces.
+*/
+void handleUpdateUpload(){
+  HTTPUpload& upload = server.upload();
+  UpdateSession& session = updateSession;
+  if (upload.status == UPLOAD_FILE_START){
+    session.filesystem = false;
+    session.gzip = false;
+    session.complete = false;
+    session.error = nullptr;
+    session.received = 0;
+    // checked before anything is erased, an image is never committed unverified
+    if (!server.hasArg("md5")){
+      return failUpdate(400, "MD5 REQUIRED");
+    }
+    const String& type = server.arg("type");
+    if (type == "filesystem"){
+      session.filesystem = true;
+    } else if (type.length() && type != "firmware"){
+      return failUpdate(400, "BAD TYPE");
+    }
+    DBG_OUTPUT_PORT.printf("Receiving %s update %s\n", session.filesystem ? "filesystem" : "firmware", upload.filename.c_str());
+    session.md5.begin();
+    bool begun;
+    if (session.filesystem){
+      // nothing may touch the filesystem while its image is overwritten
+      fileSystem->end();
+      fsOK = false;
+      begun = Update.begin(FS_end - FS_start, U_FS);
     } else {
-      return replyServerError(F("PERSISTENCE FAILED"));
+      begun = Update.begin((ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000, U_FLASH);
+    }
+    if (!begun){
+      failUpdate(500, "BEGIN FAILED");
     }
+  } else if (upload.status == UPLOAD_FILE_WRITE){
+    if (session.error){
+      return;
+    }
+    session.md5.add(upload.buf, upload.currentSize);
+    if (session.received == 0 && session.filesystem && upload.currentSize >= 2
+        && upload.buf[0] == 0x1f && upload.buf[1] == 0x8b){
+      session.inflater = new (std::nothrow) Inflater;
+      if (!session.inflater){
+        return failUpdate(500, "NO MEMORY");
+      }
+      session.inflater->begin(writeUpdate, nullptr);
+      session.gzip = true;
+    }
+    session.received += upload.currentSize;
+    if (session.gzip){
+      if (!session.inflater->write(upload.buf, upload.currentSize)){
+        failUpdate(400, Inflater::resultName(session.inflater->result()));
+      }
+    } else if (Update.write(upload.buf, upload.currentSize) != upload.currentSize){
+      failUpdate(500, "WRITE FAILED");
+    }
+    runControlTasks();
+  } else if (upload.status == UPLOAD_FILE_END){
+    if (!session.error && session.gzip && !session.inflater->end()){
+      failUpdate(400, Inflater::resultName(session.inflater->result()));
+    }
+    if (!session.error){
+      session.md5.calculate();
+      if (!server.arg("md5").equalsIgnoreCase(session.md5.toString())){
+        failUpdate(400, "MD5 MISMATCH");
+      }
+    }
+    if (!session.error && !Update.end(true)){
+      failUpdate(500, "END FAILED");
+    }
+    session.complete = !session.error;
+    finishUpdate();
+  } else if (upload.status == UPLOAD_FILE_ABORTED){
+    failUpdate(400, "ABORTED");
+    finishUpdate();
   }
-  return replyServerError(FPSTR(WRONG_METHOD));
 }
 
+/*
+   Reply to POST /update once the upload is through, the device restarts
+   into a successful one
+*/
+void handleUpdate(){
+  DBG_OUTPUT_PORT.println("New /update request");
+  UpdateSession& session = updateSession;
+  bool complete = session.complete;
+  const char* error = session.error;
+  int code = session.code;
+  session.complete = false;
+  session.error = nullptr;
+  if (error){
+    return code == 500 ? replyServerError(error) : replyBadRequest(error);
+  }
+  if (!complete){
+    return replyBadRequest(F("NO IMAGE"));
+  }
+  replyOKWithMsg(F("UPDATED, RESTARTING"));
+  updateRestartPending = true;
+  updateRestartAtMs = millis() + updateRestartDelayMs;
+}
 
 /*
    The "Not Found" handler catches all URI not explicitely declared in code
@@ -391,20 +2321,34 @@ void handleAutoPilot(){
 */
 void handleNotFound() {
   
-  String uri = ESP8266WebServer::urlDecode(server.uri()); // required to read paths with blanks
+  const char* uri = urlDecode(server.uri()); // required to read paths with blanks
   
   // Handle wildcard paths
   
-  if(uri.indexOf("/pwm") == 0){
+  if(strncmp(uri, "/pwm", 4) == 0){
     return handlePWM();
   }
-  if(uri.indexOf("/metrics") == 0){
-    return handlePWM();
+  if(strncmp(uri, "/metrics", 8) == 0){
+    return handleMetrics();
   }  
   
-  if(uri.indexOf("/autopilot") == 0){
+  if(strncmp(uri, "/autopilot", 10) == 0){
     return handleAutoPilot();
   }  
+
+  if(strncmp(uri, "/sampler", 8) == 0){
+    return handleSampler();
+  }
+
+  if(strncmp(uri, "/calibrate", 10) == 0){
+    return handleCalibrate();
+  }
+
+  if constexpr (featureRules) {
+    if(strcmp(uri, "/rules") == 0){
+      return handleRules();
+    }
+  }
   
   if (!fsOK) {
     return replyServerError(FPSTR(FS_INIT_ERROR));
@@ -416,9 +2360,8 @@ void handleNotFound() {
   }
 
   // Dump debug data
-  String message;
-  message.reserve(100);
-  message = F("Error: File not found\n\nURI: ");
+  StrBuilder message(requestArena, 512);
+  message += F("Error: File not found\n\nURI: ");
   message += uri;
   message += F("\nMethod: ");
   message += (server.method() == HTTP_GET) ? "GET" : "POST";
@@ -436,164 +2379,1053 @@ void handleNotFound() {
   message += server.arg("path");
   message += '\n';
 
-  return replyNotFound(message);
+  server.send_P(404, TEXT_PLAIN, message.c_str(), message.length());
 }
 
 
 ////////////////////////////////
 // Persistence tasks
-void read_persistent_vars(const char * *varLocation, short int *varName){
-  File file = LittleFS.open(*varLocation, "r");
+/*
+   The settings of a zone into state, from /var-zone-settings or the one byte
+   files older firmware kept, which are migrated. state keeps its defaults
+   for anything not found.
+*/
+void read_persistent_zone_settings(uint8_t zone, ZoneState& state){
+  char path[32];
+  const char* location = zoneLocation(locZoneSettings, zone, path, sizeof(path));
+  File file = fileSystem->open(location, "r");
+  if (file) {
+    int count = schemaRead(file, zoneSettingsSchema, &state, 1);
+    file.close();
+    if (count == 1) {
+      return;
+    }
+    DBG_OUTPUT_PORT.printf("Ignoring unreadable %s\n", location);
+  }
+  char pwmPath[32];
+  char statePath[32];
+  const char* legacyPwm = zoneLocation(locPwmCurrent, zone, pwmPath, sizeof(pwmPath));
+  const char* legacyState = zoneLocation(locAutoPilotState, zone, statePath, sizeof(statePath));
+  bool migrate = false;
+  file = fileSystem->open(legacyPwm, "r");
+  if (file) {
+    int value = file.read();
+    file.close();
+    if (zoneSettingsSchema.field<0>().accepts(value)) {
+      state.currentPwm = value;
+    }
+    migrate = true;
+  }
+  file = fileSystem->open(legacyState, "r");
+  if (file) {
+    int value = file.read();
+    file.close();
+    if (zoneSettingsSchema.field<1>().accepts(value)) {
+      state.autopilotState = value;
+    }
+    migrate = true;
+  }
+  if (migrate && write_persistent_zone_settings(zone, state)) {
+    fileSystem->remove(legacyPwm);
+    fileSystem->remove(legacyState);
+    DBG_OUTPUT_PORT.printf("Migrated the settings of zone %d to %s\n", zone, location);
+  }
+}
+bool write_persistent_zone_settings(uint8_t zone, const ZoneState& state){
+  char path[32];
+  const char* location = zoneLocation(locZoneSettings, zone, path, sizeof(path));
+  TRACE_SCOPE(TRACE_FS_WRITE, traceHash(location));
+  File file = fileSystem->open(location, "w");
+  if (!file) {
+    return false;
+  }
+  bool written = schemaWrite(file, zoneSettingsSchema, &state, 1);
+  file.close();
+  return written;
+}
+/*
+   The curve of a zone. A CSV written by older firmware ("temperature,strength"
+   and a line per point) is read as well and rewritten in the binary format.
+*/
+void read_persistent_autopilot_settings(uint8_t zone, AutopilotSettings& settings){
+  char path[32];
+  const char* location = zoneLocation(locAutoPilotSettings, zone, path, sizeof(path));
+  File file = fileSystem->open(location, "r");
   if (!file) {
     DBG_OUTPUT_PORT.println("Failed to open file for reading");
     return;
   }
-  while (file.available()) {
-    *varName = file.read();
+  AutopilotSettings parsed = {};
+  if (schemaRead(file, curvePointSchema, parsed.points, autopilotSettingsSize) >= 0) {
+    file.close();
+    settings = parsed;
+    return;
+  }
+  char csv[16 * (autopilotSettingsSize + 1)];
+  file.seek(0);
+  size_t length = file.read((uint8_t*) csv, sizeof(csv) - 1);
+  file.close();
+  csv[length] = '\0';
+  if (strncmp_P(csv, PSTR("temperature,strength"), 20) != 0) {
+    DBG_OUTPUT_PORT.printf("Ignoring unreadable %s\n", location);
+    return;
+  }
+  byte count = 0;
+  for (const char* line = strchr(csv, '\n'); line && count < autopilotSettingsSize; line = strchr(line, '\n')) {
+    char* end;
+    long temperature = strtol(++line, &end, 10);
+    if (end == line || *end != ',') {
+      break;
+    }
+    long strength = strtol(end + 1, &end, 10);
+    if (!curvePointSchema.field<0>().accepts(temperature) || !curvePointSchema.field<1>().accepts(strength)) {
+      break;
+    }
+    parsed.points[count].temperature = temperature;
+    parsed.points[count++].strength = strength;
+    line = end;
+  }
+  settings = parsed;
+  if (write_persistent_autopilot_settings(zone, settings)) {
+    DBG_OUTPUT_PORT.printf("Migrated %s, %d points\n", location, count);
   }
+}
+bool write_persistent_autopilot_settings(uint8_t zone, const AutopilotSettings& settings){
+  char path[32];
+  const char* location = zoneLocation(locAutoPilotSettings, zone, path, sizeof(path));
+  TRACE_SCOPE(TRACE_FS_WRITE, traceHash(location));
+  File file = fileSystem->open(location, "w");
+  if (!file) {
+    return false;
+  }
+  bool written = schemaWrite(file, curvePointSchema, settings.points, autopilotSettingsSize);
   file.close();
+  return written;
 }
-void read_persistent_autopilot_state(const char * *varLocation, bool *varName){
+void read_persistent_wifi_cache(const char * *varLocation, WifiCache *varName){
   File file = LittleFS.open(*varLocation, "r");
   if (!file) {
     DBG_OUTPUT_PORT.println("Failed to open file for reading");
     return;
   }
-  while (file.available()) {
-    *varName = bool(file.read());
+  if (file.read((uint8_t*) varName, sizeof(WifiCache)) != sizeof(WifiCache) || varName->magic != wifiCacheMagic) {
+    memset(varName, 0, sizeof(WifiCache));
   }
   file.close();
 }
-void read_persistent_autopilot_settings(const char * *varLocation, short int varName[autopilotSettingsSize][2]){
+void write_persistent_wifi_cache(const char * *varLocation, WifiCache *varName){
+  TRACE_SCOPE(TRACE_FS_WRITE, traceHash(*varLocation));
+  File file = LittleFS.open(*varLocation, "w");
+  if (!file) {
+    DBG_OUTPUT_PORT.println("Failed to open file for writing");
+    return;
+  }
+  file.write((const uint8_t*) varName, sizeof(WifiCache));
+  file.close();
+}
+// Predictive settings and the learned model of a zone, binary
+void read_persistent_thermal_model(uint8_t zone){
+  char path[32];
+  File file = LittleFS.open(zoneLocation(locAutoPilotModel, zone, path, sizeof(path)), "r");
+  if (!file) {
+    DBG_OUTPUT_PORT.println("Failed to open file for reading");
+    return;
+  }
+  uint32_t magic = 0;
+  PredictiveSettings settings;
+  ThermalModelState state;
+  if (file.read((uint8_t*) &magic, sizeof(magic)) == sizeof(magic) && magic == thermalModelMagic
+      && file.read((uint8_t*) &settings, sizeof(settings)) == sizeof(settings)
+      && file.read((uint8_t*) &state, sizeof(state)) == sizeof(state)) {
+    predictiveSettings[zone] = settings;
+    thermalModels[zone].restore(state);
+  }
+  file.close();
+}
+bool write_persistent_thermal_model(uint8_t zone){
+  char path[32];
+  const char* location = zoneLocation(locAutoPilotModel, zone, path, sizeof(path));
+  TRACE_SCOPE(TRACE_FS_WRITE, traceHash(location));
+  File file = LittleFS.open(location, "w");
+  if (!file) {
+    DBG_OUTPUT_PORT.println("Failed to open file for writing");
+    return false;
+  }
+  file.write((const uint8_t*) &thermalModelMagic, sizeof(thermalModelMagic));
+  file.write((const uint8_t*) &predictiveSettings[zone], sizeof(PredictiveSettings));
+  file.write((const uint8_t*) &thermalModels[zone].state(), sizeof(ThermalModelState));
+  file.close();
+  return true;
+}
+// Calibrated mapping of a zone's fan, binary
+void read_persistent_fan_mapping(uint8_t zone){
+  char path[32];
+  File file = LittleFS.open(zoneLocation(locFanMapping, zone, path, sizeof(path)), "r");
+  if (!file) {
+    DBG_OUTPUT_PORT.println("Failed to open file for reading");
+    return;
+  }
+  if (file.read((uint8_t*) &fanMappings[zone], sizeof(FanMapping)) != sizeof(FanMapping) || fanMappings[zone].magic != fanMappingMagic) {
+    fanMappings[zone] = {};
+  }
+  file.close();
+}
+bool write_persistent_fan_mapping(uint8_t zone){
+  char path[32];
+  const char* location = zoneLocation(locFanMapping, zone, path, sizeof(path));
+  TRACE_SCOPE(TRACE_FS_WRITE, traceHash(location));
+  File file = LittleFS.open(location, "w");
+  if (!file) {
+    DBG_OUTPUT_PORT.println("Failed to open file for writing");
+    return false;
+  }
+  file.write((const uint8_t*) &fanMappings[zone], sizeof(FanMapping));
+  file.close();
+  return true;
+}
+void read_persistent_sampler_policy(const char * *varLocation, SamplerPolicy *varName){
   File file = LittleFS.open(*varLocation, "r");
   if (!file) {
     DBG_OUTPUT_PORT.println("Failed to open file for reading");
     return;
   }
-  
-  // TODO: Could be nicer
-  byte i = 0;
-  char charBuf[15];
-  String itemString;
-  String readString;
-  char * pch;
-  while (file.available()) {
-    readString = file.readStringUntil('\n');
-    // DBG_OUTPUT_PORT.println("readString");
-    // DBG_OUTPUT_PORT.println(readString);
-    if(i != 0){
-      readString.toCharArray(charBuf,15);
-      
-      pch = strtok(charBuf,",");
-      itemString = String(pch);
-      // DBG_OUTPUT_PORT.println("itemString1");
-      // DBG_OUTPUT_PORT.println(itemString);
-      autopilotSettings[i-1][0] = itemString.toInt();
-      
-      pch = strtok (NULL, ",");
-      itemString = String(pch);
-      // DBG_OUTPUT_PORT.println("itemString2");
-      // DBG_OUTPUT_PORT.println(itemString);
-      autopilotSettings[i-1][1] = itemString.toInt();
-    }
-    i++;
+  if (file.read((uint8_t*) varName, sizeof(SamplerPolicy)) != sizeof(SamplerPolicy) || varName->magic != samplerPolicyMagic) {
+    *varName = samplerPolicyDefault;
   }
   file.close();
 }
+/*
+   Compiles the stored rules and publishes them. Rules that do not compile
+   (any more, say after an update) stay in the file for GET /rules but do not
+   run.
+*/
+void read_persistent_rules(){
+  File file = fileSystem->open(locRules, "r");
+  if (!file) {
+    return;
+  }
+  // one more than the compiler takes, so a longer file fails as too long
+  char* source = (char*) requestArena.alloc(ruleSourceMax + 1);
+  size_t length = source ? file.read((uint8_t*) source, ruleSourceMax + 1) : 0;
+  file.close();
+  RuleProgram program;
+  RuleError error;
+  if (ruleCompile(source, length, program, error)) {
+    rulesProgram.write(program);
+    DBG_OUTPUT_PORT.printf("Rules loaded, %u bytes of code\n", program.length);
+  } else {
+    DBG_OUTPUT_PORT.printf("Rules in %s not loaded, line %u, column %u: %s\n", locRules, error.line, error.column, error.message);
+  }
+  rulesTag = rulesSourceTag(source, length);
+  requestArena.reset();
+}
+bool write_persistent_rules(const char* source, size_t length){
+  TRACE_SCOPE(TRACE_FS_WRITE, traceHash(locRules));
+  if (length == 0) {
+    return !fileSystem->exists(locRules) || fileSystem->remove(locRules);
+  }
+  File file = fileSystem->open(locRules, "w");
+  if (!file) {
+    return false;
+  }
+  bool written = file.write((const uint8_t*) source, length) == length;
+  file.close();
+  return written;
+}
   
 
 ////////////////////////////////
 // PWM Signal Task
+// The waveform itself comes from the core's timer driven analogWrite(), so this
+// task only has to pick up new values. While the output is a steady level the
+// CPU may light sleep between tasks, a running waveform needs modem sleep.
+// It also turns the tach pulses into a speed once a second.
+void IRAM_ATTR countTachPulse(void* pulses) {
+  (*(volatile uint32_t*) pulses)++;
+}
+
 class PwmSignalTask : public Task {
+public:
+    PwmSignalTask() : Task("pwm", pwmTaskDelayMs) {}
+
+protected:
+    void setup() {
+      char path[32];
+      for(uint8_t zone=0; zone<zoneCount; zone++){
+        pinMode(zonePwmPins[zone], OUTPUT);
+        if (fileSystem->exists(zoneLocation(locFanMapping, zone, path, sizeof(path)))) {
+          read_persistent_fan_mapping(zone);
+        }
+        if(zoneTachPins[zone] >= 0){
+          pinMode(zoneTachPins[zone], INPUT_PULLUP);
+          attachInterruptArg(digitalPinToInterrupt(zoneTachPins[zone]), countTachPulse, (void*) &tachPulses[zone], FALLING);
+        }
+      }
+      analogWriteRange(pwmDutyRange);
+      DBG_OUTPUT_PORT.printf("PWM Signal Task with delay of %d ms\n", pwmTaskDelayMs);
+    }
+    void loop() {
+      // One pass over all zones; the core's waveform generator runs every
+      // analogWrite() pin off the same timer, so more zones cost no extra task
+      unsigned long now = millis();
+      const ControlState current = controlState.read();
+      bool changed = false;
+      bool steady = true;
+      for(uint8_t zone=0; zone<zoneCount; zone++){
+        short int currentPwm = current.zones[zone].currentPwm;
+        if(current.zones[zone].prevPwm != currentPwm){
+          DBG_OUTPUT_PORT.printf("Updated PWM Signal of zone %d, from %d to %d\n", zone, current.zones[zone].prevPwm, currentPwm);
+          changed = true;
+        }
+        uint16_t level = outputLevel(zone, current.zones[zone], now);
+        steady = steady && (level == 0 || level == pwmDutyRange);
+        if(state && level == lastLevel[zone]){
+          continue;
+        }
+        lastLevel[zone] = level;
+        TRACE(TRACE_PWM, zone, level);
+        uint8_t pin = zonePwmPins[zone];
+        if(level == 0){
+          digitalWrite(pin, LOW);
+        } else if(level == pwmDutyRange){
+          digitalWrite(pin, HIGH);
+        } else {
+          analogWrite(pin, level);
+        }
+      }
+      if(changed){
+        controlState.update([&current](ControlState& control) {
+          for(uint8_t zone=0; zone<zoneCount; zone++){
+            control.zones[zone].prevPwm = current.zones[zone].currentPwm;
+          }
+        });
+      }
+      state = 1;
+      if(now - tachMs >= 1000){
+        for(uint8_t zone=0; zone<zoneCount; zone++){
+          uint32_t pulses = tachPulses[zone];
+          tachRpm[zone] = (pulses - lastPulses[zone]) * 60000UL / ((now - tachMs) * tachPulsesPerRev);
+          lastPulses[zone] = pulses;
+        }
+        tachMs = now;
+      }
+      // while sampling slowly the radio may also skip a few beacons
+      bool idle = samplerPeriodMs >= samplerPolicy.maxMs;
+      uint8_t sleepMode = steady | (idle << 1);
+      if(sleepMode != this->sleepMode){
+        this->sleepMode = sleepMode;
+        WiFi.setSleepMode(steady ? WIFI_LIGHT_SLEEP : WIFI_MODEM_SLEEP, idle ? samplerIdleListenInterval : 0);
+      }
+      if(!bootFirstControlMs){
+        bootFirstControlMs = millis();
+      }
+    }
+
+    /*
+       The per-mille a zone's output runs at. Until its fan is calibrated the
+       strength is the duty, off below 1 and full above 90. A calibrated fan
+       spreads strength 1..99 from its hold to its saturation duty, and coming
+       from a standstill it gets its start duty for fanKickMs first.
+       While calibrating the strength is the raw duty.
+    */
+    uint16_t outputLevel(uint8_t zone, const ZoneState& zoneState, unsigned long now) {
+      short int pwm = zoneState.currentPwm;
+      if(pwm < 1){
+        turning[zone] = false;
+        return 0;
+      }
+      const FanMapping& mapping = fanMappings[zone];
+      uint16_t duty;
+      if(zoneState.calibrating){
+        duty = min(pwm, (short int) 100);
+      } else if(!mapping.magic){
+        duty = pwm > 90 ? 100 : pwm;
+      } else {
+        duty = pwm >= 100 ? 100 : mapping.holdDuty + (pwm - 1) * (mapping.saturationDuty - mapping.holdDuty) / 99;
+        if(duty >= mapping.saturationDuty){
+          duty = 100;
+        }
+        if(!turning[zone]){
+          kickUntilMs[zone] = now + fanKickMs;
+        }
+        if(duty < mapping.startDuty && (long)(kickUntilMs[zone] - now) > 0){
+          duty = mapping.startDuty;
+        }
+      }
+      turning[zone] = true;
+      // duty in percent, the output in per-mille
+      return duty * (pwmDutyRange / 100);
+    }
+
+private:
+    uint8_t state = 0;
+    uint8_t sleepMode = 0xff; // light sleep bit 0, idle listen interval bit 1
+    uint16_t lastLevel[zoneCount];
+    bool turning[zoneCount];
+    unsigned long kickUntilMs[zoneCount];
+    unsigned long tachMs = 0;
+    uint32_t lastPulses[zoneCount];
+} pwmsignal_task;
+
+////////////////////////////////
+// Sensor Task
+// A conversion takes up to 750 ms, so it is started on the periodic release and
+// read back in a second run once it is done instead of blocking in between.
+// The period adapts to the temperature: a flat tube far from the next curve
+// breakpoint is sampled every samplerPolicy.maxMs, a fast slope or a nearby
+// breakpoint brings it down to the conversion limit. Each sample wakes the
+// autopilot, so it needs no polling of its own.
+class SensorTask : public Task {
+public:
+    SensorTask() : Task("sensor", probeSleepMs) {
+      for(uint8_t zone=0; zone<zoneCount; zone++){
+        lastRaw[zone] = tempRawInvalid;
+      }
+    }
+
+protected:
+    void setup() {
+      sensors.begin();
+      sensors.setWaitForConversion(false);
+      if (fileSystem->exists(locSamplerPolicy)) {
+        read_persistent_sampler_policy(&locSamplerPolicy, &samplerPolicy);
+      }
+      for(uint8_t zone=0; zone<zoneCount; zone++){
+        for(uint8_t slot=0; slot<zoneProbesMax; slot++){
+          if(zoneProbes[zone][slot] >= 0){
+            probesUsed |= 1 << zoneProbes[zone][slot];
+          }
+        }
+      }
+      DBG_OUTPUT_PORT.printf("Temperature probe started with delay of %d ms\n", probeSleepMs);
+    }
+    void loop() {
+      if(state == 0){
+        // one conversion command converts every probe on the bus
+        TRACE_BEGIN(TRACE_SENSOR, probesUsed, 0);
+        uint16_t conversionMs = sensors.millisToWaitForConversion(sensors.getResolution());
+        // the probes integrate over the conversion, its middle is when the
+        // sample was taken, however late the read below runs
+        sampledMs = millis() + conversionMs / 2;
+        sensors.requestTemperatures();
+        state = 1;
+        runAgainIn(conversionMs);
+        return;
+      }
+      state = 0;
+      // getTempCByIndex() searches the bus and converts to float on every call,
+      // the addresses are looked up once and the raw counts are used as is
+      int16_t probeRaw[probesMax];
+      for(uint8_t probe=0; probe<probesMax; probe++){
+        probeRaw[probe] = tempRawInvalid;
+        if(!(probesUsed & (1 << probe))){
+          continue;
+        }
+        if(!probeFound[probe]){
+          probeFound[probe] = sensors.getAddress(probeAddresses[probe], probe);
+          if(!probeFound[probe]){
+            continue;
+          }
+        }
+        int32_t raw = sensors.getTemp(probeAddresses[probe]);
+        if(raw == DEVICE_DISCONNECTED_RAW){
+          probeFound[probe] = false;
+          continue;
+        }
+        int16_t newTemp = raw >> 3; // 1/128 °C to 1/16 °C
+        TRACE(TRACE_TEMPERATURE, probe, newTemp);
+        if(newTemp > 0 && newTemp < 100 * tempRawPerDegree){
+          probeRaw[probe] = newTemp;
+        }
+      }
+      TRACE_END(TRACE_SENSOR, probesUsed, 0);
+
+      // a zone follows its hottest probe, all zones are published at once
+      int16_t zoneRaw[zoneCount];
+      for(uint8_t zone=0; zone<zoneCount; zone++){
+        zoneRaw[zone] = tempRawInvalid;
+        for(uint8_t slot=0; slot<zoneProbesMax; slot++){
+          int8_t probe = zoneProbes[zone][slot];
+          if(probe >= 0 && probeRaw[probe] > zoneRaw[zone]){
+            zoneRaw[zone] = probeRaw[probe];
+          }
+        }
+      }
+      const uint32_t sampled = sampledMs;
+      controlState.update([&zoneRaw, &probeRaw, sampled](ControlState& control) {
+        for(uint8_t zone=0; zone<zoneCount; zone++){
+          if(zoneRaw[zone] != tempRawInvalid){
+            control.zones[zone].tempRaw = zoneRaw[zone];
+            control.zones[zone].sampledMs = sampled;
+          }
+        }
+        memcpy(control.probeRaw, probeRaw, sizeof(control.probeRaw));
+      });
+
+      learn(zoneRaw);
+      adapt(zoneRaw);
+      wakeAutopilot();
+    }
+
+    /*
+       Feeds the models with the sample and the duty the fans ran at since the
+       last one, i.e. before the autopilot reacts to this sample
+    */
+    void learn(const int16_t zoneRaw[zoneCount]) {
+      unsigned long now = sampledMs;
+      const ControlState current = controlState.read();
+      for(uint8_t zone=0; zone<zoneCount; zone++){
+        // a calibration sweeps raw duties, not strengths
+        if(zoneRaw[zone] != tempRawInvalid && !current.zones[zone].calibrating){
+          short int pwm = current.zones[zone].currentPwm;
+          // the same levels the PWM task switches to, a calibrated fan runs every strength
+          uint8_t duty = pwm < 1 ? 0 : pwm > (fanMappings[zone].magic ? 99 : 90) ? 100 : pwm;
+          thermalModels[zone].sample(zoneRaw[zone], duty, now);
+        }
+      }
+      if(now - lastModelSaveMs >= thermalModelSaveMs){
+        lastModelSaveMs = now;
+        for(uint8_t zone=0; zone<zoneCount; zone++){
+          write_persistent_thermal_model(zone);
+        }
+      }
+    }
+
+    /*
+       Picks the next sample period. Per zone, a slope above flatCentiPerMin
+       shortens the period in proportion, and gives the time until the next
+       breakpoint of the curve in its direction is reached, which should take
+       at least leadSamples samples. The fastest zone wins.
+    */
+    void adapt(const int16_t zoneRaw[zoneCount]) {
+      unsigned long now = sampledMs;
+      uint32_t elapsed = now - lastSampleMs;
+      lastSampleMs = now;
+      const SamplerPolicy policy = samplerPolicy;
+      uint32_t period = policy.maxMs;
+      bool known = false;
+      for(uint8_t zone=0; zone<zoneCount; zone++){
+        int16_t previous = lastRaw[zone];
+        lastRaw[zone] = zoneRaw[zone];
+        if(zoneRaw[zone] == tempRawInvalid || previous == tempRawInvalid || elapsed == 0){
+          continue;
+        }
+        known = true;
+        // 1/16 °C per sample to 1/100 °C per minute
+        int32_t slope = (int32_t)(zoneRaw[zone] - previous) * (100L * 60000 / tempRawPerDegree) / (int32_t) elapsed;
+        slope = constrain(slope, -samplerSlopeClamp, samplerSlopeClamp);
+        samplerSlope[zone] += (slope - samplerSlope[zone]) * (int32_t) elapsed / (int32_t)(elapsed + samplerSlopeTauMs);
+        uint32_t steepness = abs(samplerSlope[zone]);
+
+        if(steepness <= policy.flatCentiPerMin){
+          continue;
+        }
+        period = min(period, (uint32_t) policy.maxMs * policy.flatCentiPerMin / steepness);
+        uint8_t mode = controlState.read().zones[zone].autopilotState;
+        if(mode == AUTOPILOT_DISABLED){
+          continue;
+        }
+        // The output steps where the rounded temperature crosses a curve point,
+        // in predictive mode the limit takes their place. Only points ahead of
+        // the slope count: a flat tube parked on a point would otherwise be
+        // sampled fast just to chatter between two duties.
+        int16_t breakpoints[autopilotSettingsSize];
+        byte count = 0;
+        if(mode == AUTOPILOT_PREDICTIVE){
+          breakpoints[count++] = predictiveSettings[zone].limitRaw;
+        } else {
+          const AutopilotSettings settings = autopilotSettings[zone].read();
+          for(byte i=0; i<autopilotSettingsSize; i++){
+            if(settings.points[i].temperature != 0){
+              breakpoints[count++] = settings.points[i].temperature * tempRawPerDegree - tempRawPerDegree / 2;
+            }
+          }
+        }
+        uint32_t distance = UINT32_MAX;
+        for(byte i=0; i<count; i++){
+          int16_t ahead = breakpoints[i] - zoneRaw[zone];
+          if(samplerSlope[zone] < 0){
+            ahead = -ahead;
+          }
+          if(ahead >= 0){
+            distance = min(distance, (uint32_t) tempRawToCenti(ahead));
+          }
+        }
+        if(distance <= policy.nearCenti){
+          period = 0;
+        } else if(distance != UINT32_MAX){
+          period = min(period, distance * 60000 / (steepness * policy.leadSamples));
+        }
+      }
+      if(!known){
+        return;
+      }
+      uint32_t floor = max((uint32_t) policy.minMs, (uint32_t) sensors.millisToWaitForConversion(sensors.getResolution()) + samplerReadMarginMs);
+      samplerPeriodMs = max(period, floor);
+      setPeriod(samplerPeriodMs);
+    }
+
+private:
+    uint8_t state = 0;
+    uint8_t probesUsed = 0;
+    unsigned long sampledMs = 0;  // of the conversion in progress or just read
+    unsigned long lastSampleMs = 0;
+    unsigned long lastModelSaveMs = 0;
+    int16_t lastRaw[zoneCount];
+} sensor_task;
+
+////////////////////////////////
+// Auto Pilot Task
+// Each zone follows its curve, or its forecast in predictive mode. Control
+// rules (POST /rules) run first and may change the temperature either looks
+// at, replace the strength they give and bound it.
+
+/*
+   What the rules see of a zone, Q4 like the probes, ruleNoValue for what is
+   not known
+*/
+void ruleInputs(uint8_t zone, const ControlState& control, int32_t inputs[ruleInputCount]){
+  const ZoneState& zoneState = control.zones[zone];
+  inputs[RULE_T] = zoneState.sampledMs ? zoneState.tempRaw : ruleNoValue;
+  for(uint8_t probe=0; probe<=RULE_T3 - RULE_T0; probe++){
+    int16_t raw = probe < probesMax ? control.probeRaw[probe] : tempRawInvalid;
+    inputs[RULE_T0 + probe] = raw != tempRawInvalid ? raw : ruleNoValue;
+  }
+  inputs[RULE_DUTY] = zoneState.currentPwm * ruleOne;
+  inputs[RULE_HOUR] = ruleNoValue;
+  if(wallClock.valid()){
+    int64_t localS = wallClock.unixMs(millis()) / 1000 + localOffsetMin * 60L;
+    int32_t secondOfDay = (localS % 86400 + 86400) % 86400;
+    inputs[RULE_HOUR] = secondOfDay * ruleOne / 3600;
+  }
+  for(uint8_t i=0; i<2; i++){
+    int8_t pin = ruleSwitchPins[i];
+    inputs[RULE_IN0 + i] = pin < 0 ? ruleNoValue : digitalRead(pin) == LOW ? ruleOne : 0;
+  }
+  inputs[RULE_ZONE] = zone * ruleOne;
+}
+
+/*
+   Runs the rules on a zone; result holds what they assigned, nothing without
+   rules or when the run faulted
+*/
+void runRules(uint8_t zone, const ControlState& control, RuleResult& result){
+  int32_t inputs[ruleInputCount];
+  ruleInputs(zone, control, inputs);
+  uint32_t startedUs = micros();
+  RuleFault fault;
+  bool loaded;
+  uint32_t seq;
+  do {
+    seq = rulesProgram.begin();
+    const RuleProgram& program = rulesProgram.view(seq);
+    loaded = program.length > 0;
+    fault = ruleRun(program, inputs, result);
+  } while (rulesProgram.retry(seq));
+  if(!loaded){
+    return;
+  }
+  uint32_t elapsedUs = micros() - startedUs;
+  rulesRuns++;
+  if(fault != RULE_OK){
+    rulesFaults[fault]++;
+  }
+  rulesStepsMax = max(rulesStepsMax, result.steps);
+  rulesRunUsMax = max(rulesRunUsMax, elapsedUs);
+}
+
+class AutopilotTask : public Task {
+public:
+    AutopilotTask() : Task("autopilot", autopilotDelay) {}
+
 protected:
     void setup() {
-      pinMode(PWMGPIO, OUTPUT);
-      DBG_OUTPUT_PORT.println("PWM Signal Task with delay of " + String(pwmTaskDelayMs) + " ms");
+      // pinMode(BUILTIN_LED1, OUTPUT);
+
+      char path[32];
+      for(uint8_t zone=0; zone<zoneCount; zone++){
+        if (fileSystem->exists(zoneLocation(locAutoPilotSettings, zone, path, sizeof(path)))) {
+          AutopilotSettings settings = {};
+          read_persistent_autopilot_settings(zone, settings);
+          autopilotSettings[zone].write(settings);
+        }
+        predictiveSettings[zone] = predictiveSettingsDefault;
+        if (fileSystem->exists(zoneLocation(locAutoPilotModel, zone, path, sizeof(path)))) {
+          read_persistent_thermal_model(zone);
+        }
+      }
+      if constexpr (featureRules) {
+        for(uint8_t i=0; i<2; i++){
+          if(ruleSwitchPins[i] >= 0){
+            pinMode(ruleSwitchPins[i], INPUT_PULLUP);
+          }
+        }
+        read_persistent_rules();
+      }
     }
+
     void loop() {
-      if(prevPwm != currentPwm){
-        DBG_OUTPUT_PORT.println("Updated PWM Signal, from " + String(prevPwm) + " to " + String(currentPwm));
-        prevPwm = currentPwm;
-      }
-      // DBG_OUTPUT_PORT.println("TMP");
-      if(currentPwm < 1){
-        digitalWrite(PWMGPIO, LOW);
-        // DBG_OUTPUT_PORT.println("LOW");
-      } else if(currentPwm > 90){ 
-        digitalWrite(PWMGPIO, HIGH);
-        // DBG_OUTPUT_PORT.println("HIGH");
-      } else {
-        analogWrite(PWMGPIO, round(float(currentPwm) * float(2.55)));
-        // analogWrite(PWMGPIO, 255);
-        // DBG_OUTPUT_PORT.println(float(currentPwm) * float(2.55));
+      // Woken by every sample, a curve or a mode change, the periodic release
+      // is only a fallback
+      setPeriod(samplerPolicy.maxMs);
+      // All zones in one pass. Each curve is read in place, it is only walked
+      // again if a new one got published meanwhile.
+      const ControlState current = controlState.read();
+      short int newPwm[zoneCount];
+      bool changed = false;
+      for(uint8_t zone=0; zone<zoneCount; zone++){
+        newPwm[zone] = -1;
+        const ZoneState& zoneState = current.zones[zone];
+        if(zoneState.autopilotState == AUTOPILOT_DISABLED || zoneState.calibrating){
+          continue;
+        }
+        RuleResult rules = {};
+        if constexpr (featureRules) {
+          runRules(zone, current, rules);
+          rulesResults[zone] = rules;
+        }
+        int16_t tempRaw = rules.has(RULE_TEMP) ? ruleTempRaw(rules.value[RULE_TEMP]) : zoneState.tempRaw;
+        if(tempRaw == tempRawInvalid && !rules.has(RULE_STRENGTH)){
+          // nothing read since boot, the restored strength stands
+          continue;
+        }
+        const ThermalModel& model = thermalModels[zone];
+        if(rules.has(RULE_STRENGTH)){
+          newPwm[zone] = ruleDuty(rules.value[RULE_STRENGTH]);
+        } else if(zoneState.autopilotState == AUTOPILOT_PREDICTIVE && model.trusted()){
+          newPwm[zone] = model.lowestDuty(tempRaw, predictiveSettings[zone].limitRaw, predictiveSettings[zone].horizonS * 1000UL);
+          // small corrections are noise in the forecast, they would only make the fan hunt
+          if(abs(newPwm[zone] - zoneState.currentPwm) < predictiveDeadband){
+            newPwm[zone] = zoneState.currentPwm;
+          }
+        } else {
+          // whole degrees, rounded like round() did on the float
+          short int tempCelcius = (tempRaw + tempRawPerDegree / 2) / tempRawPerDegree;
+          uint32_t seq;
+          do {
+            seq = autopilotSettings[zone].begin();
+            const AutopilotSettings& settings = autopilotSettings[zone].view(seq);
+            newPwm[zone] = -1;
+            for(byte i=0; i<autopilotSettingsSize; i++){
+              if(settings.points[i].temperature > tempCelcius){ // First temperature in the array higher than current temp
+                newPwm[zone] = settings.points[i].strength;
+                break;
+              }
+            }
+          } while (autopilotSettings[zone].retry(seq));
+          if(zoneState.autopilotState == AUTOPILOT_PREDICTIVE && newPwm[zone] >= 0){
+            // The curve alone moves the duty in step with the temperature, which
+            // leaves the model unable to tell fan from heating. A small square
+            // wave on top gives it something to learn from until it is trusted.
+            short int dither = (millis() / predictiveDitherMs) & 1 ? predictiveDither : -predictiveDither;
+            newPwm[zone] = constrain(newPwm[zone] + dither, 0, 100);
+          }
+        }
+        // floor and cap bound whatever runs, the duty as it is when the curve
+        // has no point above the temperature; cap wins
+        if(rules.has(RULE_FLOOR) || rules.has(RULE_CAP)){
+          short int duty = newPwm[zone] >= 0 ? newPwm[zone] : zoneState.currentPwm;
+          if(rules.has(RULE_FLOOR)){
+            duty = max(duty, ruleDuty(rules.value[RULE_FLOOR]));
+          }
+          if(rules.has(RULE_CAP)){
+            duty = min(duty, ruleDuty(rules.value[RULE_CAP]));
+          }
+          newPwm[zone] = duty;
+        }
+        changed = changed || (newPwm[zone] >= 0 && newPwm[zone] != zoneState.currentPwm);
+      }
+      if(changed){
+        controlState.update([&newPwm](ControlState& control) {
+          for(uint8_t zone=0; zone<zoneCount; zone++){
+            if(newPwm[zone] >= 0){
+              control.zones[zone].currentPwm = newPwm[zone];
+            }
+          }
+        });
       }
-      // delay(pwmTaskDelayMs);
     }
+} autopilot_task;
 
-private:
-    uint8_t state;
-} pwmsignal_task;
+void wakeAutopilot() {
+  Scheduler.wake(&autopilot_task);
+}
 
 ////////////////////////////////
-// Sensor Task
-class SensorTask : public Task {
+// Calibration Task
+// Characterises one fan while everything else keeps running, the handler only
+// requests it. Each step sets a raw duty, lets fan and tube settle and then
+// measures a response: the speed with a tach, otherwise how much faster the
+// tube cools than with the fan off.
+//   REFERENCE  off, then full, the responses the others are compared to
+//   HOLD       down from full until it stalls; the lowest duty still turning
+//              is the hold duty, the lowest within 95 % of full saturation
+//   START      stop, then up from the hold duty until it starts again
+// Without a tach the tube has to be warm and steady. It heats while the fan
+// is slow, the guard temperature aborts.
+const unsigned long calibrationIdleMs = 60000;
+const unsigned long calibrationPollMs = 250;
+const unsigned long calibrationTachSettleMs = 3000;
+const unsigned long calibrationTachMeasureMs = 2000;
+const unsigned long calibrationTempSettleMs = 60000;   // sensor lag and airflow
+const unsigned long calibrationTempMeasureMs = 120000; // 1/16 °C steps need a long baseline
+const uint8_t calibrationStallPercent = 12;            // of the full cooling, without a tach
+const int32_t calibrationMinCooling = 50;              // 1/100 °C per minute full must add, a cold tube shows nothing
+
+class CalibrationTask : public Task {
+public:
+    CalibrationTask() : Task("calibration", calibrationIdleMs) {}
+
 protected:
-    void setup() {
-      DBG_OUTPUT_PORT.println("Temperature probe started with delay of " + String(probeSleepMs) + " ms");
-    }
     void loop() {
-      sensors.requestTemperatures(); 
-      float newTemp = sensors.getTempCByIndex(0);
-      // DBG_OUTPUT_PORT.println("newTemp");
-      // DBG_OUTPUT_PORT.println(sensors.getTempCByIndex(0));
-      // DBG_OUTPUT_PORT.println(sensors.getTempCByIndex(1));
-      // DBG_OUTPUT_PORT.println(sensors.getTempCByIndex(2));
-
-      if(newTemp > 0 && newTemp < 100){
-        tempCelcius = newTemp;
+      if(calibration.phase == CALIBRATION_REQUESTED){
+        begin();
+      }
+      if(calibration.phase < CALIBRATION_REFERENCE || calibration.phase > CALIBRATION_START){
+        setPeriod(calibrationIdleMs);
+        return;
+      }
+      unsigned long now = millis();
+      int16_t tempRaw = controlState.read().zones[calibration.zone].tempRaw;
+      if(calibration.abort){
+        return finish("ABORTED");
+      }
+      if(tempRaw != tempRawInvalid && tempRaw >= calibrationGuardRaw){
+        return finish("TOO HOT");
       }
-      delay(probeSleepMs);
+      if(!tach && tempRaw == tempRawInvalid){
+        return finish("NO PROBE");
+      }
+      if(now - stepMs < (tach ? calibrationTachSettleMs : calibrationTempSettleMs)){
+        return;
+      }
+      if(stopping){
+        // stood still long enough, try the next start duty
+        stopping = false;
+        return apply(candidate);
+      }
+      if(!measuring){
+        measuring = true;
+        measureMs = now;
+        fromPulses = tachPulses[calibration.zone];
+        fromRaw = tempRaw;
+        return;
+      }
+      unsigned long elapsed = now - measureMs;
+      if(elapsed < (tach ? calibrationTachMeasureMs : calibrationTempMeasureMs)){
+        return;
+      }
+      int32_t value;
+      if(tach){
+        value = (tachPulses[calibration.zone] - fromPulses) * 60000UL / (elapsed * tachPulsesPerRev);
+      } else {
+        // 1/16 °C to 1/100 °C per minute
+        value = (int32_t)(tempRaw - fromRaw) * (100L * 60000 / tempRawPerDegree) / (int32_t) elapsed;
+      }
+      advance(value);
     }
 
 private:
-    uint8_t state;
-} sensor_task;
+    void begin() {
+      uint8_t zone = calibration.zone;
+      tach = zoneTachPins[zone] >= 0;
+      calibration.method = tach ? CALIBRATION_TACH : CALIBRATION_TEMPERATURE;
+      calibration.error = nullptr;
+      calibration.abort = false;
+      calibration.phase = CALIBRATION_REFERENCE;
+      savedPwm = controlState.read().zones[zone].currentPwm;
+      stopping = false;
+      DBG_OUTPUT_PORT.printf("Calibrating the fan of zone %d by %s\n", zone, tach ? "tach" : "temperature");
+      setPeriod(calibrationPollMs);
+      // every response is taken against the off reference, a tube still
+      // warming up or cooling down would skew them all
+      if(!tach && (uint32_t) abs(samplerSlope[zone]) > samplerPolicy.flatCentiPerMin){
+        return finish("NOT STEADY");
+      }
+      apply(0);
+    }
 
-////////////////////////////////
-// Auto Pilot Task
-class AutopilotTask : public Task {
-protected:
-    void setup() {
-      // pinMode(BUILTIN_LED1, OUTPUT);
+    void apply(uint8_t duty) {
+      uint8_t zone = calibration.zone;
+      calibration.duty = duty;
+      stepMs = millis();
+      measuring = false;
+      controlState.update([zone, duty](ControlState& control) {
+        control.zones[zone].calibrating = true;
+        control.zones[zone].currentPwm = duty;
+      });
+    }
+
+    // speed, or the cooling the fan adds in 1/100 °C per minute
+    int32_t response(int32_t value) const {
+      return tach ? value : offValue - value;
+    }
 
-      if (fileSystem->exists(locAutoPilotSettings)) {
-        read_persistent_autopilot_settings(&locAutoPilotSettings, autopilotSettings);
+    bool isTurning(int32_t response) const {
+      if(tach){
+        return response >= calibrationMinRpm;
       }
-      if (fileSystem->exists(locAutoPilotState)) {
-        read_persistent_autopilot_state(&locAutoPilotState, &autopilotState);
+      return response > 0 && response * 100 >= fullResponse * calibrationStallPercent;
+    }
+
+    void advance(int32_t value) {
+      uint8_t duty = calibration.duty;
+      uint8_t step = tach ? 5 : 10;
+      int32_t r = response(value);
+      switch(calibration.phase){
+        case CALIBRATION_REFERENCE:
+          if(duty == 0){
+            offValue = value;
+            return apply(100);
+          }
+          fullResponse = r;
+          if(tach ? r < calibrationMinRpm : r < calibrationMinCooling){
+            return finish("NO RESPONSE");
+          }
+          holdDuty = saturationDuty = 100;
+          saturated = true;
+          calibration.phase = CALIBRATION_HOLD;
+          return apply(100 - step);
+        case CALIBRATION_HOLD:
+          if(isTurning(r)){
+            holdDuty = duty;
+            if(saturated && r * 100 >= fullResponse * calibrationSaturationPercent){
+              saturationDuty = duty;
+            } else {
+              saturated = false;
+            }
+            if(duty > step){
+              return apply(duty - step);
+            }
+          }
+          calibration.phase = CALIBRATION_START;
+          candidate = holdDuty;
+          stopping = true;
+          return apply(0);
+        case CALIBRATION_START:
+          if(isTurning(r) || duty >= 100){
+            startDuty = duty;
+            return finish(nullptr);
+          }
+          candidate = min(duty + step, 100);
+          stopping = true;
+          return apply(0);
       }
     }
 
-    void loop() {
-      for(byte i; i<autopilotSettingsSize; i++){
-        if(autopilotSettings[i][1] > round(tempCelcius)){ // First temperature in the array higher than current temp
-          currentPwm = autopilotSettings[i][1];
-          break;
+    void finish(const char* error) {
+      uint8_t zone = calibration.zone;
+      if(!error){
+        FanMapping mapping = {fanMappingMagic, startDuty, holdDuty, saturationDuty, calibration.method, (uint16_t) (tach ? fullResponse : 0)};
+        fanMappings[zone] = mapping;
+        if(!write_persistent_fan_mapping(zone)){
+          error = "PERSISTENCE FAILED";
         }
+        DBG_OUTPUT_PORT.printf("Fan of zone %d starts at %d, holds at %d, saturates at %d\n", zone, startDuty, holdDuty, saturationDuty);
+      } else {
+        DBG_OUTPUT_PORT.printf("Calibration of zone %d failed: %s\n", zone, error);
       }
-      delay(autopilotDelay);
+      calibration.error = error;
+      calibration.phase = error ? CALIBRATION_FAILED : CALIBRATION_DONE;
+      calibration.duty = 0;
+      short int pwm = savedPwm;
+      controlState.update([zone, pwm](ControlState& control) {
+        control.zones[zone].calibrating = false;
+        control.zones[zone].currentPwm = pwm;
+      });
+      setPeriod(calibrationIdleMs);
+      wakeAutopilot();
     }
 
-private:
-    uint8_t state;
-} autopilot_task;
+    bool tach;
+    bool measuring;
+    bool stopping;
+    bool saturated;
+    short int savedPwm;
+    uint8_t candidate;
+    uint8_t startDuty;
+    uint8_t holdDuty;
+    uint8_t saturationDuty;
+    unsigned long stepMs;
+    unsigned long measureMs;
+    uint32_t fromPulses;
+    int16_t fromRaw;
+    int32_t offValue;
+    int32_t fullResponse;
+} calibration_task;
+
+bool startCalibration(uint8_t zone) {
+  if(calibration.phase >= CALIBRATION_REQUESTED && calibration.phase <= CALIBRATION_START){
+    return false;
+  }
+  calibration.zone = zone;
+  calibration.phase = CALIBRATION_REQUESTED;
+  calibration.error = nullptr;
+  calibration.abort = false;
+  Scheduler.wake(&calibration_task);
+  return true;
+}
+
+////////////////////////////////
+// Heap Sample Task
+// Tracks free heap, largest free block and fragmentation, so slow leaks and
+// fragmentation after days of uptime show up in /metrics.
+class HeapSampleTask : public Task {
+public:
+    HeapSampleTask() : Task("heap", heapSampleDelayMs) {}
+
+protected:
+    void loop() {
+      ESP.getHeapStats(&heapFree, &heapMaxBlock, &heapFragmentation);
+      if(heapFree < heapFreeMin){
+        heapFreeMin = heapFree;
+      }
+      if(heapMaxBlock < heapMaxBlockMin){
+        heapMaxBlockMin = heapMaxBlock;
+      }
+      if(heapFragmentation > heapFragmentationMax){
+        heapFragmentationMax = heapFragmentation;
+      }
+    }
+} heapsample_task;
+
+////////////////////////////////
+// Control tasks
+// What keeps the tubes safe, run from within requests that hold the loop
+// for seconds (see handleUpdateUpload). The network tasks wait for the end.
+Task* const controlTasks[] = {&pwmsignal_task, &sensor_task, &autopilot_task, &calibration_task, &heapsample_task};
+
+void runControlTasks() {
+  Scheduler.runDue(controlTasks, sizeof(controlTasks) / sizeof(controlTasks[0]));
+}
 
 
 
 ////////////////////////////////
 // WIFI Task
+// Connects in the background so the control tasks never wait for the network:
+//   FAST_CONNECT  replay cached BSSID/channel, and the IP while its lease lasts,
+//                 no scan and no DHCP
+//   SCAN          async scan, pick the known SSID with the best RSSI
+//   CONNECTING    wait for association, retry the cached BSSID with DHCP when
+//                 the cached IP did not connect, then fall back to a scan
+//   CONNECTED     serve HTTP, drop back to FAST_CONNECT when the link is lost
+//                 or the lease of a replayed IP ends
+//   BACKOFF       nothing known in range, wait before scanning again
+
+enum WifiState : uint8_t {
+  WIFI_FAST_CONNECT,
+  WIFI_SCAN,
+  WIFI_SCANNING,
+  WIFI_CONNECTING,
+  WIFI_CONNECTED,
+  WIFI_BACKOFF
+};
 
 class WifiTask : public Task {
+public:
+    WifiTask() : Task("wifi", wifiSleepMS) {}
+
 protected:
     void setup() {
 
@@ -606,7 +3438,28 @@ protected:
 
       // List directory
       server.on("/list", HTTP_GET, handleFileList);
+
+      // Content hashes of the assets
+      server.on("/manifest", HTTP_GET, handleManifest);
+
+      // Load editor
+      server.on("/edit", HTTP_GET, handleGetEdit);
+
+      // Create file
+      server.on("/edit", HTTP_PUT, handleFileCreate);
+
+      // Delete file
+      server.on("/edit", HTTP_DELETE, handleFileDelete);
+
+      // Upload file
+      // - first callback is called after the request has ended with all parsed arguments
+      // - second callback handles file upload at that location
+      server.on("/edit", HTTP_POST, handleFileUploadDone, handleFileUpload);
       
+      // If-Match of the changes to /pwm and /autopilot
+      const char* conditionalHeaders[] = {"If-Match"};
+      server.collectHeaders(conditionalHeaders, 1);
+
       // Get PWM strength
       server.on("/pwm", HTTP_GET, handlePWM);
       
@@ -616,30 +3469,718 @@ protected:
       // Get Metrics strength
       server.on("/autopilot", HTTP_GET, handleAutoPilot);
 
+      // Sampling policy and period
+      server.on("/sampler", HTTP_GET, handleSampler);
+
+      // Fan calibration progress and result
+      server.on("/calibrate", HTTP_GET, handleCalibrate);
+
+      // Control rules
+      if constexpr (featureRules) {
+        server.on("/rules", HTTP_GET, handleRules);
+      }
+
+      // Task and heap profile
+      server.on("/debug/tasks", HTTP_GET, handleDebugTasks);
+#ifdef KIRBY_TRACE
+      server.on("/debug/trace", HTTP_GET, handleTrace);
+      server.addHook(traceRequestBegin);
+#endif
+
+      // Firmware or filesystem image upload
+      if constexpr (featureUpdate) {
+        server.on("/update", HTTP_POST, handleUpdate, handleUpdateUpload);
+      }
+
       // Default handler for all URIs not defined above
       // Use it to read files from filesystem
       server.onNotFound(handleNotFound);
 
-      // Start server
+      // Start server, it accepts clients as soon as an interface comes up
       server.begin();
       DBG_OUTPUT_PORT.println("HTTP server started");
+
+      ////////////////////////////////
+      // WI-FI INIT
+      WiFi.persistent(false); // the SDK would otherwise rewrite its flash config on every begin()
+      WiFi.setAutoReconnect(false);
+      WiFi.mode(WIFI_STA);
+      WiFi.hostname(host);
+      if (fileSystem->exists(locWifiCache)) {
+        read_persistent_wifi_cache(&locWifiCache, &wifiCache);
+      }
+      state = WIFI_FAST_CONNECT;
     }
 
     void loop() {
-      server.handleClient();
-      MDNS.update();
-      delay(wifiSleepMS);
+      switch (state) {
+        case WIFI_FAST_CONNECT:
+          fastConnect();
+          break;
+        case WIFI_SCAN:
+          WiFi.config(0u, 0u, 0u); // back to DHCP
+          WiFi.scanNetworks(true);
+          state = WIFI_SCANNING;
+          break;
+        case WIFI_SCANNING:
+          scanResult();
+          break;
+        case WIFI_CONNECTING:
+          if (WiFi.status() == WL_CONNECTED) {
+            connected();
+          } else if (millis() - stateSince > (staticLease ? wifiFastConnectTimeoutMs : wifiConnectTimeoutMs)) {
+            DBG_OUTPUT_PORT.println(F("Wi-Fi connect timed out"));
+            WiFi.disconnect();
+            if (staticLease) {
+              dhcpConnect();
+            } else if (usingCache) {
+              wifiCache.magic = 0;
+              state = WIFI_SCAN;
+            } else {
+              enter(WIFI_BACKOFF);
+            }
+          }
+          break;
+        case WIFI_CONNECTED:
+          if (WiFi.status() != WL_CONNECTED) {
+            DBG_OUTPUT_PORT.println(F("Wi-Fi link lost, reconnecting"));
+            state = WIFI_FAST_CONNECT;
+            break;
+          }
+          if (staticLease && !leaseValid()) {
+            DBG_OUTPUT_PORT.println(F("Wi-Fi lease ended, reconnecting with DHCP"));
+            WiFi.disconnect();
+            state = WIFI_FAST_CONNECT;
+            break;
+          }
+          if (leaseSinceMs && wallClock.valid()) {
+            wifiCache.leaseEndS = wallClock.unixMs(leaseSinceMs) / 1000 + wifiCache.leaseS;
+            leaseSinceMs = 0;
+            write_persistent_wifi_cache(&locWifiCache, &wifiCache);
+          }
+          server.handleClient();
+          traceRequestEnd();
+          requestArena.reset();
+          if constexpr (featureMdns) {
+            MDNS.update();
+          }
+          if constexpr (featureUpdate) {
+            if (updateRestartPending && (long)(millis() - updateRestartAtMs) >= 0){
+              DBG_OUTPUT_PORT.println(F("Restarting into the update"));
+              ESP.restart();
+            }
+          }
+          break;
+        case WIFI_BACKOFF:
+          if (millis() - stateSince > wifiBackoffMs) {
+            state = WIFI_SCAN;
+          }
+          break;
+      }
     }
 
 private:
     uint8_t state;
+    unsigned long stateSince;
+    bool usingCache;
+    bool staticLease = false;    // the address is the cached one, not from DHCP
+    unsigned long leaseSinceMs = 0; // lease granted before the wall clock was valid
+    bool mdnsStarted = false;
+
+    void enter(uint8_t newState) {
+      state = newState;
+      stateSince = millis();
+    }
+
+    void begin(uint8_t ssidIndex, int32_t channel, const uint8_t* bssid) {
+      const char* ssid = ssidIndex ? ssid2 : ssid1;
+      DBG_OUTPUT_PORT.printf("Connecting to %s on channel %d\n", ssid, channel);
+      WiFi.begin(ssid, ssidIndex ? wifipassword2 : wifipassword1, channel, bssid);
+      enter(WIFI_CONNECTING);
+    }
+
+    // The cached lease still has wifiLeaseMarginS to go
+    bool leaseValid() {
+      return wifiCache.leaseEndS && wallClock.valid() &&
+        wallClock.unixMs(millis()) / 1000 + wifiLeaseMarginS < wifiCache.leaseEndS;
+    }
+
+    void fastConnect() {
+      if (wifiCache.magic != wifiCacheMagic) {
+        state = WIFI_SCAN;
+        return;
+      }
+      if (!leaseValid()) {
+        dhcpConnect();
+        return;
+      }
+      usingCache = true;
+      staticLease = true;
+      WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway), IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+      begin(wifiCache.ssidIndex, wifiCache.channel, wifiCache.bssid);
+    }
+
+    // Cached BSSID and channel, address from DHCP
+    void dhcpConnect() {
+      usingCache = true;
+      staticLease = false;
+      WiFi.config(0u, 0u, 0u);
+      begin(wifiCache.ssidIndex, wifiCache.channel, wifiCache.bssid);
+    }
+
+    void scanResult() {
+      int8_t found = WiFi.scanComplete();
+      if (found == WIFI_SCAN_RUNNING) {
+        return;
+      }
+      int best = -1;
+      int32_t bestRssi = -1000;
+      uint8_t bestSsid = 0;
+      for (int8_t i = 0; i < found; i++) {
+        int32_t rssi = WiFi.RSSI(i);
+        if (rssi <= bestRssi) {
+          continue;
+        }
+        if (WiFi.SSID(i) == ssid1) {
+          bestSsid = 0;
+        } else if (WiFi.SSID(i) == ssid2) {
+          bestSsid = 1;
+        } else {
+          continue;
+        }
+        best = i;
+        bestRssi = rssi;
+      }
+      if (best < 0) {
+        WiFi.scanDelete();
+        DBG_OUTPUT_PORT.println(F("No known Wi-Fi network in range"));
+        enter(WIFI_BACKOFF);
+        return;
+      }
+      uint8_t bssid[6];
+      memcpy(bssid, WiFi.BSSID(best), sizeof(bssid));
+      int32_t channel = WiFi.channel(best);
+      WiFi.scanDelete();
+      usingCache = false;
+      staticLease = false;
+      wifiCache.ssidIndex = bestSsid;
+      begin(bestSsid, channel, bssid);
+    }
+
+    void connected() {
+      DBG_OUTPUT_PORT.println(F("Connected! IP address: "));
+      DBG_OUTPUT_PORT.println(WiFi.localIP());
+      if (!bootNetworkMs) {
+        bootNetworkMs = millis();
+      }
+
+      WifiCache fresh;
+      fresh.magic = wifiCacheMagic;
+      fresh.ssidIndex = wifiCache.ssidIndex;
+      fresh.channel = WiFi.channel();
+      memcpy(fresh.bssid, WiFi.BSSID(), sizeof(fresh.bssid));
+      fresh.ip = WiFi.localIP();
+      fresh.gateway = WiFi.gatewayIP();
+      fresh.subnet = WiFi.subnetMask();
+      fresh.dns = WiFi.dnsIP();
+      if (staticLease) {
+        fresh.leaseS = wifiCache.leaseS;
+        fresh.leaseEndS = wifiCache.leaseEndS;
+      } else {
+        struct dhcp *dhcp = netif_dhcp_data(netif_default);
+        fresh.leaseS = dhcp && dhcp_supplied_address(netif_default) ? dhcp->offered_t0_lease : 0;
+        fresh.leaseEndS = 0;
+        leaseSinceMs = 0;
+        if (fresh.leaseS && wallClock.valid()) {
+          fresh.leaseEndS = wallClock.unixMs(millis()) / 1000 + fresh.leaseS;
+        } else if (fresh.leaseS) {
+          leaseSinceMs = millis();
+        }
+      }
+      if (memcmp(&fresh, &wifiCache, sizeof(WifiCache)) != 0) {
+        wifiCache = fresh;
+        write_persistent_wifi_cache(&locWifiCache, &wifiCache);
+      }
+
+      ////////////////////////////////
+      // MDNS INIT
+      if constexpr (featureMdns) {
+        if (!mdnsStarted && MDNS.begin(host)) {
+          mdnsStarted = true;
+          MDNS.addService("http", "tcp", 80);
+          DBG_OUTPUT_PORT.println(F("Open http://"));
+          DBG_OUTPUT_PORT.println(host);
+        }
+      }
+      enter(WIFI_CONNECTED);
+    }
 } wifi_task;
 
+////////////////////////////////
+// MQTT Task
+// Optional push of the control state to a broker, for consumers that would
+// otherwise each poll /metrics. All zones go out as one retained JSON message
+// on <prefix>/state, when a value changed (changes within mqttMinIntervalMs
+// are coalesced) or the heartbeat is due. <prefix>/status is "online", the
+// broker sets it "offline" when the connection drops.
+// Commands arrive on <prefix>/cmd/<command>[/<zone index or name>]:
+//   pwm        strength, like PUT /pwm/{strength}
+//   mode       Enabled, Disabled or Predictive, like PUT /autopilot/{state}
+//   autopilot  curve JSON, like POST /autopilot
+// and are answered on <prefix>/result. Nothing waits for the socket: the
+// state is only sent when it fits the send buffer and results queue in a
+// small ring, a full ring drops them (kirby_mqtt_dropped_total).
+enum MqttCommand : uint8_t {
+  MQTT_COMMAND_PWM = 0,
+  MQTT_COMMAND_MODE,
+  MQTT_COMMAND_AUTOPILOT,
+  MQTT_COMMAND_UNKNOWN
+};
+const char* const mqttCommandNames[] = {"pwm", "mode", "autopilot"};
+struct MqttResult {
+  uint8_t command; // MqttCommand
+  int8_t zone;
+  uint8_t result;  // CommandResult
+};
+MqttResult mqttOutbox[mqttOutboxSize];
+uint8_t mqttOutboxHead = 0;
+uint8_t mqttOutboxCount = 0;
+
+const char* mqttTopic(const char* suffix, char* topic, size_t size) {
+  snprintf(topic, size, "%s/%s", mqttTopicPrefix, suffix);
+  return topic;
+}
+
+void onMqttMessage(char* topic, uint8_t* payload, unsigned int length) {
+  // <prefix>/cmd/<command>[/<zone>]
+  size_t prefixLength = strlen(mqttTopicPrefix);
+  if (strncmp(topic, mqttTopicPrefix, prefixLength) != 0 || strncmp(topic + prefixLength, "/cmd/", 5) != 0) {
+    return;
+  }
+  const char* name = topic + prefixLength + 5;
+  const char* slash = strchr(name, '/');
+  size_t nameLength = slash ? (size_t) (slash - name) : strlen(name);
+  uint8_t command = MQTT_COMMAND_PWM;
+  while (command < MQTT_COMMAND_UNKNOWN && !(strlen(mqttCommandNames[command]) == nameLength && strncmp(name, mqttCommandNames[command], nameLength) == 0)) {
+    command++;
+  }
+  int8_t zone = slash ? parseZone(slash + 1) : 0;
+  mqttCommands++;
+
+  CommandResult result = COMMAND_BAD_VALUE;
+  char value[16];
+  size_t valueLength = min((size_t) length, sizeof(value) - 1);
+  memcpy(value, payload, valueLength);
+  value[valueLength] = '\0';
+  if (zone < 0 || command == MQTT_COMMAND_UNKNOWN) {
+    result = COMMAND_BAD_VALUE;
+  } else if (command == MQTT_COMMAND_PWM) {
+    long strength;
+    if (isdigit(value[0]) && parseLong(value, strength)) {
+      result = setPwm(zone, strength);
+    }
+  } else if (command == MQTT_COMMAND_MODE) {
+    int8_t mode = parseAutopilotMode(value);
+    if (mode >= 0) {
+      result = setAutopilotState(zone, mode);
+    }
+  } else if (!deserializeJson(doc, (const char*) payload, length)) {
+    result = setAutopilotCurve(zone);
+  }
+  DBG_OUTPUT_PORT.printf("MQTT command %s: %s\n", topic, commandResultNames[result]);
+
+  if (mqttOutboxCount == mqttOutboxSize) {
+    mqttDropped++;
+    return;
+  }
+  MqttResult& entry = mqttOutbox[(mqttOutboxHead + mqttOutboxCount) % mqttOutboxSize];
+  entry.command = command;
+  entry.zone = zone;
+  entry.result = result;
+  mqttOutboxCount++;
+}
+
+class MqttTask : public Task {
+public:
+    MqttTask() : Task("mqtt", mqttPollMs) {}
+
+protected:
+    void setup() {
+      mqtt.setServer(mqttHost, mqttPort);
+      mqtt.setCallback(onMqttMessage);
+      mqtt.setBufferSize(mqttBufferSize);
+      mqtt.setSocketTimeout((mqttConnectTimeoutMs + 999) / 1000); // seconds, for the CONNACK
+      client.setTimeout(mqttConnectTimeoutMs);
+    }
+
+    void loop() {
+      mqttConnected = mqtt.connected();
+      if (!*mqttHost || WiFi.status() != WL_CONNECTED) {
+        return;
+      }
+      unsigned long now = millis();
+      if (!mqtt.connected()) {
+        if (now - lastAttemptMs < backoffMs) {
+          return;
+        }
+        lastAttemptMs = now;
+        if (!connect()) {
+          backoffMs = backoffMs ? min(backoffMs * 2, mqttBackoffMaxMs) : mqttBackoffMinMs;
+          return;
+        }
+        backoffMs = 0;
+      }
+      // commands and keepalive
+      mqtt.loop();
+      sendResults();
+      sendState(now);
+      requestArena.reset();
+    }
+
+private:
+    bool connect() {
+      char clientId[24];
+      snprintf(clientId, sizeof(clientId), "%s-%06x", host, ESP.getChipId());
+      char topic[64];
+      mqttTopic("status", topic, sizeof(topic));
+      bool anonymous = !*mqttUser;
+      if (!mqtt.connect(clientId, anonymous ? nullptr : mqttUser, anonymous ? nullptr : mqttPassword, topic, 0, true, "offline")) {
+        DBG_OUTPUT_PORT.printf("MQTT connect to %s failed: %d\n", mqttHost, mqtt.state());
+        return false;
+      }
+      mqttConnects++;
+      DBG_OUTPUT_PORT.printf("MQTT connected to %s\n", mqttHost);
+      mqtt.publish(topic, "online", true);
+      mqtt.subscribe(mqttTopic("cmd/#", topic, sizeof(topic)));
+      // the broker may have lost the retained state
+      published = false;
+      return true;
+    }
+
+    // Whether a message of length bytes on topic fits the socket without blocking
+    bool fits(const char* topic, size_t length) {
+      return client.availableForWrite() >= (int) (length + strlen(topic) + 7);
+    }
+
+    void sendResults() {
+      char topic[64];
+      mqttTopic("result", topic, sizeof(topic));
+      while (mqttOutboxCount) {
+        const MqttResult& entry = mqttOutbox[mqttOutboxHead];
+        char payload[80];
+        int length = snprintf(payload, sizeof(payload), "{\"command\":\"%s\",\"zone\":%d,\"result\":\"%s\"}",
+                              entry.command < MQTT_COMMAND_UNKNOWN ? mqttCommandNames[entry.command] : "unknown",
+                              entry.zone, commandResultNames[entry.result]);
+        if (!fits(topic, length)) {
+          return;
+        }
+        if (mqtt.publish(topic, payload)) {
+          mqttPublished++;
+        } else {
+          mqttDropped++;
+        }
+        mqttOutboxHead = (mqttOutboxHead + 1) % mqttOutboxSize;
+        mqttOutboxCount--;
+      }
+    }
+
+    void sendState(unsigned long now) {
+      const ControlState current = controlState.read();
+      bool changed = !published;
+      for (uint8_t zone = 0; zone < zoneCount; zone++) {
+        const ZoneState& zoneState = current.zones[zone];
+        const ZoneState& last = sent.zones[zone];
+        changed = changed || abs(zoneState.tempRaw - last.tempRaw) >= mqttTempDeadbandRaw
+          || zoneState.currentPwm != last.currentPwm || zoneState.autopilotState != last.autopilotState
+          || zoneState.calibrating != last.calibrating;
+      }
+      if (!(changed || now - sentMs >= mqttHeartbeatMs) || (published && now - sentMs < mqttMinIntervalMs)) {
+        return;
+      }
+      StrBuilder json(requestArena, mqttBufferSize);
+      json += F("{\"uptimeMs\":");
+      json += now;
+      if constexpr (featureSntp) {
+        // the time of the state, the temperatures carry when they were taken
+        json += F(",\"unixMs\":");
+        appendUnixMs(json, now);
+      }
+      json += F(",\"zones\":[");
+      for (uint8_t zone = 0; zone < zoneCount; zone++) {
+        const ZoneState& zoneState = current.zones[zone];
+        json += zone ? F(",{\"zone\":") : F("{\"zone\":");
+        json += (int) zone;
+        json += F(",\"name\":\"");
+        json += zoneNames[zone];
+        json += F("\",\"temperature\":");
+        if (zoneState.tempRaw == tempRawInvalid) {
+          json += F("null");
+        } else {
+          json.appendFixed(tempRawToCenti(zoneState.tempRaw), 2);
+        }
+        if constexpr (featureSntp) {
+          json += F(",\"sampleUnixMs\":");
+          appendUnixMs(json, zoneState.sampledMs);
+        }
+        json += ',';
+        schemaJsonFields(json, zoneSettingsSchema, zoneState);
+        json += F(",\"calibrating\":");
+        json += zoneState.calibrating ? F("true}") : F("false}");
+      }
+      json += F("]}");
+      char topic[64];
+      mqttTopic("state", topic, sizeof(topic));
+      if (json.overflowed() || !fits(topic, json.length())) {
+        // the next pass sends whatever the state is by then
+        return;
+      }
+      if (!mqtt.publish(topic, json.c_str(), true)) {
+        mqttDropped++;
+        return;
+      }
+      mqttPublished++;
+      published = true;
+      sent = current;
+      sentMs = now;
+    }
+
+    WiFiClient client;
+    PubSubClient mqtt{client};
+    unsigned long lastAttemptMs = 0;
+    unsigned long backoffMs = 0;
+    bool published = false;
+    ControlState sent;
+    unsigned long sentMs = 0;
+};
+OptionalTask<featureMqtt, MqttTask> mqtt_task;
+
+////////////////////////////////
+// Telemetry Task
+// Multicasts a TelemetryPacket every telemetryPeriodMs, for fleets where
+// scraping every device over TCP costs more than the numbers are worth. The
+// packet is laid out once, a period only refreshes its fields and sends it
+// as one datagram.
+class TelemetryTask : public Task {
+public:
+    TelemetryTask() : Task("telemetry", telemetryPeriodMs ? telemetryPeriodMs : 60000) {}
+
+protected:
+    void setup() {
+      packet.magic = telemetryMagic;
+      packet.version = telemetryVersion;
+      packet.zoneCount = zoneCount;
+      packet.deviceId = ESP.getChipId();
+      packet.sequence = 0;
+    }
+
+    void loop() {
+      if (!telemetryPeriodMs || WiFi.status() != WL_CONNECTED) {
+        return;
+      }
+      const ControlState current = controlState.read();
+      packet.sequence++;
+      packet.uptimeMs = millis();
+      for (uint8_t zone = 0; zone < zoneCount; zone++) {
+        const ZoneState& zoneState = current.zones[zone];
+        packet.zones[zone].tempRaw = zoneState.tempRaw;
+        packet.zones[zone].pwm = constrain(zoneState.currentPwm, 0, 255);
+        packet.zones[zone].mode = zoneState.autopilotState | (zoneState.calibrating ? telemetryCalibrating : 0);
+        packet.zones[zone].rpm = tachRpm[zone];
+      }
+      IPAddress group(telemetryGroup[0], telemetryGroup[1], telemetryGroup[2], telemetryGroup[3]);
+      if (udp.beginPacketMulticast(group, telemetryPort, WiFi.localIP(), telemetryTtl)
+          && udp.write((const uint8_t*) &packet, sizeof(packet)) == sizeof(packet)
+          && udp.endPacket()) {
+        telemetrySent++;
+      } else {
+        telemetryFailed++;
+      }
+    }
+
+private:
+    WiFiUDP udp;
+    TelemetryPacket packet;
+};
+OptionalTask<featureTelemetry, TelemetryTask> telemetry_task;
+
+////////////////////////////////
+// Clock Task
+// Keeps wallClock on ntpHost with SNTP. A request goes out every poll
+// interval, which doubles from ntpPollMinMs up to ntpPollMaxMs while the
+// offsets stay within ntpSteadyOffsetMs and drops back after a step or a
+// failure. The reply is looked for every ms rather than waited for: its
+// receive time is what the offset rests on. ntpHost is resolved once, which
+// can block for up to ntpTimeoutMs, and again only after a failed exchange:
+// a pool may have retired the server.
+// Every run saves the clock to RTC memory along with the RTC timer, which
+// keeps counting through a soft or watchdog reset, so the next boot has the
+// time before the network is up.
+struct ClockRtcRecord {
+  uint32_t magic;
+  uint32_t rtcTicks;     // system_get_rtc_time() when the snapshot was taken
+  WallClockState clock;
+  uint32_t check;        // FNV-1a of what comes before
+};
+
+uint32_t clockRtcCheck(const ClockRtcRecord& record) {
+  const uint8_t* bytes = (const uint8_t*) &record;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(ClockRtcRecord, check); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+class ClockTask : public Task {
+public:
+    ClockTask() : Task("clock", clockTickMs) {}
+
+protected:
+    void setup() {
+      restore();
+    }
+
+    void loop() {
+      unsigned long now = millis();
+      if (waiting) {
+        receive(now);
+        if (waiting) {
+          runAgainIn(1);
+          return;
+        }
+      }
+      wallClock.tick(now);
+      save();
+      if (ntpHost[0] && WiFi.status() == WL_CONNECTED && (long)(now - nextPollMs) >= 0) {
+        send();
+      }
+    }
+
+    void send() {
+      if (!udpOpen) {
+        // any free local port
+        udpOpen = udp.begin(0);
+      }
+      if (!udpOpen) {
+        return fail(millis());
+      }
+      if (!serverResolved) {
+        // blocks for at most ntpTimeoutMs
+        serverResolved = WiFi.hostByName(ntpHost, serverIp, ntpTimeoutMs);
+        if (!serverResolved) {
+          return fail(millis());
+        }
+      }
+      while (udp.parsePacket() > 0) {
+        // stale, e.g. a reply that came after its timeout
+      }
+      uint8_t packet[sntpPacketSize];
+      nonce = ((uint64_t) ESP.random() << 32) | ESP.random();
+      sntpRequest(packet, nonce);
+      sentMs = millis();
+      if (!udp.beginPacket(serverIp, ntpPort) || udp.write(packet, sizeof(packet)) != sizeof(packet) || !udp.endPacket()) {
+        return fail(sentMs);
+      }
+      waiting = true;
+      runAgainIn(1);
+    }
+
+    void receive(unsigned long now) {
+      while (udp.parsePacket() > 0) {
+        uint8_t packet[sntpPacketSize];
+        int length = udp.read(packet, sizeof(packet));
+        int64_t serverUnixMs;
+        uint32_t delayMs;
+        // anything else arriving on the port is dropped, so is a forged or late reply
+        if ((uint32_t) udp.remoteIP() != (uint32_t) serverIp || udp.remotePort() != ntpPort
+            || !sntpReply(packet, length > 0 ? length : 0, nonce, sentMs, now, serverUnixMs, delayMs)) {
+          continue;
+        }
+        waiting = false;
+        if (delayMs > ntpDelayMaxMs) {
+          return fail(now);
+        }
+        ntpDelayMs = delayMs;
+        WallClockSync result = wallClock.sync(serverUnixMs, now, pollMs);
+        bool steady = result == WALL_CLOCK_SLEWED && abs(wallClock.offsetMs()) <= ntpSteadyOffsetMs;
+        pollMs = steady ? min(pollMs * 2, ntpPollMaxMs) : ntpPollMinMs;
+        nextPollMs = now + pollMs;
+        return;
+      }
+      if (now - sentMs >= ntpTimeoutMs) {
+        waiting = false;
+        fail(now);
+      }
+    }
+
+    void fail(unsigned long now) {
+      ntpFailures++;
+      serverResolved = false;
+      pollMs = ntpPollMinMs;
+      nextPollMs = now + pollMs;
+    }
+
+    void save() {
+      if (!wallClock.valid()) {
+        return;
+      }
+      ClockRtcRecord record;
+      memset(&record, 0, sizeof(record));
+      record.magic = clockRtcMagic;
+      record.rtcTicks = system_get_rtc_time();
+      record.clock = wallClock.snapshot(millis());
+      record.check = clockRtcCheck(record);
+      ESP.rtcUserMemoryWrite(clockRtcOffset, (uint32_t*) &record, sizeof(record));
+    }
+
+    /*
+       Takes the clock over from before a soft or watchdog reset, plus the
+       time the RTC timer counted since. Power on and the reset pin clear
+       the timer, and RTC memory holds garbage after power on.
+    */
+    void restore() {
+      uint32_t reason = system_get_rst_info()->reason;
+      if (reason == REASON_DEFAULT_RST || reason == REASON_EXT_SYS_RST) {
+        return;
+      }
+      ClockRtcRecord record;
+      if (!ESP.rtcUserMemoryRead(clockRtcOffset, (uint32_t*) &record, sizeof(record))
+          || record.magic != clockRtcMagic || record.check != clockRtcCheck(record)) {
+        return;
+      }
+      // RTC ticks to us, the calibration is Q12
+      uint64_t elapsedUs = ((uint64_t)(system_get_rtc_time() - record.rtcTicks) * system_rtc_clock_cali_proc()) >> 12;
+      if (elapsedUs > clockRestoreMaxMs * 1000ULL) {
+        return;
+      }
+      wallClock.restore(record.clock, elapsedUs / 1000, millis());
+      DBG_OUTPUT_PORT.printf("Wall clock restored, %lu ms since it was saved\n", (unsigned long) (elapsedUs / 1000));
+    }
+
+private:
+    WiFiUDP udp;
+    bool udpOpen = false;
+    bool waiting = false;
+    IPAddress serverIp;
+    bool serverResolved = false;
+    uint64_t nonce = 0;
+    unsigned long sentMs = 0;
+    unsigned long nextPollMs = 0;
+    uint32_t pollMs = ntpPollMinMs;
+};
+OptionalTask<featureSntp, ClockTask> clock_task;
+
 
 boolean configMode = false;
 void setup(void) {
-  pinMode(PWMGPIO, OUTPUT);
-  digitalWrite(PWMGPIO, HIGH); 
+#ifdef KIRBY_TRACE
+  Trace.begin();
+#endif
+  // fans at full speed until the control tasks take over
+  for(uint8_t zone=0; zone<zoneCount; zone++){
+    pinMode(zonePwmPins[zone], OUTPUT);
+    digitalWrite(zonePwmPins[zone], HIGH);
+  }
   configMode = (digitalRead(2) == LOW);
   if(configMode){
 
@@ -658,59 +4199,42 @@ void setup(void) {
   fileSystem->setConfig(fileSystemConfig);
   fsOK = fileSystem->begin();
   DBG_OUTPUT_PORT.println(fsOK ? F("Filesystem initialized.") : F("Filesystem init failed!"));
+  bootFsMountedMs = millis();
 
-  Scheduler.start(&pwmsignal_task);
-  ////////////////////////////////
-  // WI-FI INIT
-  WiFi.mode(WIFI_STA);
-  WiFi.hostname(host);
-  
-  const char* *ssid = &ssid1;
-  const char* *wifipassword = &wifipassword1;
-
-  do{
-    DBG_OUTPUT_PORT.printf("Connecting to %s\n", *ssid);
-    WiFi.begin(*ssid, *wifipassword);
-    for(uint8_t i=0; i<10; i++){
-      delay(1000);
-      DBG_OUTPUT_PORT.print(".");
-      if(WiFi.status() == WL_CONNECTED){
-        break;
-      }
-      // Wait for connection
+  ControlState restored = {};
+  for(uint8_t zone=0; zone<zoneCount; zone++){
+    // no reading until the first conversion, 0 would be a temperature
+    restored.zones[zone].tempRaw = tempRawInvalid;
+    // without a stored state a zone follows its curve, as before modes existed
+    restored.zones[zone].autopilotState = AUTOPILOT_ENABLED;
+    read_persistent_zone_settings(zone, restored.zones[zone]);
+  }
+  controlState.update([&restored](ControlState& control) {
+    for(uint8_t zone=0; zone<zoneCount; zone++){
+      control.zones[zone].tempRaw = restored.zones[zone].tempRaw;
+      control.zones[zone].currentPwm = restored.zones[zone].currentPwm;
+      control.zones[zone].autopilotState = restored.zones[zone].autopilotState;
     }
-    if(ssid == &ssid1){
-      ssid = &ssid2;
-      wifipassword = &wifipassword2;
-    }else{
-      ssid = &ssid1;
-      wifipassword = &wifipassword1;
+    for(uint8_t probe=0; probe<probesMax; probe++){
+      control.probeRaw[probe] = tempRawInvalid;
     }
-  } while (WiFi.status() != WL_CONNECTED);
-  DBG_OUTPUT_PORT.println(F("Connected! IP address: "));
-  DBG_OUTPUT_PORT.println(WiFi.localIP());  
+  });
 
-  ////////////////////////////////
-  // MDNS INIT
-  if (MDNS.begin(host)) {
-    MDNS.addService("http", "tcp", 80);
-    DBG_OUTPUT_PORT.println(F("Open http://"));
-    DBG_OUTPUT_PORT.println(host);
-  }
-
-  if (fileSystem->exists(locPwmCurrent)) {
-    read_persistent_vars(&locPwmCurrent, &currentPwm);
-  }
-
-  Scheduler.start(&wifi_task);
+  // Control first, the network comes up in the background
+  Scheduler.start(&pwmsignal_task);
   Scheduler.start(&sensor_task);
   Scheduler.start(&autopilot_task);
+  Scheduler.start(&calibration_task);
+  Scheduler.start(&wifi_task);
+  Scheduler.start(mqtt_task.task());
+  Scheduler.start(telemetry_task.task());
+  Scheduler.start(clock_task.task());
+  Scheduler.start(&heapsample_task);
 
   Scheduler.begin();
- 
 }
 
 
 void loop(void) {
-  DBG_OUTPUT_PORT.println("This should never happen");
+  Scheduler.run();
 }
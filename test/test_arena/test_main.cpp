@@ -0,0 +1,137 @@
+// RequestArena and StrBuilder: allocation, overflow, streaming through the
+// flush callback and number formatting.
+#include <Arduino.h>
+#include <RequestArena.h>
+#include <unity.h>
+
+#include <string>
+
+static std::string flushed;
+static uint32_t flushes;
+
+static void collect(const char *data, size_t length) {
+    flushed.append(data, length);
+    flushes++;
+}
+
+void setUp() {
+    flushed.clear();
+    flushes = 0;
+}
+
+void tearDown() {
+}
+
+void test_alloc_is_aligned_and_bounded() {
+    StaticRequestArena<64> arena;
+    uint8_t *a = (uint8_t *) arena.alloc(5);
+    uint8_t *b = (uint8_t *) arena.alloc(1);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_EQUAL(8, b - a);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) b & 3);
+    TEST_ASSERT_EQUAL_size_t(12, arena.used());
+    TEST_ASSERT_EQUAL_size_t(52, arena.available());
+
+    TEST_ASSERT_NULL(arena.alloc(53));
+    TEST_ASSERT_EQUAL_UINT32(1, arena.failures());
+    TEST_ASSERT_NOT_NULL(arena.alloc(52));
+    TEST_ASSERT_EQUAL_size_t(0, arena.available());
+    TEST_ASSERT_NULL(arena.alloc(1));
+    TEST_ASSERT_EQUAL_UINT32(2, arena.failures());
+}
+
+void test_reset_keeps_high_water() {
+    StaticRequestArena<128> arena;
+    arena.alloc(100);
+    arena.reset();
+    TEST_ASSERT_EQUAL_size_t(0, arena.used());
+    arena.alloc(16);
+    TEST_ASSERT_EQUAL_size_t(100, arena.highWater());
+    // the same memory again after a reset
+    uint8_t *first = (uint8_t *) arena.alloc(4);
+    arena.reset();
+    TEST_ASSERT_EQUAL_PTR(first - 16, arena.alloc(4));
+}
+
+void test_builder_appends_like_string() {
+    StaticRequestArena<256> arena;
+    StrBuilder text(arena, 64);
+    text += "kirby_pwm_current{zone=\"";
+    text += 0;
+    text += F("\"} ");
+    text += 'x';
+    text += String("yz");
+    TEST_ASSERT_EQUAL_STRING("kirby_pwm_current{zone=\"0\"} xyz", text.c_str());
+    TEST_ASSERT_FALSE(text.overflowed());
+    text.truncate(5);
+    TEST_ASSERT_EQUAL_STRING("kirby", text.c_str());
+    text.clear();
+    TEST_ASSERT_EQUAL_size_t(0, text.length());
+    TEST_ASSERT_EQUAL_STRING("", text.c_str());
+}
+
+void test_builder_formats_numbers() {
+    StaticRequestArena<512> arena;
+    StrBuilder text(arena, 256);
+    text += (short) -32768; text += ' ';
+    text += (unsigned short) 65535; text += ' ';
+    text += INT32_MIN; text += ' ';
+    text += UINT32_MAX; text += ' ';
+    text += INT64_MIN; text += ' ';
+    text += UINT64_MAX; text += ' ';
+    text += 0UL;
+    TEST_ASSERT_EQUAL_STRING("-32768 65535 -2147483648 4294967295 -9223372036854775808 18446744073709551615 0", text.c_str());
+
+    text.clear();
+    text.appendFixed(2345, 2); text += ' ';
+    text.appendFixed(-5, 2); text += ' ';
+    text.appendFixed(-1234, 1); text += ' ';
+    text.appendFixed(7, 0); text += ' ';
+    text.appendFixed(100, 3);
+    TEST_ASSERT_EQUAL_STRING("23.45 -0.05 -123.4 7 0.100", text.c_str());
+}
+
+void test_builder_overflow_drops_the_rest() {
+    StaticRequestArena<64> arena;
+    StrBuilder text(arena, 8);
+    text += "0123456789";
+    TEST_ASSERT_TRUE(text.overflowed());
+    TEST_ASSERT_EQUAL_STRING("01234567", text.c_str());
+
+    // an exhausted arena gives an empty builder rather than a crash
+    StrBuilder none(arena, 128);
+    TEST_ASSERT_EQUAL_size_t(0, none.capacity());
+    none += "anything";
+    TEST_ASSERT_TRUE(none.overflowed());
+    TEST_ASSERT_EQUAL_STRING("", none.c_str());
+}
+
+void test_builder_streams_through_flush() {
+    StaticRequestArena<64> arena;
+    StrBuilder text(arena, 16, collect);
+    std::string expected;
+    for (int i = 0; i < 1000; i++) {
+        text += "line ";
+        text += i;
+        text += '\n';
+        expected += "line " + std::to_string(i) + "\n";
+    }
+    text.flush();
+    TEST_ASSERT_FALSE(text.overflowed());
+    TEST_ASSERT_EQUAL_size_t(expected.size(), flushed.size());
+    TEST_ASSERT_TRUE(expected == flushed);
+    TEST_ASSERT_GREATER_OR_EQUAL(expected.size() / 16, flushes);
+    // a 16 byte buffer never needed more of the arena
+    TEST_ASSERT_EQUAL_size_t(20, arena.highWater());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_alloc_is_aligned_and_bounded);
+    RUN_TEST(test_reset_keeps_high_water);
+    RUN_TEST(test_builder_appends_like_string);
+    RUN_TEST(test_builder_formats_numbers);
+    RUN_TEST(test_builder_overflow_drops_the_rest);
+    RUN_TEST(test_builder_streams_through_flush);
+    return UNITY_END();
+}
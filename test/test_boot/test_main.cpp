@@ -0,0 +1,150 @@
+// Boot before the first probe reading: the strength restored from the flash
+// stands, the autopilot does not take the missing reading for 0 °C, and no
+// temperature is exported until there is one.
+#include <Arduino.h>
+#include <DallasTemperature.h>
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include <NativeHost.h>
+#include <SETTINGS.h>
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+void setup();
+void loop();
+
+// from src/main.cpp
+const short int autopilotSettingsSize = 20;
+struct AutopilotSettings {
+    CurvePoint points[autopilotSettingsSize];
+};
+bool write_persistent_zone_settings(uint8_t zone, const ZoneState &state);
+bool write_persistent_autopilot_settings(uint8_t zone, const AutopilotSettings &settings);
+
+static std::string root;
+static uint16_t port;
+
+static void runFor(uint32_t ms) {
+    uint64_t end = nativeMicros64() + ms * 1000ULL;
+    while (nativeMicros64() < end) {
+        loop();
+    }
+}
+
+// Body of a GET, the firmware runs until it has replied
+static std::string get(const char *path) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return "";
+    }
+    char head[128];
+    int length = snprintf(head, sizeof(head), "GET %s HTTP/1.1\r\nHost: kirby\r\nConnection: close\r\n\r\n", path);
+    send(fd, head, length, MSG_NOSIGNAL);
+
+    std::string reply;
+    for (uint32_t spins = 0; spins < 100000; spins++) {
+        loop();
+        struct pollfd readable = {fd, POLLIN, 0};
+        if (poll(&readable, 1, 0) <= 0) {
+            continue;
+        }
+        char buffer[4096];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            break;
+        }
+        reply.append(buffer, n);
+    }
+    close(fd);
+    size_t body = reply.find("\r\n\r\n");
+    return body == std::string::npos ? "" : reply.substr(body + 4);
+}
+
+static uint16_t freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *) &addr, &length);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+static bool contains(const std::string &text, const char *part) {
+    return text.find(part) != std::string::npos;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// Strength 64 from before the reset and a curve that asks for 20 below 30 °C
+void test_boots_without_a_probe() {
+    char dir[] = "/tmp/kirby-test-boot-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    root = dir;
+    LittleFS.setRoot(root.c_str());
+    TEST_ASSERT_TRUE(LittleFS.begin());
+    ZoneState saved = {};
+    saved.currentPwm = 64;
+    saved.autopilotState = AUTOPILOT_ENABLED;
+    TEST_ASSERT_TRUE(write_persistent_zone_settings(0, saved));
+    AutopilotSettings curve = {{{30, 20}, {40, 80}}};
+    TEST_ASSERT_TRUE(write_persistent_autopilot_settings(0, curve));
+
+    port = freePort();
+    nativeOptions.httpPort = port;
+    nativeOptions.ssids[0] = "primaryssid";
+    nativeOptions.ssidCount = 1;
+    nativeSerialTo(nullptr);
+    nativeUseVirtualTime(true);
+    nativeSetProbeCount(0);
+    setup();
+    runFor(60000);
+    TEST_ASSERT_EQUAL_INT(WL_CONNECTED, WiFi.status());
+}
+
+void test_restored_strength_stands_until_the_first_reading() {
+    std::string metrics = get("/metrics");
+    TEST_ASSERT_TRUE(contains(metrics, "kirby_pwm_current{zone=\"0\",name=\"tube\"} 64\n"));
+    TEST_ASSERT_FALSE(contains(metrics, "kirby_temperature_current"));
+    TEST_ASSERT_FALSE(contains(metrics, "kirby_model_forecast"));
+    std::string model = get("/autopilot/model");
+    TEST_ASSERT_TRUE(contains(model, "\"forecast\":null,\"lowestDuty\":null"));
+}
+
+void test_curve_takes_over_with_the_first_reading() {
+    nativeSetProbeCount(1);
+    nativeSetProbeRaw(0, 35 * 128);
+    runFor(60000);
+    std::string metrics = get("/metrics");
+    TEST_ASSERT_TRUE(contains(metrics, "kirby_temperature_current{zone=\"0\",name=\"tube\"} 35.00"));
+    TEST_ASSERT_TRUE(contains(metrics, "kirby_pwm_current{zone=\"0\",name=\"tube\"} 80\n"));
+
+    std::string command = "rm -rf " + root;
+    TEST_ASSERT_EQUAL_INT(0, system(command.c_str()));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_boots_without_a_probe);
+    RUN_TEST(test_restored_strength_stands_until_the_first_reading);
+    RUN_TEST(test_curve_takes_over_with_the_first_reading);
+    return UNITY_END();
+}
@@ -0,0 +1,140 @@
+// One control iteration the way the firmware did it in float and the way it
+// does it now in integer units: probe reading to whole degrees, the curve
+// point, the PWM duty and the temperature on /metrics. Both must come to the
+// same result for every reading, and the benchmark prints what each costs.
+#include <Arduino.h>
+#include <RequestArena.h>
+#include <SETTINGS.h>
+#include <unity.h>
+
+#include <chrono>
+#include <math.h>
+
+// from src/main.cpp
+const int16_t tempRawPerDegree = 16;
+const uint16_t pwmDutyRange = 1000;
+const short int autopilotSettingsSize = 20;
+long tempRawToCenti(int16_t raw);
+
+static CurvePoint curve[autopilotSettingsSize] = {{25, 0}, {30, 20}, {32, 35}, {35, 60}, {38, 80}, {40, 100}};
+static StaticRequestArena<256> arena;
+
+struct Iteration {
+    short int pwm;  // percent, -1 when the curve has no point above
+    uint16_t duty;  // of analogWrite()
+};
+
+/*
+   Before: DallasTemperature's getTempCByIndex() turned the count (1/128 °C)
+   into a float, the autopilot compared round() of it with the curve, the
+   PWM task wrote round(pwm * 2.55) into the default range of 255 and
+   /metrics printed lround(temp * 100).
+*/
+static Iteration floatIteration(int32_t raw128, StrBuilder &metrics) {
+    Iteration out = {-1, 0};
+    float tempCelcius = (float) raw128 * 0.0078125f;
+    if (!(tempCelcius > 0 && tempCelcius < 100)) {
+        return out;
+    }
+    for (byte i = 0; i < autopilotSettingsSize; i++) {
+        if (curve[i].temperature > round(tempCelcius)) {
+            out.pwm = curve[i].strength;
+            break;
+        }
+    }
+    out.duty = out.pwm < 0 ? 0 : round(float(out.pwm) * float(2.55));
+    metrics += F("kirby_temperature_current ");
+    metrics.appendFixed(lround(tempCelcius * 100), 2);
+    return out;
+}
+
+// After: the count is shifted to 1/16 °C and stays an integer, the duty is
+// per-mille and /metrics scales the count to 1/100 °C
+static Iteration integerIteration(int32_t raw128, StrBuilder &metrics) {
+    Iteration out = {-1, 0};
+    int16_t tempRaw = raw128 >> 3;
+    if (!(tempRaw > 0 && tempRaw < 100 * tempRawPerDegree)) {
+        return out;
+    }
+    short int tempCelcius = (tempRaw + tempRawPerDegree / 2) / tempRawPerDegree;
+    for (byte i = 0; i < autopilotSettingsSize; i++) {
+        if (curve[i].temperature > tempCelcius) {
+            out.pwm = curve[i].strength;
+            break;
+        }
+    }
+    out.duty = out.pwm < 0 ? 0 : out.pwm * (pwmDutyRange / 100);
+    metrics += F("kirby_temperature_current ");
+    metrics.appendFixed(tempRawToCenti(tempRaw), 2);
+    return out;
+}
+
+void setUp() {
+    arena.reset();
+}
+
+void tearDown() {
+}
+
+// Every 12 bit reading from -10 to 110 °C: the same curve point, a duty
+// within one step of the old range and the same text on /metrics
+void test_integer_path_matches_the_float_path() {
+    StrBuilder before(arena, 64);
+    StrBuilder after(arena, 64);
+    for (int32_t raw128 = -10 * 128; raw128 <= 110 * 128; raw128 += 8) {
+        before.clear();
+        after.clear();
+        Iteration old = floatIteration(raw128, before);
+        Iteration now = integerIteration(raw128, after);
+        char where[32];
+        snprintf(where, sizeof(where), "at %.4f °C", raw128 / 128.0);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(old.pwm, now.pwm, where);
+        TEST_ASSERT_INT_WITHIN_MESSAGE(pwmDutyRange / 255 + 1, old.duty * pwmDutyRange / 255, now.duty, where);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(before.c_str(), after.c_str(), where);
+    }
+}
+
+void test_api_rounding() {
+    TEST_ASSERT_EQUAL_INT32(13, tempRawToCenti(2));
+    TEST_ASSERT_EQUAL_INT32(3506, tempRawToCenti(561));
+    TEST_ASSERT_EQUAL_INT32(-13, tempRawToCenti(-2));
+    TEST_ASSERT_EQUAL_INT32(0, tempRawToCenti(0));
+}
+
+/*
+   Host ns per iteration on the same readings. The host has an FPU, the
+   ESP8266 does every float operation in software, so there the float path
+   costs far more than this ratio says; kirby_task_cycles_* on a device
+   gives the real numbers.
+*/
+void test_benchmark_control_iteration() {
+    const uint32_t iterations = 2000000;
+    StrBuilder metrics(arena, 64);
+    uint32_t sum[2] = {0, 0};
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        metrics.clear();
+        sum[0] += floatIteration(24 * 128 + (i & 2047) * 8, metrics).duty;
+    }
+    auto floats = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        metrics.clear();
+        sum[1] += integerIteration(24 * 128 + (i & 2047) * 8, metrics).duty;
+    }
+    auto integers = std::chrono::steady_clock::now();
+    TEST_ASSERT_TRUE(sum[0] > 0 && sum[1] > 0);
+
+    char message[96];
+    snprintf(message, sizeof(message), "control iteration: float %.1f ns, integer %.1f ns",
+             std::chrono::duration<double, std::nano>(floats - start).count() / iterations,
+             std::chrono::duration<double, std::nano>(integers - floats).count() / iterations);
+    TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_integer_path_matches_the_float_path);
+    RUN_TEST(test_api_rounding);
+    RUN_TEST(test_benchmark_control_iteration);
+    return UNITY_END();
+}
@@ -0,0 +1,184 @@
+// The LittleFS shim and the firmware's persistence on top of it: files,
+// directories, the binary settings files and the migration of the files
+// older firmware wrote, and the writes a save of a zone's settings takes.
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <NativeHost.h>
+#include <SETTINGS.h>
+#include <unity.h>
+
+#include <stdlib.h>
+#include <string>
+
+// from src/main.cpp and include/VAR_LOCATIONS.h
+extern const char *locZoneSettings;
+extern const char *locAutoPilotSettings;
+extern const char *locPwmCurrent;
+extern const char *locAutoPilotState;
+const short int autopilotSettingsSize = 20;
+struct AutopilotSettings {
+    CurvePoint points[autopilotSettingsSize];
+};
+void read_persistent_zone_settings(uint8_t zone, ZoneState &state);
+bool write_persistent_zone_settings(uint8_t zone, const ZoneState &state);
+void read_persistent_autopilot_settings(uint8_t zone, AutopilotSettings &settings);
+bool write_persistent_autopilot_settings(uint8_t zone, const AutopilotSettings &settings);
+
+static std::string root;
+
+static void writeFile(const char *path, const void *data, size_t length) {
+    File file = LittleFS.open(path, "w");
+    TEST_ASSERT_TRUE(file);
+    TEST_ASSERT_EQUAL_size_t(length, file.write((const uint8_t *) data, length));
+    file.close();
+}
+
+void setUp() {
+    char dir[] = "/tmp/kirby-test-fs-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    root = dir;
+    LittleFS.setRoot(root.c_str());
+    TEST_ASSERT_TRUE(LittleFS.begin());
+    LittleFS.resetStats();
+    nativeSerialTo(nullptr);
+}
+
+void tearDown() {
+    std::string command = "rm -rf " + root;
+    TEST_ASSERT_EQUAL_INT(0, system(command.c_str()));
+}
+
+void test_files_read_back() {
+    writeFile("/a.txt", "hello", 5);
+    File file = LittleFS.open("/a.txt", "a");
+    file.print(" world");
+    file.close();
+
+    file = LittleFS.open("/a.txt", "r");
+    TEST_ASSERT_EQUAL_size_t(11, file.size());
+    char text[16] = {};
+    TEST_ASSERT_EQUAL_size_t(11, file.read((uint8_t *) text, sizeof(text)));
+    TEST_ASSERT_EQUAL_STRING("hello world", text);
+    TEST_ASSERT_TRUE(file.seek(6));
+    TEST_ASSERT_EQUAL_INT('w', file.read());
+    TEST_ASSERT_EQUAL_INT(4, file.available());
+    file.close();
+
+    TEST_ASSERT_FALSE(LittleFS.open("/missing", "r"));
+    TEST_ASSERT_TRUE(LittleFS.rename("/a.txt", "/b.txt"));
+    TEST_ASSERT_FALSE(LittleFS.exists("/a.txt"));
+    TEST_ASSERT_TRUE(LittleFS.remove("/b.txt"));
+    TEST_ASSERT_FALSE(LittleFS.exists("/b.txt"));
+}
+
+void test_directories_list_in_name_order() {
+    writeFile("/dir/c", "3", 1);
+    writeFile("/dir/a", "1", 1);
+    writeFile("/dir/sub/b", "22", 2);
+    Dir dir = LittleFS.openDir("/dir");
+    const char *names[] = {"a", "c", "sub"};
+    for (const char *name : names) {
+        TEST_ASSERT_TRUE(dir.next());
+        TEST_ASSERT_EQUAL_STRING(name, dir.fileName().c_str());
+    }
+    TEST_ASSERT_TRUE(dir.isDirectory());
+    TEST_ASSERT_FALSE(dir.next());
+    TEST_ASSERT_TRUE(LittleFS.open("/dir/sub", "r").isDirectory());
+
+    FSInfo info;
+    TEST_ASSERT_TRUE(LittleFS.info(info));
+    TEST_ASSERT_EQUAL_size_t(3 * 4096, info.usedBytes);
+}
+
+void test_zone_settings_round_trip() {
+    ZoneState saved = {};
+    saved.currentPwm = 64;
+    saved.autopilotState = AUTOPILOT_PREDICTIVE;
+    TEST_ASSERT_TRUE(write_persistent_zone_settings(0, saved));
+    TEST_ASSERT_TRUE(LittleFS.exists(locZoneSettings));
+
+    ZoneState read = {};
+    read_persistent_zone_settings(0, read);
+    TEST_ASSERT_EQUAL_INT16(64, read.currentPwm);
+    TEST_ASSERT_EQUAL_UINT8(AUTOPILOT_PREDICTIVE, read.autopilotState);
+}
+
+void test_unreadable_zone_settings_are_ignored() {
+    writeFile(locZoneSettings, "garbage", 7);
+    ZoneState read = {};
+    read.currentPwm = 12;
+    read.autopilotState = AUTOPILOT_ENABLED;
+    read_persistent_zone_settings(0, read);
+    TEST_ASSERT_EQUAL_INT16(12, read.currentPwm);
+    TEST_ASSERT_EQUAL_UINT8(AUTOPILOT_ENABLED, read.autopilotState);
+}
+
+void test_legacy_zone_files_are_migrated() {
+    uint8_t pwm = 55;
+    uint8_t state = AUTOPILOT_DISABLED;
+    writeFile(locPwmCurrent, &pwm, 1);
+    writeFile(locAutoPilotState, &state, 1);
+
+    ZoneState read = {};
+    read.autopilotState = AUTOPILOT_ENABLED;
+    read_persistent_zone_settings(0, read);
+    TEST_ASSERT_EQUAL_INT16(55, read.currentPwm);
+    TEST_ASSERT_EQUAL_UINT8(AUTOPILOT_DISABLED, read.autopilotState);
+    TEST_ASSERT_FALSE(LittleFS.exists(locPwmCurrent));
+    TEST_ASSERT_FALSE(LittleFS.exists(locAutoPilotState));
+
+    ZoneState again = {};
+    read_persistent_zone_settings(0, again);
+    TEST_ASSERT_EQUAL_INT16(55, again.currentPwm);
+}
+
+void test_legacy_curve_csv_is_migrated() {
+    const char csv[] = "temperature,strength\n30,20\n35,60\n40,100\n";
+    writeFile(locAutoPilotSettings, csv, sizeof(csv) - 1);
+
+    AutopilotSettings settings = {};
+    read_persistent_autopilot_settings(0, settings);
+    TEST_ASSERT_EQUAL_INT16(30, settings.points[0].temperature);
+    TEST_ASSERT_EQUAL_INT16(60, settings.points[1].strength);
+    TEST_ASSERT_EQUAL_INT16(40, settings.points[2].temperature);
+    TEST_ASSERT_EQUAL_INT16(0, settings.points[3].temperature);
+
+    // rewritten in the binary format
+    File file = LittleFS.open(locAutoPilotSettings, "r");
+    SchemaFileHeader header;
+    TEST_ASSERT_EQUAL_size_t(sizeof(header), file.read((uint8_t *) &header, sizeof(header)));
+    TEST_ASSERT_EQUAL_UINT32(schemaFileMagic, header.magic);
+    TEST_ASSERT_EQUAL_UINT16(autopilotSettingsSize, header.count);
+    file.close();
+    AutopilotSettings again = {};
+    read_persistent_autopilot_settings(0, again);
+    TEST_ASSERT_EQUAL_MEMORY(&settings, &again, sizeof(settings));
+}
+
+// What matters on the flash: one save is one write of the header and one
+// of the record, nothing more
+void test_zone_settings_save_writes_once() {
+    ZoneState state = {};
+    state.autopilotState = AUTOPILOT_ENABLED;
+    const uint32_t saves = 100;
+    LittleFS.resetStats();
+    for (uint32_t i = 0; i < saves; i++) {
+        state.currentPwm = i % 101;
+        TEST_ASSERT_TRUE(write_persistent_zone_settings(0, state));
+    }
+    fs::FSStats stats = LittleFS.stats();
+    TEST_ASSERT_EQUAL_UINT32(2 * saves, stats.writeCalls);
+    TEST_ASSERT_EQUAL_UINT32((sizeof(SchemaFileHeader) + zoneSettingsSchema.recordSize) * saves, stats.bytesWritten);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_files_read_back);
+    RUN_TEST(test_directories_list_in_name_order);
+    RUN_TEST(test_zone_settings_round_trip);
+    RUN_TEST(test_unreadable_zone_settings_are_ignored);
+    RUN_TEST(test_legacy_zone_files_are_migrated);
+    RUN_TEST(test_legacy_curve_csv_is_migrated);
+    RUN_TEST(test_zone_settings_save_writes_once);
+    return UNITY_END();
+}
@@ -0,0 +1,164 @@
+// gzip streams for test_main.cpp, made with Python's zlib from the texts
+// text() and noise() of test_main.cpp generate:
+//
+//   fixedGz    text(2000, 2), level 9, 4 KB window, Z_FIXED: fixed Huffman codes
+//   dynamicGz  text(6000, 3), level 9, 4 KB window, named kirby.bin: dynamic codes,
+//              a name field and more output than the window holds
+//   tooFarGz   noise(200, 4), 4200 'x', noise(200, 4), level 9, 32 KB window:
+//              the second noise refers back 4400 bytes
+//
+// Stored blocks are built by the test itself.
+#ifndef TEST_GZIP_STREAMS
+#define TEST_GZIP_STREAMS
+
+#include <stdint.h>
+
+static const uint8_t fixedGz[] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x4b, 0x2c, 0x2d, 0xc9, 0x2f, 0xc8,
+    0xcc, 0xc9, 0x2f, 0x51, 0xc8, 0xce, 0x2c, 0x4a, 0xaa, 0x54, 0xc8, 0x4d, 0x2d, 0x29, 0xca, 0x4c,
+    0x2e, 0x56, 0x48, 0xce, 0xcf, 0x49, 0x51, 0xa8, 0xca, 0xcf, 0x4b, 0x55, 0x48, 0x2e, 0x2d, 0x2a,
+    0x4b, 0x55, 0x28, 0x2e, 0x29, 0x4a, 0xcd, 0x4b, 0x2f, 0xc9, 0x50, 0x28, 0xc9, 0x48, 0x85, 0x88,
+    0xe7, 0xa7, 0x81, 0xd8, 0x5c, 0x70, 0x89, 0xf2, 0xc4, 0xa2, 0x5c, 0x85, 0x44, 0xb8, 0x71, 0x10,
+    0x6d, 0x10, 0x43, 0xe1, 0x6a, 0xa0, 0xa6, 0x73, 0x81, 0x4d, 0x47, 0xd3, 0x00, 0x32, 0xb8, 0xa4,
+    0x34, 0x29, 0x15, 0xcc, 0x80, 0xe8, 0x4e, 0x4b, 0xcc, 0x03, 0x59, 0x83, 0xea, 0x32, 0xb0, 0xe5,
+    0x20, 0x19, 0x88, 0x30, 0x58, 0x25, 0x17, 0xd8, 0xac, 0x94, 0xd2, 0x92, 0x4a, 0x2e, 0x90, 0x6e,
+    0x88, 0x0c, 0xdc, 0x68, 0x24, 0x59, 0xa0, 0x69, 0x20, 0xad, 0x89, 0x79, 0x30, 0xeb, 0x81, 0x0c,
+    0x88, 0xea, 0x82, 0xa2, 0xfc, 0xa4, 0x54, 0x64, 0x1f, 0x23, 0x7b, 0x00, 0x2c, 0xc9, 0x05, 0x52,
+    0x0c, 0xd2, 0x0d, 0x91, 0x41, 0xb8, 0x1c, 0x6c, 0x12, 0x58, 0x27, 0x8a, 0x1b, 0xb1, 0x06, 0x08,
+    0xc2, 0xe7, 0x40, 0x93, 0x10, 0x81, 0x87, 0x6e, 0x24, 0xd0, 0x9d, 0x90, 0xf0, 0x85, 0x04, 0x09,
+    0xc8, 0xed, 0xe8, 0x61, 0x09, 0xf3, 0x07, 0x88, 0x06, 0x29, 0x44, 0xf3, 0x3d, 0x88, 0x95, 0x88,
+    0x2b, 0x72, 0xc1, 0xb6, 0xc1, 0x43, 0x16, 0x6c, 0x3a, 0xd8, 0xc9, 0xd0, 0x80, 0x03, 0x9a, 0x0a,
+    0x51, 0x02, 0x09, 0x14, 0x90, 0x9b, 0xb9, 0x60, 0x7a, 0x11, 0x4e, 0x06, 0xf9, 0x04, 0x9b, 0x2d,
+    0x28, 0x21, 0x01, 0x56, 0x05, 0x72, 0x22, 0x9a, 0x57, 0x61, 0x29, 0x01, 0xac, 0x18, 0x62, 0x0d,
+    0xd8, 0xa7, 0x68, 0xca, 0xe0, 0x5c, 0xf4, 0x70, 0x44, 0xf6, 0x3d, 0x5a, 0x74, 0x83, 0x3c, 0x06,
+    0x8f, 0x5c, 0x50, 0x12, 0x45, 0x04, 0x0a, 0x22, 0x5e, 0x60, 0xee, 0x03, 0x7b, 0x00, 0xa4, 0xae,
+    0x14, 0xe6, 0x02, 0x90, 0x89, 0xd0, 0x84, 0x87, 0x30, 0x12, 0x11, 0x3a, 0x5c, 0x60, 0x45, 0x60,
+    0x3e, 0x88, 0x00, 0xa5, 0x28, 0x68, 0x28, 0x81, 0x13, 0x22, 0x24, 0xe2, 0x10, 0x49, 0x0f, 0x11,
+    0xdf, 0x88, 0xb0, 0x84, 0x5b, 0x0a, 0x11, 0x82, 0xfb, 0x11, 0x35, 0x82, 0xb9, 0x40, 0x8e, 0x00,
+    0xdb, 0x03, 0x52, 0x9a, 0x9f, 0xc6, 0x85, 0xf0, 0x2a, 0x8a, 0x7e, 0x2e, 0x78, 0x6c, 0x82, 0x5d,
+    0x06, 0x75, 0x24, 0xd0, 0xdb, 0x08, 0xcf, 0x82, 0x08, 0x2e, 0x24, 0x47, 0x20, 0x22, 0x1c, 0x64,
+    0x0a, 0x98, 0x81, 0xf0, 0x3f, 0x44, 0x09, 0xae, 0xa4, 0x03, 0xf1, 0x1f, 0x8c, 0x87, 0xc8, 0x3e,
+    0xd0, 0x04, 0x0c, 0x4a, 0x39, 0x20, 0x1f, 0xa2, 0xf9, 0x09, 0x49, 0x16, 0xcc, 0x02, 0x79, 0x00,
+    0xee, 0x4f, 0x54, 0xb5, 0x5c, 0x28, 0x09, 0x8c, 0x0b, 0x11, 0x4c, 0xa8, 0xb1, 0x84, 0x66, 0x01,
+    0xbc, 0xe0, 0x80, 0xe7, 0x6c, 0xb0, 0x1f, 0x21, 0x21, 0x07, 0x77, 0x2e, 0x38, 0x1c, 0x40, 0xaa,
+    0x80, 0x62, 0x10, 0x87, 0x80, 0x55, 0x41, 0x98, 0xf0, 0xf0, 0x00, 0x97, 0x3f, 0x20, 0x4f, 0x20,
+    0x82, 0x09, 0xcc, 0x45, 0x78, 0x02, 0x12, 0x08, 0xc8, 0xe5, 0x06, 0x24, 0x26, 0x30, 0xf3, 0x08,
+    0x22, 0x17, 0x71, 0x41, 0x23, 0x08, 0x1c, 0x2d, 0x5c, 0xc8, 0x85, 0x0b, 0x2c, 0xe6, 0xa0, 0x89,
+    0x0e, 0xee, 0x47, 0xb8, 0x71, 0xc8, 0xd1, 0x92, 0x97, 0xc2, 0x05, 0x31, 0x0e, 0x11, 0x14, 0x60,
+    0xef, 0x42, 0x52, 0x1f, 0x72, 0xb8, 0x42, 0x4d, 0x07, 0x15, 0x33, 0x60, 0x7f, 0xa3, 0x46, 0x3a,
+    0x72, 0x90, 0x40, 0x55, 0x42, 0x48, 0x24, 0x01, 0x54, 0x7b, 0xe1, 0x59, 0x16, 0x64, 0x09, 0x38,
+    0xfb, 0xa1, 0x25, 0x11, 0xb8, 0xc5, 0x98, 0x99, 0x16, 0x11, 0xa9, 0x88, 0x44, 0x09, 0xcf, 0x38,
+    0x10, 0x12, 0x51, 0xf4, 0xc0, 0x23, 0x07, 0xec, 0x6c, 0xb0, 0x06, 0x44, 0xed, 0x83, 0x12, 0xf7,
+    0xb0, 0x08, 0x87, 0xc5, 0x1a, 0x22, 0x4c, 0xe0, 0xd9, 0x8e, 0x0b, 0xa5, 0x82, 0x81, 0x17, 0xe1,
+    0xf0, 0xf4, 0x82, 0x48, 0x1d, 0x90, 0xac, 0x0a, 0x49, 0x83, 0x60, 0x26, 0x2c, 0x88, 0x50, 0x82,
+    0x0a, 0xa9, 0x9a, 0x00, 0x47, 0x24, 0xac, 0x2a, 0x44, 0x2a, 0x9f, 0x90, 0xd3, 0x3f, 0x22, 0xfd,
+    0x72, 0x21, 0x22, 0x10, 0x91, 0x90, 0x90, 0x82, 0x1c, 0xa2, 0x08, 0x4b, 0x79, 0x87, 0x54, 0x25,
+    0x41, 0x8c, 0x00, 0xb9, 0x1f, 0xdd, 0x6d, 0x70, 0xdf, 0x03, 0x00, 0x91, 0x21, 0x95, 0x03, 0xd0,
+    0x07, 0x00, 0x00,
+};
+static const uint8_t dynamicGz[] = {
+    0x1f, 0x8b, 0x08, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x6b, 0x69, 0x72, 0x62, 0x79, 0x2e,
+    0x62, 0x69, 0x6e, 0x00, 0x75, 0x57, 0x51, 0x76, 0xdb, 0x30, 0x0c, 0xfb, 0xe7, 0x29, 0x7c, 0xb5,
+    0xae, 0x4d, 0xe7, 0xbe, 0x6e, 0xc9, 0x5e, 0x96, 0x6c, 0x6f, 0x3b, 0xfd, 0x2c, 0x52, 0x24, 0x00,
+    0xca, 0xfb, 0x68, 0x6a, 0xcb, 0x12, 0x45, 0x91, 0x20, 0x08, 0x7d, 0x7e, 0xdc, 0xbf, 0xfc, 0xd9,
+    0x5e, 0xae, 0x6f, 0xdb, 0xfb, 0xcb, 0x75, 0xfb, 0xac, 0xb7, 0xc7, 0xf3, 0xcb, 0x65, 0x7b, 0x7b,
+    0x3e, 0xfe, 0xc4, 0x4f, 0x7c, 0xf8, 0x7b, 0xbb, 0x5e, 0xb6, 0x97, 0xe7, 0xe3, 0xf6, 0xe3, 0xe3,
+    0xdb, 0xed, 0x81, 0x39, 0x36, 0xd6, 0xfe, 0x7e, 0xb9, 0x7f, 0xdf, 0x1e, 0xfb, 0x65, 0xce, 0x7d,
+    0xbd, 0x7d, 0x7b, 0xdb, 0xbe, 0x5f, 0x1e, 0xf7, 0x8f, 0xd7, 0x9f, 0xfe, 0xcd, 0x7c, 0x64, 0xcc,
+    0xbc, 0xbd, 0x6f, 0xaf, 0xcf, 0xfb, 0xaf, 0xcb, 0xf6, 0xf3, 0x71, 0xbf, 0x5c, 0xbf, 0x3e, 0x76,
+    0x3c, 0x8c, 0xcf, 0xb1, 0xcb, 0xe1, 0x03, 0x76, 0xb6, 0x9a, 0x70, 0xac, 0xfd, 0x71, 0xbf, 0xa5,
+    0x6f, 0xf1, 0xe8, 0x86, 0xfd, 0x3d, 0xcc, 0xc2, 0x43, 0x3c, 0x95, 0x81, 0x1a, 0x32, 0x3a, 0xc8,
+    0x7e, 0xb1, 0xf0, 0xda, 0x8f, 0x24, 0xde, 0xf8, 0xc8, 0x3c, 0x87, 0x8d, 0xe3, 0xe1, 0x2c, 0x7e,
+    0xe2, 0xc3, 0xa1, 0x9a, 0xef, 0x73, 0xfd, 0xe7, 0xf6, 0x1e, 0x53, 0xc8, 0xd7, 0x71, 0xa2, 0xb4,
+    0xc3, 0xc1, 0x99, 0x3b, 0xd7, 0x27, 0x3f, 0x82, 0xc7, 0x20, 0xa3, 0x97, 0xff, 0xc7, 0xa0, 0x55,
+    0x84, 0xe0, 0x82, 0x3f, 0x0d, 0xd7, 0x62, 0xed, 0x98, 0xe1, 0x43, 0x6b, 0x78, 0x7d, 0xa1, 0xec,
+    0x57, 0xff, 0x11, 0x97, 0x38, 0xc5, 0x8e, 0xfd, 0x87, 0xc1, 0x7c, 0xf6, 0x6d, 0x38, 0xb5, 0x71,
+    0x42, 0xdd, 0x81, 0x63, 0xc6, 0x70, 0xa0, 0xc4, 0x5c, 0xa7, 0xef, 0x3e, 0xbf, 0x56, 0x7b, 0x6c,
+    0x7d, 0xbc, 0xf6, 0x7b, 0x66, 0x82, 0xc7, 0xce, 0x19, 0x56, 0x9f, 0x32, 0xdc, 0xf2, 0xdd, 0x4d,
+    0xb3, 0x36, 0x26, 0xe6, 0x1f, 0x67, 0x87, 0x31, 0xe4, 0x2b, 0x0e, 0x03, 0x56, 0xc7, 0x3f, 0x1c,
+    0x2a, 0x5c, 0xd6, 0xc3, 0x18, 0x0d, 0xff, 0x8f, 0xa1, 0xcc, 0x10, 0x81, 0x6e, 0x6c, 0x51, 0x66,
+    0xf3, 0xbb, 0xe4, 0xce, 0xed, 0xc4, 0x10, 0x4c, 0x04, 0x20, 0x86, 0xff, 0x5e, 0x6a, 0xfb, 0x8c,
+    0x58, 0xec, 0x19, 0xe6, 0x23, 0x8e, 0x07, 0x2e, 0xc7, 0x5f, 0x60, 0x5b, 0x52, 0x9a, 0x75, 0x34,
+    0x06, 0x09, 0xba, 0x82, 0xe9, 0xf6, 0x86, 0x02, 0x17, 0x2b, 0xe2, 0x29, 0xc0, 0x43, 0x50, 0xd1,
+    0x12, 0x9c, 0x08, 0xc5, 0xf4, 0x70, 0x78, 0x9c, 0xa4, 0x2a, 0xd7, 0x0b, 0xa7, 0x00, 0x29, 0x39,
+    0x36, 0x9c, 0xcf, 0x88, 0x55, 0xc6, 0x31, 0xe1, 0x6e, 0xcc, 0x49, 0x2b, 0xf3, 0xbf, 0x1d, 0xe7,
+    0x1d, 0xc6, 0x99, 0x47, 0xc6, 0x7b, 0x59, 0x16, 0xe0, 0xac, 0x50, 0xb7, 0x4a, 0xd9, 0x08, 0x55,
+    0xbc, 0x49, 0xf5, 0x06, 0x5e, 0xa8, 0x4e, 0x7b, 0x4c, 0x8b, 0xeb, 0x66, 0xc4, 0xf7, 0xcc, 0x56,
+    0xfc, 0xc6, 0x68, 0x46, 0x30, 0x50, 0xb9, 0x82, 0xb9, 0x18, 0x4c, 0xaa, 0x84, 0xce, 0x09, 0xfe,
+    0x6d, 0xb5, 0xe5, 0x56, 0x09, 0xf1, 0xf1, 0x39, 0x2d, 0x80, 0xe1, 0xae, 0xbd, 0xd2, 0xc4, 0x02,
+    0x13, 0xba, 0xd6, 0xe8, 0xd8, 0x1f, 0x50, 0x43, 0x5a, 0xb5, 0xb8, 0x8b, 0x99, 0x13, 0x7e, 0x52,
+    0x2d, 0xc3, 0x7f, 0xd0, 0x93, 0x3f, 0x55, 0x73, 0x38, 0xbe, 0x5b, 0x75, 0x09, 0x78, 0xe8, 0x43,
+    0xa7, 0x55, 0xca, 0x05, 0x51, 0x41, 0xd1, 0xe9, 0x54, 0x38, 0xa3, 0x9c, 0xcb, 0xfc, 0xd8, 0x54,
+    0x60, 0x9e, 0x1e, 0x50, 0x4d, 0xf3, 0xef, 0x49, 0xa7, 0x48, 0x33, 0xc4, 0xe1, 0x68, 0x6f, 0x98,
+    0x1f, 0x90, 0x31, 0xd9, 0xac, 0x25, 0xce, 0xf7, 0x86, 0x19, 0xcb, 0xc8, 0xc5, 0x8f, 0xb6, 0xc2,
+    0xf0, 0xb3, 0xac, 0x03, 0x69, 0xd4, 0xf0, 0x3e, 0xa5, 0x69, 0x1f, 0xd6, 0xd0, 0xa8, 0x85, 0x9b,
+    0x4f, 0x28, 0xb8, 0xf6, 0x81, 0x8d, 0x4e, 0x60, 0x93, 0xda, 0x8a, 0x78, 0x5b, 0xd7, 0xa7, 0x70,
+    0x38, 0xd4, 0x9d, 0xe0, 0xce, 0xe0, 0x8a, 0x8e, 0x72, 0x02, 0x25, 0x5f, 0xaf, 0xc8, 0x76, 0x4a,
+    0x68, 0xb0, 0x00, 0x11, 0x44, 0x98, 0x38, 0x65, 0x0d, 0xa5, 0x4e, 0xa7, 0xb5, 0x1a, 0x59, 0x88,
+    0x1a, 0xa6, 0xa2, 0x86, 0x52, 0x68, 0x8d, 0xa3, 0xf0, 0x49, 0x0c, 0x3f, 0x40, 0x95, 0xa8, 0x99,
+    0x6b, 0xa6, 0x06, 0x98, 0x82, 0xe7, 0x99, 0x64, 0xed, 0x99, 0x9d, 0xdc, 0xa8, 0xcd, 0xae, 0x9a,
+    0xb4, 0x91, 0xf8, 0x90, 0x22, 0x8d, 0xb5, 0xbe, 0x8a, 0x1c, 0x3d, 0xba, 0x9d, 0xc7, 0xc4, 0xe9,
+    0xaa, 0x33, 0xbf, 0x2f, 0xf1, 0x2f, 0xd9, 0xeb, 0xd6, 0xd6, 0xeb, 0x1b, 0x77, 0xae, 0x42, 0xd0,
+    0x85, 0xf0, 0x0d, 0x75, 0x01, 0xed, 0x47, 0xbd, 0x08, 0xe8, 0x2a, 0x16, 0x68, 0xec, 0xd8, 0x84,
+    0xa1, 0x92, 0x4e, 0xe5, 0xc9, 0x16, 0xb8, 0xb9, 0x65, 0x77, 0x55, 0x41, 0x01, 0x7b, 0xd8, 0x76,
+    0x66, 0xa6, 0xc9, 0x3c, 0x6e, 0x63, 0xbd, 0x3c, 0xa5, 0x1b, 0xfb, 0x8b, 0x8c, 0x60, 0xe2, 0xc2,
+    0xa3, 0x14, 0x0c, 0x65, 0x5a, 0x71, 0x1c, 0xc0, 0x50, 0x7f, 0xb4, 0xda, 0x3c, 0x5b, 0x91, 0xb2,
+    0xfd, 0x3f, 0x31, 0xdb, 0xbb, 0x64, 0xe2, 0xb6, 0x1e, 0xea, 0x04, 0x39, 0xef, 0x04, 0xe1, 0xae,
+    0x4c, 0x95, 0x61, 0xc5, 0xd0, 0xb3, 0x99, 0x18, 0x40, 0xca, 0xbb, 0xa0, 0x9d, 0x4c, 0x19, 0x55,
+    0x00, 0xb2, 0x69, 0x84, 0xc5, 0x11, 0x48, 0xa1, 0x31, 0x43, 0x8f, 0x8a, 0x44, 0xe7, 0x70, 0xba,
+    0x49, 0x0e, 0xa4, 0xa0, 0xf1, 0x8a, 0x56, 0xc4, 0xa4, 0x48, 0x63, 0x0d, 0x3a, 0xbb, 0x8d, 0x25,
+    0x31, 0x1f, 0x8f, 0x7d, 0x1a, 0x6b, 0x13, 0x00, 0x1f, 0x4f, 0x12, 0x09, 0x93, 0xfe, 0xd2, 0x08,
+    0x9d, 0xf9, 0x87, 0xaa, 0x7a, 0x72, 0xca, 0xce, 0x24, 0x5c, 0x6a, 0x94, 0x04, 0xa5, 0xa5, 0xba,
+    0x5b, 0xee, 0x41, 0x54, 0xde, 0xae, 0x44, 0xd3, 0x94, 0x48, 0x51, 0xba, 0xcd, 0x50, 0x0d, 0xb6,
+    0x88, 0x8d, 0xed, 0x5a, 0x0d, 0xb6, 0x66, 0x32, 0x89, 0xd2, 0x07, 0x13, 0x48, 0xc6, 0x32, 0xa3,
+    0xca, 0xce, 0xc0, 0xb1, 0x10, 0x6e, 0x40, 0x55, 0x50, 0x18, 0x06, 0x3b, 0x8e, 0xd0, 0x0f, 0xaa,
+    0xe5, 0x9f, 0x07, 0xb7, 0xda, 0xf0, 0x29, 0x19, 0x91, 0x1a, 0x32, 0xe5, 0x8f, 0xb5, 0x4e, 0xc9,
+    0x1b, 0xc8, 0x8f, 0x04, 0xdd, 0x72, 0xbb, 0x49, 0xba, 0x9a, 0x11, 0x47, 0x55, 0x1b, 0x32, 0xaa,
+    0x37, 0x88, 0xac, 0xbb, 0x02, 0xcf, 0x94, 0x5e, 0xad, 0x41, 0xa3, 0x91, 0xeb, 0x8d, 0xa8, 0x79,
+    0xbd, 0x5e, 0x13, 0xf7, 0x0e, 0xa3, 0xce, 0x5c, 0xa0, 0x6c, 0x2d, 0x8d, 0x56, 0x50, 0xf1, 0x9a,
+    0x77, 0xd1, 0x85, 0xc5, 0xd0, 0xa5, 0xb8, 0x83, 0xf4, 0x66, 0xab, 0x42, 0xb9, 0xe4, 0x04, 0x9a,
+    0x9d, 0x5f, 0x45, 0xb8, 0xb7, 0x14, 0x9d, 0xb4, 0x36, 0x88, 0x8e, 0xad, 0x12, 0x33, 0xa3, 0x5f,
+    0x92, 0xb1, 0x09, 0x20, 0xee, 0x55, 0x73, 0x6a, 0x34, 0xbf, 0x5d, 0x92, 0x5c, 0xa9, 0x01, 0x4a,
+    0xfd, 0xd2, 0x48, 0x55, 0x52, 0x7b, 0x5b, 0x0a, 0x52, 0x2e, 0x03, 0x05, 0x9a, 0x14, 0x24, 0x15,
+    0x66, 0xdd, 0x12, 0x14, 0x85, 0xc9, 0x3c, 0xad, 0xd5, 0x69, 0x7b, 0xe8, 0xc2, 0x55, 0xda, 0x82,
+    0xa6, 0x17, 0x05, 0x56, 0x70, 0xc3, 0xe1, 0x66, 0xa0, 0x9a, 0x15, 0xa3, 0xc3, 0x18, 0x58, 0x78,
+    0xa5, 0xfa, 0x83, 0x1d, 0x25, 0xd6, 0x22, 0x73, 0x08, 0x34, 0x65, 0xc3, 0x26, 0x85, 0xf9, 0xf9,
+    0x95, 0x56, 0x48, 0x91, 0xd4, 0xed, 0xcb, 0x7d, 0x57, 0xcc, 0xcb, 0x45, 0xcf, 0x61, 0xc6, 0x6a,
+    0xde, 0xf3, 0xa4, 0x45, 0x10, 0x6e, 0x34, 0x2a, 0x58, 0x5a, 0x73, 0xe0, 0xf1, 0x44, 0xa1, 0x83,
+    0x79, 0x34, 0xab, 0x79, 0x64, 0xc9, 0xee, 0x62, 0x5f, 0xaf, 0x66, 0x7b, 0x13, 0x97, 0x60, 0x97,
+    0xba, 0xd9, 0x06, 0xa8, 0xea, 0xec, 0xe1, 0xf6, 0xc4, 0xe9, 0x4c, 0x08, 0x84, 0x78, 0x75, 0x49,
+    0x4a, 0x09, 0xe9, 0x56, 0x76, 0xa2, 0x82, 0x32, 0x00, 0x6b, 0xe0, 0xdb, 0x64, 0x5a, 0x43, 0xc7,
+    0x9d, 0x97, 0x0d, 0xa2, 0x35, 0x83, 0x5a, 0x03, 0x90, 0x1a, 0x39, 0x14, 0x42, 0x40, 0x29, 0xc8,
+    0xba, 0xa6, 0x70, 0xe9, 0x7a, 0xb8, 0x2d, 0xf6, 0x5e, 0x03, 0x99, 0x51, 0x07, 0x2c, 0x31, 0x44,
+    0x9a, 0x51, 0xc8, 0xcb, 0x5a, 0xe5, 0x10, 0x01, 0x38, 0xdf, 0x74, 0x0e, 0x3c, 0x7b, 0x42, 0xd6,
+    0xd1, 0x3b, 0x29, 0xee, 0x3b, 0x8b, 0x93, 0x3a, 0xf0, 0xe0, 0x91, 0xa1, 0x16, 0x56, 0x62, 0x9a,
+    0xd5, 0x8e, 0x08, 0x36, 0x17, 0x7b, 0x73, 0x15, 0x26, 0xdf, 0x2f, 0x6d, 0xd7, 0x89, 0x73, 0x08,
+    0x1f, 0xba, 0xb1, 0x99, 0x12, 0x00, 0x82, 0xa2, 0x45, 0xa1, 0x17, 0xdc, 0x95, 0x01, 0x54, 0xc0,
+    0x49, 0x8b, 0x19, 0x25, 0xb7, 0x76, 0x3f, 0x6b, 0x29, 0xe7, 0xeb, 0xcb, 0xde, 0x01, 0x30, 0x10,
+    0xa6, 0xe2, 0x99, 0xb8, 0xc2, 0xd1, 0x8a, 0xd4, 0x0a, 0x05, 0xd0, 0x2d, 0x67, 0x0a, 0x0b, 0x13,
+    0x85, 0xd0, 0x4f, 0x51, 0x64, 0xb7, 0xde, 0xcb, 0x58, 0x70, 0x21, 0x72, 0x5c, 0x92, 0x72, 0x73,
+    0xda, 0x4e, 0x80, 0x59, 0x55, 0x51, 0x82, 0x8c, 0x52, 0xc0, 0x17, 0xd1, 0x54, 0x42, 0x00, 0x86,
+    0x6a, 0x12, 0x23, 0x3c, 0x8b, 0xa7, 0x4b, 0x61, 0x2e, 0xfe, 0x9f, 0xe5, 0xed, 0x1f, 0xa5, 0x9b,
+    0x7e, 0x05, 0x70, 0x17, 0x00, 0x00,
+};
+static const uint8_t tooFarGz[] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x93, 0x4c, 0xfb, 0x5d, 0xaf, 0x3f,
+    0xa1, 0x69, 0xaa, 0x93, 0xb7, 0x6b, 0xe5, 0x5c, 0xf1, 0xf4, 0xa7, 0x5b, 0x27, 0x37, 0x34, 0x6a,
+    0x9e, 0xfa, 0x2c, 0x50, 0xe5, 0xcc, 0x1f, 0xdb, 0x75, 0xfc, 0xc5, 0xe3, 0x6b, 0x1f, 0x3e, 0xdb,
+    0x17, 0x97, 0xa5, 0x84, 0x9d, 0xb2, 0xf4, 0x70, 0x13, 0xe6, 0x4b, 0xe4, 0x9b, 0xe4, 0x75, 0xf4,
+    0xcf, 0x14, 0x7e, 0xd3, 0x5b, 0x1a, 0x91, 0x76, 0xd7, 0xe7, 0x1d, 0x17, 0x32, 0x3f, 0xa8, 0xa5,
+    0xb2, 0xeb, 0xf2, 0xf9, 0xd6, 0xb3, 0xbe, 0x3d, 0x8c, 0xc5, 0xc1, 0xbd, 0x3f, 0x3e, 0xfd, 0xbc,
+    0xf3, 0xcf, 0xd6, 0x62, 0xa3, 0x91, 0xea, 0xba, 0xfa, 0x78, 0x3b, 0xc9, 0xdd, 0x57, 0x26, 0x4d,
+    0xca, 0x62, 0xe6, 0xe8, 0x2c, 0xbc, 0x33, 0xa9, 0x65, 0xce, 0x73, 0xa9, 0xe9, 0x39, 0x2a, 0x5a,
+    0x8b, 0x16, 0x2e, 0x8e, 0xf5, 0xed, 0x7a, 0xd4, 0x79, 0x84, 0xff, 0xe5, 0x2a, 0xe3, 0x6a, 0xf5,
+    0x5e, 0x06, 0x2e, 0x6e, 0xc7, 0xd3, 0x66, 0x49, 0xb6, 0xea, 0x87, 0x8a, 0x03, 0x45, 0x9b, 0xef,
+    0xf8, 0xb9, 0x7e, 0xd4, 0x2a, 0xe1, 0x2e, 0xb4, 0x5e, 0xa0, 0x94, 0x10, 0x62, 0xa4, 0x72, 0x9f,
+    0x69, 0xff, 0xd1, 0xc4, 0x8d, 0x35, 0x97, 0xbf, 0xf2, 0xa5, 0xbe, 0x0b, 0x91, 0x31, 0x60, 0x5f,
+    0x25, 0xf1, 0x75, 0xa6, 0x2a, 0xdf, 0xac, 0x55, 0x76, 0xe6, 0x0c, 0x0d, 0xa7, 0x24, 0xdf, 0xab,
+    0xec, 0x8f, 0x3d, 0x34, 0xe3, 0x78, 0xfe, 0xa5, 0xeb, 0xed, 0x37, 0x16, 0x57, 0x8c, 0x82, 0x51,
+    0x30, 0x0a, 0x46, 0xc1, 0x28, 0x18, 0x05, 0xa3, 0x60, 0x14, 0x8c, 0x82, 0x51, 0x30, 0x0a, 0x46,
+    0xc1, 0x28, 0x18, 0x05, 0xa3, 0x60, 0x14, 0x50, 0x09, 0x48, 0x0e, 0x93, 0xf1, 0x12, 0x00, 0x4d,
+    0xe0, 0x96, 0x3c, 0xf8, 0x11, 0x00, 0x00,
+};
+
+#endif //TEST_GZIP_STREAMS
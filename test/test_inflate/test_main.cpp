@@ -0,0 +1,252 @@
+// Inflater into the simulated flash partition of the Updater shim, the way
+// POST /update writes a gzip filesystem image: stored, fixed and dynamic
+// blocks whole and in random pieces, and the streams it has to refuse.
+#include <Arduino.h>
+#include <ESP8266WebServer.h>
+#include <Inflate.h>
+#include <Updater.h>
+#include <flash_hal.h>
+#include <unity.h>
+
+#include <string>
+#include <vector>
+
+#include "gzip_streams.h"
+
+static const char *const words[] = {"fan", "tube", "kirby", "duty", "probe", "curve", "strength", "zone",
+                                    "autopilot", "metrics", "the", "of", "and", "warm", "cold"};
+
+// The plain texts of gzip_streams.h
+static std::string text(size_t length, uint32_t seed) {
+    std::string out;
+    uint32_t x = seed;
+    while (out.size() < length) {
+        x = (x * 1103515245u + 12345u) & 0x7fffffff;
+        out += words[(x >> 16) % (sizeof(words) / sizeof(words[0]))];
+        out += (x >> 8) & 7 ? ' ' : '\n';
+    }
+    out.resize(length);
+    return out;
+}
+
+static std::string noise(size_t length, uint32_t seed) {
+    std::string out;
+    uint32_t x = seed;
+    while (out.size() < length) {
+        x = (x * 1103515245u + 12345u) & 0x7fffffff;
+        out += (char) ((x >> 16) & 0xff);
+    }
+    return out;
+}
+
+static uint32_t crc32(const std::string &data) {
+    uint32_t crc = 0xffffffff;
+    for (uint8_t c : data) {
+        crc ^= c;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc >> 1 ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static void putLe(std::vector<uint8_t> &out, uint32_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+// A gzip stream of stored blocks of at most blockSize bytes
+static std::vector<uint8_t> storedGz(const std::string &data, size_t blockSize) {
+    std::vector<uint8_t> out = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    size_t offset = 0;
+    do {
+        size_t n = std::min(blockSize, data.size() - offset);
+        out.push_back(offset + n == data.size() ? 1 : 0);
+        putLe(out, n, 2);
+        putLe(out, ~n & 0xffff, 2);
+        out.insert(out.end(), data.begin() + offset, data.begin() + offset + n);
+        offset += n;
+    } while (offset < data.size());
+    putLe(out, crc32(data), 4);
+    putLe(out, data.size(), 4);
+    return out;
+}
+
+static std::vector<uint8_t> bytes(const uint8_t *data, size_t length) {
+    return std::vector<uint8_t>(data, data + length);
+}
+
+static bool toFlash(const uint8_t *data, size_t length, void *) {
+    return Update.write(const_cast<uint8_t *>(data), length) == length;
+}
+
+static bool refuse(const uint8_t *, size_t, void *) {
+    return false;
+}
+
+static Inflater inflater;
+static uint32_t chunkSeed;
+
+// Next piece size, 1 to 1500 bytes: smaller and larger than the input buffer
+static size_t nextChunk() {
+    chunkSeed = chunkSeed * 1103515245u + 12345u;
+    return 1 + (chunkSeed >> 8) % 1500;
+}
+
+// Inflates stream into a freshly erased filesystem partition, in pieces of
+// chunk bytes or random ones for chunk 0. Returns whether end() accepted it.
+static bool inflate(const std::vector<uint8_t> &stream, size_t chunk, Inflater::Output output = toFlash) {
+    TEST_ASSERT_TRUE(Update.begin(FS_end - FS_start, U_FS));
+    inflater.begin(output, nullptr);
+    bool ok = true;
+    for (size_t offset = 0; ok && offset < stream.size();) {
+        size_t n = std::min(chunk ? chunk : nextChunk(), stream.size() - offset);
+        ok = inflater.write(stream.data() + offset, n);
+        offset += n;
+    }
+    return ok && inflater.end();
+}
+
+static void assertFlashHolds(const std::string &expected) {
+    TEST_ASSERT_EQUAL_size_t(expected.size(), Update.progress());
+    TEST_ASSERT_EQUAL_UINT32(expected.size(), inflater.outputBytes());
+    TEST_ASSERT_EQUAL_MEMORY(expected.data(), Update.flash().data(), expected.size());
+    // nothing past the image was touched
+    TEST_ASSERT_EQUAL_UINT8(0xff, Update.flash()[expected.size()]);
+}
+
+void setUp() {
+    chunkSeed = 1;
+}
+
+void tearDown() {
+    // drop the partition without saving it to a file
+    Update.end(false);
+}
+
+void test_stored_blocks() {
+    std::string data = text(10000, 1);
+    TEST_ASSERT_TRUE(inflate(storedGz(data, 3000), SIZE_MAX));
+    TEST_ASSERT_EQUAL(INFLATE_OK, inflater.result());
+    assertFlashHolds(data);
+
+    // an empty stored block ends an empty stream
+    TEST_ASSERT_TRUE(inflate(storedGz("", 3000), SIZE_MAX));
+    TEST_ASSERT_EQUAL_UINT32(0, inflater.outputBytes());
+}
+
+void test_fixed_block() {
+    TEST_ASSERT_TRUE(inflate(bytes(fixedGz, sizeof(fixedGz)), SIZE_MAX));
+    assertFlashHolds(text(2000, 2));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(fixedGz), inflater.inputBytes());
+}
+
+void test_dynamic_block_longer_than_the_window() {
+    TEST_ASSERT_TRUE(inflate(bytes(dynamicGz, sizeof(dynamicGz)), SIZE_MAX));
+    assertFlashHolds(text(6000, 3));
+}
+
+void test_random_pieces() {
+    const std::vector<uint8_t> streams[] = {
+        storedGz(text(10000, 1), 3000),
+        bytes(fixedGz, sizeof(fixedGz)),
+        bytes(dynamicGz, sizeof(dynamicGz)),
+    };
+    const std::string expected[] = {text(10000, 1), text(2000, 2), text(6000, 3)};
+    for (int s = 0; s < 3; s++) {
+        for (uint32_t seed = 1; seed <= 50; seed++) {
+            chunkSeed = seed;
+            TEST_ASSERT_TRUE(inflate(streams[s], 0));
+            assertFlashHolds(expected[s]);
+        }
+        // a byte at a time
+        TEST_ASSERT_TRUE(inflate(streams[s], 1));
+        assertFlashHolds(expected[s]);
+    }
+}
+
+void test_reference_beyond_the_window() {
+    TEST_ASSERT_FALSE(inflate(bytes(tooFarGz, sizeof(tooFarGz)), SIZE_MAX));
+    TEST_ASSERT_EQUAL(INFLATE_TOO_FAR, inflater.result());
+    TEST_ASSERT_EQUAL_STRING("REFERENCE BEYOND WINDOW", Inflater::resultName(inflater.result()));
+    // what was decoded before it is right, nothing after it was written
+    std::string good = noise(200, 4) + std::string(4200, 'x');
+    TEST_ASSERT_LESS_OR_EQUAL(good.size(), Update.progress());
+    TEST_ASSERT_EQUAL_MEMORY(good.data(), Update.flash().data(), Update.progress());
+}
+
+void test_truncated_stream() {
+    const std::vector<uint8_t> streams[] = {
+        storedGz(text(10000, 1), 3000),
+        bytes(fixedGz, sizeof(fixedGz)),
+        bytes(dynamicGz, sizeof(dynamicGz)),
+    };
+    for (const std::vector<uint8_t> &stream : streams) {
+        // in the header, in the data, in the last block and in the trailer
+        const size_t cuts[] = {5, stream.size() / 2, stream.size() - 9, stream.size() - 1};
+        for (size_t cut : cuts) {
+            std::vector<uint8_t> truncated(stream.begin(), stream.begin() + cut);
+            TEST_ASSERT_FALSE(inflate(truncated, SIZE_MAX));
+            TEST_ASSERT_EQUAL(INFLATE_TRUNCATED, inflater.result());
+        }
+    }
+}
+
+void test_bad_crc_and_length() {
+    std::vector<uint8_t> stream = bytes(dynamicGz, sizeof(dynamicGz));
+    stream[stream.size() - 8] ^= 1;
+    TEST_ASSERT_FALSE(inflate(stream, SIZE_MAX));
+    TEST_ASSERT_EQUAL(INFLATE_BAD_TRAILER, inflater.result());
+
+    stream = bytes(dynamicGz, sizeof(dynamicGz));
+    stream[stream.size() - 4] ^= 1;
+    TEST_ASSERT_FALSE(inflate(stream, SIZE_MAX));
+    TEST_ASSERT_EQUAL(INFLATE_BAD_TRAILER, inflater.result());
+
+    // corrupt data is caught by the CRC at the latest
+    stream = storedGz(text(1000, 1), 3000);
+    stream[500] ^= 0x20;
+    TEST_ASSERT_FALSE(inflate(stream, SIZE_MAX));
+    TEST_ASSERT_EQUAL(INFLATE_BAD_TRAILER, inflater.result());
+}
+
+void test_bad_header_and_block() {
+    std::vector<uint8_t> stream = bytes(fixedGz, sizeof(fixedGz));
+    stream[0] = 0x1e;
+    TEST_ASSERT_FALSE(inflate(stream, SIZE_MAX));
+    TEST_ASSERT_EQUAL(INFLATE_BAD_HEADER, inflater.result());
+
+    // block type 3 is reserved
+    stream = storedGz(text(100, 1), 3000);
+    stream[10] = 0x07;
+    TEST_ASSERT_FALSE(inflate(stream, SIZE_MAX));
+    TEST_ASSERT_EQUAL(INFLATE_BAD_BLOCK, inflater.result());
+
+    // a stored length that does not match its complement
+    stream = storedGz(text(100, 1), 3000);
+    stream[13] ^= 0xff;
+    TEST_ASSERT_FALSE(inflate(stream, SIZE_MAX));
+    TEST_ASSERT_EQUAL(INFLATE_BAD_BLOCK, inflater.result());
+}
+
+void test_full_flash_stops_the_stream() {
+    TEST_ASSERT_FALSE(inflate(bytes(dynamicGz, sizeof(dynamicGz)), SIZE_MAX, refuse));
+    TEST_ASSERT_EQUAL(INFLATE_OUTPUT_FAILED, inflater.result());
+    // and stays stopped
+    TEST_ASSERT_FALSE(inflater.write(dynamicGz, 1));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_stored_blocks);
+    RUN_TEST(test_fixed_block);
+    RUN_TEST(test_dynamic_block_longer_than_the_window);
+    RUN_TEST(test_random_pieces);
+    RUN_TEST(test_reference_beyond_the_window);
+    RUN_TEST(test_truncated_stream);
+    RUN_TEST(test_bad_crc_and_length);
+    RUN_TEST(test_bad_header_and_block);
+    RUN_TEST(test_full_flash_stops_the_stream);
+    return UNITY_END();
+}
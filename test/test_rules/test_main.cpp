@@ -0,0 +1,319 @@
+// Control rules: what the compiler accepts and where it points at what it
+// does not, the verifier against hand made and random code, and the faults
+// and step budget of the machine.
+#include <Arduino.h>
+#include <Rules.h>
+#include <unity.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static int32_t inputs[ruleInputCount];
+static RuleProgram program;
+static RuleError error;
+static RuleResult result;
+
+static int32_t q4(double value) {
+    return (int32_t) (value * ruleOne);
+}
+
+static bool compile(const char *source) {
+    return ruleCompile(source, strlen(source), program, error);
+}
+
+// Compiles and runs source, which has to compile
+static RuleFault run(const char *source) {
+    TEST_ASSERT_TRUE_MESSAGE(compile(source), error.message ? error.message : source);
+    return ruleRun(program, inputs, result);
+}
+
+static RuleProgram code(std::initializer_list<uint8_t> bytes) {
+    RuleProgram made = {};
+    for (uint8_t byte : bytes) {
+        made.code[made.length++] = byte;
+    }
+    return made;
+}
+
+void setUp() {
+    // zone 0 at 30 °C, probes at 28 and 33 °C and two without a reading,
+    // 50 % duty at 23:30 with in0 closed and in1 open
+    const int32_t values[ruleInputCount] = {q4(30), q4(28), q4(33), ruleNoValue, ruleNoValue, q4(50), q4(23.5), ruleOne, 0, 0};
+    memcpy(inputs, values, sizeof(inputs));
+}
+
+void tearDown() {
+}
+
+void test_examples_of_the_header() {
+    TEST_ASSERT_EQUAL(RULE_OK, run("# the door switch on in0: follow the hotter probe, with a margin\n"
+                                   "temp = max(t0, t1) + 5 when in0\n"
+                                   "# night mode\n"
+                                   "cap = 40 when hour >= 22 or hour < 7\n"));
+    TEST_ASSERT_TRUE(result.has(RULE_TEMP));
+    TEST_ASSERT_EQUAL_INT32(q4(38), result.value[RULE_TEMP]);
+    TEST_ASSERT_TRUE(result.has(RULE_CAP));
+    TEST_ASSERT_EQUAL_INT32(q4(40), result.value[RULE_CAP]);
+    TEST_ASSERT_FALSE(result.has(RULE_STRENGTH));
+    TEST_ASSERT_FALSE(result.has(RULE_FLOOR));
+
+    // switch open and daytime: nothing assigned
+    inputs[RULE_IN0] = 0;
+    inputs[RULE_HOUR] = q4(12);
+    TEST_ASSERT_EQUAL(RULE_OK, ruleRun(program, inputs, result));
+    TEST_ASSERT_EQUAL_UINT8(0, result.assigned);
+}
+
+void test_values_and_precedence() {
+    TEST_ASSERT_EQUAL(RULE_OK, run("strength = 2 + 3 * 4 - 10 / 4"));
+    TEST_ASSERT_EQUAL_INT32(q4(11.5), result.value[RULE_STRENGTH]);
+    TEST_ASSERT_EQUAL(RULE_OK, run("strength = -t + -2 * -(3)"));
+    TEST_ASSERT_EQUAL_INT32(q4(-24), result.value[RULE_STRENGTH]);
+    // Q4: constants are rounded to the nearest 1/16
+    TEST_ASSERT_EQUAL(RULE_OK, run("strength = 12.04; floor = 0.03"));
+    TEST_ASSERT_EQUAL_INT32(q4(12.0625), result.value[RULE_STRENGTH]);
+    TEST_ASSERT_EQUAL_INT32(0, result.value[RULE_FLOOR]);
+    TEST_ASSERT_EQUAL(RULE_OK, run("strength = min(t0, t1, t); cap = clamp(t * 2 - 1.5, 20, 60); floor = abs(t0 - t1)"));
+    TEST_ASSERT_EQUAL_INT32(q4(28), result.value[RULE_STRENGTH]);
+    TEST_ASSERT_EQUAL_INT32(q4(58.5), result.value[RULE_CAP]);
+    TEST_ASSERT_EQUAL_INT32(q4(5), result.value[RULE_FLOOR]);
+    // comparisons are 1 or 0, and binds tighter than or
+    TEST_ASSERT_EQUAL(RULE_OK, run("strength = (1 < 2) + (not in1) + (0 and 1 or 1)"));
+    TEST_ASSERT_EQUAL_INT32(q4(3), result.value[RULE_STRENGTH]);
+    // saturates instead of wrapping
+    TEST_ASSERT_EQUAL(RULE_OK, run("strength = 1000000 * 1000000; floor = -1000000 * 1000000"));
+    TEST_ASSERT_EQUAL_INT32(INT32_MAX, result.value[RULE_STRENGTH]);
+    TEST_ASSERT_EQUAL_INT32(-INT32_MAX, result.value[RULE_FLOOR]);
+}
+
+void test_locals_and_later_assignments() {
+    TEST_ASSERT_EQUAL(RULE_OK, run("x = 5 when in0; x = 7 when in1\n"
+                                   "strength = x * 2 when x > 1 and t >= 30\n"
+                                   "cap = 90; cap = 80"));
+    TEST_ASSERT_EQUAL_INT32(q4(10), result.value[RULE_STRENGTH]);
+    TEST_ASSERT_EQUAL_INT32(q4(80), result.value[RULE_CAP]);
+}
+
+void test_empty_rules() {
+    TEST_ASSERT_EQUAL(RULE_OK, run(""));
+    TEST_ASSERT_EQUAL_UINT8(0, program.length);
+    TEST_ASSERT_EQUAL(RULE_OK, run("# only a comment\n\n;;\n"));
+    TEST_ASSERT_EQUAL_UINT8(0, result.assigned);
+    TEST_ASSERT_EQUAL_UINT16(0, result.steps);
+}
+
+struct Rejected {
+    const char *source;
+    const char *message;
+    uint16_t line;
+    uint16_t column;
+};
+
+void test_errors_point_at_the_problem() {
+    const Rejected rejected[] = {
+        {"t = 3", "inputs cannot be assigned", 1, 1},
+        {"min = 3", "functions cannot be assigned", 1, 1},
+        {"= 3", "expected a name to assign", 1, 1},
+        {"cap = floor", "outputs cannot be read", 1, 7},
+        {"strength = y", "unknown name", 1, 12},
+        {"strength 3", "expected '='", 1, 10},
+        {"strength = (1 + 2", "expected ')'", 1, 18},
+        {"strength = 1 +", "expected a value", 1, 15},
+        {"strength = 1 when", "expected a value", 1, 18},
+        {"strength = 1 2", "expected the end of the statement", 1, 14},
+        {"strength = 3 $", "unexpected character", 1, 14},
+        {"\n\n  strength = abs(1, 2)", "abs takes one value", 3, 22},
+        {"strength = clamp(1, 2)", "clamp takes a value, a low and a high", 1, 22},
+        {"strength = max(1)", "min and max take two or more values", 1, 17},
+        {"strength = 1 < 2 < 3", "comparisons cannot be chained, use and", 1, 18},
+        {"strength = 99999999999", "number too large", 1, 12},
+        {"abcdefghijklmnopqrstuvwxyz = 1", "name too long", 1, 1},
+        {"a=1;b=1;c=1;d=1;e=1;f=1;g=1;h=1;i=1", "too many locals", 1, 33},
+    };
+    for (const Rejected &expected : rejected) {
+        TEST_ASSERT_FALSE_MESSAGE(compile(expected.source), expected.source);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(expected.message, error.message, expected.source);
+        TEST_ASSERT_EQUAL_UINT16_MESSAGE(expected.line, error.line, expected.source);
+        TEST_ASSERT_EQUAL_UINT16_MESSAGE(expected.column, error.column, expected.source);
+    }
+}
+
+void test_limits() {
+    // sixteen values on the stack fit, seventeen do not
+    std::string deep = "strength = 1";
+    for (int i = 0; i < 15; i++) {
+        deep += "+(1";
+    }
+    TEST_ASSERT_TRUE(compile((deep + std::string(15, ')')).c_str()));
+    TEST_ASSERT_EQUAL_UINT8(ruleStackMax, program.stackDepth);
+    TEST_ASSERT_FALSE(compile((deep + "+(1" + std::string(16, ')')).c_str()));
+    TEST_ASSERT_EQUAL_STRING("expression too deep", error.message);
+
+    // every kind of nesting stops at sixteen levels, long before the
+    // source limit would
+    const char *nesting[] = {"(", "not ", "-", "abs("};
+    for (const char *level : nesting) {
+        std::string inside;
+        for (int i = 0; i < ruleStackMax; i++) {
+            inside += level;
+        }
+        std::string closing(level[strlen(level) - 1] == '(' ? ruleStackMax : 0, ')');
+        TEST_ASSERT_TRUE_MESSAGE(compile(("strength = " + inside + "t" + closing).c_str()), level);
+        TEST_ASSERT_FALSE_MESSAGE(compile(("strength = " + inside + level + "t" + closing + ")").c_str()), level);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE("nested too deep", error.message, level);
+    }
+    std::string deepest = "strength = ";
+    for (int i = 0; i < 1000; i++) {
+        deepest += '(';
+    }
+    TEST_ASSERT_FALSE(compile(deepest.c_str()));
+    TEST_ASSERT_EQUAL_STRING("nested too deep", error.message);
+    TEST_ASSERT_EQUAL_UINT16(28, error.column);
+
+    std::string longRules = "strength = 0";
+    while (longRules.size() < 600) {
+        longRules += "+t";
+    }
+    TEST_ASSERT_FALSE(compile(longRules.c_str()));
+    TEST_ASSERT_EQUAL_STRING("rules too long", error.message);
+
+    std::string longSource(ruleSourceMax + 1, '#');
+    TEST_ASSERT_FALSE(ruleCompile(longSource.c_str(), longSource.size(), program, error));
+    TEST_ASSERT_EQUAL_STRING("rules too long", error.message);
+}
+
+void test_faults_drop_the_outputs() {
+    TEST_ASSERT_EQUAL(RULE_DIVIDE, run("cap = 50; strength = t / (t0 - 28)"));
+    TEST_ASSERT_EQUAL_STRING("divide", ruleFaultNames[RULE_DIVIDE]);
+    TEST_ASSERT_EQUAL_UINT8(0, result.assigned);
+    // a probe without a reading
+    TEST_ASSERT_EQUAL(RULE_NO_INPUT, run("cap = 50; strength = t2"));
+    TEST_ASSERT_EQUAL_UINT8(0, result.assigned);
+    // a local whose when did not hold
+    TEST_ASSERT_EQUAL(RULE_NO_INPUT, run("x = 1 when in1; strength = x"));
+    // the hour before the clock is set
+    inputs[RULE_HOUR] = ruleNoValue;
+    TEST_ASSERT_EQUAL(RULE_NO_INPUT, run("cap = 40 when hour >= 22"));
+    // what is not read does not matter
+    TEST_ASSERT_EQUAL(RULE_OK, run("strength = t0 when in0"));
+    TEST_ASSERT_EQUAL_INT32(q4(28), result.value[RULE_STRENGTH]);
+}
+
+// The longest run the compiler can produce stays under ruleStepsMax, the
+// budget only stops code that runs longer than it
+void test_run_stops_at_the_step_budget() {
+    std::string longest = "strength = 0";
+    while (compile((longest + "+t").c_str())) {
+        longest += "+t";
+    }
+    TEST_ASSERT_EQUAL(RULE_OK, run(longest.c_str()));
+    TEST_ASSERT_TRUE(result.has(RULE_STRENGTH));
+    TEST_ASSERT_LESS_THAN(ruleStepsMax, result.steps);
+    uint16_t steps = result.steps;
+
+    TEST_ASSERT_EQUAL(RULE_STEPS, ruleRun(program, inputs, result, steps - 1));
+    TEST_ASSERT_EQUAL_UINT16(steps - 1, result.steps);
+    TEST_ASSERT_EQUAL_UINT8(0, result.assigned);
+    TEST_ASSERT_EQUAL(RULE_OK, ruleRun(program, inputs, result, steps));
+
+    // an output assigned before the budget ran out is dropped as well
+    TEST_ASSERT_TRUE(compile("cap = 50; strength = 1 + 2 + 3"));
+    TEST_ASSERT_EQUAL(RULE_STEPS, ruleRun(program, inputs, result, 4));
+    TEST_ASSERT_EQUAL_UINT8(0, result.assigned);
+}
+
+void test_verify_rejects_bad_code() {
+    const RuleProgram bad[] = {
+        code({ruleOpCount}),                                          // no such op
+        code({RULE_OP_PUSH16, 1}),                                    // operand cut off
+        code({RULE_OP_INPUT, ruleInputCount, RULE_OP_OUT, 0}),        // no such input
+        code({RULE_OP_PUSH8, 1, RULE_OP_STORE, ruleLocalsMax}),       // no such local
+        code({RULE_OP_PUSH8, 1, RULE_OP_OUT, ruleOutputCount}),       // no such output
+        code({RULE_OP_ADD}),                                          // stack underflow
+        code({RULE_OP_PUSH8, 1}),                                     // value left over
+        code({RULE_OP_PUSH8, 0, RULE_OP_JZ, 9, RULE_OP_PUSH8, 1, RULE_OP_OUT, 0}),          // jump past the end
+        code({RULE_OP_PUSH8, 0, RULE_OP_JZ, 1, RULE_OP_PUSH16, 1, 2, RULE_OP_OUT, 0}),      // into an operand
+        code({RULE_OP_PUSH8, 0, RULE_OP_JZ, 2, RULE_OP_PUSH8, 1, RULE_OP_PUSH8, 1, RULE_OP_OUT, 0}),  // uneven depth
+    };
+    for (const RuleProgram &candidate : bad) {
+        RuleProgram copy = candidate;
+        TEST_ASSERT_FALSE(ruleVerify(copy));
+    }
+    RuleProgram tooLong = {};
+    tooLong.length = ruleCodeMax + 1;
+    TEST_ASSERT_FALSE(ruleVerify(tooLong));
+
+    RuleProgram deepest = {};
+    for (uint8_t i = 0; i <= ruleStackMax; i++) {
+        deepest.code[deepest.length++] = RULE_OP_PUSH8;
+        deepest.code[deepest.length++] = 1;
+    }
+    TEST_ASSERT_FALSE(ruleVerify(deepest));
+
+    // strength = 1 when in0
+    RuleProgram good = code({RULE_OP_INPUT, RULE_IN0, RULE_OP_JZ, 4, RULE_OP_PUSH8, 16, RULE_OP_OUT, RULE_STRENGTH});
+    TEST_ASSERT_TRUE(ruleVerify(good));
+    TEST_ASSERT_EQUAL_UINT8(1, good.stackDepth);
+    TEST_ASSERT_EQUAL(RULE_OK, ruleRun(good, inputs, result));
+    TEST_ASSERT_EQUAL_INT32(16, result.value[RULE_STRENGTH]);
+}
+
+// Whatever the verifier lets through runs without a bad op, within its
+// length in steps: random code and compiled code with random bytes changed
+void test_verify_fuzz() {
+    srand(1);
+    uint32_t accepted = 0;
+    for (uint32_t n = 0; n < 200000; n++) {
+        RuleProgram random = {};
+        random.length = rand() % 24;
+        for (uint8_t i = 0; i < random.length; i++) {
+            // mostly ops, some operands out of every range
+            random.code[i] = rand() % 4 ? rand() % ruleOpCount : rand() % 256;
+        }
+        if (!ruleVerify(random)) {
+            continue;
+        }
+        accepted++;
+        TEST_ASSERT_LESS_OR_EQUAL(ruleStackMax, random.stackDepth);
+        TEST_ASSERT_TRUE(ruleRun(random, inputs, result) != RULE_BAD_CODE);
+        TEST_ASSERT_LESS_OR_EQUAL(random.length, result.steps);
+    }
+
+    TEST_ASSERT_TRUE(compile("temp = max(t0, t1) + 5 when in0\ncap = 40 when hour >= 22 or hour < 7\n"
+                             "x = clamp(t * 2 - duty / 10, 0, 100); strength = x when x > 20"));
+    const RuleProgram compiled = program;
+    uint32_t mutantsAccepted = 0;
+    for (uint32_t n = 0; n < 200000; n++) {
+        RuleProgram mutant = compiled;
+        for (int changes = 1 + rand() % 3; changes > 0; changes--) {
+            mutant.code[rand() % mutant.length] = rand() % 256;
+        }
+        if (!ruleVerify(mutant)) {
+            continue;
+        }
+        mutantsAccepted++;
+        TEST_ASSERT_TRUE(ruleRun(mutant, inputs, result) != RULE_BAD_CODE);
+        TEST_ASSERT_LESS_OR_EQUAL(mutant.length, result.steps);
+    }
+    char message[80];
+    snprintf(message, sizeof(message), "verified %u of 200000 random, %u of 200000 mutated", accepted, mutantsAccepted);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN(0, accepted);
+    TEST_ASSERT_GREATER_THAN(0, mutantsAccepted);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_examples_of_the_header);
+    RUN_TEST(test_values_and_precedence);
+    RUN_TEST(test_locals_and_later_assignments);
+    RUN_TEST(test_empty_rules);
+    RUN_TEST(test_errors_point_at_the_problem);
+    RUN_TEST(test_limits);
+    RUN_TEST(test_faults_drop_the_outputs);
+    RUN_TEST(test_run_stops_at_the_step_budget);
+    RUN_TEST(test_verify_rejects_bad_code);
+    RUN_TEST(test_verify_fuzz);
+    return UNITY_END();
+}
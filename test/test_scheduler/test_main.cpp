@@ -0,0 +1,169 @@
+// DeadlineScheduler in virtual time: periodic releases, deadline order,
+// overruns, one-shots and wake().
+#include <Arduino.h>
+#include <NativeHost.h>
+#include <DeadlineScheduler.h>
+#include <unity.h>
+
+#include <vector>
+
+static std::vector<const char *> order;
+
+// Records its runs and takes runUs of virtual time per run
+class ProbeTask : public Task {
+public:
+    ProbeTask(const char *name, unsigned long periodMs, uint32_t runUs = 0) : Task(name, periodMs), runUs(runUs) {}
+
+    uint32_t runUs;
+    unsigned long againMs = 0;  // runAgainIn() on the next run
+    std::vector<uint32_t> startedUs;
+
+protected:
+    void loop() override {
+        startedUs.push_back(micros());
+        order.push_back(name());
+        nativeAdvanceMicros(runUs);
+        if (againMs) {
+            runAgainIn(againMs);
+            againMs = 0;
+        }
+    }
+};
+
+// Runs the scheduler until virtual time has moved by us
+static void runFor(SchedulerClass &scheduler, uint64_t us) {
+    uint64_t until = nativeMicros64() + us;
+    while (nativeMicros64() < until) {
+        scheduler.run();
+    }
+}
+
+void setUp() {
+    nativeUseVirtualTime(true);
+    nativeSerialTo(nullptr);
+    order.clear();
+}
+
+void tearDown() {
+    nativeUseVirtualTime(false);
+}
+
+void test_periodic_releases_do_not_drift() {
+    SchedulerClass scheduler;
+    ProbeTask task("periodic", 100, 3000);
+    scheduler.start(&task);
+    scheduler.begin();
+    uint32_t begun = micros();
+    runFor(scheduler, 1000000);
+
+    TEST_ASSERT_EQUAL_UINT32(10, task.stats().runs);
+    TEST_ASSERT_EQUAL_UINT32(0, task.stats().overruns);
+    // anchored to the release, not to the end of the 3 ms run
+    for (size_t i = 0; i < task.startedUs.size(); i++) {
+        TEST_ASSERT_UINT32_WITHIN(1000, begun + i * 100000, task.startedUs[i]);
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(1000, task.stats().maxJitterUs);
+    TEST_ASSERT_EQUAL_UINT64(30000, task.stats().cpuUs);
+}
+
+void test_earliest_deadline_runs_first() {
+    SchedulerClass scheduler;
+    ProbeTask slow("slow", 300);
+    ProbeTask fast("fast", 100);
+    scheduler.start(&slow);
+    scheduler.start(&fast);
+    scheduler.begin();
+    runFor(scheduler, 650000);
+
+    const char *expected[] = {"slow", "fast", "fast", "fast", "slow", "fast", "fast", "fast", "slow", "fast"};
+    TEST_ASSERT_EQUAL_size_t(sizeof(expected) / sizeof(expected[0]), order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        TEST_ASSERT_EQUAL_STRING(expected[i], order[i]);
+    }
+}
+
+void test_overrun_skips_missed_releases() {
+    SchedulerClass scheduler;
+    ProbeTask task("late", 10, 25000);
+    scheduler.start(&task);
+    scheduler.begin();
+    scheduler.run();
+
+    TEST_ASSERT_EQUAL_UINT32(1, task.stats().runs);
+    TEST_ASSERT_EQUAL_UINT32(1, task.stats().overruns);
+    TEST_ASSERT_EQUAL_UINT32(2, task.stats().missed);
+    // the next run is at the next release after the end, not back to back
+    uint32_t ended = micros();
+    scheduler.run();
+    scheduler.run();
+    TEST_ASSERT_EQUAL_UINT32(2, task.stats().runs);
+    TEST_ASSERT_EQUAL_UINT32(ended + 5000, task.startedUs[1]);
+}
+
+void test_run_again_keeps_periodic_releases() {
+    SchedulerClass scheduler;
+    ProbeTask task("oneshot", 100);
+    task.againMs = 20;
+    scheduler.start(&task);
+    scheduler.begin();
+    uint32_t begun = micros();
+    runFor(scheduler, 250000);
+
+    TEST_ASSERT_EQUAL_size_t(4, task.startedUs.size());
+    TEST_ASSERT_UINT32_WITHIN(100, begun, task.startedUs[0]);
+    TEST_ASSERT_UINT32_WITHIN(100, begun + 20000, task.startedUs[1]);
+    TEST_ASSERT_UINT32_WITHIN(100, begun + 100000, task.startedUs[2]);
+    TEST_ASSERT_UINT32_WITHIN(100, begun + 200000, task.startedUs[3]);
+}
+
+void test_wake_runs_now_and_keeps_the_period() {
+    SchedulerClass scheduler;
+    ProbeTask task("woken", 1000);
+    scheduler.start(&task);
+    scheduler.begin();
+    uint32_t begun = micros();
+    scheduler.run();
+    nativeAdvanceMicros(300000);
+    TEST_ASSERT_EQUAL_size_t(1, task.startedUs.size());
+
+    scheduler.wake(&task);
+    scheduler.run();
+    TEST_ASSERT_EQUAL_size_t(2, task.startedUs.size());
+    TEST_ASSERT_UINT32_WITHIN(100, begun + 300000, task.startedUs[1]);
+    runFor(scheduler, 800000);
+    TEST_ASSERT_EQUAL_size_t(3, task.startedUs.size());
+    TEST_ASSERT_UINT32_WITHIN(100, begun + 1000000, task.startedUs[2]);
+}
+
+void test_disabled_optional_task_is_not_started() {
+    SchedulerClass scheduler;
+    OptionalTask<false, ProbeTask> disabled;
+    TEST_ASSERT_NULL(disabled.task());
+    TEST_ASSERT_NULL(disabled.get());
+    scheduler.start(disabled.task());
+    TEST_ASSERT_EQUAL_UINT8(0, scheduler.taskCount());
+}
+
+void test_idle_time_is_accounted() {
+    SchedulerClass scheduler;
+    ProbeTask task("busy", 100, 10000);
+    scheduler.start(&task);
+    scheduler.begin();
+    runFor(scheduler, 1000000);
+
+    TEST_ASSERT_EQUAL_UINT64(100000, scheduler.busyUs());
+    TEST_ASSERT_UINT32_WITHIN(2000, 900000, scheduler.idleUs());
+    TEST_ASSERT_EQUAL_UINT32(0, scheduler.stalls());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_periodic_releases_do_not_drift);
+    RUN_TEST(test_earliest_deadline_runs_first);
+    RUN_TEST(test_overrun_skips_missed_releases);
+    RUN_TEST(test_run_again_keeps_periodic_releases);
+    RUN_TEST(test_wake_runs_now_and_keeps_the_period);
+    RUN_TEST(test_disabled_optional_task_is_not_started);
+    RUN_TEST(test_idle_time_is_accounted);
+    return UNITY_END();
+}
@@ -0,0 +1,159 @@
+// The settings schemas of include/SETTINGS.h: JSON both ways, metrics and
+// the binary files.
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <RequestArena.h>
+#include <SETTINGS.h>
+#include <unity.h>
+
+#include <vector>
+
+// Just enough of File for schemaWrite() and schemaRead()
+struct MemoryFile {
+    std::vector<uint8_t> data;
+    size_t position = 0;
+    size_t capacity = SIZE_MAX;  // a full filesystem takes no more
+
+    size_t write(const uint8_t *buf, size_t size) {
+        size_t n = std::min(size, capacity - data.size());
+        data.insert(data.end(), buf, buf + n);
+        return n;
+    }
+    size_t read(uint8_t *buf, size_t size) {
+        size_t n = std::min(size, data.size() - position);
+        memcpy(buf, data.data() + position, n);
+        position += n;
+        return n;
+    }
+};
+
+static StaticRequestArena<1024> arena;
+
+void setUp() {
+    arena.reset();
+}
+
+void tearDown() {
+}
+
+void test_json_of_a_record() {
+    ZoneState state = {};
+    state.currentPwm = 42;
+    state.autopilotState = AUTOPILOT_PREDICTIVE;
+    StrBuilder json(arena, 128);
+    schemaJson(json, zoneSettingsSchema, state);
+    TEST_ASSERT_EQUAL_STRING("{\"pwm\":42,\"autopilot\":\"Predictive\"}", json.c_str());
+
+    CurvePoint point = {36, 50};
+    json.clear();
+    schemaJson(json, curvePointSchema, point);
+    TEST_ASSERT_EQUAL_STRING("{\"temperature\":36,\"strength\":50}", json.c_str());
+}
+
+void test_json_is_read_back() {
+    StaticJsonDocument<128> doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, "{\"pwm\":70,\"autopilot\":\"Disabled\"}"));
+    ZoneState state = {};
+    state.autopilotState = AUTOPILOT_ENABLED;
+    TEST_ASSERT_NULL(schemaFromJson(zoneSettingsSchema, doc.as<JsonObjectConst>(), state));
+    TEST_ASSERT_EQUAL_INT16(70, state.currentPwm);
+    TEST_ASSERT_EQUAL_UINT8(AUTOPILOT_DISABLED, state.autopilotState);
+
+    // a missing field keeps its value
+    TEST_ASSERT_FALSE(deserializeJson(doc, "{\"pwm\":10}"));
+    TEST_ASSERT_NULL(schemaFromJson(zoneSettingsSchema, doc.as<JsonObjectConst>(), state));
+    TEST_ASSERT_EQUAL_INT16(10, state.currentPwm);
+    TEST_ASSERT_EQUAL_UINT8(AUTOPILOT_DISABLED, state.autopilotState);
+}
+
+void test_bad_json_leaves_the_record_alone() {
+    const char *bad[][2] = {
+        {"{\"pwm\":101}", "pwm"},
+        {"{\"pwm\":-1}", "pwm"},
+        {"{\"pwm\":\"50\"}", "pwm"},
+        {"{\"pwm\":65586}", "pwm"},
+        {"{\"pwm\":20,\"autopilot\":\"Auto\"}", "autopilot"},
+        {"{\"pwm\":20,\"autopilot\":1}", "autopilot"},
+    };
+    for (auto &json : bad) {
+        StaticJsonDocument<128> doc;
+        TEST_ASSERT_FALSE(deserializeJson(doc, json[0]));
+        ZoneState state = {};
+        state.currentPwm = 33;
+        state.autopilotState = AUTOPILOT_ENABLED;
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(json[1], schemaFromJson(zoneSettingsSchema, doc.as<JsonObjectConst>(), state), json[0]);
+        TEST_ASSERT_EQUAL_INT16(33, state.currentPwm);
+        TEST_ASSERT_EQUAL_UINT8(AUTOPILOT_ENABLED, state.autopilotState);
+    }
+}
+
+void test_metrics_with_labels() {
+    CurvePoint point = {36, 50};
+    StrBuilder metrics(arena, 128);
+    schemaMetrics(metrics, curvePointSchema, point, [](StrBuilder &out) { out += "zone=\"0\""; });
+    TEST_ASSERT_EQUAL_STRING("kirby_autopilot_setting{zone=\"0\",temperature=\"36\"} 50\n", metrics.c_str());
+}
+
+void test_binary_round_trip() {
+    CurvePoint points[3] = {{30, 20}, {35, 60}, {0, 0}};
+    MemoryFile file;
+    TEST_ASSERT_TRUE(schemaWrite(file, curvePointSchema, points, 3));
+    TEST_ASSERT_EQUAL_size_t(sizeof(SchemaFileHeader) + 3 * 4, file.data.size());
+
+    CurvePoint read[4] = {};
+    TEST_ASSERT_EQUAL_INT(3, schemaRead(file, curvePointSchema, read, 4));
+    TEST_ASSERT_EQUAL_MEMORY(points, read, sizeof(points));
+    TEST_ASSERT_EQUAL_UINT32(schemaHash(curvePointSchema, points, 3), schemaHash(curvePointSchema, read, 3));
+}
+
+void test_binary_rejects_what_it_did_not_write() {
+    CurvePoint points[2] = {{30, 20}, {35, 60}};
+    MemoryFile file;
+    schemaWrite(file, curvePointSchema, points, 2);
+    CurvePoint read[2];
+
+    // another schema's file
+    ZoneState state = {};
+    TEST_ASSERT_EQUAL_INT(-1, schemaRead(file, zoneSettingsSchema, &state, 1));
+    // more records than there is room for
+    file.position = 0;
+    TEST_ASSERT_EQUAL_INT(-1, schemaRead(file, curvePointSchema, read, 1));
+    // cut short
+    MemoryFile cut = file;
+    cut.position = 0;
+    cut.data.pop_back();
+    TEST_ASSERT_EQUAL_INT(-1, schemaRead(cut, curvePointSchema, read, 2));
+    // a value out of range
+    MemoryFile corrupt = file;
+    corrupt.position = 0;
+    corrupt.data[sizeof(SchemaFileHeader) + 2] = 101;
+    TEST_ASSERT_EQUAL_INT(-1, schemaRead(corrupt, curvePointSchema, read, 2));
+    // a full filesystem
+    MemoryFile full;
+    full.capacity = sizeof(SchemaFileHeader) + 5;
+    TEST_ASSERT_FALSE(schemaWrite(full, curvePointSchema, points, 2));
+}
+
+void test_hash_ignores_padding() {
+    ZoneState a, b;
+    memset(&a, 0x00, sizeof(a));
+    memset(&b, 0xff, sizeof(b));
+    a.currentPwm = b.currentPwm = 50;
+    a.autopilotState = b.autopilotState = AUTOPILOT_ENABLED;
+    TEST_ASSERT_EQUAL_UINT32(schemaHash(zoneSettingsSchema, &a, 1), schemaHash(zoneSettingsSchema, &b, 1));
+    b.currentPwm = 51;
+    TEST_ASSERT_TRUE(schemaHash(zoneSettingsSchema, &a, 1) != schemaHash(zoneSettingsSchema, &b, 1));
+    TEST_ASSERT_TRUE(zoneSettingsSchema.layout != curvePointSchema.layout);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_json_of_a_record);
+    RUN_TEST(test_json_is_read_back);
+    RUN_TEST(test_bad_json_leaves_the_record_alone);
+    RUN_TEST(test_metrics_with_labels);
+    RUN_TEST(test_binary_round_trip);
+    RUN_TEST(test_binary_rejects_what_it_did_not_write);
+    RUN_TEST(test_hash_ignores_padding);
+    return UNITY_END();
+}
@@ -0,0 +1,114 @@
+// Seqlock: snapshots, versions and what a reader sees when it interrupts a
+// write half way.
+#include <Arduino.h>
+#include <Seqlock.h>
+#include <unity.h>
+
+#include <functional>
+
+// A value whose copy can be interrupted between its two halves, the way an
+// interrupt handler can preempt the writer on the ESP8266
+struct Pair {
+    uint32_t a = 0;
+    uint32_t b = 0;
+
+    Pair() {}
+    Pair(uint32_t a, uint32_t b) : a(a), b(b) {}
+    Pair(const Pair &other) = default;
+    Pair &operator=(const Pair &other);
+};
+
+static std::function<void()> interrupt;
+
+Pair &Pair::operator=(const Pair &other) {
+    a = other.a;
+    if (interrupt) {
+        std::function<void()> handler;
+        handler.swap(interrupt);
+        handler();
+    }
+    b = other.b;
+    return *this;
+}
+
+void setUp() {
+    interrupt = nullptr;
+}
+
+void tearDown() {
+}
+
+void test_read_returns_what_was_written() {
+    Seqlock<Pair> lock(Pair(1, 1));
+    TEST_ASSERT_EQUAL_UINT32(1, lock.read().a);
+    lock.write(Pair(2, 2));
+    Pair value = lock.read();
+    TEST_ASSERT_EQUAL_UINT32(2, value.a);
+    TEST_ASSERT_EQUAL_UINT32(2, value.b);
+}
+
+void test_version_changes_per_write() {
+    Seqlock<Pair> lock;
+    uint32_t version = lock.version();
+    lock.write(Pair(1, 1));
+    TEST_ASSERT_EQUAL_UINT32(version + 1, lock.version());
+    lock.update([](Pair &value) { value.b = 7; });
+    TEST_ASSERT_EQUAL_UINT32(version + 2, lock.version());
+    TEST_ASSERT_EQUAL_UINT32(1, lock.read().a);
+    TEST_ASSERT_EQUAL_UINT32(7, lock.read().b);
+}
+
+void test_reader_interrupting_a_write_sees_a_whole_value() {
+    Seqlock<Pair> lock(Pair(1, 1));
+    // every copy the writer makes is interrupted once, while it is half done
+    for (int copy = 0; copy < 2; copy++) {
+        Pair seen;
+        int interrupted = 0;
+        std::function<void()> reader = [&]() {
+            uint32_t seq = lock.begin();
+            const Pair &view = lock.view(seq);
+            seen.a = view.a;
+            seen.b = view.b;
+            TEST_ASSERT_FALSE(lock.retry(seq));
+            interrupted++;
+        };
+        // skip the copies before the one to interrupt
+        int skip = copy;
+        std::function<void()> arm = [&]() {
+            if (skip-- > 0) {
+                interrupt = arm;
+            } else {
+                reader();
+            }
+        };
+        interrupt = arm;
+        lock.write(Pair(copy + 2, copy + 2));
+        TEST_ASSERT_EQUAL(1, interrupted);
+        // the old value or the new one, never half of each
+        TEST_ASSERT_EQUAL_UINT32(seen.a, seen.b);
+        TEST_ASSERT_TRUE(seen.a == (uint32_t) copy + 1 || seen.a == (uint32_t) copy + 2);
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, lock.read().a);
+    TEST_ASSERT_EQUAL_UINT32(3, lock.read().b);
+}
+
+void test_in_place_reader_retries_after_a_write() {
+    Seqlock<Pair> lock(Pair(1, 1));
+    uint32_t seq = lock.begin();
+    const Pair &view = lock.view(seq);
+    TEST_ASSERT_EQUAL_UINT32(1, view.a);
+    lock.write(Pair(2, 2));
+    TEST_ASSERT_TRUE(lock.retry(seq));
+    seq = lock.begin();
+    TEST_ASSERT_EQUAL_UINT32(2, lock.view(seq).a);
+    TEST_ASSERT_FALSE(lock.retry(seq));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_read_returns_what_was_written);
+    RUN_TEST(test_version_changes_per_write);
+    RUN_TEST(test_reader_interrupting_a_write_sees_a_whole_value);
+    RUN_TEST(test_in_place_reader_retries_after_a_write);
+    return UNITY_END();
+}
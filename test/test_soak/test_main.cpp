@@ -0,0 +1,181 @@
+// Soak test of the request path: 100k mixed requests through the firmware's
+// web server over loopback, in virtual time. Replies are built in the
+// request arena, so the heap must look the same after the last request as
+// after the first thousand: the largest free block may not shrink and
+// nothing may be left allocated.
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include <NativeHost.h>
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+void setup();
+void loop();
+
+const uint32_t soakRequests = 100000;
+const uint32_t soakWarmup = 1000;      // requests before the baseline is taken
+const uint32_t soakSampleEvery = 1000;
+
+static std::string root;
+static uint16_t port;
+
+// Status code of one request, 0 when it got no reply. The firmware runs in
+// between, the reply is read to the end so no connection is left behind.
+static int request(const char *method, const char *path, const char *body = "") {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // reset on close instead of TIME_WAIT, 100k connections would run out of ports
+    struct linger linger = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return 0;
+    }
+    char head[256];
+    int length = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: kirby\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+                          method, path, strlen(body), body);
+    send(fd, head, length, MSG_NOSIGNAL);
+
+    char status[16] = {};
+    size_t received = 0;
+    for (uint32_t spins = 0; spins < 100000; spins++) {
+        loop();
+        struct pollfd readable = {fd, POLLIN, 0};
+        if (poll(&readable, 1, 0) <= 0) {
+            continue;
+        }
+        char reply[4096];
+        ssize_t n = recv(fd, reply, sizeof(reply), 0);
+        if (n <= 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < n && received < sizeof(status) - 1; i++) {
+            status[received++] = reply[i];
+        }
+    }
+    close(fd);
+    return received >= 12 ? atoi(status + 9) : 0;
+}
+
+static uint16_t freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *) &addr, &length);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+static size_t heapInUse() {
+    return mallinfo2().uordblks;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_firmware_comes_up() {
+    char dir[] = "/tmp/kirby-test-soak-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    root = dir;
+    std::string index = root + "/index.html";
+    FILE *file = fopen(index.c_str(), "w");
+    fputs("<html><body>kirby</body></html>\n", file);
+    fclose(file);
+
+    port = freePort();
+    nativeOptions.httpPort = port;
+    nativeOptions.ssids[0] = "primaryssid";
+    nativeOptions.ssidCount = 1;
+    nativeSerialTo(nullptr);
+    nativeUseVirtualTime(true);
+    LittleFS.setRoot(root.c_str());
+    setup();
+    for (uint32_t i = 0; i < 100000 && WiFi.status() != WL_CONNECTED; i++) {
+        loop();
+    }
+    TEST_ASSERT_EQUAL_INT(WL_CONNECTED, WiFi.status());
+    TEST_ASSERT_EQUAL_INT(200, request("GET", "/pwm"));
+}
+
+struct Mixed {
+    const char *method;
+    const char *path;
+    int status;
+};
+
+static const Mixed mix[] = {
+    {"GET", "/metrics", 200},
+    {"GET", "/pwm", 200},
+    {"GET", "/autopilot", 200},
+    {"GET", "/sampler", 200},
+    {"GET", "/calibrate", 200},
+    {"GET", "/debug/tasks", 200},
+    {"GET", "/status", 200},
+    {"GET", "/list?dir=/", 200},
+    {"GET", "/index.html", 200},
+    {"GET", "/missing/file.txt?path=x", 404},
+    {"PUT", "/pwm/abc", 400},
+    {"PUT", "/pwm/65636", 400},       // 100 once narrowed to short
+    {"PUT", "/pwm/4294967346", 400},  // 50 once narrowed to int
+    {"PUT", "/pwm/50x", 400},
+};
+const uint8_t mixCount = sizeof(mix) / sizeof(mix[0]);
+
+void test_heap_stays_flat_over_100k_requests() {
+    uint32_t baselineBlock = 0;
+    uint32_t minBlock = UINT32_MAX;
+    size_t baselineInUse = 0;
+    size_t maxInUse = 0;
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < soakRequests; i++) {
+        const Mixed &next = mix[i % mixCount];
+        // every 7th request changes the strength, so writes to the flash are part of it
+        int status = i % 7 == 6 ? request("PUT", i & 8 ? "/pwm/40" : "/pwm/60") : request(next.method, next.path);
+        if (status != (i % 7 == 6 ? 200 : next.status)) {
+            failed++;
+        }
+        if (i + 1 == soakWarmup) {
+            baselineBlock = ESP.getMaxFreeBlockSize();
+            baselineInUse = heapInUse();
+        } else if (i + 1 > soakWarmup && (i + 1) % soakSampleEvery == 0) {
+            minBlock = std::min(minBlock, ESP.getMaxFreeBlockSize());
+            maxInUse = std::max(maxInUse, heapInUse());
+        }
+    }
+    char message[160];
+    snprintf(message, sizeof(message), "max free block %u -> min %u bytes, in use %zu -> max %zu bytes, %u of %u unexpected replies",
+             baselineBlock, minBlock, baselineInUse, maxInUse, failed, soakRequests);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_EQUAL_UINT32(0, failed);
+    TEST_ASSERT_GREATER_OR_EQUAL(baselineBlock, minBlock);
+    // a leak of a byte per request would be 100 KB by now
+    TEST_ASSERT_LESS_OR_EQUAL(baselineInUse + 1024, maxInUse);
+
+    std::string command = "rm -rf " + root;
+    TEST_ASSERT_EQUAL_INT(0, system(command.c_str()));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_firmware_comes_up);
+    RUN_TEST(test_heap_stays_flat_over_100k_requests);
+    return UNITY_END();
+}
@@ -0,0 +1,164 @@
+// ThermalModel against a tube that follows the model's own equation: the
+// parameters converge, the forecast matches the tube, and driving the fan
+// with lowestDuty() keeps the tube under the limit through a heat step.
+#include <Arduino.h>
+#include <ThermalModel.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <math.h>
+
+// dT/dt = heating + cooling * (T - 30) / 10 + fan * duty, °C per minute
+struct Tube {
+    double heating = 0.5;
+    double cooling = -0.5;
+    double fan = -1.0;
+    double temp = 22.0;  // switched on at room temperature
+
+    void run(double duty, uint32_t ms) {
+        for (uint32_t t = 0; t < ms; t += 100) {
+            temp += (heating + cooling * (temp - 30) / 10 + fan * duty) * 100 / 60000;
+        }
+    }
+    // what the DS18B20 reports, 1/16 °C
+    int16_t raw() const { return (int16_t) lround(temp * 16); }
+};
+
+const uint32_t sampleMs = 1000;
+
+static ThermalModel model;
+static Tube tube;
+static uint32_t nowMs;
+
+// Duty dithered around 40 % in five minute halves, the way the autopilot
+// excites the fan while the model learns. The cooling term is only learned
+// when the temperature moves, which it does while the tube warms up.
+static uint8_t dither(uint32_t ms) {
+    return (ms / 300000) % 2 ? 60 : 20;
+}
+
+static void learn(uint32_t minutes) {
+    for (uint32_t end = nowMs + minutes * 60000; nowMs < end; nowMs += sampleMs) {
+        uint8_t duty = dither(nowMs);
+        tube.run(duty / 100.0, sampleMs);
+        model.sample(tube.raw(), duty, nowMs + sampleMs);
+    }
+}
+
+void setUp() {
+    model.reset();
+    tube = Tube();
+    nowMs = 0;
+}
+
+void tearDown() {
+}
+
+void test_untrained_model_is_not_trusted() {
+    TEST_ASSERT_FALSE(model.trusted());
+    TEST_ASSERT_EQUAL_UINT32(0, model.state().updates);
+    TEST_ASSERT_EQUAL_INT32(-1, model.timeConstantS());
+    // knows nothing, so it forecasts no change
+    TEST_ASSERT_EQUAL_INT16(35 * 16, model.forecast(35 * 16, 50, 300000));
+}
+
+void test_parameters_converge() {
+    learn(120);
+    TEST_ASSERT_TRUE(model.trusted());
+    // 0.5 °C/min heating and 1 °C/min for the fan at full duty, in 1/100
+    TEST_ASSERT_INT_WITHIN(5, 50, model.heatingCentiPerMin());
+    TEST_ASSERT_INT_WITHIN(10, -100, model.fanCentiPerMin());
+    // 10 °C over 0.5 °C/min per 10 °C is 20 minutes
+    TEST_ASSERT_INT_WITHIN(120, 1200, model.timeConstantS());
+}
+
+// Five minutes ahead at a few duties against the tube itself
+static void assertForecastsMatch() {
+    const uint8_t duties[] = {0, 30, 60, 100};
+    for (uint8_t duty : duties) {
+        Tube ahead = tube;
+        ahead.run(duty / 100.0, 300000);
+        // half a degree
+        TEST_ASSERT_INT_WITHIN(8, ahead.raw(), model.forecast(tube.raw(), duty, 300000));
+    }
+}
+
+void test_forecast_matches_the_tube() {
+    learn(120);
+    assertForecastsMatch();
+}
+
+void test_forecast_follows_a_heat_step() {
+    learn(120);
+    tube.heating = 0.8;
+    learn(120);
+    TEST_ASSERT_TRUE(model.trusted());
+    TEST_ASSERT_GREATER_THAN(60, model.heatingCentiPerMin());
+    assertForecastsMatch();
+}
+
+// The predictive autopilot in short: while the model is not trusted the
+// duty is dithered, then it is the lowest that keeps the forecast at the
+// limit. With a steady heat input the tube stays under the limit. A heat
+// step nobody announced overshoots until the model has caught up, then the
+// tube is back under the limit.
+void test_lowest_duty_keeps_the_tube_under_the_limit() {
+    const int16_t limitRaw = 35 * 16;
+    const uint32_t horizonMs = 300000;
+    tube.heating = 0.6;
+    learn(120);
+    TEST_ASSERT_TRUE(model.trusted());
+
+    int16_t hottest = 0;
+    int16_t hottestAfterStep = 0;
+    int16_t last = 0;
+    uint8_t duty = 0;
+    for (uint32_t minute = 0; minute < 6 * 60; minute++) {
+        if (minute == 3 * 60) {
+            tube.heating = 0.9;
+        }
+        for (uint32_t end = nowMs + 60000; nowMs < end; nowMs += sampleMs) {
+            duty = model.lowestDuty(tube.raw(), limitRaw, horizonMs);
+            tube.run(duty / 100.0, sampleMs);
+            model.sample(tube.raw(), duty, nowMs + sampleMs);
+            if (minute < 3 * 60) {
+                hottest = std::max(hottest, tube.raw());
+            } else {
+                hottestAfterStep = std::max(hottestAfterStep, tube.raw());
+            }
+            last = tube.raw();
+        }
+    }
+    char message[96];
+    snprintf(message, sizeof(message), "hottest %.2f °C, after the heat step %.2f °C, last duty %u %%", hottest / 16.0,
+             hottestAfterStep / 16.0, duty);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_OR_EQUAL(limitRaw, hottest);
+    TEST_ASSERT_LESS_OR_EQUAL(limitRaw + 16, hottestAfterStep);
+    TEST_ASSERT_LESS_OR_EQUAL(limitRaw, last);
+    TEST_ASSERT_TRUE(model.trusted());
+    // at 0.9 °C/min it takes 65 % duty to hold 35 °C
+    TEST_ASSERT_INT_WITHIN(3, 65, duty);
+    // well under the limit the fan can stay off
+    TEST_ASSERT_EQUAL_UINT8(0, model.lowestDuty(25 * 16, limitRaw, horizonMs));
+}
+
+void test_restored_state_forecasts_the_same() {
+    learn(120);
+    ThermalModel restored;
+    restored.restore(model.state());
+    TEST_ASSERT_TRUE(restored.trusted());
+    TEST_ASSERT_EQUAL_INT16(model.forecast(34 * 16, 40, 300000), restored.forecast(34 * 16, 40, 300000));
+    TEST_ASSERT_EQUAL_UINT8(model.lowestDuty(34 * 16, 35 * 16, 300000), restored.lowestDuty(34 * 16, 35 * 16, 300000));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_untrained_model_is_not_trusted);
+    RUN_TEST(test_parameters_converge);
+    RUN_TEST(test_forecast_matches_the_tube);
+    RUN_TEST(test_forecast_follows_a_heat_step);
+    RUN_TEST(test_lowest_duty_keeps_the_tube_under_the_limit);
+    RUN_TEST(test_restored_state_forecasts_the_same);
+    return UNITY_END();
+}
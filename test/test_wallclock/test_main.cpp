@@ -0,0 +1,197 @@
+// WallClock: steps and slews on sync, timestamps that never go backwards,
+// the drift of a crystal learned over two days, snapshots across a reset
+// and the SNTP messages.
+#include <Arduino.h>
+#include <WallClock.h>
+#include <unity.h>
+
+#include <math.h>
+
+const int64_t startUnixMs = 1760000000000LL;  // October 2025
+
+// TIME_DETAILS.h, the poll interval of ClockTask
+const uint32_t pollMinMs = 64000;
+const uint32_t pollMaxMs = 1024000;
+const int32_t steadyOffsetMs = 20;
+
+static WallClock wall;
+
+void setUp() {
+    wall = WallClock();
+}
+
+void tearDown() {
+}
+
+void test_invalid_until_the_first_sync() {
+    TEST_ASSERT_FALSE(wall.valid());
+    TEST_ASSERT_FALSE(wall.synced());
+    TEST_ASSERT_EQUAL_INT64(0, wall.unixMs(1234));
+
+    TEST_ASSERT_EQUAL(WALL_CLOCK_STEPPED, wall.sync(startUnixMs, 5000, pollMinMs));
+    TEST_ASSERT_TRUE(wall.valid());
+    TEST_ASSERT_TRUE(wall.synced());
+    // the first sync sets the clock, it is no step
+    TEST_ASSERT_EQUAL_UINT32(0, wall.steps());
+    TEST_ASSERT_EQUAL_INT64(startUnixMs, wall.unixMs(5000));
+    TEST_ASSERT_EQUAL_INT64(startUnixMs + 1000, wall.unixMs(6000));
+    // instants before the sync map as well
+    TEST_ASSERT_EQUAL_INT64(startUnixMs - 4000, wall.unixMs(1000));
+}
+
+void test_offset_is_slewed_without_going_backwards() {
+    wall.sync(startUnixMs, 0, pollMinMs);
+    // the server is 300 ms behind 20 s later, too soon to take it for drift
+    TEST_ASSERT_EQUAL(WALL_CLOCK_SLEWED, wall.sync(startUnixMs + 20000 - 300, 20000, pollMinMs));
+    TEST_ASSERT_EQUAL_INT32(-300, wall.offsetMs());
+    TEST_ASSERT_EQUAL_INT32(0, wall.driftPpb());
+    TEST_ASSERT_EQUAL_UINT32(0, wall.steps());
+    // removing it by the next poll would take 4700 ppm, it goes at the cap
+    TEST_ASSERT_EQUAL_INT32(-wallClockSlewMaxPpb, wall.slewPpb());
+
+    const uint32_t slewMs = 300LL * 1000000000 / wallClockSlewMaxPpb;
+    int64_t previous = wall.unixMs(19999);
+    for (uint32_t ms = 20000; ms <= 20000 + slewMs + 60000; ms++) {
+        int64_t now = wall.unixMs(ms);
+        TEST_ASSERT_TRUE(now >= previous);
+        previous = now;
+    }
+    TEST_ASSERT_EQUAL_INT64(startUnixMs + 20000 + slewMs / 2 - 150, wall.unixMs(20000 + slewMs / 2));
+    TEST_ASSERT_EQUAL_INT64(startUnixMs + 20000 + slewMs - 300, wall.unixMs(20000 + slewMs));
+    TEST_ASSERT_EQUAL_INT64(startUnixMs + 20000 + slewMs + 60000 - 300, wall.unixMs(20000 + slewMs + 60000));
+}
+
+void test_large_offset_steps() {
+    wall.sync(startUnixMs, 0, pollMinMs);
+    TEST_ASSERT_EQUAL(WALL_CLOCK_STEPPED, wall.sync(startUnixMs + pollMinMs + 5000, pollMinMs, pollMinMs));
+    TEST_ASSERT_EQUAL_UINT32(1, wall.steps());
+    TEST_ASSERT_EQUAL_INT32(5000, wall.offsetMs());
+    TEST_ASSERT_EQUAL_INT64(startUnixMs + pollMinMs + 5000, wall.unixMs(pollMinMs));
+}
+
+void test_millis_wrapping_around() {
+    uint32_t atMs = UINT32_MAX - 1000;
+    wall.sync(startUnixMs, atMs, pollMinMs);
+    TEST_ASSERT_EQUAL_INT64(startUnixMs + 1000, wall.unixMs(atMs + 1000));
+    TEST_ASSERT_EQUAL_INT64(startUnixMs + 6001, wall.unixMs(5000));
+    wall.tick(5000);
+    TEST_ASSERT_EQUAL_INT64(startUnixMs + 6001, wall.unixMs(5000));
+}
+
+/*
+   Two days of ClockTask against a perfect server, with the crystal behind
+   millis() 40 ppm fast: the poll interval grows while the offsets stay
+   small, the clock learns the drift and every instant in between, every
+   10 ms, maps to a later time than the one before.
+*/
+void test_learns_the_drift_of_a_crystal() {
+    const double crystalPpm = 40;
+    const double msPerTrueMs = 1 + crystalPpm / 1e6;
+    const double days = 2;
+
+    double trueMs = 0;
+    uint32_t ms = 1000;
+    uint32_t pollMs = pollMinMs;
+    int64_t previous = 0;
+    int32_t worstLateOffset = 0;
+    uint32_t syncs = 0;
+    while (trueMs < days * 86400000) {
+        wall.sync(startUnixMs + (int64_t) llround(trueMs), ms, pollMs);
+        syncs++;
+        if (trueMs > 86400000) {
+            worstLateOffset = std::max(worstLateOffset, abs(wall.offsetMs()));
+        }
+        bool steady = abs(wall.offsetMs()) <= steadyOffsetMs;
+        pollMs = steady ? std::min(pollMs * 2, pollMaxMs) : pollMinMs;
+
+        for (uint32_t step = 0; step < pollMs; step += 10) {
+            int64_t now = wall.unixMs(ms + step);
+            TEST_ASSERT_TRUE(now >= previous);
+            previous = now;
+        }
+        // ClockTask runs every clockTickMs and ticks the clock
+        wall.tick(ms + pollMs / 2);
+        ms += pollMs;
+        trueMs += pollMs / msPerTrueMs;
+    }
+    char message[96];
+    snprintf(message, sizeof(message), "%u syncs, drift %d ppb, worst offset on day two %d ms", syncs,
+             wall.driftPpb(), worstLateOffset);
+    TEST_MESSAGE(message);
+    // the wall clock runs 40 ppm slower than the crystal
+    TEST_ASSERT_INT32_WITHIN(2000, -40000, wall.driftPpb());
+    TEST_ASSERT_LESS_OR_EQUAL(steadyOffsetMs, worstLateOffset);
+    TEST_ASSERT_EQUAL_UINT32(0, wall.steps());
+    // no sync for another poll interval: still within a few ms
+    TEST_ASSERT_INT64_WITHIN(5, startUnixMs + (int64_t) llround(trueMs), wall.unixMs(ms));
+}
+
+void test_snapshot_survives_a_reset() {
+    wall.sync(startUnixMs, 0, pollMinMs);
+    wall.sync(startUnixMs + pollMinMs - 3, pollMinMs, pollMinMs);
+    WallClockState state = wall.snapshot(100000);
+    TEST_ASSERT_EQUAL_INT64(wall.unixMs(100000), state.unixMs);
+
+    // 2.5 s of reset and boot, millis() starts over
+    WallClock restored;
+    restored.restore(state, 2500, 300);
+    TEST_ASSERT_TRUE(restored.valid());
+    TEST_ASSERT_TRUE(restored.restored());
+    TEST_ASSERT_FALSE(restored.synced());
+    TEST_ASSERT_EQUAL_INT32(wall.driftPpb(), restored.driftPpb());
+    TEST_ASSERT_EQUAL_INT64(state.unixMs + 2500, restored.unixMs(300));
+}
+
+void test_sntp_request_and_reply() {
+    const uint64_t nonce = 0x0123456789abcdefULL;
+    uint8_t packet[sntpPacketSize];
+    sntpRequest(packet, nonce);
+    TEST_ASSERT_EQUAL_HEX8(0x23, packet[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, packet[40]);
+    TEST_ASSERT_EQUAL_HEX8(0xef, packet[47]);
+
+    // the server's answer: received at a whole NTP second and sent 2 ms later
+    uint8_t reply[sntpPacketSize] = {};
+    reply[0] = (4 << 3) | 4;
+    reply[1] = 2;
+    memcpy(reply + 24, packet + 40, 8);
+    const uint32_t ntpSeconds = 3969420810u;
+    const uint8_t receive[8] = {(uint8_t) (ntpSeconds >> 24), (uint8_t) (ntpSeconds >> 16), (uint8_t) (ntpSeconds >> 8),
+                                (uint8_t) ntpSeconds, 0, 0, 0, 0};
+    memcpy(reply + 32, receive, 8);
+    memcpy(reply + 40, receive, 8);
+    reply[44] = 0x00;
+    reply[45] = 0x83;
+    reply[46] = 0x12;
+    reply[47] = 0x6f;  // 0.002 s
+
+    int64_t serverUnixMs;
+    uint32_t delayMs;
+    TEST_ASSERT_TRUE(sntpReply(reply, sizeof(reply), nonce, 1000, 1042, serverUnixMs, delayMs));
+    // 42 ms round trip, 2 of them in the server
+    TEST_ASSERT_EQUAL_UINT32(40, delayMs);
+    TEST_ASSERT_EQUAL_INT64((3969420810LL - 2208988800LL) * 1000 + 2 + 20, serverUnixMs);
+
+    TEST_ASSERT_FALSE(sntpReply(reply, sizeof(reply) - 1, nonce, 1000, 1042, serverUnixMs, delayMs));
+    TEST_ASSERT_FALSE(sntpReply(reply, sizeof(reply), nonce + 1, 1000, 1042, serverUnixMs, delayMs));
+    uint8_t kiss[sntpPacketSize];
+    memcpy(kiss, reply, sizeof(kiss));
+    kiss[1] = 0;
+    TEST_ASSERT_FALSE(sntpReply(kiss, sizeof(kiss), nonce, 1000, 1042, serverUnixMs, delayMs));
+    uint8_t unsynchronized[sntpPacketSize];
+    memcpy(unsynchronized, reply, sizeof(unsynchronized));
+    unsynchronized[0] |= 3 << 6;
+    TEST_ASSERT_FALSE(sntpReply(unsynchronized, sizeof(unsynchronized), nonce, 1000, 1042, serverUnixMs, delayMs));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_invalid_until_the_first_sync);
+    RUN_TEST(test_offset_is_slewed_without_going_backwards);
+    RUN_TEST(test_large_offset_steps);
+    RUN_TEST(test_millis_wrapping_around);
+    RUN_TEST(test_learns_the_drift_of_a_crystal);
+    RUN_TEST(test_snapshot_survives_a_reset);
+    RUN_TEST(test_sntp_request_and_reply);
+    return UNITY_END();
+}
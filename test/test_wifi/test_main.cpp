@@ -0,0 +1,130 @@
+// The Wi-Fi cache across reconnects: the first connect scans and takes its
+// address from DHCP, a reconnect replays the cached address while its lease
+// lasts and goes back to DHCP once the lease has ended.
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include <NativeHost.h>
+#include <WallClock.h>
+#include <lwip/dhcp.h>
+#include <unity.h>
+
+#include <stdlib.h>
+#include <string>
+
+void setup();
+void loop();
+
+// from src/main.cpp
+struct WifiCache {
+    uint32_t magic;
+    uint8_t ssidIndex;
+    uint8_t channel;
+    uint8_t bssid[6];
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint32_t leaseS;
+    uint32_t leaseEndS;
+};
+extern WifiCache wifiCache;
+extern WallClock wallClock;
+
+const int64_t startUnixMs = 1760000000000LL;  // October 2025
+const uint32_t leaseS = 600;
+
+static std::string root;
+
+static void runFor(uint32_t ms) {
+    uint64_t end = nativeMicros64() + ms * 1000ULL;
+    while (nativeMicros64() < end) {
+        loop();
+    }
+}
+
+static bool fromDhcp() {
+    return dhcp_supplied_address(netif_default);
+}
+
+// The link drops and comes back on its own
+static void reconnect() {
+    WiFi.disconnect();
+    runFor(1000);
+    TEST_ASSERT_EQUAL_INT(WL_CONNECTED, WiFi.status());
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_first_connect_scans_and_asks_dhcp() {
+    char dir[] = "/tmp/kirby-test-wifi-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    root = dir;
+    LittleFS.setRoot(root.c_str());
+    TEST_ASSERT_TRUE(LittleFS.begin());
+
+    nativeOptions.httpPort = 0;
+    nativeOptions.ssids[0] = "primaryssid";
+    nativeOptions.ssidCount = 1;
+    nativeSerialTo(nullptr);
+    nativeUseVirtualTime(true);
+    WiFi.nativeSetLeaseS(leaseS);
+    setup();
+    runFor(1000);
+    TEST_ASSERT_EQUAL_INT(WL_CONNECTED, WiFi.status());
+    TEST_ASSERT_TRUE(fromDhcp());
+    TEST_ASSERT_EQUAL_UINT32(leaseS, wifiCache.leaseS);
+    // there is no wall clock yet to tell when the lease ends
+    TEST_ASSERT_EQUAL_UINT32(0, wifiCache.leaseEndS);
+}
+
+void test_without_a_wall_clock_reconnects_with_dhcp() {
+    reconnect();
+    TEST_ASSERT_TRUE(fromDhcp());
+}
+
+// The lease counts from when it was granted, not from the first sync
+void test_lease_end_is_kept_once_the_clock_is_valid() {
+    uint32_t connectedMs = millis();
+    runFor(10000);
+    wallClock.sync(startUnixMs, millis(), 64000);
+    runFor(1000);
+    TEST_ASSERT_UINT32_WITHIN(1, wallClock.unixMs(connectedMs) / 1000 + leaseS, wifiCache.leaseEndS);
+}
+
+void test_reconnect_replays_the_cached_address() {
+    uint32_t leaseEndS = wifiCache.leaseEndS;
+    reconnect();
+    TEST_ASSERT_FALSE(fromDhcp());
+    TEST_ASSERT_EQUAL_UINT32(leaseEndS, wifiCache.leaseEndS);
+}
+
+void test_expired_lease_goes_back_to_dhcp() {
+    uint32_t leaseEndS = wifiCache.leaseEndS;
+    // the cached address is dropped a minute before its lease ends
+    runFor((leaseEndS - wallClock.unixMs(millis()) / 1000 - 60) * 1000 + 2000);
+    TEST_ASSERT_EQUAL_INT(WL_CONNECTED, WiFi.status());
+    TEST_ASSERT_TRUE(fromDhcp());
+    TEST_ASSERT_INT64_WITHIN(2, wallClock.unixMs(millis()) / 1000 + leaseS, wifiCache.leaseEndS);
+
+    // the new lease is replayed again
+    reconnect();
+    TEST_ASSERT_FALSE(fromDhcp());
+
+    std::string command = "rm -rf " + root;
+    TEST_ASSERT_EQUAL_INT(0, system(command.c_str()));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_connect_scans_and_asks_dhcp);
+    RUN_TEST(test_without_a_wall_clock_reconnects_with_dhcp);
+    RUN_TEST(test_lease_end_is_kept_once_the_clock_is_valid);
+    RUN_TEST(test_reconnect_replays_the_cached_address);
+    RUN_TEST(test_expired_lease_goes_back_to_dhcp);
+    return UNITY_END();
+}
@@ -0,0 +1,453 @@
+#!/usr/bin/env python3
+"""Load and soak benchmark for the Kirby HTTP API.
+
+Drives a weighted mix of realistic requests against a device or the native
+build (pio run -e native), samples heap and fragmentation from /metrics while
+it runs, and writes the results as JSON so runs can be compared between
+commits:
+
+    tools/loadbench.py --url http://localhost:8080 --duration 60 --out after.json
+    tools/loadbench.py --url http://kirby.local --duration 3600 --out soak.json
+    tools/loadbench.py --compare before.json after.json
+
+Writes go through the normal API, so the PWM strength and the autopilot curve
+are read before the run and restored afterwards. The "upload" kind (not in
+the default mix) posts --upload-size bytes to /edit and reports how many
+filesystem writes the device needed for them:
+
+    tools/loadbench.py --url http://localhost:8080 --mix upload=1 --duration 20
+"""
+
+import argparse
+import hashlib
+import http.client
+import json
+import math
+import os
+import random
+import subprocess
+import sys
+import threading
+import time
+import urllib.parse
+
+DEFAULT_MIX = "metrics=40,pwm_get=15,pwm_put=10,autopilot_post=5,static=20,list=10"
+HEAP_GAUGES = {
+    "kirby_heap_free_bytes": "free",
+    "kirby_heap_max_block_bytes": "max_block",
+    "kirby_heap_fragmentation_percent": "fragmentation",
+    "kirby_request_arena_bytes_max": "arena_max",
+}
+UPLOAD_COUNTERS = {
+    "kirby_upload_writes_total": "writes",
+    "kirby_upload_bytes_total": "bytes",
+    "kirby_upload_failures_total": "failures",
+}
+UPLOAD_PATH = "/loadbench-upload.bin"
+
+
+class Target:
+    def __init__(self, url, timeout):
+        parsed = urllib.parse.urlsplit(url)
+        if parsed.scheme != "http":
+            raise ValueError("only http:// targets are supported")
+        self.host = parsed.hostname
+        self.port = parsed.port or 80
+        self.timeout = timeout
+
+    def request(self, method, path, body=None, headers=None):
+        """Returns (status, body bytes); the device closes every connection."""
+        conn = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout)
+        try:
+            conn.request(method, path, body=body, headers=headers or {})
+            response = conn.getresponse()
+            return response.status, response.read()
+        finally:
+            conn.close()
+
+
+class Workload:
+    """The request kinds of the mix, each returns (method, path, body, headers)."""
+
+    def __init__(self, static_files, rng, upload_size=16384):
+        self.static_files = static_files or ["index.htm"]
+        self.rng = rng
+        self.upload_size = upload_size
+
+    def metrics(self):
+        return "GET", "/metrics", None, None
+
+    def pwm_get(self):
+        return "GET", "/pwm", None, None
+
+    def pwm_put(self):
+        return "PUT", "/pwm/%d" % self.rng.randint(0, 100), None, None
+
+    def autopilot_get(self):
+        return "GET", "/autopilot", None, None
+
+    def autopilot_post(self):
+        points = []
+        temperature = self.rng.randint(20, 26)
+        strength = 0
+        for _ in range(self.rng.randint(3, 8)):
+            points.append({"temperature": temperature, "strength": strength})
+            temperature += self.rng.randint(2, 5)
+            strength = min(100, strength + self.rng.randint(10, 30))
+        body = json.dumps(points)
+        return "POST", "/autopilot", body, {"Content-Type": "application/json"}
+
+    def static(self):
+        return "GET", "/" + urllib.parse.quote(self.rng.choice(self.static_files)), None, None
+
+    def list(self):
+        return "GET", "/list?dir=/", None, None
+
+    def upload(self):
+        data = bytes(self.rng.getrandbits(8) for _ in range(self.upload_size))
+        boundary = "loadbench%08x" % self.rng.getrandbits(32)
+        body = b"".join([
+            b"--%s\r\n" % boundary.encode(),
+            b'Content-Disposition: form-data; name="data"; filename="%s"\r\n' % UPLOAD_PATH.encode(),
+            b"Content-Type: application/octet-stream\r\n\r\n",
+            data,
+            b"\r\n--%s--\r\n" % boundary.encode(),
+        ])
+        path = "/edit?md5=" + hashlib.md5(data).hexdigest()
+        return "POST", path, body, {"Content-Type": "multipart/form-data; boundary=%s" % boundary}
+
+
+def parse_mix(text):
+    mix = []
+    for item in text.split(","):
+        name, _, weight = item.partition("=")
+        name = name.strip()
+        if not hasattr(Workload, name) or name.startswith("_"):
+            raise ValueError("unknown request kind %r" % name)
+        mix.append((name, float(weight or 1)))
+    return mix
+
+
+def percentile(sorted_values, fraction):
+    """Nearest rank percentile of an already sorted list."""
+    if not sorted_values:
+        return None
+    rank = max(0, min(len(sorted_values) - 1, math.ceil(fraction * len(sorted_values)) - 1))
+    return sorted_values[rank]
+
+
+def summarize(latencies, errors, statuses, elapsed):
+    ordered = sorted(latencies)
+    count = len(latencies) + errors
+    return {
+        "requests": count,
+        "errors": errors,
+        "error_rate": errors / count if count else 0.0,
+        "throughput_rps": count / elapsed if elapsed else 0.0,
+        "latency_ms": {
+            "p50": percentile(ordered, 0.50),
+            "p95": percentile(ordered, 0.95),
+            "p99": percentile(ordered, 0.99),
+            "max": ordered[-1] if ordered else None,
+            "mean": sum(ordered) / len(ordered) if ordered else None,
+        },
+        "status": dict(sorted(statuses.items())),
+    }
+
+
+def read_gauges(target):
+    status, body = target.request("GET", "/metrics")
+    if status != 200:
+        return None
+    sample = {}
+    for line in body.decode("utf-8", "replace").splitlines():
+        name, _, value = line.partition(" ")
+        key = HEAP_GAUGES.get(name) or UPLOAD_COUNTERS.get(name)
+        if key:
+            try:
+                sample[key] = float(value)
+            except ValueError:
+                pass
+    return sample
+
+
+def heap_trend(samples):
+    """Least squares slope of free heap in bytes per hour, a leak shows up negative."""
+    points = [(s["t"], s["free"]) for s in samples if "free" in s]
+    if len(points) < 2:
+        return None
+    n = len(points)
+    mean_t = sum(p[0] for p in points) / n
+    mean_f = sum(p[1] for p in points) / n
+    var = sum((p[0] - mean_t) ** 2 for p in points)
+    if not var:
+        return None
+    cov = sum((p[0] - mean_t) * (p[1] - mean_f) for p in points)
+    return cov / var * 3600
+
+
+class Bench:
+    def __init__(self, args):
+        self.args = args
+        self.target = Target(args.url, args.timeout)
+        self.mix = parse_mix(args.mix)
+        self.lock = threading.Lock()
+        self.results = {name: {"latencies": [], "errors": 0, "statuses": {}} for name, _ in self.mix}
+        self.samples = []
+        self.stop = threading.Event()
+
+    def worker(self, seed):
+        rng = random.Random(seed)
+        workload = Workload(static_files(self.args.data), rng, self.args.upload_size)
+        names = [name for name, _ in self.mix]
+        weights = [weight for _, weight in self.mix]
+        while not self.stop.is_set():
+            name = rng.choices(names, weights)[0]
+            method, path, body, headers = getattr(workload, name)()
+            started = time.perf_counter()
+            try:
+                status, _ = self.target.request(method, path, body, headers)
+                failed = status >= 400
+            except (OSError, http.client.HTTPException) as error:
+                status, failed = type(error).__name__, True
+            elapsed_ms = (time.perf_counter() - started) * 1000
+            with self.lock:
+                result = self.results[name]
+                result["statuses"][str(status)] = result["statuses"].get(str(status), 0) + 1
+                if failed:
+                    result["errors"] += 1
+                else:
+                    result["latencies"].append(elapsed_ms)
+            if self.args.think_ms:
+                time.sleep(self.args.think_ms / 1000)
+
+    def sampler(self, started):
+        while not self.stop.wait(self.args.sample_interval):
+            self.sample(started)
+
+    def sample(self, started):
+        try:
+            gauges = read_gauges(self.target)
+        except (OSError, http.client.HTTPException):
+            gauges = None
+        if gauges:
+            gauges["t"] = round(time.monotonic() - started, 3)
+            with self.lock:
+                self.samples.append(gauges)
+
+    def snapshot_state(self):
+        """PWM and curve before the run, so the device is left as it was found."""
+        try:
+            status, pwm = self.target.request("GET", "/pwm")
+            pwm = int(pwm) if status == 200 else None
+        except (OSError, http.client.HTTPException, ValueError):
+            pwm = None
+        try:
+            status, curve = self.target.request("GET", "/autopilot")
+            curve = json.loads(curve) if status == 200 else None
+        except (OSError, http.client.HTTPException, ValueError):
+            curve = None
+        return pwm, curve
+
+    def restore_state(self, pwm, curve):
+        try:
+            if any(name == "upload" for name, _ in self.mix):
+                self.target.request("DELETE", "/edit?path=" + UPLOAD_PATH)
+            if curve is not None:
+                self.target.request("POST", "/autopilot", json.dumps(curve), {"Content-Type": "application/json"})
+            if pwm is not None:
+                self.target.request("PUT", "/pwm/%d" % pwm)
+        except (OSError, http.client.HTTPException) as error:
+            print("warning: could not restore the device state: %s" % error, file=sys.stderr)
+
+    def run(self):
+        pwm, curve = self.snapshot_state()
+        started = time.monotonic()
+        self.sample(started)
+        threads = [threading.Thread(target=self.sampler, args=(started,), daemon=True)]
+        for i in range(self.args.concurrency):
+            threads.append(threading.Thread(target=self.worker, args=(self.args.seed + i,), daemon=True))
+        for thread in threads:
+            thread.start()
+        try:
+            deadline = started + self.args.duration
+            while time.monotonic() < deadline:
+                time.sleep(min(1.0, deadline - time.monotonic()))
+                if self.args.progress:
+                    self.print_progress(started)
+        except KeyboardInterrupt:
+            print("interrupted, writing partial results", file=sys.stderr)
+        self.stop.set()
+        for thread in threads:
+            thread.join(self.args.timeout + 1)
+        elapsed = time.monotonic() - started
+        self.sample(started)
+        self.restore_state(pwm, curve)
+        return self.report(elapsed)
+
+    def print_progress(self, started):
+        with self.lock:
+            done = sum(len(r["latencies"]) + r["errors"] for r in self.results.values())
+        print("\r%6.0fs %8d requests" % (time.monotonic() - started, done), end="", file=sys.stderr, flush=True)
+
+    def report(self, elapsed):
+        if self.args.progress:
+            print(file=sys.stderr)
+        all_latencies, all_errors, all_statuses = [], 0, {}
+        endpoints = {}
+        for name, result in self.results.items():
+            endpoints[name] = summarize(result["latencies"], result["errors"], result["statuses"], elapsed)
+            all_latencies += result["latencies"]
+            all_errors += result["errors"]
+            for status, count in result["statuses"].items():
+                all_statuses[status] = all_statuses.get(status, 0) + count
+        heap = list(self.samples)
+        upload = None
+        counted = [s for s in heap if "writes" in s and "bytes" in s]
+        if len(counted) >= 2 and counted[-1]["writes"] > counted[0]["writes"]:
+            writes = counted[-1]["writes"] - counted[0]["writes"]
+            written = counted[-1]["bytes"] - counted[0]["bytes"]
+            upload = {
+                "writes": writes,
+                "bytes": written,
+                "bytes_per_write": written / writes,
+                "failures": counted[-1].get("failures", 0) - counted[0].get("failures", 0),
+                "throughput_bytes_per_s": written / elapsed if elapsed else None,
+            }
+        free = [s["free"] for s in heap if "free" in s]
+        fragmentation = [s["fragmentation"] for s in heap if "fragmentation" in s]
+        return {
+            "meta": {
+                "url": self.args.url,
+                "duration_s": round(elapsed, 3),
+                "concurrency": self.args.concurrency,
+                "mix": self.args.mix,
+                "seed": self.args.seed,
+                "commit": git_commit(),
+                "started": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+            },
+            "overall": summarize(all_latencies, all_errors, all_statuses, elapsed),
+            "endpoints": endpoints,
+            "upload": upload,
+            "heap": {
+                "free_first": free[0] if free else None,
+                "free_last": free[-1] if free else None,
+                "free_min": min(free) if free else None,
+                "free_slope_bytes_per_hour": heap_trend(heap),
+                "fragmentation_max": max(fragmentation) if fragmentation else None,
+                "samples": heap,
+            },
+        }
+
+
+def static_files(data_dir):
+    try:
+        return sorted(name for name in os.listdir(data_dir) if os.path.isfile(os.path.join(data_dir, name)))
+    except OSError:
+        return []
+
+
+def git_commit():
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], capture_output=True, text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def fmt(value, spec=".1f"):
+    return "-" if value is None else format(value, spec)
+
+
+def print_report(results):
+    meta, overall, heap = results["meta"], results["overall"], results["heap"]
+    print("%s, %.0f s, concurrency %d, commit %s" % (meta["url"], meta["duration_s"], meta["concurrency"], meta["commit"] or "?"))
+    print("%-16s %8s %8s %7s %8s %8s %8s %8s" % ("endpoint", "requests", "rps", "errors", "p50 ms", "p95 ms", "p99 ms", "max ms"))
+    rows = list(results["endpoints"].items()) + [("overall", overall)]
+    for name, stats in rows:
+        latency = stats["latency_ms"]
+        print("%-16s %8d %8.2f %6.1f%% %8s %8s %8s %8s" % (
+            name, stats["requests"], stats["throughput_rps"], stats["error_rate"] * 100,
+            fmt(latency["p50"]), fmt(latency["p95"]), fmt(latency["p99"]), fmt(latency["max"])))
+    upload = results.get("upload")
+    if upload:
+        print("upload %d bytes in %d filesystem writes (%.0f bytes/write), %.0f bytes/s, %d failed" % (
+            upload["bytes"], upload["writes"], upload["bytes_per_write"], upload["throughput_bytes_per_s"] or 0, upload["failures"]))
+    print("heap free %s -> %s bytes (min %s, trend %s bytes/h), fragmentation max %s%%" % (
+        fmt(heap["free_first"], ".0f"), fmt(heap["free_last"], ".0f"), fmt(heap["free_min"], ".0f"),
+        fmt(heap["free_slope_bytes_per_hour"], "+.0f"), fmt(heap["fragmentation_max"], ".0f")))
+
+
+def compare(before, after, tolerance):
+    """Prints the change per endpoint, returns False if anything regressed beyond tolerance."""
+    ok = True
+    print("%-16s %22s %22s %22s" % ("endpoint", "rps", "p95 ms", "error rate"))
+    names = list(after["endpoints"]) + ["overall"]
+    for name in names:
+        old = before["overall"] if name == "overall" else before["endpoints"].get(name)
+        new = after["overall"] if name == "overall" else after["endpoints"].get(name)
+        if not old or not new:
+            continue
+        cells = []
+        for key, worse_if_higher in (("throughput_rps", False), ("p95", True), ("error_rate", True)):
+            a = old["latency_ms"][key] if key == "p95" else old[key]
+            b = new["latency_ms"][key] if key == "p95" else new[key]
+            if a is None or b is None:
+                cells.append("%22s" % "-")
+                continue
+            change = (b - a) / a if a else (0.0 if b == a else float("inf"))
+            regressed = (change > tolerance) if worse_if_higher else (change < -tolerance)
+            if key == "error_rate":
+                regressed = b > a + 0.001
+            ok &= not regressed
+            cells.append("%9.3g -> %-7.3g%s" % (a, b, " !" if regressed else "  "))
+        print("%-16s %s" % (name, " ".join(cells)))
+    heap_a, heap_b = before["heap"]["free_min"], after["heap"]["free_min"]
+    if heap_a is not None and heap_b is not None:
+        regressed = heap_b < heap_a * (1 - tolerance)
+        ok &= not regressed
+        print("heap free min    %.0f -> %.0f bytes%s" % (heap_a, heap_b, " !" if regressed else ""))
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--url", default="http://localhost:8080", help="device or native build (default %(default)s)")
+    parser.add_argument("--duration", type=float, default=60, help="seconds to run (default %(default)s)")
+    parser.add_argument("--concurrency", type=int, default=1, help="parallel clients (default %(default)s)")
+    parser.add_argument("--mix", default=DEFAULT_MIX, help="weighted request kinds (default %(default)s)")
+    parser.add_argument("--think-ms", type=float, default=0, help="pause between requests per client")
+    parser.add_argument("--sample-interval", type=float, default=5, help="seconds between heap samples (default %(default)s)")
+    parser.add_argument("--timeout", type=float, default=5, help="per request timeout in seconds (default %(default)s)")
+    parser.add_argument("--data", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "data"),
+                        help="directory the static files are picked from (default data/)")
+    parser.add_argument("--upload-size", type=int, default=16384, help="bytes per upload request (default %(default)s)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--out", help="write the results as JSON")
+    parser.add_argument("--progress", action="store_true", help="print a running request count")
+    parser.add_argument("--compare", nargs=2, metavar=("BEFORE", "AFTER"), help="compare two result files and exit")
+    parser.add_argument("--tolerance", type=float, default=0.2,
+                        help="relative change --compare accepts before failing (default %(default)s)")
+    args = parser.parse_args()
+
+    if args.compare:
+        with open(args.compare[0]) as f:
+            before = json.load(f)
+        with open(args.compare[1]) as f:
+            after = json.load(f)
+        return 0 if compare(before, after, args.tolerance) else 1
+
+    try:
+        bench = Bench(args)
+    except ValueError as error:
+        parser.error(str(error))
+    results = bench.run()
+    print_report(results)
+    if args.out:
+        with open(args.out, "w") as f:
+            json.dump(results, f, indent=2)
+            f.write("\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
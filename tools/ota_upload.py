@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Upload a firmware or filesystem image to Kirby's POST /update.
+
+Images are gzip compressed on the way unless they already are, which cuts
+the transfer and, for the filesystem, the time the device spends without one:
+
+    tools/ota_upload.py kirby.local --firmware .pio/build/esp01/firmware.bin
+    tools/ota_upload.py 192.168.1.20 --filesystem .pio/build/esp01/littlefs.bin
+
+The firmware is installed by the core's boot loader, which inflates gzip
+itself. The filesystem image is inflated by the running firmware through a
+4 KB window, so it is compressed with that window here; an image gzipped
+elsewhere with the default 32 KB window is refused by the device.
+
+The MD5 of the uploaded bytes goes along, the device checks it before it
+commits the image and restarts.
+"""
+
+import argparse
+import hashlib
+import http.client
+import sys
+import uuid
+import zlib
+
+GZIP_MAGIC = b"\x1f\x8b"
+# matches inflateWindowSize in lib/Inflate/Inflate.h
+FILESYSTEM_WINDOW_BITS = 12
+
+
+def gzip(data, window_bits):
+    compressor = zlib.compressobj(9, zlib.DEFLATED, window_bits + 16, 9)
+    return compressor.compress(data) + compressor.flush()
+
+
+def upload(host, port, target, name, image, timeout):
+    md5 = hashlib.md5(image).hexdigest()
+    boundary = uuid.uuid4().hex
+    body = b"".join([
+        b"--%s\r\n" % boundary.encode(),
+        b'Content-Disposition: form-data; name="image"; filename="%s"\r\n' % name.encode(),
+        b"Content-Type: application/octet-stream\r\n\r\n",
+        image,
+        b"\r\n--%s--\r\n" % boundary.encode(),
+    ])
+    connection = http.client.HTTPConnection(host, port, timeout=timeout)
+    connection.request("POST", "/update?type=%s&md5=%s" % (target, md5), body, {
+        "Content-Type": "multipart/form-data; boundary=%s" % boundary,
+    })
+    response = connection.getresponse()
+    return response.status, response.read().decode(errors="replace").strip()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("host", help="device address or name, host[:port]")
+    image = parser.add_mutually_exclusive_group(required=True)
+    image.add_argument("--firmware", metavar="FILE", help="firmware.bin, plain or gzip")
+    image.add_argument("--filesystem", metavar="FILE", help="littlefs.bin, plain or gzip")
+    parser.add_argument("--no-compress", action="store_true", help="send plain images as they are")
+    parser.add_argument("--timeout", type=float, default=120, help="seconds for the whole transfer (default %(default)s)")
+    args = parser.parse_args()
+
+    target = "firmware" if args.firmware else "filesystem"
+    path = args.firmware or args.filesystem
+    with open(path, "rb") as file:
+        data = file.read()
+    if not data.startswith(GZIP_MAGIC) and not args.no_compress:
+        # the boot loader has a full window, the running firmware only 4 KB
+        compressed = gzip(data, 15 if target == "firmware" else FILESYSTEM_WINDOW_BITS)
+        print("%s: %d bytes, %d gzip compressed" % (path, len(data), len(compressed)), file=sys.stderr)
+        data = compressed
+    host, _, port = args.host.partition(":")
+    try:
+        status, reply = upload(host, int(port or 80), target, path.rsplit("/", 1)[-1], data, args.timeout)
+    except OSError as error:
+        print("upload failed: %s" % error, file=sys.stderr)
+        return 1
+    print("%d %s" % (status, reply))
+    return 0 if status == 200 else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
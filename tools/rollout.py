@@ -0,0 +1,266 @@
+#!/usr/bin/env python3
+"""Roll settings out to a fleet of Kirby devices.
+
+Pushes an autopilot curve, a mode and/or a strength to every device given on
+the command line or found through mDNS (instances named kirby* of
+_http._tcp), several devices at a time:
+
+    tools/rollout.py --discover --curve curve.json --mode Enabled
+    tools/rollout.py 192.168.1.20 192.168.1.21 --zone left --pwm 40
+    tools/rollout.py 127.0.0.1:8080 127.0.0.1:8081 --curve curve.json
+
+Every change is conditional: it carries the ETag the device returned for
+what the tool read (If-Match), so a device changed by someone else in the
+meantime answers 412 and is read and pushed again. Settings a device already
+has are left alone, the device does not even write its flash. Connection
+errors, 5xx and 412 are retried with backoff. The summary lists per device
+what changed; the exit status is 1 if any device failed.
+"""
+
+import argparse
+import concurrent.futures
+import http.client
+import json
+import random
+import socket
+import struct
+import sys
+import time
+import urllib.parse
+
+MDNS_GROUP = ("224.0.0.251", 5353)
+SERVICE = "_http._tcp.local"
+TYPE_PTR, TYPE_SRV = 12, 33
+# autopilotModeNames in include/SETTINGS.h
+MODES = ("Disabled", "Enabled", "Predictive")
+
+
+class Retry(Exception):
+    """A failure worth another attempt."""
+
+
+class Device:
+    def __init__(self, address, zone, timeout):
+        host, _, port = address.partition(":")
+        self.address = address
+        self.host = host
+        self.port = int(port or 80)
+        self.zone = zone
+        self.timeout = timeout
+
+    def request(self, method, path, body=None, etag=None):
+        """(body, ETag) of a 200, path gets ?zone= when one was given."""
+        if self.zone is not None:
+            path += "?zone=" + urllib.parse.quote(self.zone)
+        headers = {"Content-Type": "application/json"} if body is not None else {}
+        if etag:
+            headers["If-Match"] = etag
+        connection = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout)
+        try:
+            connection.request(method, path, body, headers)
+            response = connection.getresponse()
+            data = response.read().decode(errors="replace").strip()
+        except (OSError, http.client.HTTPException) as error:
+            raise Retry("%s %s: %s" % (method, path.split("?")[0], error))
+        finally:
+            connection.close()
+        if response.status == 412 or response.status >= 500:
+            raise Retry("%s %s: %d %s" % (method, path.split("?")[0], response.status, data))
+        if response.status != 200:
+            raise RuntimeError("%s %s: %d %s" % (method, path.split("?")[0], response.status, data))
+        return data, response.getheader("ETag")
+
+    def push(self, read_path, method, write_path, body=None):
+        """Reads the ETag, then changes under If-Match. "changed" or "unchanged"."""
+        _, etag = self.request("GET", read_path)
+        if etag is None:
+            raise RuntimeError("GET %s: no ETag, the firmware is too old" % read_path)
+        reply, _ = self.request(method, write_path, body, etag)
+        return "unchanged" if reply == "UNCHANGED" else "changed"
+
+
+def attempt(action, retries, backoff):
+    """action() until it does not raise Retry, at most retries more times."""
+    for tries in range(retries + 1):
+        try:
+            return action(), tries
+        except Retry as error:
+            if tries == retries:
+                raise RuntimeError("%s (after %d attempts)" % (error, tries + 1))
+            time.sleep(backoff * (2 ** tries) * (0.5 + random.random()))
+
+
+def rollout(device, settings, retries, backoff):
+    """{setting: outcome} for one device, the curve first so a mode switch finds it."""
+    started = time.monotonic()
+    outcome = {}
+    retried = 0
+    if "curve" in settings:
+        outcome["curve"], tries = attempt(lambda: device.push("/autopilot", "POST", "/autopilot", settings["curve"]), retries, backoff)
+        retried += tries
+    if "mode" in settings:
+        outcome["mode"], tries = attempt(lambda: device.push("/pwm", "PUT", "/autopilot/" + settings["mode"]), retries, backoff)
+        retried += tries
+    if "pwm" in settings:
+        outcome["pwm"], tries = attempt(lambda: device.push("/pwm", "PUT", "/pwm/%d" % settings["pwm"]), retries, backoff)
+        retried += tries
+    return {"settings": outcome, "retries": retried, "seconds": time.monotonic() - started}
+
+
+################################
+# mDNS
+
+def dns_query(name, qtype):
+    """A query with one question, sent from an ordinary port it asks for unicast replies (RFC 6762 6.7)."""
+    question = b"".join(struct.pack("B", len(label)) + label.encode() for label in name.split(".")) + b"\0"
+    return struct.pack(">HHHHHH", 0, 0, 1, 0, 0, 0) + question + struct.pack(">HH", qtype, 1)
+
+
+def read_name(data, offset):
+    """(dotted name, offset after it), following compression pointers."""
+    labels = []
+    end = None
+    for _ in range(128):
+        length = data[offset]
+        if length & 0xC0 == 0xC0:
+            if end is None:
+                end = offset + 2
+            offset = ((length & 0x3F) << 8) | data[offset + 1]
+            continue
+        if length == 0:
+            return ".".join(labels), end if end is not None else offset + 1
+        labels.append(data[offset + 1:offset + 1 + length].decode(errors="replace"))
+        offset += 1 + length
+    raise ValueError("name loops")
+
+
+def parse_records(data):
+    """(name, type, rdata offset, rdata length) of every record in a DNS message."""
+    _, _, questions, answers, authorities, additionals = struct.unpack_from(">HHHHHH", data)
+    offset = 12
+    for _ in range(questions):
+        _, offset = read_name(data, offset)
+        offset += 4
+    records = []
+    for _ in range(answers + authorities + additionals):
+        name, offset = read_name(data, offset)
+        rtype, _, _, length = struct.unpack_from(">HHIH", data, offset)
+        offset += 10
+        records.append((name.lower(), rtype, offset, length))
+        offset += length
+    return records
+
+
+def discover(prefix, timeout):
+    """host:port of every _http._tcp instance whose name starts with prefix."""
+    found = {}
+    ports = {}
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+        sock.settimeout(0.2)
+        query = dns_query(SERVICE, TYPE_PTR)
+        deadline = time.monotonic() + timeout
+        next_query = 0
+        while time.monotonic() < deadline:
+            if time.monotonic() >= next_query:
+                # mDNS is lossy, ask a few times
+                sock.sendto(query, MDNS_GROUP)
+                next_query = time.monotonic() + 1
+            try:
+                data, (address, _) = sock.recvfrom(9000)
+            except socket.timeout:
+                continue
+            try:
+                records = parse_records(data)
+                for name, rtype, offset, length in records:
+                    if rtype == TYPE_PTR and name == SERVICE:
+                        instance, _ = read_name(data, offset)
+                        if instance.split(".")[0].lower().startswith(prefix.lower()):
+                            found[instance.lower()] = address
+                    elif rtype == TYPE_SRV:
+                        ports[name] = struct.unpack_from(">HHH", data, offset)[2]
+            except (ValueError, IndexError, struct.error):
+                continue
+    finally:
+        sock.close()
+    # the device answers itself, so the reply's source is its address
+    return sorted("%s:%d" % (address, ports.get(instance, 80)) for instance, address in found.items())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("hosts", nargs="*", metavar="HOST", help="device address or name, host[:port]")
+    parser.add_argument("--discover", action="store_true", help="also roll out to the devices found through mDNS")
+    parser.add_argument("--name", default="kirby", help="mDNS instance name prefix (default %(default)s)")
+    parser.add_argument("--discover-timeout", type=float, default=3, help="seconds to listen for devices (default %(default)s)")
+    parser.add_argument("--zone", help="zone index or name (default zone 0)")
+    parser.add_argument("--curve", metavar="FILE", help="autopilot curve, a JSON array of {temperature, strength}")
+    parser.add_argument("--mode", choices=MODES, help="autopilot mode")
+    parser.add_argument("--pwm", type=int, help="strength, 0..100")
+    parser.add_argument("--parallel", type=int, default=8, help="devices at once (default %(default)s)")
+    parser.add_argument("--retries", type=int, default=3, help="attempts after a failure per setting (default %(default)s)")
+    parser.add_argument("--backoff", type=float, default=0.5, help="seconds before the first retry, doubling (default %(default)s)")
+    parser.add_argument("--timeout", type=float, default=10, help="seconds per request (default %(default)s)")
+    parser.add_argument("--json", action="store_true", help="print the summary as JSON")
+    args = parser.parse_args()
+
+    settings = {}
+    if args.curve:
+        try:
+            with open(args.curve) as file:
+                curve = json.load(file)
+        except (OSError, ValueError) as error:
+            parser.error("--curve: %s" % error)
+        if not isinstance(curve, list):
+            parser.error("--curve: expected a JSON array of points")
+        settings["curve"] = json.dumps(curve, separators=(",", ":"))
+    if args.mode:
+        settings["mode"] = args.mode
+    if args.pwm is not None:
+        if not 0 <= args.pwm <= 100:
+            parser.error("--pwm: expected 0..100")
+        settings["pwm"] = args.pwm
+    if not settings:
+        parser.error("nothing to roll out, give --curve, --mode or --pwm")
+
+    hosts = list(args.hosts)
+    if args.discover:
+        found = discover(args.name, args.discover_timeout)
+        print("discovered %d devices: %s" % (len(found), " ".join(found) or "-"), file=sys.stderr)
+        hosts += [host for host in found if host not in hosts]
+    if not hosts:
+        parser.error("no devices found" if args.discover else "no devices, give hosts or --discover")
+
+    results = {}
+    with concurrent.futures.ThreadPoolExecutor(max_workers=max(1, args.parallel)) as pool:
+        futures = {pool.submit(rollout, Device(host, args.zone, args.timeout), settings, args.retries, args.backoff): host
+                   for host in hosts}
+        for future in concurrent.futures.as_completed(futures):
+            host = futures[future]
+            try:
+                results[host] = future.result()
+            except (RuntimeError, ValueError) as error:
+                results[host] = {"error": str(error)}
+            result = results[host]
+            if "error" in result:
+                print("%s: FAILED %s" % (host, result["error"]), file=sys.stderr)
+            else:
+                print("%s: %s in %.1f s%s" % (host, ", ".join("%s %s" % item for item in result["settings"].items()),
+                      result["seconds"], ", %d retries" % result["retries"] if result["retries"] else ""), file=sys.stderr)
+
+    failed = sorted(host for host, result in results.items() if "error" in result)
+    changed = sorted(host for host, result in results.items() if "changed" in result.get("settings", {}).values())
+    unchanged = sorted(set(results) - set(failed) - set(changed))
+    if args.json:
+        json.dump({"devices": results, "changed": changed, "unchanged": unchanged, "failed": failed}, sys.stdout, indent=2)
+        print()
+    else:
+        print("%d devices: %d changed, %d already up to date, %d failed" % (len(results), len(changed), len(unchanged), len(failed)))
+        for host in failed:
+            print("  failed %s: %s" % (host, results[host]["error"]))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
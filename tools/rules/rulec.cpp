@@ -0,0 +1,110 @@
+// Compiles control rules on the host with the firmware's own compiler, to
+// check them before POST /rules and to see what the autopilot would run:
+//
+//   pio run -e rules && .pio/build/rules/program rules.txt
+//   .pio/build/rules/program rules.txt t=31.5 t0=31.5 in0=1 hour=23
+//
+// Errors are printed as file:line:column, like a C compiler's. Otherwise the
+// code is listed with its size and stack depth; with inputs (name=value, the
+// ones not given have no value) it is run once and the outputs are printed.
+#include <Rules.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+static void list(const RuleProgram &program) {
+    for (size_t pc = 0; pc < program.length;) {
+        uint8_t op = program.code[pc];
+        uint8_t operands = ruleOpOperands(op);
+        printf(operands ? "%4zu  %-7s" : "%4zu  %s", pc, ruleOpName(op));
+        const uint8_t *operand = program.code + pc + 1;
+        switch (op) {
+            case RULE_OP_PUSH8: printf("%g", (int8_t) operand[0] / (double) ruleOne); break;
+            case RULE_OP_PUSH16: printf("%g", (int16_t)(operand[0] | operand[1] << 8) / (double) ruleOne); break;
+            case RULE_OP_PUSH32: {
+                int32_t value = (int32_t)((uint32_t) operand[0] | (uint32_t) operand[1] << 8 |
+                                          (uint32_t) operand[2] << 16 | (uint32_t) operand[3] << 24);
+                printf("%g", value / (double) ruleOne);
+                break;
+            }
+            case RULE_OP_INPUT: printf("%s", ruleInputNames[operand[0]]); break;
+            case RULE_OP_OUT: printf("%s", ruleOutputNames[operand[0]]); break;
+            case RULE_OP_LOAD:
+            case RULE_OP_STORE: printf("local %u", operand[0]); break;
+            case RULE_OP_JZ: printf("%zu", pc + 2 + operand[0]); break;
+        }
+        printf("\n");
+        pc += 1 + operands;
+    }
+}
+
+static bool parseInput(const char *arg, int32_t inputs[ruleInputCount]) {
+    const char *equals = strchr(arg, '=');
+    if (!equals) {
+        return false;
+    }
+    std::string name(arg, equals - arg);
+    for (uint8_t i = 0; i < ruleInputCount; i++) {
+        if (name == ruleInputNames[i]) {
+            inputs[i] = (int32_t) lround(atof(equals + 1) * ruleOne);
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s FILE [input=value ...]\n", argv[0]);
+        return 2;
+    }
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    std::ostringstream text;
+    text << in.rdbuf();
+    const std::string source = text.str();
+
+    RuleProgram program;
+    RuleError error;
+    if (!ruleCompile(source.data(), source.size(), program, error)) {
+        fprintf(stderr, "%s:%u:%u: error: %s\n", argv[1], error.line, error.column, error.message);
+        return 1;
+    }
+    list(program);
+    printf("%u of %u bytes of code, stack depth %u of %u\n", program.length, ruleCodeMax, program.stackDepth, ruleStackMax);
+
+    if (argc < 3) {
+        return 0;
+    }
+    int32_t inputs[ruleInputCount];
+    for (uint8_t i = 0; i < ruleInputCount; i++) {
+        inputs[i] = ruleNoValue;
+    }
+    for (int i = 2; i < argc; i++) {
+        if (!parseInput(argv[i], inputs)) {
+            fprintf(stderr, "bad input %s, expected name=value with one of", argv[i]);
+            for (uint8_t j = 0; j < ruleInputCount; j++) {
+                fprintf(stderr, " %s", ruleInputNames[j]);
+            }
+            fprintf(stderr, "\n");
+            return 2;
+        }
+    }
+    RuleResult result;
+    RuleFault fault = ruleRun(program, inputs, result);
+    printf("%u steps, %s\n", result.steps, ruleFaultNames[fault]);
+    for (uint8_t i = 0; i < ruleOutputCount; i++) {
+        if (result.has((RuleOutput) i)) {
+            printf("%s = %g\n", ruleOutputNames[i], result.value[i] / (double) ruleOne);
+        }
+    }
+    return fault == RULE_OK ? 0 : 1;
+}
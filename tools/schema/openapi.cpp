@@ -0,0 +1,107 @@
+// Writes the OpenAPI components of the settings declared in include/SETTINGS.h,
+// so data/swagger.yaml describes exactly what the firmware reads and writes:
+//
+//   pio run -e schema && .pio/build/schema/program data/swagger.yaml
+//
+// With a file the block between the "BEGIN generated" and "END generated"
+// comments under components/schemas is replaced, without one the block is
+// printed. A field with a component of its own becomes a schema that the
+// properties using it refer to, each such component is written once.
+#include <SETTINGS.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+
+static const char *beginMarker = "    # BEGIN generated by tools/schema/openapi.cpp from include/SETTINGS.h";
+static const char *endMarker = "    # END generated";
+
+template <typename Field>
+static void writeType(std::ostream &out, const Field &field, const std::string &indent) {
+    if (field.names) {
+        out << indent << "type: string\n";
+        out << indent << "description: " << field.description << "\n";
+        out << indent << "enum:\n";
+        for (long value = field.min; value <= field.max; value++) {
+            out << indent << "- \"" << field.nameOf(value) << "\"\n";
+        }
+        out << indent << "example: \"" << field.nameOf(field.hasExample ? field.exampleValue : field.min) << "\"\n";
+        return;
+    }
+    out << indent << "type: integer\n";
+    out << indent << "description: " << field.description << "\n";
+    out << indent << "minimum: " << field.min << "\n";
+    out << indent << "maximum: " << field.max << "\n";
+    out << indent << "example: " << (field.hasExample ? field.exampleValue : field.min) << "\n";
+}
+
+template <typename Sc>
+static void writeComponents(std::ostream &out, const Sc &schema, std::set<std::string> &written) {
+    schema.each([&](const auto &field) {
+        if (field.componentName && written.insert(field.componentName).second) {
+            out << "    " << field.componentName << ":\n";
+            writeType(out, field, "      ");
+        }
+    });
+    out << "    " << schema.name << ":\n";
+    out << "      type: object\n";
+    out << "      description: " << schema.description << "\n";
+    out << "      properties:\n";
+    schema.each([&](const auto &field) {
+        out << "        " << field.name << ":\n";
+        if (field.componentName) {
+            out << "          $ref: '#/components/schemas/" << field.componentName << "'\n";
+        } else {
+            writeType(out, field, "          ");
+        }
+    });
+}
+
+static std::string generate() {
+    std::ostringstream out;
+    std::set<std::string> written;
+    writeComponents(out, zoneSettingsSchema, written);
+    writeComponents(out, curvePointSchema, written);
+    return out.str();
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cout << beginMarker << "\n" << generate() << endMarker << "\n";
+        return 0;
+    }
+    std::ifstream in(argv[1]);
+    if (!in) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    std::ostringstream spec;
+    std::string line;
+    bool inside = false;
+    bool replaced = false;
+    while (std::getline(in, line)) {
+        if (line == beginMarker) {
+            inside = true;
+            spec << line << "\n" << generate();
+            continue;
+        }
+        if (inside && line == endMarker) {
+            inside = false;
+            replaced = true;
+        }
+        if (!inside) {
+            spec << line << "\n";
+        }
+    }
+    in.close();
+    if (!replaced) {
+        fprintf(stderr, "%s has no generated block, add the lines\n%s\n%s\nunder components/schemas\n", argv[1], beginMarker, endMarker);
+        return 1;
+    }
+    std::ofstream file(argv[1], std::ios::trunc);
+    file << spec.str();
+    return file ? 0 : 1;
+}
@@ -0,0 +1,440 @@
+// Closed loop simulation of a tube: the firmware's own tasks control a modelled
+// thermal plant in virtual time, so curves and modes can be compared in seconds.
+//
+//   pio run -e sim && .pio/build/sim/program --hours 12 --curve 25:0,30:40,35:70,60:100
+//
+// The plant is a single thermal mass heated by a (stepwise constant) heat input
+// and cooled towards ambient through a passive path plus the fan's airflow:
+//
+//   C dT/dt = P(t) - (UApassive + UAfan * airflow(duty)) * (T - Tambient)
+//
+// airflow(duty) is 0 below the fan's start duty and rises with gamma above it.
+// The probe follows T through a first order lag and adds gaussian noise, the
+// DallasTemperature shim then quantises it to the probe's resolution.
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <NativeHost.h>
+#include <DallasTemperature.h>
+#include <DeadlineScheduler.h>
+#include <ThermalModel.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <unistd.h>
+
+#include <ZONES.h>
+
+void setup();
+void loop();
+extern ThermalModel thermalModels[];
+bool startCalibration(uint8_t zone);
+
+// the simulated tube is zone 0
+static const uint8_t fanPin = zonePwmPins[0];
+
+struct HeatStep {
+    double atS;
+    double watts;
+};
+
+struct SimConfig {
+    double hours = 6;
+    double ambientC = 22;
+    double startC = 22;
+    double capacityJK = 2500;  // J/K of the tube and its contents
+    double uaPassive = 0.6;    // W/K without airflow
+    double uaFan = 4.0;        // W/K added at full airflow
+    double fanStart = 0.2;     // duty below which the fan stalls
+    double fanGamma = 0.8;     // airflow curve above the start duty
+    double fanWatts = 2.4;     // electrical power at full speed
+    double sensorLagS = 20;
+    double noiseC = 0.05;
+    double bandC = 0.5;        // settling band around the final temperature
+    unsigned seed = 1;
+    std::vector<HeatStep> heat = {{0, 35}};
+    const char *curve = "25:0,28:30,31:50,34:70,37:90,60:100";
+    int fixedPwm = -1;         // >= 0 runs without an autopilot curve
+    int limitC = -1;           // >= 0 runs the predictive mode, the curve until it is trusted
+    double calibrateS = -1;    // >= 0 starts a fan calibration then
+    const char *rulesPath = nullptr; // control rules the autopilot boots with
+    int horizonS = 300;
+    const char *tracePath = nullptr;
+    bool json = false;
+};
+
+struct Plant {
+    double tempC;
+    double sensorC;
+    double energyJ = 0;
+
+    double airflow(const SimConfig &cfg, double duty) const {
+        if (duty < cfg.fanStart) {
+            return 0;
+        }
+        return pow((duty - cfg.fanStart) / (1 - cfg.fanStart), cfg.fanGamma);
+    }
+
+    void step(const SimConfig &cfg, double heatW, double duty, double dt) {
+        double flow = airflow(cfg, duty);
+        double cooling = (cfg.uaPassive + cfg.uaFan * flow) * (tempC - cfg.ambientC);
+        tempC += (heatW - cooling) / cfg.capacityJK * dt;
+        sensorC += (tempC - sensorC) * std::min(1.0, dt / cfg.sensorLagS);
+        // fan power follows the cube of its speed
+        energyJ += cfg.fanWatts * flow * flow * flow * dt;
+    }
+};
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --hours H            simulated time (6)\n"
+            "  --ambient C          ambient temperature (22)\n"
+            "  --start C            initial tube temperature (22)\n"
+            "  --capacity J/K       thermal mass (2500)\n"
+            "  --ua-passive W/K     cooling without airflow (0.6)\n"
+            "  --ua-fan W/K         cooling added at full airflow (4.0)\n"
+            "  --fan-start 0..1     duty below which the fan stalls (0.2)\n"
+            "  --fan-gamma G        airflow curve above the start duty (0.8)\n"
+            "  --fan-watts W        fan power at full speed (2.4)\n"
+            "  --heat W             heat input from the start (35)\n"
+            "  --heat-step MIN:W    heat input changes to W after MIN minutes\n"
+            "  --sensor-lag S       probe time constant (20)\n"
+            "  --noise C            probe noise, standard deviation (0.05)\n"
+            "  --band C             settling band (0.5)\n"
+            "  --curve T:P,...      autopilot curve, temperature:strength pairs\n"
+            "  --fixed P            fixed strength, no autopilot curve\n"
+            "  --predictive C[:S]   predictive mode, limit and horizon in seconds (300)\n"
+            "  --calibrate MIN      calibrate the fan after MIN minutes, the tube has to be warm\n"
+            "  --rules FILE         control rules, as POST /rules takes them\n"
+            "  --seed N             noise seed (1)\n"
+            "  --trace FILE         CSV of the run, one row per simulated minute\n"
+            "  --json               print the report as JSON\n",
+            name);
+}
+
+static bool parseArgs(int argc, char **argv, SimConfig &cfg) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!strcmp(arg, "--json")) {
+            cfg.json = true;
+            continue;
+        }
+        if (!value) {
+            return false;
+        }
+        i++;
+        if (!strcmp(arg, "--hours")) cfg.hours = atof(value);
+        else if (!strcmp(arg, "--ambient")) cfg.ambientC = atof(value);
+        else if (!strcmp(arg, "--start")) cfg.startC = atof(value);
+        else if (!strcmp(arg, "--capacity")) cfg.capacityJK = atof(value);
+        else if (!strcmp(arg, "--ua-passive")) cfg.uaPassive = atof(value);
+        else if (!strcmp(arg, "--ua-fan")) cfg.uaFan = atof(value);
+        else if (!strcmp(arg, "--fan-start")) cfg.fanStart = atof(value);
+        else if (!strcmp(arg, "--fan-gamma")) cfg.fanGamma = atof(value);
+        else if (!strcmp(arg, "--fan-watts")) cfg.fanWatts = atof(value);
+        else if (!strcmp(arg, "--heat")) cfg.heat[0].watts = atof(value);
+        else if (!strcmp(arg, "--heat-step")) {
+            const char *colon = strchr(value, ':');
+            if (!colon) {
+                return false;
+            }
+            cfg.heat.push_back({atof(value) * 60, atof(colon + 1)});
+        }
+        else if (!strcmp(arg, "--sensor-lag")) cfg.sensorLagS = atof(value);
+        else if (!strcmp(arg, "--noise")) cfg.noiseC = atof(value);
+        else if (!strcmp(arg, "--band")) cfg.bandC = atof(value);
+        else if (!strcmp(arg, "--curve")) cfg.curve = value;
+        else if (!strcmp(arg, "--fixed")) cfg.fixedPwm = atoi(value);
+        else if (!strcmp(arg, "--predictive")) {
+            cfg.limitC = atoi(value);
+            const char *colon = strchr(value, ':');
+            if (colon) {
+                cfg.horizonS = atoi(colon + 1);
+            }
+        }
+        else if (!strcmp(arg, "--calibrate")) cfg.calibrateS = atof(value) * 60;
+        else if (!strcmp(arg, "--rules")) cfg.rulesPath = value;
+        else if (!strcmp(arg, "--seed")) cfg.seed = (unsigned) atoi(value);
+        else if (!strcmp(arg, "--trace")) cfg.tracePath = value;
+        else return false;
+    }
+    std::sort(cfg.heat.begin(), cfg.heat.end(), [](const HeatStep &a, const HeatStep &b) { return a.atS < b.atS; });
+    return cfg.hours > 0 && cfg.capacityJK > 0 && cfg.sensorLagS > 0 && cfg.fanStart < 1 && cfg.horizonS > 0;
+}
+
+// Files the firmware restores at boot. Strength, mode and curve go in the
+// formats older firmware wrote, it converts them as it boots.
+static void seedState(const SimConfig &cfg) {
+    File file = LittleFS.open("/var-autopilot-state", "w");
+    file.write((uint8_t) (cfg.fixedPwm >= 0 ? 0 : cfg.limitC >= 0 ? 2 : 1));
+    file.close();
+
+    if (cfg.limitC >= 0) {
+        // magic, limit in 1/16 °C and horizon, then an untrained model
+        const uint32_t magic = 0x4b544d31;
+        const int16_t limitRaw = cfg.limitC * 16;
+        const uint16_t horizonS = cfg.horizonS;
+        ThermalModel model;
+        file = LittleFS.open("/var-autopilot-model", "w");
+        file.write((const uint8_t *) &magic, sizeof(magic));
+        file.write((const uint8_t *) &limitRaw, sizeof(limitRaw));
+        file.write((const uint8_t *) &horizonS, sizeof(horizonS));
+        file.write((const uint8_t *) &model.state(), sizeof(ThermalModelState));
+        file.close();
+    }
+
+    file = LittleFS.open("/var-pwm-current", "w");
+    file.write((uint8_t) std::max(cfg.fixedPwm, 0));
+    file.close();
+}
+
+// The rules as they would have been posted, false if the file cannot be read
+static bool seedRules(const SimConfig &cfg) {
+    FILE *source = fopen(cfg.rulesPath, "rb");
+    if (!source) {
+        return false;
+    }
+    File file = LittleFS.open("/var-rules", "w");
+    char buffer[256];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), source)) > 0) {
+        file.write((const uint8_t *) buffer, length);
+    }
+    file.close();
+    fclose(source);
+    return true;
+}
+
+static void seedFilesystem(const SimConfig &cfg) {
+    // without a curve the autopilot leaves the persisted strength alone
+    if (cfg.fixedPwm >= 0) {
+        seedState(cfg);
+        return;
+    }
+    File file = LittleFS.open("/var-autopilot-settings", "w");
+    file.write("temperature,strength\n");
+    const char *p = cfg.curve;
+    while (*p) {
+        int temperature = atoi(p);
+        const char *colon = strchr(p, ':');
+        if (!colon) {
+            break;
+        }
+        int strength = atoi(colon + 1);
+        file.printf("%d,%d \n", temperature, strength);
+        const char *comma = strchr(colon, ',');
+        if (!comma) {
+            break;
+        }
+        p = comma + 1;
+    }
+    file.close();
+    seedState(cfg);
+}
+
+static double heatAt(const SimConfig &cfg, double t) {
+    double watts = 0;
+    for (const HeatStep &step : cfg.heat) {
+        if (step.atS <= t) {
+            watts = step.watts;
+        }
+    }
+    return watts;
+}
+
+static double currentDuty() {
+    int value = nativePinValue(fanPin);
+    if (!nativePinIsAnalog(fanPin)) {
+        return value ? 1.0 : 0.0;
+    }
+    return (double) value / nativeAnalogRange();
+}
+
+int main(int argc, char **argv) {
+    SimConfig cfg;
+    if (!parseArgs(argc, argv, cfg)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char fsRoot[] = "/tmp/kirby-sim-XXXXXX";
+    if (!mkdtemp(fsRoot)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    nativeUseVirtualTime(true);
+    nativeSerialTo(nullptr);
+    // no listening socket and no networks: the Wi-Fi task idles in its backoff
+    nativeOptions.httpPort = 0;
+    nativeOptions.ssidCount = 0;
+    LittleFS.setRoot(fsRoot);
+    LittleFS.begin();
+    seedFilesystem(cfg);
+    if (cfg.rulesPath && !seedRules(cfg)) {
+        perror(cfg.rulesPath);
+        return 1;
+    }
+
+    FILE *trace = nullptr;
+    if (cfg.tracePath) {
+        trace = fopen(cfg.tracePath, "w");
+        if (!trace) {
+            perror(cfg.tracePath);
+            return 1;
+        }
+        fprintf(trace, "minute,heat_w,temp_c,sensor_c,duty\n");
+    }
+
+    std::mt19937 rng(cfg.seed);
+    std::normal_distribution<double> noise(0, cfg.noiseC > 0 ? cfg.noiseC : 1);
+    Plant plant;
+    plant.tempC = cfg.startC;
+    plant.sensorC = cfg.startC;
+    nativeSetProbeRaw(0, lround(plant.sensorC * 128));
+
+    auto wallStart = std::chrono::steady_clock::now();
+    setup();
+
+    const double endS = cfg.hours * 3600;
+    const double maxStepS = 0.5;
+    double lastStepS = cfg.heat.back().atS;
+    double simS = 0;
+    double nextTraceS = 0;
+    double lastDuty = currentDuty();
+    double dutySum = 0;
+    uint32_t pwmChanges = 0;
+    std::vector<std::pair<double, double>> history; // (time, temperature) once per second
+    double nextHistoryS = 0;
+
+    bool calibrationStarted = false;
+
+    while (simS < endS) {
+        if (cfg.calibrateS >= 0 && !calibrationStarted && simS >= cfg.calibrateS) {
+            calibrationStarted = startCalibration(0);
+        }
+        loop();
+        double nowS = nativeMicros64() / 1e6;
+        double duty = currentDuty();
+        if (duty != lastDuty) {
+            pwmChanges++;
+            lastDuty = duty;
+        }
+        while (simS < nowS && simS < endS) {
+            double dt = std::min(maxStepS, nowS - simS);
+            plant.step(cfg, heatAt(cfg, simS), duty, dt);
+            dutySum += duty * dt;
+            simS += dt;
+            if (simS >= nextHistoryS) {
+                history.push_back({simS, plant.tempC});
+                nextHistoryS += 1;
+            }
+            if (trace && simS >= nextTraceS) {
+                fprintf(trace, "%.0f,%.1f,%.3f,%.3f,%.3f\n", simS / 60, heatAt(cfg, simS), plant.tempC, plant.sensorC, duty);
+                nextTraceS += 60;
+            }
+        }
+        double reported = plant.sensorC + (cfg.noiseC > 0 ? noise(rng) : 0);
+        nativeSetProbeRaw(0, lround(reported * 128));
+    }
+    double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    if (trace) {
+        fclose(trace);
+    }
+
+    // Final value is the mean over the last tenth of the run, settling is the last
+    // time the temperature was outside the band around it after the last heat step
+    size_t tail = std::max<size_t>(1, history.size() / 10);
+    double finalC = 0;
+    for (size_t i = history.size() - tail; i < history.size(); i++) {
+        finalC += history[i].second;
+    }
+    finalC /= tail;
+    double peakC = -1e9;
+    double lowC = 1e9;
+    double settledS = lastStepS;
+    double stepStartC = NAN;
+    for (const auto &sample : history) {
+        if (sample.first < lastStepS) {
+            continue;
+        }
+        if (isnan(stepStartC)) {
+            stepStartC = sample.second;
+        }
+        peakC = std::max(peakC, sample.second);
+        lowC = std::min(lowC, sample.second);
+        if (fabs(sample.second - finalC) > cfg.bandC) {
+            settledS = sample.first;
+        }
+    }
+    bool settled = settledS < endS - tail;
+    double settlingMin = (settledS - lastStepS) / 60;
+    // overshoot is the excursion past the final value in the direction of the step
+    double overshootC = std::max(0.0, stepStartC <= finalC ? peakC - finalC : finalC - lowC);
+    double changesPerHour = pwmChanges / cfg.hours;
+    double energyWh = plant.energyJ / 3600;
+    double meanDuty = dutySum / endS;
+    char mode[96];
+    if (cfg.fixedPwm >= 0) {
+        snprintf(mode, sizeof(mode), "fixed");
+    } else if (cfg.limitC >= 0) {
+        snprintf(mode, sizeof(mode), "predictive %d C in %d s", cfg.limitC, cfg.horizonS);
+    } else {
+        snprintf(mode, sizeof(mode), "%s", cfg.curve);
+    }
+    // what the model learned against the plant at the final duty
+    const ThermalModel &model = thermalModels[0];
+    double finalFlow = plant.airflow(cfg, lastDuty);
+    double plantTauS = cfg.capacityJK / (cfg.uaPassive + cfg.uaFan * finalFlow);
+    // the mapping as the firmware persisted it: magic, start, hold, saturation, method, rpm
+    uint8_t mapping[10] = {};
+    bool calibrated = false;
+    if (cfg.calibrateS >= 0) {
+        File file = LittleFS.open("/var-fan-mapping", "r");
+        calibrated = file && file.read(mapping, sizeof(mapping)) == sizeof(mapping);
+        file.close();
+    }
+
+    if (cfg.json) {
+        printf("{\"hours\":%.2f,\"mode\":\"%s\",\"final_c\":%.3f,\"peak_c\":%.3f,\"overshoot_c\":%.3f,"
+               "\"settled\":%s,\"settling_min\":%.1f,\"pwm_changes_per_hour\":%.2f,\"mean_duty\":%.4f,"
+               "\"fan_energy_wh\":%.3f,\"model_trusted\":%s,\"model_tau_s\":%ld,\"plant_tau_s\":%.0f,"
+               "\"fan_calibrated\":%s,\"fan_start_duty\":%d,\"fan_hold_duty\":%d,\"fan_saturation_duty\":%d,\"speedup\":%.0f}\n",
+               cfg.hours, cfg.fixedPwm >= 0 ? "fixed" : cfg.limitC >= 0 ? "predictive" : "autopilot", finalC, peakC, overshootC,
+               settled ? "true" : "false", settlingMin, changesPerHour, meanDuty, energyWh,
+               model.trusted() ? "true" : "false", model.timeConstantS(), plantTauS,
+               calibrated ? "true" : "false", mapping[4], mapping[5], mapping[6], endS / wallS);
+    } else {
+        printf("simulated            %.2f h in %.2f s (%.0fx real time)\n", cfg.hours, wallS, endS / wallS);
+        printf("mode                 %s\n", mode);
+        printf("final temperature    %.2f C\n", finalC);
+        printf("peak temperature     %.2f C\n", peakC);
+        printf("overshoot            %.2f C\n", overshootC);
+        if (settled) {
+            printf("settling time        %.1f min (+-%.2f C)\n", settlingMin, cfg.bandC);
+        } else {
+            printf("settling time        not settled (+-%.2f C)\n", cfg.bandC);
+        }
+        printf("pwm changes          %.2f per hour\n", changesPerHour);
+        printf("mean duty            %.1f %%\n", meanDuty * 100);
+        printf("fan energy           %.2f Wh\n", energyWh);
+        printf("model                %s, %lu updates, time constant %ld s (plant %.0f s)\n",
+               model.trusted() ? "trusted" : "not trusted", (unsigned long) model.state().updates,
+               model.timeConstantS(), plantTauS);
+        if (cfg.calibrateS >= 0 && calibrated) {
+            printf("fan calibration      start %d %%, hold %d %%, saturation %d %% (plant stalls below %.0f %%)\n",
+                   mapping[4], mapping[5], mapping[6], cfg.fanStart * 100);
+        } else if (cfg.calibrateS >= 0) {
+            printf("fan calibration      no mapping, failed or not finished\n");
+        }
+        printf("task runs           ");
+        for (uint8_t i = 0; i < Scheduler.taskCount(); i++) {
+            printf(" %s=%lu", Scheduler.task(i)->name(), (unsigned long) Scheduler.task(i)->stats().runs);
+        }
+        printf("\n");
+    }
+
+    std::string cleanup = std::string("rm -rf ") + fsRoot;
+    return system(cleanup.c_str()) == 0 ? 0 : 1;
+}
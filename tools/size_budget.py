@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""Break the firmware size down by module and enforce a size budget.
+
+Run by PlatformIO after every link (extra_scripts = post:tools/size_budget.py).
+It makes the linker write a map file, then prints flash, IRAM and DRAM per
+module: each library, the core, the SDK libraries and src. The build fails
+when a budget in custom_size_budget is exceeded, e.g.
+
+    custom_size_budget = image=479232 iram=32768 dram=81920 src/main.flash=120000
+
+"image" is the flash image (code and initialized data). Where the firmware
+is updated over the network it must fit twice ahead of the filesystem so the
+update can be staged, 468 KB on eagle.flash.1m64.ld. On eagle.flash.512k128.ld
+that would be 180 KB, less than the SDK and the core take, so there it only
+has to fit once (364 KB). "iram" and "dram" are the 32 KB and 80 KB segments.
+A module budget is written as module.flash, .iram or .dram.
+
+It also runs on its own against a map file:
+
+    tools/size_budget.py .pio/build/esp01_1m/firmware.map --budget image=479232
+"""
+
+import argparse
+import collections
+import os
+import re
+import sys
+
+# Output sections of the ESP8266 linker scripts, by where they end up
+FLASH = (".irom0.text", ".flash.text", ".flash.rodata")
+IRAM = (".text", ".text1", ".lit4", ".iram0.text", ".iram.text")
+DRAM_IMAGE = (".data", ".rodata")      # in the image, copied to RAM at boot
+DRAM_ZERO = (".bss", ".noinit")        # RAM only
+KINDS = ("flash", "iram", "dram")
+
+INPUT_LINE = re.compile(r"^\s+(?:(\S+)\s+)?0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+ARCHIVE = re.compile(r"(?:^|[\\/])lib([^\\/]+)\.a\((.+)\)$")
+
+
+def module_of(path):
+    """Library, "core", "src/main" or the SDK archive an object file came from."""
+    archive = ARCHIVE.search(path)
+    if archive:
+        name = archive.group(1)
+        return "core" if name == "FrameworkArduino" else name
+    normalized = path.replace("\\", "/")
+    if "/FrameworkArduino/" in normalized:
+        return "core"
+    if "/src/" in normalized:
+        # apart from the SDK's libmain.a
+        return "src/" + os.path.basename(normalized).split(".")[0]
+    return os.path.basename(normalized)
+
+
+def parse_map(path):
+    """{module: {"flash", "iram", "dram", "image"}} in bytes from a GNU ld map."""
+    modules = collections.defaultdict(lambda: dict.fromkeys(KINDS + ("image",), 0))
+    section = None
+    pending = None
+    in_map = False
+    with open(path, errors="replace") as file:
+        for line in file:
+            if not in_map:
+                in_map = line.startswith("Linker script and memory map")
+                continue
+            if line and not line[0].isspace():
+                # an output section, possibly with its address and size on the line
+                section = line.split()[0] if line.strip() else section
+                pending = None
+                continue
+            stripped = line.strip()
+            if not stripped or stripped.startswith("*") or stripped.startswith("0x"):
+                if stripped.startswith("0x") and pending:
+                    match = INPUT_LINE.match(" %s %s" % (pending, stripped))
+                    pending = None
+                    if match:
+                        add(modules, section, match)
+                continue
+            match = INPUT_LINE.match(line)
+            if match:
+                add(modules, section, match)
+                pending = None
+            elif len(stripped.split()) == 1:
+                # a long input section name, address, size and file follow on the next line
+                pending = stripped
+    return modules
+
+
+def add(modules, section, match):
+    size = int(match.group(3), 16)
+    if not size or section is None:
+        return
+    module = modules[module_of(match.group(4).strip())]
+    if section in FLASH:
+        module["flash"] += size
+        module["image"] += size
+    elif section in IRAM:
+        module["iram"] += size
+        module["image"] += size
+    elif section in DRAM_IMAGE or section.startswith(".dport0"):
+        module["dram"] += size
+        module["image"] += size
+    elif section in DRAM_ZERO:
+        module["dram"] += size
+
+
+def parse_budgets(text):
+    budgets = {}
+    for item in (text or "").split():
+        key, _, value = item.partition("=")
+        if not value:
+            raise ValueError("size budget expects NAME=BYTES, got %r" % item)
+        budgets[key] = int(value, 0)
+    return budgets
+
+
+def check(modules, budgets, top=12):
+    """The report lines and the budgets that were exceeded."""
+    totals = dict.fromkeys(KINDS + ("image",), 0)
+    for sizes in modules.values():
+        for kind in totals:
+            totals[kind] += sizes[kind]
+    ranked = sorted(modules.items(), key=lambda item: -(item[1]["flash"] + item[1]["iram"] + item[1]["dram"]))
+    lines = ["%-24s %9s %9s %9s" % ("module", "flash", "iram", "dram")]
+    shown = [(name, sizes) for name, sizes in ranked[:top]]
+    rest = ranked[top:]
+    for name, sizes in shown:
+        lines.append("%-24s %9d %9d %9d" % (name, sizes["flash"], sizes["iram"], sizes["dram"]))
+    if rest:
+        lines.append("%-24s %9d %9d %9d" % ("(%d more)" % len(rest),
+                     sum(s["flash"] for _, s in rest), sum(s["iram"] for _, s in rest), sum(s["dram"] for _, s in rest)))
+    lines.append("%-24s %9d %9d %9d   image %d" % ("total", totals["flash"], totals["iram"], totals["dram"], totals["image"]))
+
+    exceeded = []
+    for key, limit in sorted(budgets.items()):
+        module, _, kind = key.rpartition(".")
+        if module:
+            if kind not in KINDS:
+                raise ValueError("unknown size budget %r" % key)
+            # a module that is compiled out uses nothing
+            used = modules[module][kind] if module in modules else 0
+        else:
+            used = totals.get(kind)
+            if used is None:
+                raise ValueError("unknown size budget %r" % key)
+        state = "OVER" if used > limit else "ok"
+        lines.append("budget %-17s %9d of %9d  %s" % (key, used, limit, state))
+        if used > limit:
+            exceeded.append("%s: %d > %d bytes" % (key, used, limit))
+    return lines, exceeded
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("map", help="linker map file")
+    parser.add_argument("--budget", default="", help="NAME=BYTES items, as custom_size_budget")
+    parser.add_argument("--top", type=int, default=12, help="modules listed one by one (default %(default)s)")
+    args = parser.parse_args()
+    try:
+        lines, exceeded = check(parse_map(args.map), parse_budgets(args.budget), args.top)
+    except (OSError, ValueError) as error:
+        print("size budget: %s" % error, file=sys.stderr)
+        return 2
+    print("\n".join(lines))
+    for failure in exceeded:
+        print("size budget exceeded, %s" % failure, file=sys.stderr)
+    return 1 if exceeded else 0
+
+
+def register(env):
+    map_path = os.path.join(env.subst("$BUILD_DIR"), "firmware.map")
+    env.Append(LINKFLAGS=["-Wl,-Map,%s" % map_path])
+    budgets = parse_budgets(env.GetProjectOption("custom_size_budget", ""))
+
+    def after_link(target, source, env):
+        lines, exceeded = check(parse_map(map_path), budgets)
+        print("\n".join(lines))
+        if exceeded:
+            for failure in exceeded:
+                print("size budget exceeded, %s" % failure)
+            # or the next build would find it up to date and pass
+            for node in target:
+                if os.path.exists(str(node)):
+                    os.remove(str(node))
+            return 1
+        return 0
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", after_link)
+
+
+try:
+    Import("env")  # noqa: F821, provided by PlatformIO's SCons
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main())
+else:
+    register(env)  # noqa: F821
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""A minimal SNTP server, a stand-in for testing Kirby's wall clock.
+
+Answers SNTP client requests (RFC 4330) with the host's time, optionally
+off by a fixed amount, running at a different rate or answering late, so
+the firmware's offset handling, drift estimation and delay limit can be
+watched without a real time server. With ntpHost = "127.0.0.1" and
+ntpPort = 12300 in include/TIME_DETAILS.h:
+
+    tools/sntp_server.py --port 12300
+    tools/sntp_server.py --port 12300 --offset 3.5 --drift-ppm 80
+    .pio/build/native/program --port 8080 --fs native/fs --ssid primaryssid
+
+then watch kirby_clock_* on /metrics. --drift-ppm makes the served time run
+faster than the host clock, which looks to the device like a crystal that
+is that much slow; kirby_clock_drift_ppb should settle at about 1000 times
+the value.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+NTP_UNIX_OFFSET = 2208988800  # 1900-01-01 to 1970-01-01 in seconds
+PACKET = struct.Struct(">BBbbII4sQQQQ")  # flags, stratum, poll, precision, delay, dispersion, reference id, 4 timestamps
+
+
+def to_ntp(unix):
+    """NTP 64 bit timestamp of a Unix time in seconds."""
+    seconds = int(unix) + NTP_UNIX_OFFSET
+    fraction = int((unix % 1) * (1 << 32))
+    return ((seconds & 0xFFFFFFFF) << 32) | fraction
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--bind", default="0.0.0.0", help="address to listen on (default %(default)s)")
+    parser.add_argument("--port", type=int, default=123, help="UDP port (default %(default)s)")
+    parser.add_argument("--offset", type=float, default=0, help="seconds added to the host time")
+    parser.add_argument("--drift-ppm", type=float, default=0, help="served time runs this much faster than the host's")
+    parser.add_argument("--delay", type=float, default=0, help="ms between receiving and answering")
+    parser.add_argument("--stratum", type=int, default=2, help="stratum to report, 0 sends a kiss-o'-death (default %(default)s)")
+    args = parser.parse_args()
+
+    started = time.time()
+
+    def served():
+        now = time.time()
+        return now + args.offset + (now - started) * args.drift_ppm * 1e-6
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    print("serving SNTP on %s:%d" % (args.bind, args.port), file=sys.stderr)
+    while True:
+        data, address = sock.recvfrom(1024)
+        received = served()
+        if len(data) < PACKET.size or data[0] & 7 != 3:
+            continue
+        version = (data[0] >> 3) & 7
+        originate = struct.unpack_from(">Q", data, 40)[0]
+        if args.delay:
+            time.sleep(args.delay / 1000)
+        reference_id = b"RATE" if args.stratum == 0 else b"LOCL"
+        reply = PACKET.pack((version << 3) | 4, args.stratum, data[2], -20, 0, 0, reference_id,
+                            to_ntp(received), originate, to_ntp(received), to_ntp(served()))
+        sock.sendto(reply, address)
+        print("%s:%d served %.3f" % (address[0], address[1], served()), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    try:
+        sys.exit(main())
+    except KeyboardInterrupt:
+        sys.exit(0)
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Sync the frontend assets in data/ to one or more Kirby devices.
+
+Instead of building and uploading a whole filesystem image, this compares
+the MD5 of every local file with the device's GET /manifest and only
+transfers what is new or changed (POST /edit). Files the device has but
+data/ does not are deleted (DELETE /edit), after all uploads, so a page is
+never left pointing at an asset that is already gone:
+
+    tools/sync_assets.py kirby.local
+    tools/sync_assets.py 192.168.1.20 192.168.1.21 --dir data --dry-run
+
+Entry pages (index.htm*) go up after the files they reference. Device state
+(/var-*) is not part of the manifest and never touched. Devices are synced
+in parallel.
+"""
+
+import argparse
+import concurrent.futures
+import hashlib
+import http.client
+import json
+import os
+import sys
+import time
+import urllib.parse
+import uuid
+
+# matches varPrefix in include/VAR_LOCATIONS.h
+VAR_PREFIX = "/var-"
+
+
+def local_assets(root):
+    """{"/path": (md5, size, host path)} for every file below root."""
+    assets = {}
+    for directory, dirs, files in os.walk(root):
+        dirs[:] = sorted(d for d in dirs if not d.startswith("."))
+        for name in sorted(files):
+            if name.startswith("."):
+                continue
+            host_path = os.path.join(directory, name)
+            path = "/" + os.path.relpath(host_path, root).replace(os.sep, "/")
+            if path.startswith(VAR_PREFIX):
+                continue
+            with open(host_path, "rb") as file:
+                data = file.read()
+            assets[path] = (hashlib.md5(data).hexdigest(), len(data), host_path)
+    return assets
+
+
+def upload_order(path):
+    # entry pages last, so they never reference an asset that is not there yet
+    return (os.path.basename(path).startswith("index.htm"), path)
+
+
+class Device:
+    def __init__(self, address, timeout):
+        host, _, port = address.partition(":")
+        self.address = address
+        self.host = host
+        self.port = int(port or 80)
+        self.timeout = timeout
+
+    def request(self, method, path, body=None, headers=None):
+        connection = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout)
+        try:
+            connection.request(method, path, body, headers or {})
+            response = connection.getresponse()
+            data = response.read()
+        finally:
+            connection.close()
+        if response.status != 200:
+            raise RuntimeError("%s %s: %d %s" % (method, path.split("?")[0], response.status, data.decode(errors="replace").strip()))
+        return data
+
+    def manifest(self):
+        files = json.loads(self.request("GET", "/manifest"))["files"]
+        return {entry["path"]: entry["md5"] for entry in files}
+
+    def upload(self, path, data):
+        boundary = uuid.uuid4().hex
+        body = b"".join([
+            b"--%s\r\n" % boundary.encode(),
+            b'Content-Disposition: form-data; name="data"; filename="%s"\r\n' % path.encode(),
+            b"Content-Type: application/octet-stream\r\n\r\n",
+            data,
+            b"\r\n--%s--\r\n" % boundary.encode(),
+        ])
+        # the device only replaces the file once the upload matches this
+        md5 = hashlib.md5(data).hexdigest()
+        self.request("POST", "/edit?md5=" + md5, body, {"Content-Type": "multipart/form-data; boundary=%s" % boundary})
+
+    def delete(self, path):
+        self.request("DELETE", "/edit?path=" + urllib.parse.quote(path))
+
+
+def sync(device, assets, delete, dry_run):
+    started = time.monotonic()
+    remote = device.manifest()
+    changed = sorted((p for p, (md5, _, _) in assets.items() if remote.get(p) != md5), key=upload_order)
+    stale = sorted(p for p in remote if p not in assets and not p.startswith(VAR_PREFIX)) if delete else []
+    sent = 0
+    for path in changed:
+        print("%s: upload %s" % (device.address, path), file=sys.stderr)
+        if not dry_run:
+            with open(assets[path][2], "rb") as file:
+                data = file.read()
+            device.upload(path, data)
+            sent += len(data)
+    for path in stale:
+        print("%s: delete %s" % (device.address, path), file=sys.stderr)
+        if not dry_run:
+            device.delete(path)
+    return {
+        "uploaded": len(changed),
+        "bytes": sent,
+        "deleted": len(stale),
+        "unchanged": len(assets) - len(changed),
+        "seconds": time.monotonic() - started,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("hosts", nargs="+", metavar="HOST", help="device address or name, host[:port]")
+    parser.add_argument("--dir", default="data", help="local asset directory (default %(default)s)")
+    parser.add_argument("--keep", action="store_true", help="do not delete files that are not in --dir")
+    parser.add_argument("--dry-run", action="store_true", help="only show what would be transferred")
+    parser.add_argument("--timeout", type=float, default=30, help="seconds per request (default %(default)s)")
+    parser.add_argument("--parallel", type=int, default=8, help="devices synced at once (default %(default)s)")
+    args = parser.parse_args()
+
+    assets = local_assets(args.dir)
+    failed = 0
+    with concurrent.futures.ThreadPoolExecutor(max_workers=args.parallel) as pool:
+        futures = {pool.submit(sync, Device(host, args.timeout), assets, not args.keep, args.dry_run): host for host in args.hosts}
+        for future in concurrent.futures.as_completed(futures):
+            host = futures[future]
+            try:
+                result = future.result()
+            except (OSError, RuntimeError, ValueError, KeyError) as error:
+                failed += 1
+                print("%s: FAILED %s" % (host, error))
+                continue
+            print("%s: %d uploaded (%d bytes), %d deleted, %d unchanged in %.1f s" % (
+                host, result["uploaded"], result["bytes"], result["deleted"], result["unchanged"], result["seconds"]))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""Collect Kirby multicast telemetry and serve it as one Prometheus endpoint.
+
+Every device multicasts a small binary datagram (see TelemetryPacket in
+src/main.cpp and include/TELEMETRY_DETAILS.h) instead of being scraped over
+HTTP. This joins the group, keeps the latest packet per device and serves all
+of them on a single /metrics, so Prometheus scrapes one target for the fleet:
+
+    tools/telemetry_collector.py --listen :9142
+    tools/telemetry_collector.py --group 239.255.42.42 --port 4242 --stale 60
+
+Devices are labelled by their chip id in hex; --names maps ids to names.
+Devices not heard from for --stale seconds are dropped from the export.
+"""
+
+import argparse
+import http.server
+import socket
+import struct
+import sys
+import threading
+import time
+
+MAGIC = b"KT"
+# version 1: header, then one zone record per zone
+HEADER = struct.Struct("<2sBBIII")  # magic, version, zone count, device id, sequence, uptime ms
+ZONE = struct.Struct("<hBBH")       # temperature 1/16 °C, strength, mode, rpm
+TEMP_INVALID = -32768
+CALIBRATING = 0x80
+MODES = {0: "Disabled", 1: "Enabled", 2: "Predictive"}
+
+
+def decode(data):
+    """Header fields and zone records of a datagram, None if it is not one of ours."""
+    if len(data) < HEADER.size:
+        return None
+    magic, version, zone_count, device, sequence, uptime_ms = HEADER.unpack_from(data)
+    if magic != MAGIC or version < 1 or len(data) < HEADER.size + zone_count * ZONE.size:
+        return None
+    zones = []
+    for i in range(zone_count):
+        temp_raw, pwm, mode, rpm = ZONE.unpack_from(data, HEADER.size + i * ZONE.size)
+        zones.append({
+            "temperature": None if temp_raw == TEMP_INVALID else temp_raw / 16,
+            "pwm": pwm,
+            "mode": mode & ~CALIBRATING,
+            "calibrating": bool(mode & CALIBRATING),
+            "rpm": rpm,
+        })
+    return {"version": version, "device": device, "sequence": sequence, "uptime_ms": uptime_ms, "zones": zones}
+
+
+class Fleet:
+    """Latest state and packet accounting per device, shared by receiver and exporter."""
+
+    def __init__(self, stale, names):
+        self.stale = stale
+        self.names = names
+        self.lock = threading.Lock()
+        self.devices = {}
+        self.bad_packets = 0
+
+    def receive(self, data, address):
+        packet = decode(data)
+        now = time.time()
+        with self.lock:
+            if packet is None:
+                self.bad_packets += 1
+                return
+            device = self.devices.setdefault(packet["device"], {"packets": 0, "lost": 0, "restarts": 0})
+            last = device.get("packet")
+            if last is not None:
+                if packet["uptime_ms"] < last["uptime_ms"] or packet["sequence"] < last["sequence"]:
+                    # rebooted, the sequence starts over
+                    device["restarts"] += 1
+                elif packet["sequence"] > last["sequence"] + 1:
+                    device["lost"] += packet["sequence"] - last["sequence"] - 1
+            device["packets"] += 1
+            device["packet"] = packet
+            device["address"] = address[0]
+            device["seen"] = now
+
+    def metrics(self):
+        now = time.time()
+        lines = []
+        with self.lock:
+            for device_id in [d for d, v in self.devices.items() if now - v["seen"] > self.stale]:
+                del self.devices[device_id]
+            for device_id, device in sorted(self.devices.items()):
+                packet = device["packet"]
+                hex_id = "%06x" % device_id
+                labels = 'device="%s",name="%s",address="%s"' % (hex_id, self.names.get(hex_id, hex_id), device["address"])
+                lines.append("kirby_uptime_seconds{%s} %.3f" % (labels, packet["uptime_ms"] / 1000))
+                lines.append("kirby_telemetry_packets_total{%s} %d" % (labels, device["packets"]))
+                lines.append("kirby_telemetry_lost_total{%s} %d" % (labels, device["lost"]))
+                lines.append("kirby_telemetry_restarts_total{%s} %d" % (labels, device["restarts"]))
+                lines.append("kirby_telemetry_age_seconds{%s} %.1f" % (labels, now - device["seen"]))
+                for zone, values in enumerate(packet["zones"]):
+                    zone_labels = '%s,zone="%d"' % (labels, zone)
+                    if values["temperature"] is not None:
+                        lines.append("kirby_temperature_current{%s} %.4f" % (zone_labels, values["temperature"]))
+                    lines.append("kirby_pwm_current{%s} %d" % (zone_labels, values["pwm"]))
+                    lines.append("kirby_autopilot_state{%s} %d" % (zone_labels, values["mode"]))
+                    lines.append("kirby_fan_calibrating{%s} %d" % (zone_labels, values["calibrating"]))
+                    lines.append("kirby_fan_rpm{%s} %d" % (zone_labels, values["rpm"]))
+            lines.append("kirby_telemetry_devices %d" % len(self.devices))
+            lines.append("kirby_telemetry_bad_packets_total %d" % self.bad_packets)
+        return "\n".join(lines) + "\n"
+
+
+def open_socket(group, port, interface):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if hasattr(socket, "SO_REUSEPORT"):
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+    sock.bind(("", port))
+    membership = struct.pack("4s4s", socket.inet_aton(group), socket.inet_aton(interface))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    return sock
+
+
+def receive_forever(sock, fleet):
+    while True:
+        data, address = sock.recvfrom(1500)
+        fleet.receive(data, address)
+
+
+def serve(listen, fleet):
+    class Handler(http.server.BaseHTTPRequestHandler):
+        def do_GET(self):
+            if self.path.split("?")[0] != "/metrics":
+                self.send_error(404)
+                return
+            body = fleet.metrics().encode()
+            self.send_response(200)
+            self.send_header("Content-Type", "text/plain; version=0.0.4")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def log_message(self, format, *args):
+            pass
+
+    host, _, port = listen.rpartition(":")
+    server = http.server.ThreadingHTTPServer((host, int(port)), Handler)
+    server.serve_forever()
+
+
+def parse_names(items):
+    names = {}
+    for item in items:
+        device, _, name = item.partition("=")
+        if not name:
+            raise ValueError("--names expects DEVICE=NAME, got %r" % item)
+        names[device.lower()] = name
+    return names
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--group", default="239.255.42.42", help="multicast group (default %(default)s)")
+    parser.add_argument("--port", type=int, default=4242, help="UDP port (default %(default)s)")
+    parser.add_argument("--interface", default="0.0.0.0", help="address of the interface to join on (default any)")
+    parser.add_argument("--listen", default=":9142", help="HTTP address for /metrics (default %(default)s)")
+    parser.add_argument("--stale", type=float, default=60, help="seconds before a silent device is dropped (default %(default)s)")
+    parser.add_argument("--names", nargs="*", default=[], metavar="DEVICE=NAME", help="names for device ids, e.g. c0ffee=cellar")
+    args = parser.parse_args()
+
+    try:
+        fleet = Fleet(args.stale, parse_names(args.names))
+    except ValueError as error:
+        parser.error(str(error))
+    sock = open_socket(args.group, args.port, args.interface)
+    threading.Thread(target=receive_forever, args=(sock, fleet), daemon=True).start()
+    print("collecting %s:%d, metrics on %s/metrics" % (args.group, args.port, args.listen), file=sys.stderr)
+    try:
+        serve(args.listen, fleet)
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+"""Convert Kirby's binary event trace to Chrome / Perfetto trace JSON.
+
+Firmware built with -DKIRBY_TRACE (env:esp01_trace) records task runs, HTTP
+requests, sensor conversions, PWM changes and filesystem writes into a ring
+(see lib/Trace/Trace.h), GET /debug/trace returns it. This fetches the ring,
+or reads a saved dump, and writes JSON for chrome://tracing or
+https://ui.perfetto.dev:
+
+    tools/trace2chrome.py kirby.local -o trace.json
+    tools/trace2chrome.py kirby.local --follow 120 -o trace.json
+    tools/trace2chrome.py kirby.local --save dump.bin
+    tools/trace2chrome.py --file dump.bin -o trace.json
+
+--follow keeps polling with ?since=, so a longer stretch than the ring holds
+is captured. --wall-clock puts the current boot on Unix time (from the
+device's SNTP clock, the dump says what micros() was at which Unix ms), so
+traces of several devices line up. Records that survived a reset in RTC memory show up as an
+earlier boot, each boot is a process of its own. Records only carry a hash of
+paths, they are named from the string literals in src/main.cpp and
+include/VAR_LOCATIONS.h.
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+import time
+import urllib.request
+
+# TraceDumpHeader in src/main.cpp and TraceRecord in lib/Trace/Trace.h
+HEADER = struct.Struct("<4sBBBBIII")  # magic, version, record size, task count, reserved, now us, first, skipped
+UNIX_MS = struct.Struct("<q")         # after the header from version 2, 0 while the clock is unknown
+RECORD = struct.Struct("<IHHII")      # us, event, sequence, a, b
+MAGIC = b"KTRD"
+
+# TraceEvent in lib/Trace/Trace.h
+BOOT, TASK, HTTP, SENSOR, TEMPERATURE, PWM, FS_WRITE = range(1, 8)
+END = 0x8000
+THREADS = {TASK: (1, "tasks"), HTTP: (2, "http"), FS_WRITE: (3, "filesystem")}
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+ZONES_MAX = 4
+
+
+def fnv1a(text):
+    """traceHash() in lib/Trace/Trace.cpp"""
+    value = 2166136261
+    for byte in text.encode():
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def known_paths():
+    """{hash: path} for the routes and state files the firmware names."""
+    paths = set()
+    for name in ("src/main.cpp", "include/VAR_LOCATIONS.h"):
+        try:
+            with open(os.path.join(REPO, name), encoding="utf-8") as file:
+                paths.update(re.findall(r'"(/[^"\s%]*)"', file.read()))
+        except OSError:
+            pass
+    # zoneLocation() appends "-<zone>" from the second zone on
+    for path in [p for p in paths if p.startswith("/var-")]:
+        paths.update("%s-%d" % (path, zone) for zone in range(1, ZONES_MAX))
+    return {fnv1a(path): path for path in paths}
+
+
+def parse(data):
+    """(header fields, task names, records) of one /debug/trace response."""
+    if len(data) < HEADER.size:
+        raise ValueError("short trace dump")
+    magic, version, record_size, task_count, _, now_us, first, skipped = HEADER.unpack_from(data)
+    if magic != MAGIC or version not in (1, 2) or record_size != RECORD.size:
+        raise ValueError("not a Kirby trace dump (magic %r, version %d)" % (magic, version))
+    offset = HEADER.size
+    unix_ms = 0
+    if version >= 2:
+        unix_ms = UNIX_MS.unpack_from(data, offset)[0]
+        offset += UNIX_MS.size
+    tasks = []
+    for _ in range(task_count):
+        length = data[offset]
+        tasks.append(data[offset + 1:offset + 1 + length].decode(errors="replace"))
+        offset += 1 + length
+    records = [RECORD.unpack_from(data, o) for o in range(offset, len(data) - RECORD.size + 1, RECORD.size)]
+    return {"now_us": now_us, "first": first, "skipped": skipped, "unix_ms": unix_ms}, tasks, records
+
+
+def fetch(host, since, timeout):
+    url = "http://%s/debug/trace" % host
+    if since is not None:
+        url += "?since=%d" % since
+    with urllib.request.urlopen(url, timeout=timeout) as response:
+        return response.read()
+
+
+def convert(records, tasks, paths, clock=None):
+    """Chrome trace events; every boot becomes a process, timestamps are unwrapped per boot.
+
+    clock, (micros(), Unix ms) at the end of the records, moves the last boot onto Unix time in us.
+    """
+    events = []
+    pid = 0
+    last_us = None
+    wrap = 0
+    open_spans = {}
+
+    def path_name(value):
+        return paths.get(value, "#%08x" % value)
+
+    def name_process(pid, name):
+        events.append({"ph": "M", "name": "process_name", "pid": pid, "args": {"name": name}})
+        for event, (tid, thread) in THREADS.items():
+            events.append({"ph": "M", "name": "thread_name", "pid": pid, "tid": tid, "args": {"name": thread}})
+
+    name_process(pid, "boot 0")
+    for us, event, _, a, b in records:
+        if event == 0:
+            # overwritten while it was sent
+            continue
+        kind = event & ~END
+        if kind == BOOT:
+            pid += 1
+            last_us = None
+            wrap = 0
+            open_spans = {}
+            name_process(pid, "boot %d" % pid)
+        if last_us is not None and us < last_us and last_us - us > 1 << 31:
+            wrap += 1 << 32
+        last_us = us
+        ts = us + wrap
+        base = {"pid": pid, "ts": ts}
+
+        if kind == BOOT:
+            events.append(dict(base, ph="i", s="p", name="boot", args={"restored": a}))
+        elif kind in THREADS:
+            tid = THREADS[kind][0]
+            if kind == TASK:
+                name = tasks[a] if a < len(tasks) else "task %d" % a
+                args = {"run_us": b} if event & END else {"jitter_us": b}
+            elif kind == HTTP:
+                name = path_name(a)
+                if event & END:
+                    args = {"arena_bytes": b}
+                else:
+                    method = struct.pack("<I", b).rstrip(b"\0").decode(errors="replace")
+                    name = "%s %s" % (method, name)
+                    args = {}
+            else:
+                name = path_name(a)
+                args = {}
+            depth = open_spans.get(tid, 0)
+            if event & END:
+                # its begin was overwritten before the dump
+                if depth == 0:
+                    continue
+                open_spans[tid] = depth - 1
+                events.append(dict(base, ph="E", tid=tid, args=args))
+            else:
+                open_spans[tid] = depth + 1
+                events.append(dict(base, ph="B", tid=tid, name=name, args=args))
+        elif kind == SENSOR:
+            events.append(dict(base, ph="e" if event & END else "b", cat="sensor", id=1, tid=0,
+                               name="conversion", args={"probes": "0x%x" % a}))
+        elif kind == TEMPERATURE:
+            raw = b - (1 << 32) if b & 0x80000000 else b
+            events.append(dict(base, ph="C", tid=0, name="probe %d" % a, args={"celsius": raw / 16}))
+        elif kind == PWM:
+            events.append(dict(base, ph="C", tid=0, name="zone %d pwm" % a, args={"per_mille": b}))
+    if clock and last_us is not None:
+        now_us, unix_ms = clock
+        shift = unix_ms * 1000 - (last_us + wrap + ((now_us - last_us) & 0xFFFFFFFF))
+        for event in events:
+            if event["pid"] == pid and "ts" in event:
+                event["ts"] += shift
+    return events
+
+
+def collect(args):
+    """Task names and records from a file, one dump or --follow polling."""
+    if args.file:
+        with open(args.file, "rb") as file:
+            header, tasks, records = parse(file.read())
+        return header, tasks, records, header["skipped"]
+    data = fetch(args.host, None, args.timeout)
+    if args.save:
+        with open(args.save, "wb") as file:
+            file.write(data)
+    header, tasks, records = parse(data)
+    skipped = header["skipped"]
+    since = header["first"] + len(records)
+    deadline = time.monotonic() + (args.follow or 0)
+    while time.monotonic() < deadline:
+        time.sleep(args.interval)
+        try:
+            header, _, more = parse(fetch(args.host, since, args.timeout))
+        except (OSError, ValueError) as error:
+            print("poll failed: %s" % error, file=sys.stderr)
+            continue
+        if header["first"] < since and not header["skipped"]:
+            # restarted, the ring starts over with the records it restored
+            header, tasks, more = parse(fetch(args.host, 0, args.timeout))
+        skipped += header["skipped"]
+        records.extend(more)
+        since = header["first"] + len(more)
+        print("%d records" % len(records), file=sys.stderr)
+    return header, tasks, records, skipped
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("host", nargs="?", help="device address or name, host[:port]")
+    parser.add_argument("--file", help="read a dump saved with --save instead of a device")
+    parser.add_argument("--save", metavar="FILE", help="also keep the raw dump")
+    parser.add_argument("-o", "--output", default="-", help="trace JSON (default stdout)")
+    parser.add_argument("--follow", type=float, metavar="SECONDS", help="keep collecting for this long")
+    parser.add_argument("--interval", type=float, default=1, help="seconds between polls with --follow (default %(default)s)")
+    parser.add_argument("--timeout", type=float, default=10, help="seconds per request (default %(default)s)")
+    parser.add_argument("--wall-clock", action="store_true", help="timestamps of the current boot in Unix time")
+    args = parser.parse_args()
+    if bool(args.host) == bool(args.file):
+        parser.error("give either a host or --file")
+
+    try:
+        header, tasks, records, skipped = collect(args)
+    except (OSError, ValueError) as error:
+        print("trace failed: %s" % error, file=sys.stderr)
+        return 1
+    if skipped:
+        print("%d records were overwritten before they were read" % skipped, file=sys.stderr)
+    clock = None
+    if args.wall_clock:
+        if not header["unix_ms"]:
+            print("the device has no wall clock (or its firmware predates it), timestamps stay relative", file=sys.stderr)
+        else:
+            clock = (header["now_us"], header["unix_ms"])
+    trace = {"traceEvents": convert(records, tasks, known_paths(), clock), "displayTimeUnit": "ms"}
+    if header["unix_ms"]:
+        trace["otherData"] = {"unix_ms": header["unix_ms"], "now_us": header["now_us"]}
+    if args.output == "-":
+        json.dump(trace, sys.stdout)
+    else:
+        with open(args.output, "w") as file:
+            json.dump(trace, file)
+        print("%d records, %d events written to %s" % (len(records), len(trace["traceEvents"]), args.output), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())